@@ -0,0 +1,150 @@
+/**
+ * @file dnsresolver.h In-process DNS resolver API
+ * @ingroup core
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef _PURPLE_DNSRESOLVER_H_
+#define _PURPLE_DNSRESOLVER_H_
+
+#include <glib.h>
+
+typedef struct _PurpleDnsResolverQuery PurpleDnsResolverQuery;
+
+/**
+ * The record types the resolver knows how to read.
+ */
+typedef enum
+{
+	PURPLE_DNS_RR_A     = 1,
+	PURPLE_DNS_RR_CNAME = 5,
+	PURPLE_DNS_RR_SOA   = 6,
+	PURPLE_DNS_RR_AAAA  = 28,
+	PURPLE_DNS_RR_SRV   = 33
+} PurpleDnsRRType;
+
+typedef enum
+{
+	PURPLE_DNS_RESOLVER_OK,        /**< At least one record was found.     */
+	PURPLE_DNS_RESOLVER_NOT_FOUND, /**< The name or record doesn't exist.  */
+	PURPLE_DNS_RESOLVER_ERROR      /**< No usable answer; ask someone else. */
+} PurpleDnsResolverResult;
+
+/**
+ * A resource record from an answer.
+ */
+typedef struct
+{
+	PurpleDnsRRType type;
+	guint32 ttl;
+	guchar addr[16];     /**< A (4 bytes) or AAAA (16 bytes), network order */
+	guint16 priority;    /**< SRV */
+	guint16 weight;      /**< SRV */
+	guint16 port;        /**< SRV */
+	char *target;        /**< SRV */
+} PurpleDnsRecord;
+
+/**
+ * Called with the outcome of a query.  records is a list of
+ * PurpleDnsRecord belonging to the resolver, and is only valid
+ * for the duration of the call.
+ */
+typedef void (*PurpleDnsResolverCallback)(PurpleDnsResolverResult result,
+		GSList *records, gpointer data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**************************************************************************/
+/** @name DNS resolver API                                                */
+/**************************************************************************/
+/*@{*/
+
+/**
+ * Looks up the records of one type for a name.  Answers are cached for
+ * as long as their TTL allows, names which don't exist for as long as
+ * the zone's SOA allows, and concurrent lookups of the same name and
+ * type share a single query on the wire.
+ *
+ * The callback is never called before this returns.
+ *
+ * @param name     The fully qualified name to look up.
+ * @param type     The record type wanted.
+ * @param callback The callback function to call with the result.
+ * @param data     Extra data to pass to the callback function.
+ *
+ * @return A reference to the query, which can be used to cancel it.
+ */
+PurpleDnsResolverQuery *purple_dnsresolver_query(const char *name,
+		PurpleDnsRRType type, PurpleDnsResolverCallback callback, gpointer data);
+
+/**
+ * Cancels a query.  The callback will not be called.
+ *
+ * @param query The query to cancel.
+ */
+void purple_dnsresolver_cancel(PurpleDnsResolverQuery *query);
+
+/**
+ * Checks whether a name is one for the resolver, rather than the
+ * system's.  This isn't the case for IP address literals, single
+ * label or .local names, names from the hosts file, or if no
+ * nameservers are known.
+ *
+ * @param name The name to check.
+ *
+ * @return TRUE if purple_dnsresolver_query() should be used.
+ */
+gboolean purple_dnsresolver_can_resolve(const char *name);
+
+/**
+ * Sends queries to the given nameserver instead of the system's.
+ *
+ * @param ip   The nameserver's IP address, or NULL to go back to the
+ *             system's nameservers.
+ * @param port The nameserver's port, usually 53.
+ */
+void purple_dnsresolver_set_nameserver(const char *ip, int port);
+
+/**
+ * Forgets every cached answer.  This happens by itself whenever the
+ * network configuration changes.
+ */
+void purple_dnsresolver_clear_cache(void);
+
+/**
+ * Initializes the DNS resolver subsystem.
+ */
+void purple_dnsresolver_init(void);
+
+/**
+ * Uninitializes the DNS resolver subsystem.
+ */
+void purple_dnsresolver_uninit(void);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PURPLE_DNSRESOLVER_H_ */
@@ -328,6 +328,27 @@ size_t purple_xfer_get_size(const PurpleXfer *xfer);
  */
 double purple_xfer_get_progress(const PurpleXfer *xfer);
 
+/**
+ * Returns the average speed of the transfer, from when it started
+ * until it ended or until now.
+ *
+ * @param xfer The file transfer.
+ *
+ * @return The speed, in bytes per second.
+ */
+double purple_xfer_get_throughput(const PurpleXfer *xfer);
+
+/**
+ * Returns how long receiving has spent writing batched data to the
+ * file.  The writes happen on the main loop, so nothing else is read
+ * while they run.
+ *
+ * @param xfer The file transfer.
+ *
+ * @return The time spent writing, in seconds.
+ */
+double purple_xfer_get_stall_time(const PurpleXfer *xfer);
+
 /**
  * Returns the local port number in the file transfer.
  *
@@ -431,6 +452,11 @@ void purple_xfer_set_read_fnc(PurpleXfer *xfer,
 /**
  * Sets the write function for the file transfer.
  *
+ * Without one, files are sent straight from the disk to xfer->fd
+ * where the platform allows it.  Prpls which need to frame the data
+ * should set one; it is then handed data from a read-ahead buffer
+ * which is reused for the whole transfer.
+ *
  * @param xfer The file transfer.
  * @param fnc  The write function.
  */
@@ -440,6 +466,9 @@ void purple_xfer_set_write_fnc(PurpleXfer *xfer,
 /**
  * Sets the acknowledge function for the file transfer.
  *
+ * When sending, the buffer passed to it is NULL if the data went
+ * straight from the disk to the socket.
+ *
  * @param xfer The file transfer.
  * @param fnc  The acknowledge function.
  */
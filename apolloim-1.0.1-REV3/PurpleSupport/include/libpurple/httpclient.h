@@ -0,0 +1,108 @@
+/**
+ * @file httpclient.h HTTP client API
+ * @ingroup core
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef _PURPLE_HTTPCLIENT_H_
+#define _PURPLE_HTTPCLIENT_H_
+
+#include <glib.h>
+
+typedef struct _PurpleHttpClientRequest PurpleHttpClientRequest;
+
+/**
+ * A response from a server.
+ */
+typedef struct
+{
+	int status;          /**< The status code, such as 200.                  */
+	const char *headers; /**< The status line and headers, up to and
+	                          including the blank line after them.           */
+	gsize headers_len;
+	const char *body;    /**< The body, with any chunked encoding undone.
+	                          This is nul-terminated.                        */
+	gsize body_len;
+} PurpleHttpClientResponse;
+
+/**
+ * Called with the server's response, or with an error message if
+ * there wasn't one.  The response only lasts for the duration of the
+ * call, and so does the request, which mustn't be canceled from here.
+ */
+typedef void (*PurpleHttpClientCallback)(const PurpleHttpClientResponse *response,
+		const char *error_message, gpointer data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**************************************************************************/
+/** @name HTTP client API                                                 */
+/**************************************************************************/
+/*@{*/
+
+/**
+ * Sends a request to a web server.
+ *
+ * Connections are kept open and reused for later requests to the same
+ * server, unless the request or the response says otherwise.  GET and
+ * HEAD requests may be pipelined onto a connection which is still busy.
+ * A request on a reused connection which the server has closed in the
+ * meantime is retried once on a new one.
+ *
+ * The callback is never called before this returns.
+ *
+ * @param host     The server's host name.
+ * @param port     The server's port.
+ * @param request  The whole request, including headers and any body.
+ * @param callback The callback function to call with the response.
+ * @param data     Extra data to pass to the callback function.
+ *
+ * @return A reference to the request, which can be used to cancel it.
+ */
+PurpleHttpClientRequest *purple_httpclient_request(const char *host, int port,
+		const char *request, PurpleHttpClientCallback callback, gpointer data);
+
+/**
+ * Cancels a request.  The callback will not be called.
+ *
+ * @param request The request to cancel.
+ */
+void purple_httpclient_cancel(PurpleHttpClientRequest *request);
+
+/**
+ * Initializes the HTTP client subsystem.
+ */
+void purple_httpclient_init(void);
+
+/**
+ * Uninitializes the HTTP client subsystem, closing every connection.
+ */
+void purple_httpclient_uninit(void);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PURPLE_HTTPCLIENT_H_ */
@@ -652,6 +652,10 @@ gboolean purple_status_is_online(const PurpleStatus *status);
 /**
  * Returns the value of an attribute in a status with the specified ID.
  *
+ * Until one of its attributes is set, a status shares the default values
+ * of its status type, so the returned value must not be modified.  Use
+ * purple_status_set_attr_boolean() and friends instead.
+ *
  * @param status The status.
  * @param id     The attribute ID.
  *
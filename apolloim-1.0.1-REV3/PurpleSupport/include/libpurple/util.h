@@ -588,6 +588,20 @@ int purple_build_dir(const char *path, int mode);
 gboolean purple_util_write_data_to_file(const char *filename, const char *data,
 									  size_t size);
 
+/**
+ * Write an xmlnode tree, as human readable xml, to a file of the given
+ * name in the Purple user directory.  This is the same as passing the
+ * result of xmlnode_to_formatted_str() to purple_util_write_data_to_file(),
+ * but the xml is written out as it is generated instead of being built
+ * in memory first.
+ *
+ * @param filename The basename of the file to write in the purple_user_dir.
+ * @param node     The root of the tree to write.
+ *
+ * @return TRUE if the file was written successfully.  FALSE otherwise.
+ */
+gboolean purple_util_write_xml_to_file(const char *filename, xmlnode *node);
+
 /**
  * Read the contents of a given file and parse the results into an
  * xmlnode tree structure.  This is intended to be used to read
@@ -605,6 +619,32 @@ gboolean purple_util_write_data_to_file(const char *filename, const char *data,
 xmlnode *purple_util_read_xml_from_file(const char *filename,
 									  const char *description);
 
+/**
+ * Read a given file a piece at a time with an xmlnode_stream.  This is
+ * like purple_util_read_xml_from_file(), but each element at @a depth is
+ * passed to @a element_cb as soon as it has been read, so large files
+ * never have to be held in memory whole.
+ *
+ * @param filename    The basename of the file to open in the purple_user_dir.
+ * @param description A very short description of the contents of this
+ *                    file, used in error messages.
+ * @param depth       The depth of the elements to stream; the root
+ *                    element is at depth 0.
+ * @param open_cb     Called as each element above @a depth opens, or @c NULL.
+ * @param element_cb  Called with each element at @a depth, which it must
+ *                    free.
+ * @param user_data   Data to pass to the callbacks.
+ *
+ * @return What is left of the tree once the streamed elements have been
+ *         removed, or NULL if the file does not exist or there was an
+ *         error reading the file.  If there was an error, some elements
+ *         may already have been passed to @a element_cb.
+ */
+xmlnode *purple_util_read_xml_from_file_streamed(const char *filename,
+		const char *description, int depth,
+		xmlnode_stream_open_cb open_cb, xmlnode_stream_element_cb element_cb,
+		gpointer user_data);
+
 /**
  * Creates a temporary file and returns a file pointer to it.
  *
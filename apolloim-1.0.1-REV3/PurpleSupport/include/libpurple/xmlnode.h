@@ -39,6 +39,11 @@ typedef enum _XMLNodeType
 	XMLNODE_TYPE_DATA		/**< Has data */
 } XMLNodeType;
 
+/**
+ * The memory arena a tree created with xmlnode_new_arena() is allocated from.
+ */
+typedef struct _xmlnode_arena xmlnode_arena;
+
 /**
  * An xmlnode.
  */
@@ -54,6 +59,7 @@ struct _xmlnode
 	struct _xmlnode *child;		/**< The child node or @c NULL.*/
 	struct _xmlnode *lastchild;	/**< The last child node or @c NULL.*/
 	struct _xmlnode *next;		/**< The next node or @c NULL. */
+	xmlnode_arena *arena;		/**< The arena this node lives in, or @c NULL. */
 };
 
 /**
@@ -65,6 +71,22 @@ struct _xmlnode
  */
 xmlnode *xmlnode_new(const char *name);
 
+/**
+ * Creates a new xmlnode whose whole tree is allocated from one arena.
+ *
+ * Children, attributes and data added to the tree are carved out of a few
+ * large blocks, and element and attribute names and namespaces are shared
+ * between trees.  Freeing the returned root frees everything at once;
+ * freeing any other node of the tree only unlinks it.  No node of the tree
+ * may be used after the root has been freed, even if it was moved into
+ * another tree.
+ *
+ * @param name The name of the node.
+ *
+ * @return The new node.
+ */
+xmlnode *xmlnode_new_arena(const char *name);
+
 /**
  * Creates a new xmlnode child.
  *
@@ -239,6 +261,34 @@ char *xmlnode_to_str(xmlnode *node, int *len);
  */
 char *xmlnode_to_formatted_str(xmlnode *node, int *len);
 
+/**
+ * Receives serialized XML from xmlnode_write().
+ *
+ * @param data      The next piece of the document.  It is not
+ *                  NUL-terminated.
+ * @param len       The length of @a data.
+ * @param user_data The data passed to xmlnode_write().
+ *
+ * @return @c FALSE to report an error and stop writing.
+ */
+typedef gboolean (*xmlnode_write_func)(const char *data, gsize len, gpointer user_data);
+
+/**
+ * Writes a node out as xml a piece at a time, without building the whole
+ * string first.  This produces exactly what xmlnode_to_str() or, if
+ * @a formatted is set, xmlnode_to_formatted_str() would.
+ *
+ * @param node      The starting node to output.
+ * @param formatted Whether to write human readable xml with a declaration.
+ * @param func      The function to write each piece with, or @c NULL to
+ *                  only measure the output.
+ * @param user_data Data to pass to @a func.
+ *
+ * @return The number of bytes written, or -1 if @a func failed.
+ */
+gssize xmlnode_write(xmlnode *node, gboolean formatted, xmlnode_write_func func,
+                     gpointer user_data);
+
 /**
  * Creates a node from a string of XML.  Calling this on the
  * root node of an XML document will parse the entire document
@@ -252,6 +302,98 @@ char *xmlnode_to_formatted_str(xmlnode *node, int *len);
  */
 xmlnode *xmlnode_from_str(const char *str, gssize size);
 
+/**
+ * Creates a node from a string of XML, like xmlnode_from_str(), but
+ * allocates the tree from an arena as xmlnode_new_arena() does.  This is
+ * much cheaper for trees that are read and then thrown away whole.
+ *
+ * @param str  The string of xml.
+ * @param size The size of the string, or -1 if @a str is
+ *             NUL-terminated.
+ *
+ * @return The new node.
+ */
+xmlnode *xmlnode_from_str_arena(const char *str, gssize size);
+
+/**
+ * A streaming XML parser.  Documents are fed to it a piece at a time, and
+ * every element at a chosen depth is handed to the caller as soon as it
+ * has been closed, so the whole tree never has to be in memory at once.
+ */
+typedef struct _xmlnode_stream xmlnode_stream;
+
+/**
+ * Called when an element shallower than the streaming depth is opened.
+ *
+ * @param node      The element.  It has its attributes and namespace, but
+ *                  none of its children yet.  It belongs to the stream.
+ * @param user_data The data passed to xmlnode_stream_new().
+ */
+typedef void (*xmlnode_stream_open_cb)(xmlnode *node, gpointer user_data);
+
+/**
+ * Called when an element at the streaming depth has been closed.
+ *
+ * @param node      The complete element.  It has already been removed from
+ *                  its parent, and must be freed with xmlnode_free().
+ * @param parent    The element @a node was found in.  It belongs to the
+ *                  stream.
+ * @param user_data The data passed to xmlnode_stream_new().
+ */
+typedef void (*xmlnode_stream_element_cb)(xmlnode *node, xmlnode *parent,
+                                          gpointer user_data);
+
+/**
+ * Creates a streaming parser.
+ *
+ * Elements shallower than @a depth are kept, without any text they
+ * contain, and passed to @a open_cb as they open.  Elements at @a depth
+ * are built whole and passed to @a element_cb as they close.  The root
+ * element is at depth 0.
+ *
+ * @param depth      The depth of the elements to stream.  Must be at least 1.
+ * @param open_cb    The function to call when a shallower element opens,
+ *                   or @c NULL.
+ * @param element_cb The function to call with each streamed element, or
+ *                   @c NULL to discard them.
+ * @param user_data  Data to pass to the callbacks.
+ *
+ * @return The new stream, or @c NULL on error.
+ */
+xmlnode_stream *xmlnode_stream_new(int depth, xmlnode_stream_open_cb open_cb,
+                                   xmlnode_stream_element_cb element_cb,
+                                   gpointer user_data);
+
+/**
+ * Feeds more of the document to a streaming parser.  Callbacks are made
+ * from within this function.
+ *
+ * @param stream The stream.
+ * @param data   The next piece of the document.
+ * @param size   The size of @a data, or -1 if it is NUL-terminated.
+ *
+ * @return @c FALSE if the document is not well-formed.
+ */
+gboolean xmlnode_stream_feed(xmlnode_stream *stream, const char *data, gssize size);
+
+/**
+ * Finishes a streaming parse and frees the stream.
+ *
+ * @param stream The stream.
+ *
+ * @return The root element with whatever was not streamed still attached,
+ *         or @c NULL if the document was not well-formed.  The caller
+ *         must free it with xmlnode_free().
+ */
+xmlnode *xmlnode_stream_end(xmlnode_stream *stream);
+
+/**
+ * Abandons a streaming parse and frees the stream.
+ *
+ * @param stream The stream.
+ */
+void xmlnode_stream_free(xmlnode_stream *stream);
+
 /**
  * Creates a new node from the source node.
  *
@@ -389,7 +389,6 @@ static void
 sync_accounts(void)
 {
 	xmlnode *node;
-	char *data;
 
 	if (!accounts_loaded)
 	{
@@ -399,9 +398,7 @@ sync_accounts(void)
 	}
 
 	node = accounts_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("accounts.xml", data, -1);
-	g_free(data);
+	purple_util_write_xml_to_file("accounts.xml", node);
 	xmlnode_free(node);
 }
 
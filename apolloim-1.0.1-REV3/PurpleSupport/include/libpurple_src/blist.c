@@ -40,12 +40,92 @@ static PurpleBlistUiOps *blist_ui_ops = NULL;
 static PurpleBuddyList *purplebuddylist = NULL;
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
+static PurpleSignal  *buddy_status_changed_signal = NULL;
+
+/*
+ * Setting changes on buddies and groups are appended to blist.xml.journal
+ * instead of rewriting blist.xml, which is only regenerated when the
+ * structure of the list changes or the journal grows past
+ * BLIST_JOURNAL_MAX_RECORDS.  Replaying a record is idempotent, so a crash
+ * between writing blist.xml and removing the journal loses nothing.
+ */
+#define BLIST_JOURNAL_FILE        "blist.xml.journal"
+#define BLIST_JOURNAL_MAX_RECORDS 500
+
+static FILE          *blist_journal = NULL;
+static guint          blist_journal_records = 0;
+static gboolean       blist_journal_suspended = FALSE;
+static gboolean       blist_journal_disabled = FALSE;
+
+/*
+ * Between purple_blist_begin_batch() and purple_blist_end_batch(), UI
+ * updates are queued once per node, in the order they were first asked
+ * for, and saving is put off until the batch ends.
+ */
+static guint          blist_batch_depth = 0;
+static GQueue        *blist_batch_queue = NULL;
+static GHashTable    *blist_batch_nodes = NULL;   /* node -> its queue link */
+static gboolean       blist_batch_save = FALSE;
+
+/*
+ * Buddy status changes reach signal handlers and the UI
+ * /purple/buddies/status_coalesce_interval milliseconds after the first
+ * one.  A buddy whose status changes again in the meantime is reported
+ * once, as a change from the status it had before the first change, or
+ * not at all if it ends up back where it started.
+ */
+struct buddy_status_change
+{
+	PurpleBuddy *buddy;   /* NULL once the buddy is freed */
+	PurpleStatus *old_status;
+	char *old_attrs;      /* see status_describe_attrs(), or NULL */
+};
+
+static GQueue        *status_changes = NULL;
+static GHashTable    *status_change_links = NULL; /* buddy -> its queue link */
+static guint          status_changes_timer = 0;
 
 
 /*********************************************************************
  * Private utility functions                                         *
  *********************************************************************/
 
+static void
+blist_node_update(PurpleBlistNode *node)
+{
+	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
+
+	if (blist_batch_depth > 0)
+	{
+		if (g_hash_table_lookup(blist_batch_nodes, node) == NULL)
+		{
+			g_queue_push_tail(blist_batch_queue, node);
+			g_hash_table_insert(blist_batch_nodes, node,
+					g_queue_peek_tail_link(blist_batch_queue));
+		}
+		return;
+	}
+
+	if (ops && ops->update)
+		ops->update(purplebuddylist, node);
+}
+
+/* Called before a node is freed, so a queued update doesn't outlive it. */
+static void
+blist_batch_forget(PurpleBlistNode *node)
+{
+	GList *link;
+
+	if (blist_batch_nodes == NULL)
+		return;
+
+	if ((link = g_hash_table_lookup(blist_batch_nodes, node)) != NULL)
+	{
+		g_queue_delete_link(blist_batch_queue, link);
+		g_hash_table_remove(blist_batch_nodes, node);
+	}
+}
+
 static PurpleBlistNode *purple_blist_get_last_sibling(PurpleBlistNode *node)
 {
 	PurpleBlistNode *n = node;
@@ -331,11 +411,153 @@ blist_to_xmlnode()
 	return node;
 }
 
+static char *
+blist_journal_filename(void)
+{
+	return g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+}
+
+/*
+ * Called once blist.xml holds everything the journal did.  A journal that
+ * can't be removed is emptied instead; if that fails too, its stale records
+ * would be replayed over newer ones, so changes go through full saves until
+ * a later save manages to get rid of it.
+ */
+static void
+blist_journal_reset(void)
+{
+	char *filename;
+	FILE *file;
+
+	if (blist_journal != NULL) {
+		fclose(blist_journal);
+		blist_journal = NULL;
+	}
+	blist_journal_records = 0;
+	blist_journal_disabled = FALSE;
+
+	filename = blist_journal_filename();
+	if (g_file_test(filename, G_FILE_TEST_EXISTS) && g_unlink(filename) == -1) {
+		purple_debug_error("blist", "Unable to remove %s: %s\n",
+				filename, g_strerror(errno));
+
+		if ((file = g_fopen(filename, "wb")) == NULL || fclose(file) != 0) {
+			purple_debug_error("blist", "Unable to truncate %s: %s\n",
+					filename, g_strerror(errno));
+			blist_journal_disabled = TRUE;
+		}
+	}
+	g_free(filename);
+}
+
+static xmlnode *
+blist_journal_record(PurpleBlistNode *node, const char *key)
+{
+	xmlnode *record, *child;
+	PurpleValue *value;
+
+	if (PURPLE_BLIST_NODE_IS_BUDDY(node)) {
+		PurpleBuddy *buddy = (PurpleBuddy *)node;
+		PurpleGroup *group = purple_buddy_get_group(buddy);
+
+		if (group == NULL)
+			return NULL;
+
+		record = xmlnode_new("buddy");
+		xmlnode_set_attrib(record, "group", group->name);
+		xmlnode_set_attrib(record, "account",
+				purple_account_get_username(buddy->account));
+		xmlnode_set_attrib(record, "proto",
+				purple_account_get_protocol_id(buddy->account));
+		child = xmlnode_new_child(record, "name");
+		xmlnode_insert_data(child, buddy->name, -1);
+	} else if (PURPLE_BLIST_NODE_IS_GROUP(node)) {
+		record = xmlnode_new("group");
+		xmlnode_set_attrib(record, "name", ((PurpleGroup *)node)->name);
+	} else {
+		return NULL;
+	}
+
+	value = g_hash_table_lookup(node->settings, key);
+	if (value != NULL) {
+		value_to_xmlnode((gpointer)key, value, record);
+	} else {
+		/* A setting without a type records its removal. */
+		child = xmlnode_new_child(record, "setting");
+		xmlnode_set_attrib(child, "name", key);
+	}
+
+	return record;
+}
+
+/*
+ * Appends one line recording the current value of a node's setting.
+ * Returns FALSE if the change has to go through a full save instead.
+ */
+static gboolean
+blist_journal_append(PurpleBlistNode *node, const char *key)
+{
+	xmlnode *record;
+	char *line;
+	int len;
+	gboolean ret = FALSE;
+
+	/* A pending full save will pick the change up anyway. */
+	if (!blist_loaded || blist_journal_suspended || save_timer != 0)
+		return FALSE;
+
+	if (blist_journal_disabled)
+		return FALSE;
+
+	if (!PURPLE_BLIST_NODE_SHOULD_SAVE(node) ||
+			blist_journal_records >= BLIST_JOURNAL_MAX_RECORDS)
+		return FALSE;
+
+	if ((record = blist_journal_record(node, key)) == NULL)
+		return FALSE;
+
+	line = xmlnode_to_str(record, &len);
+	xmlnode_free(record);
+
+	/* Records are one per line, so values spanning lines can't be journaled. */
+	if (strchr(line, '\n') != NULL || strchr(line, '\r') != NULL) {
+		g_free(line);
+		return FALSE;
+	}
+
+	if (blist_journal == NULL) {
+		char *filename = blist_journal_filename();
+		blist_journal = g_fopen(filename, "ab");
+		if (blist_journal == NULL)
+			purple_debug_error("blist", "Unable to open %s: %s\n",
+					filename, g_strerror(errno));
+		g_free(filename);
+	}
+
+	if (blist_journal != NULL &&
+			fwrite(line, 1, len, blist_journal) == (size_t)len &&
+			fputc('\n', blist_journal) != EOF &&
+			fflush(blist_journal) == 0)
+	{
+		blist_journal_records++;
+		ret = TRUE;
+	}
+
+	g_free(line);
+	return ret;
+}
+
+static void
+purple_blist_node_setting_changed(PurpleBlistNode *node, const char *key)
+{
+	if (blist_batch_depth > 0 || !blist_journal_append(node, key))
+		purple_blist_schedule_save();
+}
+
 static void
 purple_blist_sync()
 {
 	xmlnode *node;
-	char *data;
 
 	if (!blist_loaded)
 	{
@@ -345,9 +567,8 @@ purple_blist_sync()
 	}
 
 	node = blist_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("blist.xml", data, -1);
-	g_free(data);
+	if (purple_util_write_xml_to_file("blist.xml", node))
+		blist_journal_reset();
 	xmlnode_free(node);
 }
 
@@ -362,10 +583,57 @@ save_cb(gpointer data)
 void
 purple_blist_schedule_save()
 {
+	if (blist_batch_depth > 0)
+	{
+		blist_batch_save = TRUE;
+		return;
+	}
+
 	if (save_timer == 0)
 		save_timer = purple_timeout_add_seconds(5, save_cb, NULL);
 }
 
+void
+purple_blist_begin_batch(void)
+{
+	if (blist_batch_depth++ > 0)
+		return;
+
+	blist_batch_queue = g_queue_new();
+	blist_batch_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+void
+purple_blist_end_batch(void)
+{
+	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
+	PurpleBlistNode *node;
+
+	g_return_if_fail(blist_batch_depth > 0);
+
+	if (--blist_batch_depth > 0)
+		return;
+
+	/* Anything updated from here on goes straight to the UI. */
+	while ((node = g_queue_pop_head(blist_batch_queue)) != NULL)
+	{
+		g_hash_table_remove(blist_batch_nodes, node);
+		if (ops && ops->update)
+			ops->update(purplebuddylist, node);
+	}
+
+	g_queue_free(blist_batch_queue);
+	blist_batch_queue = NULL;
+	g_hash_table_destroy(blist_batch_nodes);
+	blist_batch_nodes = NULL;
+
+	if (blist_batch_save)
+	{
+		blist_batch_save = FALSE;
+		purple_blist_schedule_save();
+	}
+}
+
 
 /*********************************************************************
  * Reading from disk                                                 *
@@ -510,12 +778,11 @@ parse_chat(PurpleGroup *group, xmlnode *cnode)
 	g_free(alias);
 }
 
-static void
+static PurpleGroup *
 parse_group(xmlnode *groupnode)
 {
 	const char *name = xmlnode_get_attrib(groupnode, "name");
 	PurpleGroup *group;
-	xmlnode *cnode;
 
 	if (!name)
 		name = _("Buddies");
@@ -524,86 +791,361 @@ parse_group(xmlnode *groupnode)
 	purple_blist_add_group(group,
 			purple_blist_get_last_sibling(purplebuddylist->root));
 
-	for (cnode = groupnode->child; cnode; cnode = cnode->next) {
-		if (cnode->type != XMLNODE_TYPE_TAG)
+	return group;
+}
+
+static void
+parse_group_child(PurpleGroup *group, xmlnode *cnode)
+{
+	if (!strcmp(cnode->name, "setting"))
+		parse_setting((PurpleBlistNode*)group, cnode);
+	else if (!strcmp(cnode->name, "contact") ||
+			!strcmp(cnode->name, "person"))
+		parse_contact(group, cnode);
+	else if (!strcmp(cnode->name, "chat"))
+		parse_chat(group, cnode);
+}
+
+/*
+ * blist.xml is streamed one group member (or privacy entry) at a time:
+ *
+ *   <purple><blist><group><contact/>...</group></blist>
+ *           <privacy><account><permit/>...</account></privacy></purple>
+ *
+ * Groups and privacy accounts are set up as they open, and each of their
+ * children is loaded and freed as soon as it has been read.  What was
+ * there before is remembered, so that a file which turns out to be
+ * broken part of the way through can be taken back out again.
+ */
+#define BLIST_STREAM_DEPTH 3
+
+struct _blist_load_privacy {
+	PurpleAccount *account;
+	int perm_deny;
+	GSList *permit;
+	GSList *deny;
+};
+
+struct _blist_load_data {
+	PurpleGroup *group;
+	PurpleAccount *account;
+	GList *groups;    /* the groups in the list before loading */
+	GList *privacy;   /* a struct _blist_load_privacy per account touched */
+};
+
+static void
+blist_load_remember_privacy(struct _blist_load_data *data, PurpleAccount *account)
+{
+	struct _blist_load_privacy *saved;
+	GSList *l;
+	GList *p;
+
+	for (p = data->privacy; p != NULL; p = p->next)
+		if (((struct _blist_load_privacy *)p->data)->account == account)
+			return;
+
+	saved = g_new0(struct _blist_load_privacy, 1);
+	saved->account = account;
+	saved->perm_deny = account->perm_deny;
+	for (l = account->permit; l != NULL; l = l->next)
+		saved->permit = g_slist_prepend(saved->permit, g_strdup(l->data));
+	for (l = account->deny; l != NULL; l = l->next)
+		saved->deny = g_slist_prepend(saved->deny, g_strdup(l->data));
+
+	data->privacy = g_list_prepend(data->privacy, saved);
+}
+
+static void
+blist_load_privacy_free(struct _blist_load_privacy *saved)
+{
+	g_slist_foreach(saved->permit, (GFunc)g_free, NULL);
+	g_slist_free(saved->permit);
+	g_slist_foreach(saved->deny, (GFunc)g_free, NULL);
+	g_slist_free(saved->deny);
+	g_free(saved);
+}
+
+static gboolean
+blist_load_name_in(GSList *names, const char *name)
+{
+	for (; names != NULL; names = names->next)
+		if (!strcmp(names->data, name))
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Takes back out everything a failed load put into the list. */
+static void
+blist_load_rollback(struct _blist_load_data *data)
+{
+	PurpleBlistNode *gnode, *next;
+	GList *p;
+	GSList *l, *names;
+
+	for (gnode = purple_blist_get_root(); gnode != NULL; gnode = next)
+	{
+		next = gnode->next;
+
+		if (g_list_find(data->groups, gnode) != NULL)
 			continue;
-		if (!strcmp(cnode->name, "setting"))
-			parse_setting((PurpleBlistNode*)group, cnode);
-		else if (!strcmp(cnode->name, "contact") ||
-				!strcmp(cnode->name, "person"))
-			parse_contact(group, cnode);
-		else if (!strcmp(cnode->name, "chat"))
-			parse_chat(group, cnode);
+
+		while (gnode->child != NULL)
+		{
+			if (PURPLE_BLIST_NODE_IS_CONTACT(gnode->child))
+				purple_blist_remove_contact((PurpleContact *)gnode->child);
+			else if (PURPLE_BLIST_NODE_IS_CHAT(gnode->child))
+				purple_blist_remove_chat((PurpleChat *)gnode->child);
+			else
+				break;
+		}
+		purple_blist_remove_group((PurpleGroup *)gnode);
+	}
+
+	for (p = data->privacy; p != NULL; p = p->next)
+	{
+		struct _blist_load_privacy *saved = p->data;
+
+		names = g_slist_copy(saved->account->permit);
+		for (l = names; l != NULL; l = l->next)
+			if (!blist_load_name_in(saved->permit, l->data))
+				purple_privacy_permit_remove(saved->account, l->data, TRUE);
+		g_slist_free(names);
+
+		names = g_slist_copy(saved->account->deny);
+		for (l = names; l != NULL; l = l->next)
+			if (!blist_load_name_in(saved->deny, l->data))
+				purple_privacy_deny_remove(saved->account, l->data, TRUE);
+		g_slist_free(names);
+
+		saved->account->perm_deny = saved->perm_deny;
 	}
 }
 
-/* TODO: Make static and rename to load_blist */
-void
-purple_blist_load()
+static PurpleAccount *
+parse_privacy_account(xmlnode *anode, struct _blist_load_data *data)
 {
-	xmlnode *purple, *blist, *privacy;
+	PurpleAccount *account;
+	int imode;
+	const char *acct_name, *proto, *mode, *protocol;
 
-	blist_loaded = TRUE;
+	acct_name = xmlnode_get_attrib(anode, "name");
+	protocol = xmlnode_get_attrib(anode, "protocol");
+	proto = xmlnode_get_attrib(anode, "proto");
+	mode = xmlnode_get_attrib(anode, "mode");
 
-	purple = purple_util_read_xml_from_file("blist.xml", _("buddy list"));
+	if (!acct_name || (!proto && !protocol) || !mode)
+		return NULL;
 
-	if (purple == NULL)
+	account = purple_accounts_find(acct_name, proto ? proto : protocol);
+
+	if (!account)
+		return NULL;
+
+	blist_load_remember_privacy(data, account);
+
+	imode = atoi(mode);
+	account->perm_deny = (imode != 0 ? imode : PURPLE_PRIVACY_ALLOW_ALL);
+
+	return account;
+}
+
+static void
+parse_privacy_child(PurpleAccount *account, xmlnode *x)
+{
+	char *name;
+
+	if (!strcmp(x->name, "permit")) {
+		name = xmlnode_get_data(x);
+		purple_privacy_permit_add(account, name, TRUE);
+		g_free(name);
+	} else if (!strcmp(x->name, "block")) {
+		name = xmlnode_get_data(x);
+		purple_privacy_deny_add(account, name, TRUE);
+		g_free(name);
+	}
+}
+
+static void
+blist_load_open_cb(xmlnode *node, gpointer user_data)
+{
+	struct _blist_load_data *data = user_data;
+	const char *parent;
+
+	if (node->parent == NULL)
 		return;
 
-	blist = xmlnode_get_child(purple, "blist");
-	if (blist) {
-		xmlnode *groupnode;
-		for (groupnode = xmlnode_get_child(blist, "group"); groupnode != NULL;
-				groupnode = xmlnode_get_next_twin(groupnode)) {
-			parse_group(groupnode);
+	parent = node->parent->name;
+
+	if (!strcmp(parent, "blist") && !strcmp(node->name, "group"))
+		data->group = parse_group(node);
+	else if (!strcmp(parent, "privacy"))
+		data->account = parse_privacy_account(node, data);
+}
+
+static void
+blist_load_element_cb(xmlnode *node, xmlnode *parent, gpointer user_data)
+{
+	struct _blist_load_data *data = user_data;
+	const char *section = parent->parent ? parent->parent->name : NULL;
+
+	if (section != NULL) {
+		if (!strcmp(section, "blist") && !strcmp(parent->name, "group")) {
+			if (data->group != NULL)
+				parse_group_child(data->group, node);
+		} else if (!strcmp(section, "privacy")) {
+			if (data->account != NULL)
+				parse_privacy_child(data->account, node);
 		}
 	}
 
-	privacy = xmlnode_get_child(purple, "privacy");
-	if (privacy) {
-		xmlnode *anode;
-		for (anode = privacy->child; anode; anode = anode->next) {
-			xmlnode *x;
-			PurpleAccount *account;
-			int imode;
-			const char *acct_name, *proto, *mode, *protocol;
+	xmlnode_free(node);
+}
 
-			acct_name = xmlnode_get_attrib(anode, "name");
-			protocol = xmlnode_get_attrib(anode, "protocol");
-			proto = xmlnode_get_attrib(anode, "proto");
-			mode = xmlnode_get_attrib(anode, "mode");
+static void
+blist_journal_replay_record(xmlnode *record)
+{
+	PurpleBlistNode *node = NULL;
+	xmlnode *setting;
+	const char *name;
 
-			if (!acct_name || (!proto && !protocol) || !mode)
-				continue;
+	if ((setting = xmlnode_get_child(record, "setting")) == NULL)
+		return;
 
-			account = purple_accounts_find(acct_name, proto ? proto : protocol);
+	if (!strcmp(record->name, "buddy")) {
+		const char *acct_name = xmlnode_get_attrib(record, "account");
+		const char *proto = xmlnode_get_attrib(record, "proto");
+		const char *group_name = xmlnode_get_attrib(record, "group");
+		PurpleAccount *account;
+		PurpleGroup *group;
+		xmlnode *x;
+		char *buddy_name;
+
+		if (!acct_name || !proto || !group_name ||
+				!(account = purple_accounts_find(acct_name, proto)) ||
+				!(group = purple_find_group(group_name)) ||
+				!(x = xmlnode_get_child(record, "name")) ||
+				!(buddy_name = xmlnode_get_data(x)))
+			return;
+
+		node = (PurpleBlistNode *)purple_find_buddy_in_group(account, buddy_name, group);
+		g_free(buddy_name);
+	} else if (!strcmp(record->name, "group")) {
+		const char *group_name = xmlnode_get_attrib(record, "name");
+
+		if (group_name != NULL)
+			node = (PurpleBlistNode *)purple_find_group(group_name);
+	}
 
-			if (!account)
-				continue;
+	if (node == NULL || (name = xmlnode_get_attrib(setting, "name")) == NULL)
+		return;
 
-			imode = atoi(mode);
-			account->perm_deny = (imode != 0 ? imode : PURPLE_PRIVACY_ALLOW_ALL);
+	if (xmlnode_get_attrib(setting, "type") != NULL)
+		parse_setting(node, setting);
+	else
+		purple_blist_node_remove_setting(node, name);
+}
 
-			for (x = anode->child; x; x = x->next) {
-				char *name;
-				if (x->type != XMLNODE_TYPE_TAG)
-					continue;
+/*
+ * Applies the setting changes journaled since blist.xml was last written.
+ * A torn last line from a crash mid-append simply fails to parse.
+ */
+static void
+blist_journal_replay(void)
+{
+	char *filename, *contents, **lines;
+	GError *error = NULL;
+	int i;
 
-				if (!strcmp(x->name, "permit")) {
-					name = xmlnode_get_data(x);
-					purple_privacy_permit_add(account, name, TRUE);
-					g_free(name);
-				} else if (!strcmp(x->name, "block")) {
-					name = xmlnode_get_data(x);
-					purple_privacy_deny_add(account, name, TRUE);
-					g_free(name);
-				}
-			}
-		}
+	filename = blist_journal_filename();
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+		g_free(filename);
+		return;
 	}
 
+	if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+		purple_debug_error("blist", "Error reading %s: %s\n",
+				filename, error->message);
+		g_error_free(error);
+		g_free(filename);
+		return;
+	}
+
+	purple_debug_info("blist", "Replaying %s\n", filename);
+	g_free(filename);
+
+	blist_journal_suspended = TRUE;
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	for (i = 0; lines[i] != NULL; i++) {
+		xmlnode *record;
+
+		if (*lines[i] == '\0')
+			continue;
+
+		if ((record = xmlnode_from_str(lines[i], -1)) == NULL)
+			continue;
+
+		blist_journal_replay_record(record);
+		xmlnode_free(record);
+	}
+
+	g_strfreev(lines);
+
+	blist_journal_suspended = FALSE;
+
+	/* Fold the journal back into blist.xml. */
+	purple_blist_schedule_save();
+}
+
+/* TODO: Make static and rename to load_blist */
+void
+purple_blist_load()
+{
+	struct _blist_load_data data = { NULL, NULL, NULL, NULL };
+	PurpleBlistNode *gnode;
+	xmlnode *purple;
+	/* A save scheduled before the list was read (creating the accounts
+	 * does that) has nothing to write that isn't already on disk. */
+	gboolean saving = (blist_loaded && save_timer != 0);
+
+	blist_loaded = TRUE;
+
+	for (gnode = purple_blist_get_root(); gnode != NULL; gnode = gnode->next)
+		data.groups = g_list_prepend(data.groups, gnode);
+
+	purple = purple_util_read_xml_from_file_streamed("blist.xml", _("buddy list"),
+			BLIST_STREAM_DEPTH, blist_load_open_cb, blist_load_element_cb, &data);
+
+	/* The user is told the list wasn't loaded, so none of it may stay */
+	if (purple == NULL) {
+		blist_journal_suspended = TRUE;
+		blist_load_rollback(&data);
+		blist_journal_suspended = FALSE;
+	}
+
+	g_list_free(data.groups);
+	g_list_foreach(data.privacy, (GFunc)blist_load_privacy_free, NULL);
+	g_list_free(data.privacy);
+
+	/* Adding what was just read schedules a save of what is already on
+	 * disk, and would keep the journal shut until it ran.  After a failed
+	 * load it would also write over the file the user was told about. */
+	if (!saving && save_timer != 0) {
+		purple_timeout_remove(save_timer);
+		save_timer = 0;
+	}
+
+	if (purple == NULL)
+		return;
+
 	xmlnode_free(purple);
 
+	blist_journal_replay();
+
 	/* This tells the buddy icon code to do its thing. */
 	_purple_buddy_icons_blist_loaded_cb();
 }
@@ -752,40 +1294,25 @@ PurpleBlistNode *purple_blist_node_next(PurpleBlistNode *node, gboolean offline)
 	return ret;
 }
 
-void
-purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
+static void
+buddy_status_changed(PurpleBuddy *buddy, PurpleStatus *old_status)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurplePresence *presence;
 	PurpleStatus *status;
 
-	g_return_if_fail(buddy != NULL);
-
 	presence = purple_buddy_get_presence(buddy);
 	status = purple_presence_get_active_status(presence);
 
-	purple_debug_info("blist", "Updating buddy status for %s (%s)\n",
-			buddy->name, purple_account_get_protocol_name(buddy->account));
-
 	if (purple_status_is_online(status) &&
 		!purple_status_is_online(old_status)) {
-
 		purple_signal_emit(purple_blist_get_handle(), "buddy-signed-on", buddy);
-
-		((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online++;
-		if (((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online == 1)
-			((PurpleGroup *)((PurpleBlistNode *)buddy)->parent->parent)->online++;
 	} else if (!purple_status_is_online(status) &&
 				purple_status_is_online(old_status)) {
 		purple_blist_node_set_int(&buddy->node, "last_seen", time(NULL));
 		purple_signal_emit(purple_blist_get_handle(), "buddy-signed-off", buddy);
-		((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online--;
-		if (((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online == 0)
-			((PurpleGroup *)((PurpleBlistNode *)buddy)->parent->parent)->online--;
 	} else {
-		purple_signal_emit(purple_blist_get_handle(),
-		                 "buddy-status-changed", buddy, old_status,
-		                 status);
+		purple_signal_emit_by_signal(buddy_status_changed_signal,
+		                 buddy, old_status, status);
 	}
 
 	/*
@@ -799,18 +1326,196 @@ purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
 	 * certainly won't hurt anything.  Unless you're on a K6-2 300.
 	 */
 	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
+	blist_node_update((PurpleBlistNode *)buddy);
 }
 
-void purple_blist_update_buddy_icon(PurpleBuddy *buddy)
+/* Returns a string that differs whenever a status's attributes do. */
+static char *
+status_describe_attrs(PurpleStatus *status)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
+	GString *str = g_string_new(NULL);
+	GList *l;
+
+	for (l = purple_status_type_get_attrs(purple_status_get_type(status));
+	     l != NULL; l = l->next)
+	{
+		const char *id = purple_status_attr_get_id(l->data);
+		PurpleValue *value = purple_status_get_attr_value(status, id);
+		const char *s;
+
+		g_string_append_printf(str, "%s=", id);
+		if (value == NULL)
+			continue;
+
+		switch (purple_value_get_type(value))
+		{
+			case PURPLE_TYPE_STRING:
+				if ((s = purple_value_get_string(value)) != NULL)
+					g_string_append_printf(str, "%u:%s", (guint)strlen(s), s);
+				break;
+			case PURPLE_TYPE_INT:
+				g_string_append_printf(str, "%d", purple_value_get_int(value));
+				break;
+			case PURPLE_TYPE_BOOLEAN:
+				g_string_append_printf(str, "%d", purple_value_get_boolean(value));
+				break;
+			default:
+				break;
+		}
+		g_string_append_c(str, ';');
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+/* Whether a buddy is back where it was before a coalesced change. */
+static gboolean
+status_change_is_noop(struct buddy_status_change *change)
+{
+	PurpleStatus *status;
+	char *attrs;
+	gboolean noop;
+
+	if (change->old_attrs == NULL)
+		return FALSE;
+
+	status = purple_presence_get_active_status(purple_buddy_get_presence(change->buddy));
+	if (status != change->old_status)
+		return FALSE;
+
+	attrs = status_describe_attrs(status);
+	noop = !strcmp(attrs, change->old_attrs);
+	g_free(attrs);
+
+	return noop;
+}
+
+static void
+status_change_free(struct buddy_status_change *change)
+{
+	g_free(change->old_attrs);
+	g_free(change);
+}
+
+static gboolean
+status_changes_cb(gpointer data)
+{
+	struct buddy_status_change *change;
+
+	GQueue *batch;
+
+	status_changes_timer = 0;
+
+	/*
+	 * Handlers may change statuses again.  A buddy still waiting in this
+	 * batch has it merged into its pending change; anyone else goes into
+	 * a fresh queue, and a new timer, for the next round.
+	 */
+	batch = status_changes;
+	status_changes = g_queue_new();
+
+	purple_blist_begin_batch();
+
+	while ((change = g_queue_pop_head(batch)) != NULL)
+	{
+		if (change->buddy != NULL)
+		{
+			g_hash_table_remove(status_change_links, change->buddy);
+			if (!status_change_is_noop(change))
+				buddy_status_changed(change->buddy, change->old_status);
+		}
+		status_change_free(change);
+	}
+
+	purple_blist_end_batch();
+
+	g_queue_free(batch);
+
+	return FALSE;
+}
+
+/* Called before a buddy is freed, so its pending change doesn't outlive it. */
+static void
+status_changes_forget(PurpleBuddy *buddy)
+{
+	GList *link;
+
+	if (status_change_links == NULL)
+		return;
+
+	/*
+	 * The link may be in a batch that is being delivered, so it stays in
+	 * its queue and is skipped when its turn comes.
+	 */
+	if ((link = g_hash_table_lookup(status_change_links, buddy)) != NULL)
+	{
+		((struct buddy_status_change *)link->data)->buddy = NULL;
+		g_hash_table_remove(status_change_links, buddy);
+	}
+}
+
+void
+purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
+{
+	PurplePresence *presence;
+	PurpleStatus *status;
+	struct buddy_status_change *change;
+	int interval;
 
 	g_return_if_fail(buddy != NULL);
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
+	presence = purple_buddy_get_presence(buddy);
+	status = purple_presence_get_active_status(presence);
+
+	purple_debug_info("blist", "Updating buddy status for %s (%s)\n",
+			buddy->name, purple_account_get_protocol_name(buddy->account));
+
+	/* The online counts have to follow every change as it happens. */
+	if (purple_status_is_online(status) &&
+		!purple_status_is_online(old_status)) {
+		((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online++;
+		if (((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online == 1)
+			((PurpleGroup *)((PurpleBlistNode *)buddy)->parent->parent)->online++;
+	} else if (!purple_status_is_online(status) &&
+				purple_status_is_online(old_status)) {
+		((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online--;
+		if (((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online == 0)
+			((PurpleGroup *)((PurpleBlistNode *)buddy)->parent->parent)->online--;
+	}
+
+	interval = purple_prefs_get_int("/purple/buddies/status_coalesce_interval");
+	if (interval <= 0 || status_changes == NULL) {
+		buddy_status_changed(buddy, old_status);
+		return;
+	}
+
+	if (g_hash_table_lookup(status_change_links, buddy) != NULL)
+		return;
+
+	change = g_new(struct buddy_status_change, 1);
+	change->buddy = buddy;
+	change->old_status = old_status;
+
+	/*
+	 * A switch to another status leaves the old one's attributes as they
+	 * were, so they can be compared later.  A change to the attributes of
+	 * the active status has already overwritten them, and is always reported.
+	 */
+	change->old_attrs = (old_status != NULL && old_status != status) ?
+		status_describe_attrs(old_status) : NULL;
+	g_queue_push_tail(status_changes, change);
+	g_hash_table_insert(status_change_links, buddy,
+			g_queue_peek_tail_link(status_changes));
+
+	if (status_changes_timer == 0)
+		status_changes_timer = purple_timeout_add(interval, status_changes_cb, NULL);
+}
+
+void purple_blist_update_buddy_icon(PurpleBuddy *buddy)
+{
+	g_return_if_fail(buddy != NULL);
+
+	blist_node_update((PurpleBlistNode *)buddy);
 }
 
 /*
@@ -819,7 +1524,6 @@ void purple_blist_update_buddy_icon(PurpleBuddy *buddy)
  */
 void purple_blist_rename_buddy(PurpleBuddy *buddy, const char *name)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	struct _purple_hbuddy *hb;
 
 	g_return_if_fail(buddy != NULL);
@@ -839,13 +1543,11 @@ void purple_blist_rename_buddy(PurpleBuddy *buddy, const char *name)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
+	blist_node_update((PurpleBlistNode *)buddy);
 }
 
 void purple_blist_alias_contact(PurpleContact *contact, const char *alias)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleConversation *conv;
 	PurpleBlistNode *bnode;
 	char *old_alias;
@@ -861,8 +1563,7 @@ void purple_blist_alias_contact(PurpleContact *contact, const char *alias)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)contact);
+	blist_node_update((PurpleBlistNode *)contact);
 
 	for(bnode = ((PurpleBlistNode *)contact)->child; bnode != NULL; bnode = bnode->next)
 	{
@@ -881,7 +1582,6 @@ void purple_blist_alias_contact(PurpleContact *contact, const char *alias)
 
 void purple_blist_alias_chat(PurpleChat *chat, const char *alias)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	char *old_alias;
 
 	g_return_if_fail(chat != NULL);
@@ -895,8 +1595,7 @@ void purple_blist_alias_chat(PurpleChat *chat, const char *alias)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)chat);
+	blist_node_update((PurpleBlistNode *)chat);
 
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-aliased",
 					 chat, old_alias);
@@ -905,7 +1604,6 @@ void purple_blist_alias_chat(PurpleChat *chat, const char *alias)
 
 void purple_blist_alias_buddy(PurpleBuddy *buddy, const char *alias)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleConversation *conv;
 	char *old_alias;
 
@@ -920,8 +1618,7 @@ void purple_blist_alias_buddy(PurpleBuddy *buddy, const char *alias)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
+	blist_node_update((PurpleBlistNode *)buddy);
 
 	conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, buddy->name,
 											   buddy->account);
@@ -935,7 +1632,6 @@ void purple_blist_alias_buddy(PurpleBuddy *buddy, const char *alias)
 
 void purple_blist_server_alias_buddy(PurpleBuddy *buddy, const char *alias)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleConversation *conv;
 	char *old_alias;
 
@@ -950,8 +1646,7 @@ void purple_blist_server_alias_buddy(PurpleBuddy *buddy, const char *alias)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
+	blist_node_update((PurpleBlistNode *)buddy);
 
 	conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, buddy->name,
 											   buddy->account);
@@ -968,7 +1663,6 @@ void purple_blist_server_alias_buddy(PurpleBuddy *buddy, const char *alias)
  */
 void purple_blist_rename_group(PurpleGroup *source, const char *new_name)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleGroup *dest;
 	gchar *old_name;
 	GList *moved_buddies = NULL;
@@ -1039,8 +1733,7 @@ void purple_blist_rename_group(PurpleGroup *source, const char *new_name)
 	purple_blist_schedule_save();
 
 	/* Update the UI */
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode*)source);
+	blist_node_update((PurpleBlistNode*)source);
 
 	/* Notify all PRPLs */
 	/* TODO: Is this condition needed?  Seems like it would always be TRUE */
@@ -1253,8 +1946,7 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode *)cnode);
+	blist_node_update((PurpleBlistNode *)cnode);
 }
 
 void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGroup *group, PurpleBlistNode *node)
@@ -1340,8 +2032,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 			purple_blist_remove_contact((PurpleContact*)bnode->parent);
 		} else {
 			purple_contact_invalidate_priority_buddy((PurpleContact*)bnode->parent);
-			if (ops && ops->update)
-				ops->update(purplebuddylist, bnode->parent);
+			blist_node_update(bnode->parent);
 		}
 	}
 
@@ -1384,8 +2075,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode*)buddy);
+	blist_node_update((PurpleBlistNode*)buddy);
 
 	/* Signal that the buddy has been added */
 	purple_signal_emit(purple_blist_get_handle(), "buddy-added", buddy);
@@ -1411,7 +2101,6 @@ PurpleContact *purple_contact_new()
 
 void purple_contact_set_alias(PurpleContact *contact, const char *alias)
 {
-	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	char *old_alias;
 
 	g_return_if_fail(contact != NULL);
@@ -1425,8 +2114,7 @@ void purple_contact_set_alias(PurpleContact *contact, const char *alias)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-		ops->update(purplebuddylist, (PurpleBlistNode*)contact);
+	blist_node_update((PurpleBlistNode*)contact);
 
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-aliased",
 					 contact, old_alias);
@@ -1611,14 +2299,11 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update)
-	{
-		if (cnode->child)
-			ops->update(purplebuddylist, cnode);
+	if (cnode->child)
+		blist_node_update(cnode);
 
-		for (bnode = cnode->child; bnode; bnode = bnode->next)
-			ops->update(purplebuddylist, bnode);
-	}
+	for (bnode = cnode->child; bnode; bnode = bnode->next)
+		blist_node_update(bnode);
 }
 
 void purple_blist_merge_contact(PurpleContact *source, PurpleBlistNode *node)
@@ -1706,11 +2391,9 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 
 	purple_blist_schedule_save();
 
-	if (ops && ops->update) {
-		ops->update(purplebuddylist, gnode);
-		for (node = gnode->child; node; node = node->next)
-			ops->update(purplebuddylist, node);
-	}
+	blist_node_update(gnode);
+	for (node = gnode->child; node; node = node->next)
+		blist_node_update(node);
 }
 
 void purple_blist_remove_contact(PurpleContact *contact)
@@ -1755,6 +2438,7 @@ void purple_blist_remove_contact(PurpleContact *contact)
 
 		/* Delete the node */
 		g_hash_table_destroy(contact->node.settings);
+		blist_batch_forget(node);
 		PURPLE_DBUS_UNREGISTER_POINTER(contact);
 		g_free(contact);
 	}
@@ -1801,8 +2485,7 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 		/* Re-sort the contact */
 		if (cnode->child && contact->priority == buddy) {
 			purple_contact_invalidate_priority_buddy(contact);
-			if (ops && ops->update)
-				ops->update(purplebuddylist, cnode);
+			blist_node_update(cnode);
 		}
 	}
 
@@ -1830,6 +2513,8 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 	g_free(buddy->alias);
 	g_free(buddy->server_alias);
 
+	blist_batch_forget(node);
+	status_changes_forget(buddy);
 	PURPLE_DBUS_UNREGISTER_POINTER(buddy);
 	g_free(buddy);
 
@@ -1885,6 +2570,7 @@ void purple_blist_remove_chat(PurpleChat *chat)
 	g_hash_table_destroy(chat->components);
 	g_hash_table_destroy(chat->node.settings);
 	g_free(chat->alias);
+	blist_batch_forget(node);
 	PURPLE_DBUS_UNREGISTER_POINTER(chat);
 	g_free(chat);
 }
@@ -1929,6 +2615,7 @@ void purple_blist_remove_group(PurpleGroup *group)
 	/* Delete the node */
 	g_hash_table_destroy(group->node.settings);
 	g_free(group->name);
+	blist_batch_forget(node);
 	PURPLE_DBUS_UNREGISTER_POINTER(group);
 	g_free(group);
 }
@@ -2339,6 +3026,9 @@ void purple_blist_remove_account(PurpleAccount *account)
 					if (account == buddy->account) {
 						PurplePresence *presence;
 
+						/* The account going offline isn't reported per buddy. */
+						status_changes_forget(buddy);
+
 						presence = purple_buddy_get_presence(buddy);
 
 						if(purple_presence_is_online(presence)) {
@@ -2369,8 +3059,7 @@ void purple_blist_remove_account(PurpleAccount *account)
 				}
 				if (recompute) {
 					purple_contact_invalidate_priority_buddy(contact);
-					if (ops && ops->update)
-						ops->update(purplebuddylist, cnode);
+					blist_node_update(cnode);
 				}
 			} else if (PURPLE_BLIST_NODE_IS_CHAT(cnode)) {
 				chat = (PurpleChat *)cnode;
@@ -2479,7 +3168,7 @@ void purple_blist_node_remove_setting(PurpleBlistNode *node, const char *key)
 
 	g_hash_table_remove(node->settings, key);
 
-	purple_blist_schedule_save();
+	purple_blist_node_setting_changed(node, key);
 }
 
 void
@@ -2519,7 +3208,7 @@ purple_blist_node_set_bool(PurpleBlistNode* node, const char *key, gboolean data
 
 	g_hash_table_replace(node->settings, g_strdup(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_setting_changed(node, key);
 }
 
 gboolean
@@ -2555,7 +3244,7 @@ purple_blist_node_set_int(PurpleBlistNode* node, const char *key, int data)
 
 	g_hash_table_replace(node->settings, g_strdup(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_setting_changed(node, key);
 }
 
 int
@@ -2591,7 +3280,7 @@ purple_blist_node_set_string(PurpleBlistNode* node, const char *key, const char
 
 	g_hash_table_replace(node->settings, g_strdup(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_setting_changed(node, key);
 }
 
 const char *
@@ -2668,6 +3357,11 @@ purple_blist_init(void)
 {
 	void *handle = purple_blist_get_handle();
 
+	purple_prefs_add_int("/purple/buddies/status_coalesce_interval", 250);
+
+	status_changes = g_queue_new();
+	status_change_links = g_hash_table_new(g_direct_hash, g_direct_equal);
+
 	purple_signal_register(handle, "buddy-status-changed",
 	                     purple_marshal_VOID__POINTER_POINTER_POINTER, NULL,
 	                     3,
@@ -2677,6 +3371,8 @@ purple_blist_init(void)
 										PURPLE_SUBTYPE_STATUS),
 	                     purple_value_new(PURPLE_TYPE_SUBTYPE,
 										PURPLE_SUBTYPE_STATUS));
+	buddy_status_changed_signal =
+		purple_signal_lookup(handle, "buddy-status-changed");
 	purple_signal_register(handle, "buddy-privacy-changed",
 	                     purple_marshal_VOID__POINTER, NULL,
 	                     1,
@@ -2747,5 +3443,24 @@ purple_blist_uninit(void)
 		purple_blist_sync();
 	}
 
+	if (blist_journal != NULL) {
+		fclose(blist_journal);
+		blist_journal = NULL;
+	}
+
+	if (status_changes_timer != 0)
+	{
+		purple_timeout_remove(status_changes_timer);
+		status_changes_timer = 0;
+	}
+
+	while (!g_queue_is_empty(status_changes))
+		status_change_free(g_queue_pop_head(status_changes));
+	g_queue_free(status_changes);
+	status_changes = NULL;
+	g_hash_table_destroy(status_change_links);
+	status_change_links = NULL;
+
 	purple_signals_unregister_by_instance(purple_blist_get_handle());
+	buddy_status_changed_signal = NULL;
 }
@@ -255,6 +255,12 @@ void purple_blist_set_visible(gboolean show);
 /**
  * Updates a buddy's status.
  *
+ * The "buddy-signed-on", "buddy-signed-off" and "buddy-status-changed"
+ * signals and the UI update follow after the number of milliseconds in
+ * the /purple/buddies/status_coalesce_interval preference (0 sends them
+ * right away).  Further changes to the buddy's status in the meantime are
+ * merged into a single change from @a old_status.
+ *
  * @param buddy      The buddy whose status has changed.
  * @param old_status The status from which we are changing.
  */
@@ -751,6 +757,23 @@ void purple_blist_load(void);
  */
 void purple_blist_schedule_save(void);
 
+/**
+ * Starts a batch of buddy list changes, such as adding a roster received
+ * from the server.  Until the matching purple_blist_end_batch(), the UI
+ * is updated at most once per node and the buddy list is not saved.
+ * Batches may be nested; only the outermost one has any effect.
+ *
+ * @see purple_blist_end_batch()
+ */
+void purple_blist_begin_batch(void);
+
+/**
+ * Ends a batch of buddy list changes started with
+ * purple_blist_begin_batch(), sending the queued updates to the UI and
+ * scheduling a save if anything changed.
+ */
+void purple_blist_end_batch(void);
+
 /**
  * Requests from the user information needed to add a buddy to the
  * buddy list.
@@ -40,6 +40,117 @@ static GList *ims = NULL;
 static GList *chats = NULL;
 static PurpleConversationUiOps *default_ops = NULL;
 
+/**
+ * A hash table used for efficient lookups of conversations by name.
+ * struct _purple_hconv => PurpleConversation*
+ */
+static GHashTable *conversation_cache = NULL;
+
+/* Emitted for every conversation change, so it is looked up once. */
+static PurpleSignal *conversation_updated_signal = NULL;
+
+struct _purple_hconv {
+	PurpleConversationType type;
+	char *name;
+	const PurpleAccount *account;
+};
+
+static guint
+_purple_conversations_hconv_hash(struct _purple_hconv *hc)
+{
+	return g_str_hash(hc->name) ^ hc->type ^ g_direct_hash(hc->account);
+}
+
+static gboolean
+_purple_conversations_hconv_equal(struct _purple_hconv *hc1, struct _purple_hconv *hc2)
+{
+	return (hc1->type == hc2->type &&
+	        hc1->account == hc2->account &&
+	        g_str_equal(hc1->name, hc2->name));
+}
+
+static void
+_purple_conversations_hconv_free_key(struct _purple_hconv *hc)
+{
+	g_free(hc->name);
+	g_free(hc);
+}
+
+/*
+ * Returns the key used to index a conversation name. Two names map to the
+ * same key exactly when purple_utf8_strcasecmp() considers their normalized
+ * forms equal, so the cache behaves like the old linear search did.
+ */
+static char *
+_purple_conversations_hconv_name(const PurpleAccount *account, const char *name)
+{
+	const char *norm = purple_normalize(account, name);
+	char *folded, *key;
+
+	if (norm == NULL)
+		return g_strdup("");
+
+	if (!g_utf8_validate(norm, -1, NULL))
+		return g_strdup(norm);
+
+	folded = g_utf8_casefold(norm, -1);
+	key = g_utf8_collate_key(folded, -1);
+	g_free(folded);
+
+	return key;
+}
+
+static void
+_purple_conversations_cache_add(PurpleConversation *conv)
+{
+	struct _purple_hconv *hc = g_new(struct _purple_hconv, 1);
+
+	hc->type = conv->type;
+	hc->account = conv->account;
+	hc->name = _purple_conversations_hconv_name(conv->account, conv->name);
+
+	/* Keep the first conversation registered under a given key, which is
+	 * the one the old list walk would have found. */
+	if (g_hash_table_lookup(conversation_cache, hc) != NULL)
+		_purple_conversations_hconv_free_key(hc);
+	else
+		g_hash_table_insert(conversation_cache, hc, conv);
+}
+
+static void
+_purple_conversations_cache_remove(PurpleConversation *conv)
+{
+	struct _purple_hconv hc;
+	GList *l;
+
+	hc.type = conv->type;
+	hc.account = conv->account;
+	hc.name = _purple_conversations_hconv_name(conv->account, conv->name);
+
+	if (g_hash_table_lookup(conversation_cache, &hc) == conv) {
+		g_hash_table_remove(conversation_cache, &hc);
+
+		/* Another conversation may have been shadowed by this one. */
+		for (l = conversations; l != NULL; l = l->next) {
+			PurpleConversation *c = l->data;
+			char *name;
+
+			if (c == conv || c->type != hc.type || c->account != hc.account)
+				continue;
+
+			name = _purple_conversations_hconv_name(c->account, c->name);
+			if (g_str_equal(name, hc.name)) {
+				g_free(name);
+				_purple_conversations_cache_add(c);
+				break;
+			}
+			g_free(name);
+		}
+	}
+
+	g_free(hc.name);
+}
+
 void
 purple_conversations_set_ui_ops(PurpleConversationUiOps *ops)
 {
@@ -302,6 +413,8 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 
 		conv->u.chat = g_new0(PurpleConvChat, 1);
 		conv->u.chat->conv = conv;
+		conv->u.chat->users = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                                            g_free, NULL);
 		PURPLE_DBUS_REGISTER_POINTER(conv->u.chat, PurpleConvChat);
 
 		chats = g_list_append(chats, conv);
@@ -320,6 +433,7 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 	}
 
 	conversations = g_list_append(conversations, conv);
+	_purple_conversations_cache_add(conv);
 
 	/* Auto-set the title. */
 	purple_conversation_autoset_title(conv);
@@ -414,6 +528,7 @@ purple_conversation_destroy(PurpleConversation *conv)
 	}
 
 	/* remove from conversations and im/chats lists prior to emit */
+	_purple_conversations_cache_remove(conv);
 	conversations = g_list_remove(conversations, conv);
 
 	if(conv->type==PURPLE_CONV_TYPE_IM)
@@ -445,6 +560,8 @@ purple_conversation_destroy(PurpleConversation *conv)
 
 		g_list_foreach(conv->u.chat->in_room, (GFunc)purple_conv_chat_cb_destroy, NULL);
 		g_list_free(conv->u.chat->in_room);
+		g_hash_table_destroy(conv->u.chat->users);
+		conv->u.chat->users = NULL;
 
 		g_list_foreach(conv->u.chat->ignored, (GFunc)g_free, NULL);
 		g_list_free(conv->u.chat->ignored);
@@ -551,7 +668,9 @@ purple_conversation_set_account(PurpleConversation *conv, PurpleAccount *account
 	if (account == purple_conversation_get_account(conv))
 		return;
 
+	_purple_conversations_cache_remove(conv);
 	conv->account = account;
+	_purple_conversations_cache_add(conv);
 
 	purple_conversation_update(conv, PURPLE_CONV_UPDATE_ACCOUNT);
 }
@@ -647,8 +766,10 @@ purple_conversation_set_name(PurpleConversation *conv, const char *name)
 {
 	g_return_if_fail(conv != NULL);
 
+	_purple_conversations_cache_remove(conv);
 	g_free(conv->name);
 	conv->name = g_strdup(name);
+	_purple_conversations_cache_add(conv);
 
 	purple_conversation_autoset_title(conv);
 }
@@ -757,29 +878,34 @@ purple_find_conversation_with_account(PurpleConversationType type,
 									const PurpleAccount *account)
 {
 	PurpleConversation *c = NULL;
-	gchar *name1;
-	const gchar *name2;
-	GList *cnv;
+	struct _purple_hconv hc;
 
 	g_return_val_if_fail(name != NULL, NULL);
 
-	name1 = g_strdup(purple_normalize(account, name));
+	hc.name = _purple_conversations_hconv_name(account, name);
+	hc.account = account;
 
-	for (cnv = purple_get_conversations(); cnv != NULL; cnv = cnv->next) {
-		c = (PurpleConversation *)cnv->data;
-		name2 = purple_normalize(account, purple_conversation_get_name(c));
+	if (type == PURPLE_CONV_TYPE_ANY) {
+		PurpleConversation *chat;
 
-		if (((type == PURPLE_CONV_TYPE_ANY) || (type == purple_conversation_get_type(c))) &&
-				(account == purple_conversation_get_account(c)) &&
-				!purple_utf8_strcasecmp(name1, name2)) {
+		hc.type = PURPLE_CONV_TYPE_IM;
+		c = g_hash_table_lookup(conversation_cache, &hc);
 
-			break;
-		}
+		hc.type = PURPLE_CONV_TYPE_CHAT;
+		chat = g_hash_table_lookup(conversation_cache, &hc);
 
-		c = NULL;
+		/* Prefer whichever was created first, as the list walk used to. */
+		if (c == NULL)
+			c = chat;
+		else if (chat != NULL &&
+		         g_list_index(conversations, chat) < g_list_index(conversations, c))
+			c = chat;
+	} else {
+		hc.type = type;
+		c = g_hash_table_lookup(conversation_cache, &hc);
 	}
 
-	g_free(name1);
+	g_free(hc.name);
 
 	return c;
 }
@@ -927,8 +1053,7 @@ purple_conversation_update(PurpleConversation *conv, PurpleConvUpdateType type)
 {
 	g_return_if_fail(conv != NULL);
 
-	purple_signal_emit(purple_conversations_get_handle(),
-					 "conversation-updated", conv, type);
+	purple_signal_emit_by_signal(conversation_updated_signal, conv, type);
 }
 
 /**************************************************************************
@@ -1240,12 +1365,88 @@ purple_conv_chat_get_conversation(const PurpleConvChat *chat)
 	return chat->conv;
 }
 
+/*
+ * The users in a chat are kept in chat->in_room, and chat->users maps the
+ * collation key of each name to its link in that list, so finding, adding
+ * and removing a single user never has to walk the room.
+ */
+static gboolean
+purple_conv_chat_users_clear_cb(gpointer key, gpointer value, gpointer data)
+{
+	return TRUE;
+}
+
+static void
+purple_conv_chat_users_reindex(PurpleConvChat *chat)
+{
+	GList *l;
+
+	g_hash_table_foreach_remove(chat->users, purple_conv_chat_users_clear_cb, NULL);
+
+	/* The first entry for a name is the one lookups have always found. */
+	for (l = chat->in_room; l != NULL; l = l->next) {
+		PurpleConvChatBuddy *cb = l->data;
+		char *key = g_utf8_collate_key(cb->name, -1);
+
+		if (g_hash_table_lookup(chat->users, key) == NULL)
+			g_hash_table_insert(chat->users, key, l);
+		else
+			g_free(key);
+	}
+}
+
+static void
+purple_conv_chat_users_detach(PurpleConvChat *chat, PurpleConvChatBuddy *cb)
+{
+	char *key = g_utf8_collate_key(cb->name, -1);
+	GList *link = g_hash_table_lookup(chat->users, key);
+
+	if (link != NULL && link->data == cb) {
+		g_hash_table_remove(chat->users, key);
+		chat->in_room = g_list_delete_link(chat->in_room, link);
+	} else {
+		chat->in_room = g_list_remove(chat->in_room, cb);
+	}
+
+	g_free(key);
+}
+
+static void
+purple_conv_chat_users_attach(PurpleConvChat *chat, PurpleConvChatBuddy *cb)
+{
+	char *key = g_utf8_collate_key(cb->name, -1);
+	GList *link = g_hash_table_lookup(chat->users, key);
+
+	/* Nobody can be in the same room twice; drop any stale entry, and
+	 * take it out of the UI's list before it goes away. */
+	if (link != NULL) {
+		PurpleConvChatBuddy *old = link->data;
+		PurpleConversation *conv = purple_conv_chat_get_conversation(chat);
+		PurpleConversationUiOps *ops = purple_conversation_get_ui_ops(conv);
+
+		g_hash_table_remove(chat->users, key);
+		chat->in_room = g_list_delete_link(chat->in_room, link);
+
+		if (ops != NULL && ops->chat_remove_users != NULL) {
+			GList *names = g_list_append(NULL, old->name);
+			ops->chat_remove_users(conv, names);
+			g_list_free(names);
+		}
+
+		purple_conv_chat_cb_destroy(old);
+	}
+
+	chat->in_room = g_list_prepend(chat->in_room, cb);
+	g_hash_table_insert(chat->users, key, chat->in_room);
+}
+
 GList *
 purple_conv_chat_set_users(PurpleConvChat *chat, GList *users)
 {
 	g_return_val_if_fail(chat != NULL, NULL);
 
 	chat->in_room = users;
+	purple_conv_chat_users_reindex(chat);
 
 	return users;
 }
@@ -1540,6 +1741,18 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 		PurpleConvChatBuddyFlags flag = GPOINTER_TO_INT(fl->data);
 		const char *extra_msg = (extra_msgs ? extra_msgs->data : NULL);
 
+		/* Someone who is already here can't join again.  Replacing them
+		 * would free an entry that may still be waiting in cbuddies, so
+		 * only their flags are brought up to date. */
+		if (purple_conv_chat_cb_find(chat, user) != NULL) {
+			purple_conv_chat_user_set_flags(chat, user, flag);
+			ul = ul->next;
+			fl = fl->next;
+			if (extra_msgs != NULL)
+				extra_msgs = extra_msgs->next;
+			continue;
+		}
+
 		if(!(prpl_info->options & OPT_PROTO_UNIQUE_CHATNAME)) {
 			if (!strcmp(chat->nick, purple_normalize(conv->account, user))) {
 				const char *alias2 = purple_account_get_alias(conv->account);
@@ -1564,9 +1777,7 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 
 		cbuddy = purple_conv_chat_cb_new(user, alias, flag);
 		cbuddy->buddy = purple_find_buddy(conv->account, user) != NULL;
-		/* This seems dumb. Why should we set users thousands of times? */
-		purple_conv_chat_set_users(chat,
-				g_list_prepend(chat->in_room, cbuddy));
+		purple_conv_chat_users_attach(chat, cbuddy);
 
 		cbuddies = g_list_prepend(cbuddies, cbuddy);
 
@@ -1614,7 +1825,7 @@ purple_conv_chat_rename_user(PurpleConvChat *chat, const char *old_user,
 	PurpleConversationUiOps *ops;
 	PurpleConnection *gc;
 	PurplePluginProtocolInfo *prpl_info;
-	PurpleConvChatBuddy *cb;
+	PurpleConvChatBuddy *cb, *old_cb;
 	PurpleConvChatBuddyFlags flags;
 	const char *new_alias = new_user;
 	char tmp[BUF_LONG];
@@ -1655,22 +1866,21 @@ purple_conv_chat_rename_user(PurpleConvChat *chat, const char *old_user,
 			new_alias = purple_buddy_get_contact_alias(buddy);
 	}
 
-	flags = purple_conv_chat_user_get_flags(chat, old_user);
+	/* Take the old entry out first, so a rename that only changes case
+	 * doesn't remove the entry it just added. */
+	old_cb = purple_conv_chat_cb_find(chat, old_user);
+	flags = (old_cb != NULL) ? old_cb->flags : PURPLE_CBFLAGS_NONE;
+	if (old_cb != NULL)
+		purple_conv_chat_users_detach(chat, old_cb);
+
 	cb = purple_conv_chat_cb_new(new_user, new_alias, flags);
 	cb->buddy = purple_find_buddy(conv->account, new_user) != NULL;
-	purple_conv_chat_set_users(chat,
-		g_list_prepend(chat->in_room, cb));
+	purple_conv_chat_users_attach(chat, cb);
 
 	if (ops != NULL && ops->chat_rename_user != NULL)
 		ops->chat_rename_user(conv, old_user, new_user, new_alias);
 
-	cb = purple_conv_chat_cb_find(chat, old_user);
-
-	if (cb) {
-		purple_conv_chat_set_users(chat,
-				g_list_remove(chat->in_room, cb));
-		purple_conv_chat_cb_destroy(cb);
-	}
+	purple_conv_chat_cb_destroy(old_cb);
 
 	if (purple_conv_chat_is_user_ignored(chat, old_user)) {
 		purple_conv_chat_unignore(chat, old_user);
@@ -1761,8 +1971,7 @@ purple_conv_chat_remove_users(PurpleConvChat *chat, GList *users, const char *re
 		cb = purple_conv_chat_cb_find(chat, user);
 
 		if (cb) {
-			purple_conv_chat_set_users(chat,
-					g_list_remove(chat->in_room, cb));
+			purple_conv_chat_users_detach(chat, cb);
 			purple_conv_chat_cb_destroy(cb);
 		}
 
@@ -1971,19 +2180,17 @@ purple_conv_chat_cb_new(const char *name, const char *alias, PurpleConvChatBuddy
 PurpleConvChatBuddy *
 purple_conv_chat_cb_find(PurpleConvChat *chat, const char *name)
 {
-	GList *l;
-	PurpleConvChatBuddy *cb = NULL;
+	GList *link;
+	char *key;
 
 	g_return_val_if_fail(chat != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	for (l = purple_conv_chat_get_users(chat); l; l = l->next) {
-		cb = l->data;
-		if (!g_utf8_collate(cb->name, name))
-			return cb;
-	}
+	key = g_utf8_collate_key(name, -1);
+	link = g_hash_table_lookup(chat->users, key);
+	g_free(key);
 
-	return NULL;
+	return (link != NULL) ? link->data : NULL;
 }
 
 void
@@ -2044,6 +2251,11 @@ purple_conversations_init(void)
 {
 	void *handle = purple_conversations_get_handle();
 
+	conversation_cache = g_hash_table_new_full((GHashFunc)_purple_conversations_hconv_hash,
+	                                           (GEqualFunc)_purple_conversations_hconv_equal,
+	                                           (GDestroyNotify)_purple_conversations_hconv_free_key,
+	                                           NULL);
+
 	/**********************************************************************
 	 * Register preferences
 	 **********************************************************************/
@@ -2191,6 +2403,8 @@ purple_conversations_init(void)
 						 purple_value_new(PURPLE_TYPE_SUBTYPE,
 										PURPLE_SUBTYPE_CONVERSATION),
 						 purple_value_new(PURPLE_TYPE_UINT));
+	conversation_updated_signal =
+		purple_signal_lookup(handle, "conversation-updated");
 
 	purple_signal_register(handle, "deleting-conversation",
 						 purple_marshal_VOID__POINTER, NULL, 1,
@@ -2307,5 +2521,8 @@ purple_conversations_uninit(void)
 {
 	while (conversations)
 		purple_conversation_destroy((PurpleConversation*)conversations->data);
+	g_hash_table_destroy(conversation_cache);
+	conversation_cache = NULL;
 	purple_signals_unregister_by_instance(purple_conversations_get_handle());
+	conversation_updated_signal = NULL;
 }
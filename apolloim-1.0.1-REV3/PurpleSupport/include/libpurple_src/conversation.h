@@ -268,6 +268,9 @@ struct _PurpleConvChat
 	char *nick;                      /**< Your nick in this chat.       */
 
 	gboolean left;                   /**< We left the chat and kept the window open */
+
+	GHashTable *users;               /**< Collation key of each user's name
+	                                      => that user's link in in_room. */
 };
 
 /**
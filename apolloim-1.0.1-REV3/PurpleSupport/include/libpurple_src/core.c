@@ -29,7 +29,9 @@
 #include "core.h"
 #include "debug.h"
 #include "dnsquery.h"
+#include "dnsresolver.h"
 #include "ft.h"
+#include "httpclient.h"
 #include "idle.h"
 #include "imgstore.h"
 #include "network.h"
@@ -150,6 +152,8 @@ purple_core_init(const char *ui)
 	purple_pounces_init();
 	purple_proxy_init();
 	purple_dnsquery_init();
+	purple_dnsresolver_init();
+	purple_httpclient_init();
 	purple_sound_init();
 	purple_ssl_init();
 	purple_stun_init();
@@ -190,6 +194,7 @@ purple_core_quit(void)
 	purple_blist_uninit();
 	purple_ciphers_uninit();
 	purple_notify_uninit();
+	purple_log_uninit();
 	purple_conversations_uninit();
 	purple_connections_uninit();
 	purple_buddy_icons_uninit();
@@ -198,7 +203,9 @@ purple_core_quit(void)
 	purple_status_uninit();
 	purple_prefs_uninit();
 	purple_xfers_uninit();
+	purple_httpclient_uninit();
 	purple_proxy_uninit();
+	purple_dnsresolver_uninit();
 	purple_dnsquery_uninit();
 	purple_imgstore_uninit();
 
@@ -27,6 +27,7 @@
 #include "internal.h"
 #include "debug.h"
 #include "dnsquery.h"
+#include "dnsresolver.h"
 #include "notify.h"
 #include "prefs.h"
 #include "util.h"
@@ -46,6 +47,11 @@ struct _PurpleDnsQueryData {
 	gpointer data;
 	guint timeout;
 
+	/* A and AAAA lookups through the in-process resolver */
+	PurpleDnsResolverQuery *lookups[2];
+	GSList *lookup_hosts[2];
+	gboolean lookup_tried;
+
 #if defined(__unix__) || defined(__APPLE__)
 	PurpleDnsQueryResolverProcess *resolver;
 #elif defined _WIN32 /* end __unix__ || __APPLE__ */
@@ -116,6 +122,123 @@ purple_dnsquery_failed(PurpleDnsQueryData *query_data, const gchar *error_messag
 	purple_dnsquery_destroy(query_data);
 }
 
+static void
+purple_dnsquery_free_hosts(GSList *hosts)
+{
+	while (hosts != NULL)
+	{
+		/* Discard the length... */
+		hosts = g_slist_delete_link(hosts, hosts);
+		/* Free the address... */
+		g_free(hosts->data);
+		hosts = g_slist_delete_link(hosts, hosts);
+	}
+}
+
+static gboolean resolve_host(gpointer data);
+
+static void
+purple_dnsquery_lookup_done(PurpleDnsQueryData *query_data, int i,
+		PurpleDnsResolverResult result, GSList *records)
+{
+	GSList *hosts;
+
+	query_data->lookups[i] = NULL;
+
+	for (; records != NULL; records = records->next)
+	{
+		PurpleDnsRecord *record = records->data;
+		struct sockaddr *addr;
+		size_t addrlen;
+
+		if (record->type == PURPLE_DNS_RR_A)
+		{
+			struct sockaddr_in *sin = g_new0(struct sockaddr_in, 1);
+			sin->sin_family = AF_INET;
+			sin->sin_port = htons(query_data->port);
+			memcpy(&sin->sin_addr, record->addr, 4);
+			addr = (struct sockaddr *)sin;
+			addrlen = sizeof(struct sockaddr_in);
+		}
+		else
+		{
+			struct sockaddr_in6 *sin6 = g_new0(struct sockaddr_in6, 1);
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_port = htons(query_data->port);
+			memcpy(&sin6->sin6_addr, record->addr, 16);
+			addr = (struct sockaddr *)sin6;
+			addrlen = sizeof(struct sockaddr_in6);
+		}
+
+		query_data->lookup_hosts[i] = g_slist_append(query_data->lookup_hosts[i],
+				GSIZE_TO_POINTER(addrlen));
+		query_data->lookup_hosts[i] = g_slist_append(query_data->lookup_hosts[i], addr);
+	}
+
+	if (query_data->lookups[0] != NULL || query_data->lookups[1] != NULL)
+		/* Wait for the other one */
+		return;
+
+	/* IPv4 addresses first, since that's what most servers are reachable on */
+	hosts = g_slist_concat(query_data->lookup_hosts[0], query_data->lookup_hosts[1]);
+	query_data->lookup_hosts[0] = query_data->lookup_hosts[1] = NULL;
+
+	if (hosts != NULL)
+	{
+		purple_dnsquery_resolved(query_data, hosts);
+	}
+	else
+	{
+		/*
+		 * The system's resolver may still know the name, through its
+		 * search domains or sources other than DNS, so a name the
+		 * nameservers deny is handed on just like a failed lookup.
+		 */
+		query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
+	}
+}
+
+static void
+purple_dnsquery_lookup_a_cb(PurpleDnsResolverResult result, GSList *records, gpointer data)
+{
+	purple_dnsquery_lookup_done(data, 0, result, records);
+}
+
+static void
+purple_dnsquery_lookup_aaaa_cb(PurpleDnsResolverResult result, GSList *records, gpointer data)
+{
+	purple_dnsquery_lookup_done(data, 1, result, records);
+}
+
+/**
+ * Hands the query to the in-process resolver, which caches answers
+ * and shares lookups of the same name.  A UI which resolves names
+ * itself keeps doing so, and the resolver is left out.  If it can't
+ * come up with any addresses, the query goes on to the system's resolver.
+ *
+ * @return TRUE if the resolver is handling the query.
+ */
+static gboolean
+purple_dnsquery_lookup(PurpleDnsQueryData *query_data)
+{
+	PurpleDnsQueryUiOps *ops = purple_dnsquery_get_ui_ops();
+
+	if (ops != NULL && ops->resolve_host != NULL)
+		return FALSE;
+
+	if (query_data->lookup_tried ||
+			!purple_dnsresolver_can_resolve(query_data->hostname))
+		return FALSE;
+
+	query_data->lookup_tried = TRUE;
+	query_data->lookups[0] = purple_dnsresolver_query(query_data->hostname,
+			PURPLE_DNS_RR_A, purple_dnsquery_lookup_a_cb, query_data);
+	query_data->lookups[1] = purple_dnsresolver_query(query_data->hostname,
+			PURPLE_DNS_RR_AAAA, purple_dnsquery_lookup_aaaa_cb, query_data);
+
+	return TRUE;
+}
+
 static gboolean
 purple_dnsquery_ui_resolve(PurpleDnsQueryData *query_data)
 {
@@ -589,6 +712,14 @@ resolve_host(gpointer data)
 	query_data = data;
 	query_data->timeout = 0;
 
+	if (purple_dnsquery_lookup(query_data))
+		/* The in-process resolver is handling it */
+		return FALSE;
+
+	queued_requests = g_slist_append(queued_requests, query_data);
+
+	purple_debug_info("dns", "DNS query for '%s' queued\n", query_data->hostname);
+
 	handle_next_queued_request();
 
 	return FALSE;
@@ -604,7 +735,7 @@ purple_dnsquery_a(const char *hostname, int port,
 	g_return_val_if_fail(port	  != 0, NULL);
 	g_return_val_if_fail(callback != NULL, NULL);
 
-	query_data = g_new(PurpleDnsQueryData, 1);
+	query_data = g_new0(PurpleDnsQueryData, 1);
 	query_data->hostname = g_strdup(hostname);
 	g_strstrip(query_data->hostname);
 	query_data->port = port;
@@ -618,10 +749,7 @@ purple_dnsquery_a(const char *hostname, int port,
 		g_return_val_if_reached(NULL);
 	}
 
-	queued_requests = g_slist_append(queued_requests, query_data);
-
-	purple_debug_info("dns", "DNS query for '%s' queued\n", query_data->hostname);
-
+	/* Don't call the callback before returning */
 	query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
 
 	return query_data;
@@ -727,6 +855,10 @@ resolve_host(gpointer data)
 	query_data = data;
 	query_data->timeout = 0;
 
+	if (purple_dnsquery_lookup(query_data))
+		/* The in-process resolver is handling it */
+		return FALSE;
+
 	if (purple_dnsquery_ui_resolve(query_data))
 	{
 		/* The UI is handling the resolve; we're done */
@@ -779,7 +911,7 @@ purple_dnsquery_a(const char *hostname, int port,
 
 	purple_debug_info("dnsquery", "Performing DNS lookup for %s\n", hostname);
 
-	query_data = g_new(PurpleDnsQueryData, 1);
+	query_data = g_new0(PurpleDnsQueryData, 1);
 	query_data->hostname = g_strdup(hostname);
 	g_strstrip(query_data->hostname);
 	query_data->port = port;
@@ -817,6 +949,10 @@ resolve_host(gpointer data)
 	query_data = data;
 	query_data->timeout = 0;
 
+	if (purple_dnsquery_lookup(query_data))
+		/* The in-process resolver is handling it */
+		return FALSE;
+
 	if (purple_dnsquery_ui_resolve(query_data))
 	{
 		/* The UI is handling the resolve; we're done */
@@ -857,7 +993,7 @@ purple_dnsquery_a(const char *hostname, int port,
 	g_return_val_if_fail(port	  != 0, NULL);
 	g_return_val_if_fail(callback != NULL, NULL);
 
-	query_data = g_new(PurpleDnsQueryData, 1);
+	query_data = g_new0(PurpleDnsQueryData, 1);
 	query_data->hostname = g_strdup(hostname);
 	g_strstrip(query_data->hostname);
 	query_data->port = port;
@@ -882,10 +1018,20 @@ void
 purple_dnsquery_destroy(PurpleDnsQueryData *query_data)
 {
 	PurpleDnsQueryUiOps *ops = purple_dnsquery_get_ui_ops();
+	int i;
 
 	if (ops && ops->destroy)
 		ops->destroy(query_data);
 
+	for (i = 0; i < 2; i++)
+	{
+		if (query_data->lookups[i] != NULL)
+			purple_dnsresolver_cancel(query_data->lookups[i]);
+		query_data->lookups[i] = NULL;
+		purple_dnsquery_free_hosts(query_data->lookup_hosts[i]);
+		query_data->lookup_hosts[i] = NULL;
+	}
+
 #if defined(__unix__) || defined(__APPLE__)
 	queued_requests = g_slist_remove(queued_requests, query_data);
 
@@ -0,0 +1,1068 @@
+/**
+ * @file dnsresolver.c In-process DNS resolver API
+ * @ingroup core
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "internal.h"
+
+#ifndef _WIN32
+#include <resolv.h>
+#endif
+
+#include "debug.h"
+#include "dnsresolver.h"
+#include "eventloop.h"
+#include "network.h"
+#include "signals.h"
+
+/*
+ * Queries go out over UDP from the main loop, one socket per lookup,
+ * so that any number of them can be in flight without blocking.  The
+ * resolver only speaks to recursive nameservers, and anything it can't
+ * make sense of is reported as PURPLE_DNS_RESOLVER_ERROR so that the
+ * caller can fall back to the system's resolver.
+ */
+
+#define DNS_PORT             53
+#define DNS_MAX_SERVERS      3
+#define DNS_ATTEMPTS         3
+#define DNS_RETRY_TIMEOUT    2000   /* Milliseconds */
+#define DNS_MAX_TTL          86400  /* Seconds */
+#define DNS_MAX_NEGATIVE_TTL 3600   /* Seconds */
+#define DNS_MAX_CNAMES       8
+#define DNS_CACHE_SIZE       256
+#define DNS_PACKET_SIZE      512
+#define DNS_HEADER_SIZE      12
+#define DNS_NAME_SIZE        256
+
+#define DNS_FLAG_QR          0x8000
+#define DNS_FLAG_TC          0x0200
+#define DNS_FLAG_RD          0x0100
+#define DNS_RCODE_MASK       0x000f
+#define DNS_RCODE_NOERROR    0
+#define DNS_RCODE_NXDOMAIN   3
+#define DNS_CLASS_IN         1
+
+#define DNS_GET16(p) ((guint16)(((p)[0] << 8) | (p)[1]))
+#define DNS_GET32(p) ((guint32)(((p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3]))
+
+typedef struct
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} addr;
+	socklen_t addrlen;
+} PurpleDnsServer;
+
+/*
+ * The query on the wire for a name and type, shared by everyone
+ * asking for it at the same time.
+ */
+typedef struct
+{
+	char *key;
+	char *name;
+	PurpleDnsRRType type;
+	GSList *queries;
+	gboolean finishing;
+
+	int fd;
+	guint inpa;
+	guint timeout;
+	guint16 id;
+	int attempt;
+} PurpleDnsLookup;
+
+struct _PurpleDnsResolverQuery
+{
+	char *key;
+	char *name;
+	PurpleDnsRRType type;
+	PurpleDnsResolverCallback callback;
+	gpointer data;
+
+	guint timeout;
+	PurpleDnsLookup *lookup;
+};
+
+typedef struct
+{
+	PurpleDnsResolverResult result;
+	GSList *records;
+	time_t expires;
+} PurpleDnsCacheEntry;
+
+/* A resource record as found in a response */
+typedef struct
+{
+	char name[DNS_NAME_SIZE];
+	guint16 type;
+	guint32 ttl;
+	int rdata;
+	guint16 rdlen;
+} PurpleDnsAnswer;
+
+static PurpleDnsServer servers[DNS_MAX_SERVERS];
+static int server_count = 0;
+static gboolean server_override = FALSE;
+
+/* Key is "type name", value is a PurpleDnsLookup */
+static GHashTable *lookups = NULL;
+/* Key is "type name", value is a PurpleDnsCacheEntry */
+static GHashTable *cache = NULL;
+/* Names from the hosts file, which are left to the system */
+static GHashTable *hosts = NULL;
+
+static gboolean
+dns_remove_all(gpointer key, gpointer value, gpointer data)
+{
+	return TRUE;
+}
+
+static char *
+dns_normalize(const char *name)
+{
+	char *ret = g_ascii_strdown(name, -1);
+	size_t len;
+
+	g_strstrip(ret);
+	len = strlen(ret);
+	if (len > 0 && ret[len - 1] == '.')
+		ret[len - 1] = '\0';
+
+	return ret;
+}
+
+static void
+dns_record_free(PurpleDnsRecord *record)
+{
+	g_free(record->target);
+	g_free(record);
+}
+
+static void
+dns_records_free(GSList *records)
+{
+	while (records != NULL)
+	{
+		dns_record_free(records->data);
+		records = g_slist_delete_link(records, records);
+	}
+}
+
+static GSList *
+dns_records_copy(GSList *records)
+{
+	GSList *ret = NULL;
+
+	for (; records != NULL; records = records->next)
+	{
+		PurpleDnsRecord *record = g_memdup(records->data, sizeof(PurpleDnsRecord));
+		record->target = g_strdup(record->target);
+		ret = g_slist_prepend(ret, record);
+	}
+
+	return g_slist_reverse(ret);
+}
+
+/**************************************************************************
+ * Cache
+ **************************************************************************/
+
+static void
+dns_cache_entry_free(PurpleDnsCacheEntry *entry)
+{
+	dns_records_free(entry->records);
+	g_free(entry);
+}
+
+static gboolean
+dns_cache_entry_expired(gpointer key, gpointer value, gpointer now)
+{
+	PurpleDnsCacheEntry *entry = value;
+
+	return entry->expires <= *(time_t *)now;
+}
+
+static PurpleDnsCacheEntry *
+dns_cache_lookup(const char *key)
+{
+	PurpleDnsCacheEntry *entry = g_hash_table_lookup(cache, key);
+
+	if (entry != NULL && entry->expires <= time(NULL))
+	{
+		g_hash_table_remove(cache, key);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static void
+dns_cache_store(const char *key, PurpleDnsResolverResult result,
+		GSList *records, guint32 ttl)
+{
+	PurpleDnsCacheEntry *entry;
+	time_t now;
+
+	/* A TTL of zero means "use once" */
+	if (ttl == 0)
+		return;
+
+	if (result == PURPLE_DNS_RESOLVER_OK)
+		ttl = MIN(ttl, DNS_MAX_TTL);
+	else
+		ttl = MIN(ttl, DNS_MAX_NEGATIVE_TTL);
+
+	now = time(NULL);
+	if (g_hash_table_size(cache) >= DNS_CACHE_SIZE)
+	{
+		g_hash_table_foreach_remove(cache, dns_cache_entry_expired, &now);
+		if (g_hash_table_size(cache) >= DNS_CACHE_SIZE)
+			purple_dnsresolver_clear_cache();
+	}
+
+	entry = g_new0(PurpleDnsCacheEntry, 1);
+	entry->result = result;
+	entry->records = dns_records_copy(records);
+	entry->expires = now + ttl;
+	g_hash_table_replace(cache, g_strdup(key), entry);
+}
+
+/**************************************************************************
+ * Packets
+ **************************************************************************/
+
+static int
+dns_build_query(guchar *buf, guint16 id, const char *name, PurpleDnsRRType type)
+{
+	guchar *p = buf + DNS_HEADER_SIZE;
+
+	memset(buf, 0, DNS_HEADER_SIZE);
+	buf[0] = id >> 8;
+	buf[1] = id & 0xff;
+	buf[2] = DNS_FLAG_RD >> 8;
+	buf[5] = 1; /* One question */
+
+	while (*name != '\0')
+	{
+		const char *dot = strchr(name, '.');
+		size_t len = (dot != NULL) ? (size_t)(dot - name) : strlen(name);
+
+		if (len == 0 || len > 63 || (p - buf) + len + 6 > DNS_PACKET_SIZE)
+			return -1;
+
+		*p++ = len;
+		memcpy(p, name, len);
+		p += len;
+		name += len;
+		if (*name == '.')
+			name++;
+	}
+
+	*p++ = 0;
+	*p++ = type >> 8;
+	*p++ = type & 0xff;
+	*p++ = 0;
+	*p++ = DNS_CLASS_IN;
+
+	return p - buf;
+}
+
+/**
+ * Reads a possibly compressed name at pos.
+ *
+ * @return The position after the name, or -1 if it's malformed.
+ */
+static int
+dns_read_name(const guchar *buf, int len, int pos, char *name, size_t size)
+{
+	int end = -1, jumps = 0;
+	size_t n = 0;
+
+	while (TRUE)
+	{
+		guint c;
+
+		if (pos >= len)
+			return -1;
+
+		c = buf[pos];
+		if ((c & 0xc0) == 0xc0)
+		{
+			if (pos + 1 >= len || ++jumps > 16)
+				return -1;
+			if (end < 0)
+				end = pos + 2;
+			pos = ((c & 0x3f) << 8) | buf[pos + 1];
+			continue;
+		}
+		if (c & 0xc0)
+			return -1;
+
+		pos++;
+		if (c == 0)
+			break;
+		if (pos + (int)c > len || n + c + 2 > size)
+			return -1;
+
+		if (n > 0)
+			name[n++] = '.';
+		memcpy(name + n, buf + pos, c);
+		n += c;
+		pos += c;
+	}
+
+	name[n] = '\0';
+	return (end < 0) ? pos : end;
+}
+
+/**
+ * Checks that buf answers the question lookup last sent.
+ *
+ * @return The position after the question, or -1 if it doesn't.
+ */
+static int
+dns_check_response(PurpleDnsLookup *lookup, const guchar *buf, int len)
+{
+	char name[DNS_NAME_SIZE];
+	int pos;
+
+	if (len < DNS_HEADER_SIZE)
+		return -1;
+	if (DNS_GET16(buf) != lookup->id || !(DNS_GET16(buf + 2) & DNS_FLAG_QR))
+		return -1;
+	if (DNS_GET16(buf + 4) != 1)
+		return -1;
+
+	pos = dns_read_name(buf, len, DNS_HEADER_SIZE, name, sizeof(name));
+	if (pos < 0 || pos + 4 > len)
+		return -1;
+	if (g_ascii_strcasecmp(name, lookup->name) != 0 ||
+			DNS_GET16(buf + pos) != lookup->type ||
+			DNS_GET16(buf + pos + 2) != DNS_CLASS_IN)
+		return -1;
+
+	return pos + 4;
+}
+
+static PurpleDnsRecord *
+dns_read_record(const guchar *buf, int len, PurpleDnsAnswer *answer)
+{
+	PurpleDnsRecord *record;
+	const guchar *rdata = buf + answer->rdata;
+	char target[DNS_NAME_SIZE];
+
+	record = g_new0(PurpleDnsRecord, 1);
+	record->type = answer->type;
+	record->ttl = answer->ttl;
+
+	switch (answer->type)
+	{
+		case PURPLE_DNS_RR_A:
+			if (answer->rdlen != 4)
+				break;
+			memcpy(record->addr, rdata, 4);
+			return record;
+
+		case PURPLE_DNS_RR_AAAA:
+			if (answer->rdlen != 16)
+				break;
+			memcpy(record->addr, rdata, 16);
+			return record;
+
+		case PURPLE_DNS_RR_SRV:
+			if (answer->rdlen < 7 || dns_read_name(buf, len,
+					answer->rdata + 6, target, sizeof(target)) < 0)
+				break;
+			record->priority = DNS_GET16(rdata);
+			record->weight = DNS_GET16(rdata + 2);
+			record->port = DNS_GET16(rdata + 4);
+			record->target = g_strdup(target);
+			return record;
+
+		default:
+			break;
+	}
+
+	dns_record_free(record);
+	return NULL;
+}
+
+/**
+ * Reads the records answering lookup from a response, following
+ * CNAMEs.  ttl is set to how long the outcome may be cached for.
+ */
+static PurpleDnsResolverResult
+dns_parse_response(PurpleDnsLookup *lookup, const guchar *buf, int len,
+		int pos, GSList **records, guint32 *ttl)
+{
+	PurpleDnsAnswer *answers;
+	guint16 flags = DNS_GET16(buf + 2);
+	int ancount = DNS_GET16(buf + 6);
+	int nscount = DNS_GET16(buf + 8);
+	int rcode = flags & DNS_RCODE_MASK;
+	int i, hops;
+	guint32 min_ttl = G_MAXUINT32, soa_ttl = 0;
+	gboolean have_soa = FALSE;
+	char current[DNS_NAME_SIZE];
+
+	*records = NULL;
+	*ttl = 0;
+
+	/* There's no TCP fallback; the system's resolver can do that */
+	if (flags & DNS_FLAG_TC)
+		return PURPLE_DNS_RESOLVER_ERROR;
+	if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)
+		return PURPLE_DNS_RESOLVER_ERROR;
+	/* Each record takes at least 11 bytes */
+	if ((ancount + nscount) * 11 > len)
+		return PURPLE_DNS_RESOLVER_ERROR;
+
+	answers = g_new0(PurpleDnsAnswer, MAX(ancount, 1));
+	for (i = 0; i < ancount + nscount; i++)
+	{
+		PurpleDnsAnswer tmp, *answer = (i < ancount) ? &answers[i] : &tmp;
+
+		pos = dns_read_name(buf, len, pos, answer->name, sizeof(answer->name));
+		if (pos < 0 || pos + 10 > len)
+			break;
+
+		answer->type = DNS_GET16(buf + pos);
+		answer->ttl = DNS_GET32(buf + pos + 4);
+		answer->rdlen = DNS_GET16(buf + pos + 8);
+		answer->rdata = pos + 10;
+		pos += 10 + answer->rdlen;
+		if (pos > len)
+			break;
+
+		/* Treat TTLs with the top bit set as zero, as RFC 2181 says */
+		if (answer->ttl > 0x7fffffff)
+			answer->ttl = 0;
+
+		/* The SOA in the authority section says how long a
+		 * negative answer may be cached for (RFC 2308) */
+		if (i >= ancount && answer->type == PURPLE_DNS_RR_SOA &&
+				answer->rdlen >= 20)
+		{
+			soa_ttl = MIN(answer->ttl,
+					DNS_GET32(buf + answer->rdata + answer->rdlen - 4));
+			have_soa = TRUE;
+		}
+	}
+
+	if (i < ancount + nscount)
+	{
+		purple_debug_warning("dnsresolver", "Malformed response for %s\n",
+				lookup->name);
+		g_free(answers);
+		return PURPLE_DNS_RESOLVER_ERROR;
+	}
+
+	g_strlcpy(current, lookup->name, sizeof(current));
+	for (hops = 0; hops <= DNS_MAX_CNAMES; hops++)
+	{
+		char cname[DNS_NAME_SIZE];
+		gboolean aliased = FALSE;
+
+		for (i = 0; i < ancount; i++)
+		{
+			PurpleDnsAnswer *answer = &answers[i];
+
+			if (g_ascii_strcasecmp(answer->name, current) != 0)
+				continue;
+
+			if (answer->type == lookup->type)
+			{
+				PurpleDnsRecord *record = dns_read_record(buf, len, answer);
+				if (record != NULL)
+				{
+					*records = g_slist_append(*records, record);
+					min_ttl = MIN(min_ttl, answer->ttl);
+				}
+			}
+			else if (answer->type == PURPLE_DNS_RR_CNAME && !aliased &&
+					dns_read_name(buf, len, answer->rdata, cname, sizeof(cname)) >= 0)
+			{
+				min_ttl = MIN(min_ttl, answer->ttl);
+				aliased = TRUE;
+			}
+		}
+
+		if (*records != NULL || !aliased)
+			break;
+		g_strlcpy(current, cname, sizeof(current));
+	}
+
+	g_free(answers);
+
+	if (*records != NULL)
+	{
+		*ttl = min_ttl;
+		return PURPLE_DNS_RESOLVER_OK;
+	}
+
+	/* Without an SOA we don't know how long this is true for */
+	if (have_soa)
+		*ttl = MIN(soa_ttl, min_ttl);
+
+	return PURPLE_DNS_RESOLVER_NOT_FOUND;
+}
+
+/**************************************************************************
+ * Lookups
+ **************************************************************************/
+
+static void
+dns_query_free(PurpleDnsResolverQuery *query)
+{
+	if (query->timeout > 0)
+		purple_timeout_remove(query->timeout);
+
+	g_free(query->key);
+	g_free(query->name);
+	g_free(query);
+}
+
+static void
+dns_lookup_close(PurpleDnsLookup *lookup)
+{
+	if (lookup->inpa > 0)
+	{
+		purple_input_remove(lookup->inpa);
+		lookup->inpa = 0;
+	}
+	if (lookup->timeout > 0)
+	{
+		purple_timeout_remove(lookup->timeout);
+		lookup->timeout = 0;
+	}
+	if (lookup->fd >= 0)
+	{
+		close(lookup->fd);
+		lookup->fd = -1;
+	}
+}
+
+static void
+dns_lookup_free(PurpleDnsLookup *lookup)
+{
+	dns_lookup_close(lookup);
+
+	while (lookup->queries != NULL)
+	{
+		dns_query_free(lookup->queries->data);
+		lookup->queries = g_slist_delete_link(lookup->queries, lookup->queries);
+	}
+
+	g_free(lookup->key);
+	g_free(lookup->name);
+	g_free(lookup);
+}
+
+static void
+dns_lookup_finish(PurpleDnsLookup *lookup, PurpleDnsResolverResult result,
+		GSList *records, guint32 ttl)
+{
+	purple_debug_info("dnsresolver", "Type %d record for %s %s\n",
+			lookup->type, lookup->name,
+			(result == PURPLE_DNS_RESOLVER_OK) ? "found" :
+			(result == PURPLE_DNS_RESOLVER_NOT_FOUND) ? "not found" : "failed");
+
+	g_hash_table_remove(lookups, lookup->key);
+	dns_lookup_close(lookup);
+
+	if (result != PURPLE_DNS_RESOLVER_ERROR)
+		dns_cache_store(lookup->key, result, records, ttl);
+
+	/*
+	 * A callback may cancel another query waiting on this lookup,
+	 * which mustn't take the lookup down with it.
+	 */
+	lookup->finishing = TRUE;
+	while (lookup->queries != NULL)
+	{
+		PurpleDnsResolverQuery *query = lookup->queries->data;
+
+		lookup->queries = g_slist_delete_link(lookup->queries, lookup->queries);
+		query->lookup = NULL;
+		query->callback(result, records, query->data);
+		dns_query_free(query);
+	}
+
+	dns_records_free(records);
+	dns_lookup_free(lookup);
+}
+
+static gboolean dns_lookup_send(PurpleDnsLookup *lookup);
+
+static void
+dns_lookup_retry(PurpleDnsLookup *lookup)
+{
+	if (!dns_lookup_send(lookup))
+		dns_lookup_finish(lookup, PURPLE_DNS_RESOLVER_ERROR, NULL, 0);
+}
+
+static gboolean
+dns_lookup_timeout_cb(gpointer data)
+{
+	PurpleDnsLookup *lookup = data;
+
+	lookup->timeout = 0;
+	purple_debug_info("dnsresolver", "Query for %s timed out\n", lookup->name);
+	dns_lookup_retry(lookup);
+
+	return FALSE;
+}
+
+static void
+dns_lookup_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleDnsLookup *lookup = data;
+	PurpleDnsResolverResult result;
+	guchar buf[DNS_PACKET_SIZE];
+	GSList *records;
+	guint32 ttl;
+	int len, pos;
+
+	len = recv(source, buf, sizeof(buf), 0);
+	if (len < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		/* Most likely nobody is listening on the other end */
+		purple_debug_info("dnsresolver", "Query for %s failed: %s\n",
+				lookup->name, g_strerror(errno));
+		dns_lookup_retry(lookup);
+		return;
+	}
+
+	pos = dns_check_response(lookup, buf, len);
+	if (pos < 0)
+		/* Not an answer to our question; keep waiting for one */
+		return;
+
+	result = dns_parse_response(lookup, buf, len, pos, &records, &ttl);
+	if (result == PURPLE_DNS_RESOLVER_ERROR)
+	{
+		/* Maybe another nameserver has a better idea */
+		dns_lookup_retry(lookup);
+		return;
+	}
+
+	dns_lookup_finish(lookup, result, records, ttl);
+}
+
+/**
+ * Sends the lookup's question to the next nameserver.
+ *
+ * @return FALSE once every attempt has been used up.
+ */
+static gboolean
+dns_lookup_send(PurpleDnsLookup *lookup)
+{
+	guchar buf[DNS_PACKET_SIZE];
+	int len;
+
+	dns_lookup_close(lookup);
+
+	while (lookup->attempt < DNS_ATTEMPTS && server_count > 0)
+	{
+		PurpleDnsServer *server = &servers[lookup->attempt % server_count];
+
+		lookup->attempt++;
+
+		/* A fresh socket and ID each time makes forged answers harder */
+		lookup->id = g_random_int_range(0, 0x10000);
+		len = dns_build_query(buf, lookup->id, lookup->name, lookup->type);
+		if (len < 0)
+			return FALSE;
+
+		lookup->fd = socket(server->addr.sa.sa_family, SOCK_DGRAM, 0);
+		if (lookup->fd < 0)
+			continue;
+		fcntl(lookup->fd, F_SETFL, O_NONBLOCK);
+
+		if (connect(lookup->fd, &server->addr.sa, server->addrlen) != 0 ||
+				send(lookup->fd, buf, len, 0) != len)
+		{
+			purple_debug_info("dnsresolver", "Unable to send query for %s: %s\n",
+					lookup->name, g_strerror(errno));
+			dns_lookup_close(lookup);
+			continue;
+		}
+
+		lookup->inpa = purple_input_add(lookup->fd, PURPLE_INPUT_READ,
+				dns_lookup_read_cb, lookup);
+		lookup->timeout = purple_timeout_add(DNS_RETRY_TIMEOUT,
+				dns_lookup_timeout_cb, lookup);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+dns_query_start(PurpleDnsResolverQuery *query)
+{
+	PurpleDnsLookup *lookup = g_hash_table_lookup(lookups, query->key);
+
+	if (lookup != NULL)
+	{
+		/* Someone already asked; wait for the same answer */
+		lookup->queries = g_slist_append(lookup->queries, query);
+		query->lookup = lookup;
+		return;
+	}
+
+	lookup = g_new0(PurpleDnsLookup, 1);
+	lookup->key = g_strdup(query->key);
+	lookup->name = g_strdup(query->name);
+	lookup->type = query->type;
+	lookup->fd = -1;
+	lookup->queries = g_slist_append(NULL, query);
+	query->lookup = lookup;
+	g_hash_table_insert(lookups, lookup->key, lookup);
+
+	dns_lookup_retry(lookup);
+}
+
+static gboolean
+dns_query_cb(gpointer data)
+{
+	PurpleDnsResolverQuery *query = data;
+	PurpleDnsCacheEntry *entry;
+	GSList *records;
+
+	query->timeout = 0;
+
+	if (lookups == NULL)
+	{
+		/* We've been uninitialized in the meantime */
+		dns_query_free(query);
+		return FALSE;
+	}
+
+	entry = dns_cache_lookup(query->key);
+	if (entry == NULL)
+	{
+		dns_query_start(query);
+		return FALSE;
+	}
+
+	purple_debug_info("dnsresolver", "Type %d record for %s cached\n",
+			query->type, query->name);
+
+	/* The callback could clear the cache from under us */
+	records = dns_records_copy(entry->records);
+	query->callback(entry->result, records, query->data);
+	dns_records_free(records);
+	dns_query_free(query);
+
+	return FALSE;
+}
+
+PurpleDnsResolverQuery *
+purple_dnsresolver_query(const char *name, PurpleDnsRRType type,
+		PurpleDnsResolverCallback callback, gpointer data)
+{
+	PurpleDnsResolverQuery *query;
+
+	g_return_val_if_fail(name != NULL, NULL);
+	g_return_val_if_fail(callback != NULL, NULL);
+	g_return_val_if_fail(lookups != NULL, NULL);
+
+	query = g_new0(PurpleDnsResolverQuery, 1);
+	query->name = dns_normalize(name);
+	query->type = type;
+	query->key = g_strdup_printf("%d %s", type, query->name);
+	query->callback = callback;
+	query->data = data;
+
+	/* Don't call the callback before returning */
+	query->timeout = purple_timeout_add(0, dns_query_cb, query);
+
+	return query;
+}
+
+void
+purple_dnsresolver_cancel(PurpleDnsResolverQuery *query)
+{
+	PurpleDnsLookup *lookup;
+
+	g_return_if_fail(query != NULL);
+
+	lookup = query->lookup;
+	if (lookup != NULL)
+	{
+		lookup->queries = g_slist_remove(lookup->queries, query);
+		if (lookup->queries == NULL && !lookup->finishing)
+		{
+			/* Nobody wants the answer anymore */
+			g_hash_table_remove(lookups, lookup->key);
+			dns_lookup_free(lookup);
+		}
+	}
+
+	dns_query_free(query);
+}
+
+/**************************************************************************
+ * Configuration
+ **************************************************************************/
+
+static gboolean
+dns_server_set(PurpleDnsServer *server, const char *ip, int port)
+{
+	memset(server, 0, sizeof(PurpleDnsServer));
+
+	if (inet_aton(ip, &server->addr.sin.sin_addr))
+	{
+		server->addr.sin.sin_family = AF_INET;
+		server->addr.sin.sin_port = htons(port);
+		server->addrlen = sizeof(struct sockaddr_in);
+		return TRUE;
+	}
+#ifndef _WIN32
+	if (inet_pton(AF_INET6, ip, &server->addr.sin6.sin6_addr) > 0)
+	{
+		server->addr.sin6.sin6_family = AF_INET6;
+		server->addr.sin6.sin6_port = htons(port);
+		server->addrlen = sizeof(struct sockaddr_in6);
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+#ifndef _WIN32
+static void
+dns_load_resolv_conf(void)
+{
+	char line[256];
+	FILE *file;
+
+	if ((file = g_fopen("/etc/resolv.conf", "r")) == NULL)
+		return;
+
+	while (server_count < DNS_MAX_SERVERS && fgets(line, sizeof(line), file))
+	{
+		char **tokens = g_strsplit_set(g_strstrip(line), " \t", 3);
+
+		if (tokens[0] != NULL && tokens[1] != NULL &&
+				!strcmp(tokens[0], "nameserver") &&
+				dns_server_set(&servers[server_count], tokens[1], DNS_PORT))
+			server_count++;
+
+		g_strfreev(tokens);
+	}
+
+	fclose(file);
+}
+
+/*
+ * Where there's no /etc/resolv.conf to read, as on the iPhone, ask the
+ * system's resolver library which nameservers it is using.
+ */
+static void
+dns_load_res_state(void)
+{
+	struct __res_state state;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	if (res_ninit(&state) != 0)
+		return;
+
+	for (i = 0; i < state.nscount && server_count < DNS_MAX_SERVERS; i++)
+	{
+		struct sockaddr_in *addr = &state.nsaddr_list[i];
+
+		if (addr->sin_family == AF_INET &&
+				dns_server_set(&servers[server_count], inet_ntoa(addr->sin_addr),
+					addr->sin_port ? ntohs(addr->sin_port) : DNS_PORT))
+			server_count++;
+	}
+
+#ifdef __APPLE__
+	res_ndestroy(&state);
+#else
+	res_nclose(&state);
+#endif
+}
+
+static void
+dns_load_hosts(void)
+{
+	char line[1024];
+	FILE *file;
+
+	if ((file = g_fopen("/etc/hosts", "r")) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), file))
+	{
+		char *comment = strchr(line, '#');
+		char **tokens;
+		int i;
+
+		if (comment != NULL)
+			*comment = '\0';
+
+		/* The first field is the address, the rest are names for it */
+		tokens = g_strsplit_set(g_strstrip(line), " \t", -1);
+		for (i = 1; tokens[0] != NULL && tokens[i] != NULL; i++)
+			if (*tokens[i] != '\0')
+				g_hash_table_replace(hosts, dns_normalize(tokens[i]), GINT_TO_POINTER(TRUE));
+		g_strfreev(tokens);
+	}
+
+	fclose(file);
+}
+#endif
+
+static void
+dns_load_config(void)
+{
+	g_hash_table_foreach_remove(hosts, dns_remove_all, NULL);
+
+	if (!server_override)
+		server_count = 0;
+
+#ifndef _WIN32
+	if (!server_override)
+		dns_load_resolv_conf();
+	if (!server_override && server_count == 0)
+		dns_load_res_state();
+	dns_load_hosts();
+#endif
+
+	purple_debug_info("dnsresolver", "Using %d nameservers\n", server_count);
+}
+
+static void
+network_changed_cb(void *data)
+{
+	purple_dnsresolver_clear_cache();
+	dns_load_config();
+}
+
+gboolean
+purple_dnsresolver_can_resolve(const char *name)
+{
+	struct in_addr addr;
+	gboolean ret = TRUE;
+	char *normalized;
+
+	g_return_val_if_fail(name != NULL, FALSE);
+
+	if (server_count == 0 || hosts == NULL)
+		return FALSE;
+
+	normalized = dns_normalize(name);
+
+	if (strlen(normalized) > 253 || strchr(normalized, '.') == NULL)
+		ret = FALSE;
+	else if (strchr(normalized, ':') != NULL || inet_aton(normalized, &addr))
+		ret = FALSE;
+	else if (g_str_has_suffix(normalized, ".local"))
+		ret = FALSE;
+	else if (g_hash_table_lookup(hosts, normalized) != NULL)
+		ret = FALSE;
+
+	g_free(normalized);
+
+	return ret;
+}
+
+void
+purple_dnsresolver_set_nameserver(const char *ip, int port)
+{
+	if (ip == NULL)
+	{
+		server_override = FALSE;
+	}
+	else if (dns_server_set(&servers[0], ip, port))
+	{
+		server_override = TRUE;
+		server_count = 1;
+	}
+	else
+	{
+		purple_debug_error("dnsresolver", "Invalid nameserver %s\n", ip);
+		return;
+	}
+
+	purple_dnsresolver_clear_cache();
+	if (hosts != NULL)
+		dns_load_config();
+}
+
+void
+purple_dnsresolver_clear_cache(void)
+{
+	if (cache != NULL)
+		g_hash_table_foreach_remove(cache, dns_remove_all, NULL);
+}
+
+static int handle;
+
+void
+purple_dnsresolver_init(void)
+{
+	lookups = g_hash_table_new(g_str_hash, g_str_equal);
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)dns_cache_entry_free);
+	hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	dns_load_config();
+
+	purple_signal_connect(purple_network_get_handle(), "network-configuration-changed",
+			&handle, PURPLE_CALLBACK(network_changed_cb), NULL);
+}
+
+static gboolean
+dns_lookup_remove(gpointer key, gpointer value, gpointer data)
+{
+	dns_lookup_free(value);
+	return TRUE;
+}
+
+void
+purple_dnsresolver_uninit(void)
+{
+	purple_signals_disconnect_by_handle(&handle);
+
+	g_hash_table_foreach_remove(lookups, dns_lookup_remove, NULL);
+	g_hash_table_destroy(lookups);
+	lookups = NULL;
+
+	g_hash_table_destroy(cache);
+	cache = NULL;
+	g_hash_table_destroy(hosts);
+	hosts = NULL;
+}
@@ -40,6 +40,7 @@
 #endif
 #endif
 
+#include "dnsresolver.h"
 #include "dnssrv.h"
 #include "eventloop.h"
 #include "debug.h"
@@ -62,9 +63,10 @@ struct _PurpleSrvQueryData {
 	PurpleSrvCallback cb;
 	gpointer extradata;
 	guint handle;
+	char *query;
+	PurpleDnsResolverQuery *lookup;
 #ifdef _WIN32
 	GThread *resolver;
-	char *query;
 	char *error_message;
 	GSList *results;
 #else
@@ -307,36 +309,30 @@ res_thread(gpointer data)
 
 #endif
 
-PurpleSrvQueryData *
-purple_srv_resolve(const char *protocol, const char *transport, const char *domain, PurpleSrvCallback cb, gpointer extradata)
+/**
+ * Starts the query in the system's resolver.
+ *
+ * @return FALSE if it couldn't be started, in which case the
+ *         callback has been called.
+ */
+static gboolean
+resolve_system(PurpleSrvQueryData *query_data)
 {
-	char *query;
-	PurpleSrvQueryData *query_data;
 #ifndef _WIN32
 	int in[2], out[2];
 	int pid;
-#else
-	GError* err = NULL;
-	static gboolean initialized = FALSE;
-#endif
-
-	query = g_strdup_printf("_%s._%s.%s", protocol, transport, domain);
-	purple_debug_info("dnssrv","querying SRV record for %s\n", query);
 
-#ifndef _WIN32
 	if(pipe(in) || pipe(out)) {
 		purple_debug_error("dnssrv", "Could not create pipe\n");
-		g_free(query);
-		cb(NULL, 0, extradata);
-		return NULL;
+		query_data->cb(NULL, 0, query_data->extradata);
+		return FALSE;
 	}
 
 	pid = fork();
 	if (pid == -1) {
 		purple_debug_error("dnssrv", "Could not create process!\n");
-		cb(NULL, 0, extradata);
-		g_free(query);
-		return NULL;
+		query_data->cb(NULL, 0, query_data->extradata);
+		return FALSE;
 	}
 
 	/* Child */
@@ -350,19 +346,17 @@ purple_srv_resolve(const char *protocol, const char *transport, const char *doma
 	close(out[1]);
 	close(in[0]);
 
-	if (write(in[1], query, strlen(query)+1) < 0)
+	if (write(in[1], query_data->query, strlen(query_data->query)+1) < 0)
 		purple_debug_error("dnssrv", "Could not write to SRV resolver\n");
 
-	query_data = g_new0(PurpleSrvQueryData, 1);
-	query_data->cb = cb;
-	query_data->extradata = extradata;
 	query_data->pid = pid;
 	query_data->handle = purple_input_add(out[0], PURPLE_INPUT_READ, resolved, query_data);
 
-	g_free(query);
-
-	return query_data;
+	return TRUE;
 #else
+	GError* err = NULL;
+	static gboolean initialized = FALSE;
+
 	if (!initialized) {
 		MyDnsQuery_UTF8 = (void*) wpurple_find_and_loadproc("dnsapi.dll", "DnsQuery_UTF8");
 		MyDnsRecordListFree = (void*) wpurple_find_and_loadproc(
@@ -370,11 +364,6 @@ purple_srv_resolve(const char *protocol, const char *transport, const char *doma
 		initialized = TRUE;
 	}
 
-	query_data = g_new0(PurpleSrvQueryData, 1);
-	query_data->cb = cb;
-	query_data->query = query;
-	query_data->extradata = extradata;
-
 	if (!MyDnsQuery_UTF8 || !MyDnsRecordListFree)
 		query_data->error_message = g_strdup("System missing DNS API (Requires W2K+)\n");
 	else {
@@ -391,15 +380,82 @@ purple_srv_resolve(const char *protocol, const char *transport, const char *doma
 	if (query_data->error_message != NULL)
 		query_data->handle = g_idle_add(res_main_thread_cb, query_data);
 
-	return query_data;
+	return TRUE;
 #endif
 }
 
+static void
+lookup_cb(PurpleDnsResolverResult result, GSList *records, gpointer data)
+{
+	PurpleSrvQueryData *query_data = data;
+	PurpleSrvResponse *res = NULL, *tmp;
+	int size;
+
+	query_data->lookup = NULL;
+
+	if (result == PURPLE_DNS_RESOLVER_ERROR) {
+		/* Let the system's resolver have a go at it */
+		if (!resolve_system(query_data))
+			purple_srv_cancel(query_data);
+		return;
+	}
+
+	size = g_slist_length(records);
+	purple_debug_info("dnssrv","found %d SRV entries\n", size);
+
+	if (size > 0) {
+		tmp = res = g_new0(PurpleSrvResponse, size);
+		for (; records != NULL; records = records->next) {
+			PurpleDnsRecord *record = records->data;
+
+			g_strlcpy(tmp->hostname, record->target, sizeof(tmp->hostname));
+			tmp->pref = record->priority;
+			tmp->weight = record->weight;
+			tmp->port = record->port;
+			tmp++;
+		}
+		qsort(res, size, sizeof(PurpleSrvResponse), responsecompare);
+	}
+
+	query_data->cb(res, size, query_data->extradata);
+
+	purple_srv_cancel(query_data);
+}
+
+PurpleSrvQueryData *
+purple_srv_resolve(const char *protocol, const char *transport, const char *domain, PurpleSrvCallback cb, gpointer extradata)
+{
+	PurpleSrvQueryData *query_data;
+
+	query_data = g_new0(PurpleSrvQueryData, 1);
+	query_data->cb = cb;
+	query_data->extradata = extradata;
+	query_data->query = g_strdup_printf("_%s._%s.%s", protocol, transport, domain);
+	purple_debug_info("dnssrv","querying SRV record for %s\n", query_data->query);
+
+	/* The in-process resolver caches answers, and falls back to the
+	 * system's resolver itself if it has no luck */
+	if (purple_dnsresolver_can_resolve(query_data->query)) {
+		query_data->lookup = purple_dnsresolver_query(query_data->query,
+				PURPLE_DNS_RR_SRV, lookup_cb, query_data);
+		return query_data;
+	}
+
+	if (!resolve_system(query_data)) {
+		purple_srv_cancel(query_data);
+		return NULL;
+	}
+
+	return query_data;
+}
+
 void
 purple_srv_cancel(PurpleSrvQueryData *query_data)
 {
 	if (query_data->handle > 0)
 		purple_input_remove(query_data->handle);
+	if (query_data->lookup != NULL)
+		purple_dnsresolver_cancel(query_data->lookup);
 #ifdef _WIN32
 	if (query_data->resolver != NULL)
 	{
@@ -411,8 +467,8 @@ purple_srv_cancel(PurpleSrvQueryData *query_data)
 		query_data->cb = NULL;
 		return;
 	}
-	g_free(query_data->query);
 	g_free(query_data->error_message);
 #endif
+	g_free(query_data->query);
 	g_free(query_data);
 }
@@ -24,6 +24,7 @@
  */
 #include "internal.h"
 #include "dbus-maybe.h"
+#include "debug.h"
 #include "ft.h"
 #include "network.h"
 #include "notify.h"
@@ -32,11 +33,70 @@
 #include "request.h"
 #include "util.h"
 
+#if defined(__linux__)
+# include <sys/sendfile.h>
+# define FT_USE_SENDFILE
+# define FT_USE_FALLOCATE
+#elif defined(__APPLE__)
+# include <sys/uio.h>
+# define FT_USE_SENDFILE
+#endif
+
 #define FT_INITIAL_BUFFER_SIZE 4096
 #define FT_MAX_BUFFER_SIZE     65535
 
+/* How much of an outgoing file is read ahead at a time */
+#define FT_RING_SIZE           (4 * (FT_MAX_BUFFER_SIZE + 1))
+
+/*
+ * Incoming data is collected into a chunk this size, and written out
+ * from the main loop in one go once it is full.
+ */
+#define FT_CHUNK_SIZE          FT_RING_SIZE
+
+/* How often the UI hears about progress, in ms */
+#define FT_PROGRESS_INTERVAL   250
+
+typedef struct
+{
+	guchar *data;
+	gsize len;
+} PurpleXferChunk;
+
+typedef struct
+{
+	/*
+	 * Outgoing data which has been read from the file but not yet
+	 * written, for prpls which have to frame it themselves.
+	 */
+	guchar *ring;
+	gsize ring_head;
+	gsize ring_used;
+
+	/* The file or socket can't be used with sendfile() */
+	gboolean no_sendfile;
+
+	/*
+	 * Incoming data which hasn't been written to the file yet.  The
+	 * same chunk is reused for the whole transfer.
+	 */
+	PurpleXferChunk *chunk;
+	gboolean preallocated;
+	int write_error;
+
+	/* Completed, but not announced until the data is in the file */
+	gboolean completed_pending;
+
+	/* Statistics */
+	GTimeVal started;
+	GTimeVal ended;
+	gdouble stall_time;
+	GTimeVal last_progress;
+} PurpleXferPrivate;
+
 static PurpleXferUiOps *xfer_ui_ops = NULL;
 static GList *xfers;
+static GHashTable *xfers_data = NULL;
 
 static int purple_xfer_choose_file(PurpleXfer *xfer);
 
@@ -67,6 +127,8 @@ purple_xfer_new(PurpleAccount *account, PurpleXferType type, const char *who)
 	xfer->message = NULL;
 	xfer->current_buffer_size = FT_INITIAL_BUFFER_SIZE;
 
+	g_hash_table_insert(xfers_data, xfer, g_new0(PurpleXferPrivate, 1));
+
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (ui_ops != NULL && ui_ops->new_xfer != NULL)
@@ -76,6 +138,119 @@ purple_xfer_new(PurpleAccount *account, PurpleXferType type, const char *who)
 	return xfer;
 }
 
+static void
+purple_xfer_private_free(PurpleXferPrivate *priv)
+{
+	g_free(priv->ring);
+	g_free(priv);
+}
+
+static void
+purple_xfer_chunk_free(PurpleXferChunk *chunk)
+{
+	g_free(chunk->data);
+	g_free(chunk);
+}
+
+static PurpleXferChunk *
+purple_xfer_chunk_new(void)
+{
+	PurpleXferChunk *chunk = g_new0(PurpleXferChunk, 1);
+
+	chunk->data = g_malloc(FT_CHUNK_SIZE);
+
+	return chunk;
+}
+
+static gdouble
+purple_xfer_elapsed(const GTimeVal *from, const GTimeVal *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/*
+ * Writes the chunk being filled out to the file.  Returns FALSE if
+ * writing to the file has failed.
+ */
+static gboolean
+purple_xfer_chunk_flush(PurpleXfer *xfer, PurpleXferPrivate *priv)
+{
+	PurpleXferChunk *chunk = priv->chunk;
+	GTimeVal before, after;
+
+	if (chunk == NULL || chunk->len == 0)
+		return !priv->write_error;
+
+	/* This is on the main loop, so nothing else is read until it returns */
+	g_get_current_time(&before);
+	if (!priv->write_error &&
+			fwrite(chunk->data, 1, chunk->len, xfer->dest_fp) != chunk->len)
+		priv->write_error = errno ? errno : EIO;
+	chunk->len = 0;
+	g_get_current_time(&after);
+	priv->stall_time += purple_xfer_elapsed(&before, &after);
+
+	return !priv->write_error;
+}
+
+/*
+ * Gets everything received so far into the file.  Returns FALSE if
+ * writing to the file has failed.
+ */
+static gboolean
+purple_xfer_file_flush(PurpleXfer *xfer, PurpleXferPrivate *priv)
+{
+	if (!purple_xfer_chunk_flush(xfer, priv))
+		return FALSE;
+
+	if (xfer->dest_fp != NULL && fflush(xfer->dest_fp) != 0)
+		priv->write_error = errno ? errno : EIO;
+
+	return !priv->write_error;
+}
+
+/*
+ * Lets go of everything which is only needed while the file is open.
+ * Returns FALSE if not all the data made it to the file.
+ */
+static gboolean
+purple_xfer_close_file(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = g_hash_table_lookup(xfers_data, xfer);
+	gboolean ok;
+
+	ok = purple_xfer_chunk_flush(xfer, priv);
+
+	if (priv->chunk != NULL) {
+		purple_xfer_chunk_free(priv->chunk);
+		priv->chunk = NULL;
+	}
+
+	if (xfer->dest_fp != NULL) {
+		if (purple_xfer_get_type(xfer) == PURPLE_XFER_RECEIVE &&
+				fflush(xfer->dest_fp) != 0)
+			ok = FALSE;
+
+		/* Don't leave the unreceived part of the file lying around */
+		if (priv->preallocated &&
+				purple_xfer_get_status(xfer) != PURPLE_XFER_STATUS_DONE)
+			ftruncate(fileno(xfer->dest_fp), ftell(xfer->dest_fp));
+
+		if (fclose(xfer->dest_fp) != 0)
+			ok = FALSE;
+		xfer->dest_fp = NULL;
+	}
+
+	g_free(priv->ring);
+	priv->ring = NULL;
+	priv->ring_head = priv->ring_used = 0;
+
+	if (priv->started.tv_sec != 0 && priv->ended.tv_sec == 0)
+		g_get_current_time(&priv->ended);
+
+	return ok;
+}
+
 static void
 purple_xfer_destroy(PurpleXfer *xfer)
 {
@@ -99,6 +274,8 @@ purple_xfer_destroy(PurpleXfer *xfer)
 	g_free(xfer->remote_ip);
 	g_free(xfer->local_filename);
 
+	g_hash_table_remove(xfers_data, xfer);
+
 	PURPLE_DBUS_UNREGISTER_POINTER(xfer);
 	g_free(xfer);
 	xfers = g_list_remove(xfers, xfer);
@@ -641,6 +818,42 @@ purple_xfer_get_progress(const PurpleXfer *xfer)
 			(double)purple_xfer_get_size(xfer));
 }
 
+double
+purple_xfer_get_throughput(const PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv;
+	GTimeVal now;
+	gdouble elapsed;
+
+	g_return_val_if_fail(xfer != NULL, 0.0);
+
+	priv = g_hash_table_lookup(xfers_data, xfer);
+	if (priv->started.tv_sec == 0)
+		return 0.0;
+
+	if (priv->ended.tv_sec != 0)
+		now = priv->ended;
+	else
+		g_get_current_time(&now);
+
+	elapsed = purple_xfer_elapsed(&priv->started, &now);
+	if (elapsed <= 0)
+		return 0.0;
+
+	return purple_xfer_get_bytes_sent(xfer) / elapsed;
+}
+
+double
+purple_xfer_get_stall_time(const PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv;
+
+	g_return_val_if_fail(xfer != NULL, 0.0);
+
+	priv = g_hash_table_lookup(xfers_data, xfer);
+	return priv->stall_time;
+}
+
 unsigned int
 purple_xfer_get_local_port(const PurpleXfer *xfer)
 {
@@ -665,16 +878,13 @@ purple_xfer_get_remote_port(const PurpleXfer *xfer)
 	return xfer->remote_port;
 }
 
-void
-purple_xfer_set_completed(PurpleXfer *xfer, gboolean completed)
+static void
+purple_xfer_announce_completed(PurpleXfer *xfer, gboolean completed)
 {
 	PurpleXferUiOps *ui_ops;
 
-	g_return_if_fail(xfer != NULL);
-
 	if (completed == TRUE) {
 		char *msg = NULL;
-		purple_xfer_set_status(xfer, PURPLE_XFER_STATUS_DONE);
 
 		if (purple_xfer_get_filename(xfer) != NULL)
 			msg = g_strdup_printf(_("Transfer of file %s complete"),
@@ -691,6 +901,29 @@ purple_xfer_set_completed(PurpleXfer *xfer, gboolean completed)
 		ui_ops->update_progress(xfer, purple_xfer_get_progress(xfer));
 }
 
+void
+purple_xfer_set_completed(PurpleXfer *xfer, gboolean completed)
+{
+	PurpleXferPrivate *priv;
+
+	g_return_if_fail(xfer != NULL);
+
+	if (completed == TRUE) {
+		purple_xfer_set_status(xfer, PURPLE_XFER_STATUS_DONE);
+
+		/* It isn't done until the last of it is in the file, which
+		 * purple_xfer_end() checks */
+		if (purple_xfer_get_type(xfer) == PURPLE_XFER_RECEIVE &&
+				xfer->dest_fp != NULL) {
+			priv = g_hash_table_lookup(xfers_data, xfer);
+			priv->completed_pending = TRUE;
+			return;
+		}
+	}
+
+	purple_xfer_announce_completed(xfer, completed);
+}
+
 void
 purple_xfer_set_message(PurpleXfer *xfer, const char *message)
 {
@@ -824,6 +1057,26 @@ purple_xfer_increase_buffer_size(PurpleXfer *xfer)
 			FT_MAX_BUFFER_SIZE);
 }
 
+/* Reads straight from xfer->fd, for prpls without a read function */
+static gssize
+purple_xfer_read_fd(PurpleXfer *xfer, guchar *buffer, gsize size)
+{
+	gssize r;
+
+	r = read(xfer->fd, buffer, size);
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	else if (r < 0)
+		r = -1;
+	else if ((purple_xfer_get_size(xfer) > 0) &&
+		((purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer)))
+		purple_xfer_set_completed(xfer, TRUE);
+	else if (r == 0)
+		r = -1;
+
+	return r;
+}
+
 gssize
 purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 {
@@ -841,17 +1094,7 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 		r = (xfer->ops.read)(buffer, xfer);
 	else {
 		*buffer = g_malloc0(s);
-
-		r = read(xfer->fd, *buffer, s);
-		if (r < 0 && errno == EAGAIN)
-			r = 0;
-		else if (r < 0)
-			r = -1;
-		else if ((purple_xfer_get_size(xfer) > 0) &&
-			((purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer)))
-			purple_xfer_set_completed(xfer, TRUE);
-		else if (r == 0)
-			r = -1;
+		r = purple_xfer_read_fd(xfer, *buffer, s);
 	}
 
 	if (r == xfer->current_buffer_size)
@@ -889,30 +1132,233 @@ purple_xfer_write(PurpleXfer *xfer, const guchar *buffer, gsize size)
 	return r;
 }
 
+#ifdef FT_USE_SENDFILE
+/*
+ * Hands the next part of the file straight to the kernel, which copies
+ * it to the socket without it ever passing through our memory.
+ */
+static gssize
+purple_xfer_sendfile(PurpleXfer *xfer, size_t size)
+{
+	gssize r;
+#if defined(__linux__)
+	off_t offset = xfer->bytes_sent;
+
+	r = sendfile(xfer->fd, fileno(xfer->dest_fp), &offset, size);
+#else
+	off_t len = size;
+
+	/* A partial send is reported as EAGAIN, with len set */
+	if (sendfile(fileno(xfer->dest_fp), xfer->fd, xfer->bytes_sent,
+				&len, NULL, 0) == 0 || (errno == EAGAIN && len > 0))
+		r = len;
+	else
+		r = -1;
+#endif
+
+	return r;
+}
+#endif
+
+/*
+ * Tops up the read-ahead ring from the file.  Returns how many bytes
+ * can be taken from the front of the ring in one piece.
+ */
+static gsize
+purple_xfer_ring_fill(PurpleXfer *xfer, PurpleXferPrivate *priv, gsize wanted)
+{
+	if (priv->ring == NULL)
+		priv->ring = g_malloc(FT_RING_SIZE);
+
+	while (priv->ring_used < wanted) {
+		gsize tail = (priv->ring_head + priv->ring_used) % FT_RING_SIZE;
+		gsize n = fread(priv->ring + tail, 1,
+				MIN(FT_RING_SIZE - tail, FT_RING_SIZE - priv->ring_used),
+				xfer->dest_fp);
+
+		if (n == 0)
+			break;
+
+		priv->ring_used += n;
+	}
+
+	return MIN(priv->ring_used, FT_RING_SIZE - priv->ring_head);
+}
+
+/*
+ * Sends the next part of the file.  Sets buffer to the data which was
+ * sent, or NULL if it never went through our memory.  Returns the
+ * number of bytes sent, -1 if the connection failed or -2 if the file
+ * couldn't be read.
+ */
+static gssize
+purple_xfer_send_chunk(PurpleXfer *xfer, const guchar **buffer)
+{
+	PurpleXferPrivate *priv = g_hash_table_lookup(xfers_data, xfer);
+	size_t s;
+	gssize r;
+
+	*buffer = NULL;
+
+#ifdef FT_USE_SENDFILE
+	if (xfer->ops.write == NULL && !priv->no_sendfile) {
+		s = MIN(purple_xfer_get_bytes_remaining(xfer), FT_RING_SIZE);
+		r = purple_xfer_sendfile(xfer, s);
+
+		if (r > 0) {
+			if ((purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer))
+				purple_xfer_set_completed(xfer, TRUE);
+			return r;
+		} else if (r == 0) {
+			/* The file is shorter than it was */
+			return -2;
+		} else if (errno == EAGAIN || errno == EINTR) {
+			return 0;
+		} else if (errno != EINVAL && errno != ENOSYS &&
+				errno != ENOTSOCK && errno != EOPNOTSUPP) {
+			return -1;
+		}
+
+		/* Copy it ourselves from here on */
+		purple_debug_info("ft", "sendfile() unavailable for %s, copying instead\n",
+				purple_xfer_get_local_filename(xfer));
+		priv->no_sendfile = TRUE;
+		fseek(xfer->dest_fp, xfer->bytes_sent, SEEK_SET);
+	}
+#endif
+
+	s = MIN(purple_xfer_get_bytes_remaining(xfer), xfer->current_buffer_size);
+	s = MIN(s, purple_xfer_ring_fill(xfer, priv, s));
+	if (s == 0)
+		return -2;
+
+	*buffer = priv->ring + priv->ring_head;
+
+	/* Write as much as we're allowed to. */
+	r = purple_xfer_write(xfer, *buffer, s);
+
+	if (r > 0) {
+		/* Whatever didn't fit stays in the ring for next time */
+		priv->ring_head = (priv->ring_head + r) % FT_RING_SIZE;
+		priv->ring_used -= r;
+	}
+
+	if (r == s)
+		/*
+		 * We managed to write the entire buffer.  This means our
+		 * network is fast and our buffer is too small, so make it
+		 * bigger.
+		 */
+		purple_xfer_increase_buffer_size(xfer);
+
+	return r;
+}
+
+/*
+ * Receives the next part of the file into the chunk being filled.
+ * Sets buffer to the data which was received, and received to
+ * anything the caller has to free.  Returns the number of bytes
+ * received, -1 if the connection failed or -2 if the file couldn't
+ * be written.
+ */
+static gssize
+purple_xfer_receive_chunk(PurpleXfer *xfer, const guchar **buffer,
+		guchar **received)
+{
+	PurpleXferPrivate *priv = g_hash_table_lookup(xfers_data, xfer);
+	PurpleXferChunk *chunk;
+	gssize r;
+
+	if (priv->chunk == NULL)
+		priv->chunk = purple_xfer_chunk_new();
+	chunk = priv->chunk;
+
+	if (xfer->ops.read != NULL) {
+		gssize copied = 0;
+
+		r = purple_xfer_read(xfer, received);
+		*buffer = *received;
+
+		while (copied < r) {
+			gsize n = MIN(r - copied, FT_CHUNK_SIZE - chunk->len);
+
+			memcpy(chunk->data + chunk->len, *received + copied, n);
+			chunk->len += n;
+			copied += n;
+
+			if (chunk->len == FT_CHUNK_SIZE &&
+					!purple_xfer_chunk_flush(xfer, priv))
+				return -2;
+		}
+	} else {
+		gsize s = FT_CHUNK_SIZE - chunk->len;
+
+		if (purple_xfer_get_size(xfer) > 0)
+			s = MIN(s, purple_xfer_get_bytes_remaining(xfer));
+
+		*buffer = chunk->data + chunk->len;
+		r = purple_xfer_read_fd(xfer, chunk->data + chunk->len, s);
+		if (r > 0)
+			chunk->len += r;
+	}
+
+	if (r < 0)
+		return r;
+
+	if (chunk->len == FT_CHUNK_SIZE &&
+			!purple_xfer_chunk_flush(xfer, priv))
+		return -2;
+
+	return r;
+}
+
+/* Returns TRUE if it's been long enough to tell the UI about progress */
+static gboolean
+purple_xfer_progress_due(PurpleXferPrivate *priv)
+{
+	GTimeVal now;
+	gdouble elapsed;
+
+	g_get_current_time(&now);
+	elapsed = purple_xfer_elapsed(&priv->last_progress, &now);
+
+	/* Also catches the clock going backwards */
+	if (elapsed >= 0 && elapsed < FT_PROGRESS_INTERVAL / 1000.0)
+		return FALSE;
+
+	priv->last_progress = now;
+	return TRUE;
+}
+
 static void
 transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 {
 	PurpleXferUiOps *ui_ops;
+	PurpleXferPrivate *priv;
 	PurpleXfer *xfer = (PurpleXfer *)data;
-	guchar *buffer = NULL;
+	guchar *received = NULL;
+	const guchar *buffer = NULL;
 	gssize r = 0;
 
 	if (condition & PURPLE_INPUT_READ) {
-		r = purple_xfer_read(xfer, &buffer);
-		if (r > 0) {
-			fwrite(buffer, 1, r, xfer->dest_fp);
-		} else if(r < 0) {
+		r = purple_xfer_receive_chunk(xfer, &buffer, &received);
+
+		if (r == -2) {
+			g_free(received);
+			purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+			purple_xfer_cancel_local(xfer);
+			return;
+		} else if (r < 0) {
+			g_free(received);
 			purple_xfer_cancel_remote(xfer);
 			return;
 		}
 	}
 
 	if (condition & PURPLE_INPUT_WRITE) {
-		size_t s = MIN(purple_xfer_get_bytes_remaining(xfer), xfer->current_buffer_size);
-
 		/* this is so the prpl can keep the connection open
 		   if it needs to for some odd reason. */
-		if (s == 0) {
+		if (purple_xfer_get_bytes_remaining(xfer) == 0) {
 			if (xfer->watcher) {
 				purple_input_remove(xfer->watcher);
 				xfer->watcher = 0;
@@ -920,27 +1366,15 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 			return;
 		}
 
-		buffer = g_malloc0(s);
-
-		fread(buffer, 1, s, xfer->dest_fp);
-
-		/* Write as much as we're allowed to. */
-		r = purple_xfer_write(xfer, buffer, s);
+		r = purple_xfer_send_chunk(xfer, &buffer);
 
 		if (r == -1) {
 			purple_xfer_cancel_remote(xfer);
-			g_free(buffer);
 			return;
-		} else if (r < s) {
-			/* We have to seek back in the file now. */
-			fseek(xfer->dest_fp, r - s, SEEK_CUR);
-		} else {
-			/*
-			 * We managed to write the entire buffer.  This means our
-			 * network is fast and our buffer is too small, so make it
-			 * bigger.
-			 */
-			purple_xfer_increase_buffer_size(xfer);
+		} else if (r == -2) {
+			purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+			purple_xfer_cancel_local(xfer);
+			return;
 		}
 	}
 
@@ -953,15 +1387,18 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 		if (xfer->ops.ack != NULL)
 			xfer->ops.ack(xfer, buffer, r);
 
-		g_free(buffer);
-
 		ui_ops = purple_xfer_get_ui_ops(xfer);
+		priv = g_hash_table_lookup(xfers_data, xfer);
 
-		if (ui_ops != NULL && ui_ops->update_progress != NULL)
+		/* A pending completion is announced by purple_xfer_end() */
+		if (ui_ops != NULL && ui_ops->update_progress != NULL &&
+				!priv->completed_pending && purple_xfer_progress_due(priv))
 			ui_ops->update_progress(xfer,
 				purple_xfer_get_progress(xfer));
 	}
 
+	g_free(received);
+
 	if (purple_xfer_is_completed(xfer))
 		purple_xfer_end(xfer);
 }
@@ -970,6 +1407,7 @@ static void
 begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 {
 	PurpleXferType type = purple_xfer_get_type(xfer);
+	PurpleXferPrivate *priv = g_hash_table_lookup(xfers_data, xfer);
 
 	xfer->dest_fp = g_fopen(purple_xfer_get_local_filename(xfer),
 						  type == PURPLE_XFER_RECEIVE ? "wb" : "rb");
@@ -982,10 +1420,26 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 
 	fseek(xfer->dest_fp, xfer->bytes_sent, SEEK_SET);
 
+#ifdef FT_USE_FALLOCATE
+	/* Find out now if it won't fit, and keep it in one piece */
+	if (type == PURPLE_XFER_RECEIVE && purple_xfer_get_size(xfer) > 0) {
+		int err = posix_fallocate(fileno(xfer->dest_fp), 0,
+				purple_xfer_get_size(xfer));
+
+		if (err == ENOSPC || err == EFBIG) {
+			purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+			purple_xfer_cancel_local(xfer);
+			return;
+		}
+		priv->preallocated = (err == 0);
+	}
+#endif
+
 	if (xfer->fd)
 		xfer->watcher = purple_input_add(xfer->fd, cond, transfer_cb, xfer);
 
 	xfer->start_time = time(NULL);
+	g_get_current_time(&priv->started);
 
 	if (xfer->ops.start != NULL)
 		xfer->ops.start(xfer);
@@ -1044,6 +1498,8 @@ purple_xfer_start(PurpleXfer *xfer, int fd, const char *ip,
 void
 purple_xfer_end(PurpleXfer *xfer)
 {
+	PurpleXferPrivate *priv;
+
 	g_return_if_fail(xfer != NULL);
 
 	/* See if we are actually trying to cancel this. */
@@ -1052,6 +1508,18 @@ purple_xfer_end(PurpleXfer *xfer)
 		return;
 	}
 
+	priv = g_hash_table_lookup(xfers_data, xfer);
+	if (priv->completed_pending) {
+		priv->completed_pending = FALSE;
+
+		if (!purple_xfer_file_flush(xfer, priv)) {
+			purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+			purple_xfer_cancel_local(xfer);
+			return;
+		}
+		purple_xfer_announce_completed(xfer, TRUE);
+	}
+
 	xfer->end_time = time(NULL);
 	if (xfer->ops.end != NULL)
 		xfer->ops.end(xfer);
@@ -1064,10 +1532,8 @@ purple_xfer_end(PurpleXfer *xfer)
 	if (xfer->fd != 0)
 		close(xfer->fd);
 
-	if (xfer->dest_fp != NULL) {
-		fclose(xfer->dest_fp);
-		xfer->dest_fp = NULL;
-	}
+	if (!purple_xfer_close_file(xfer))
+		purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
 
 	purple_xfer_unref(xfer);
 }
@@ -1127,10 +1593,7 @@ purple_xfer_cancel_local(PurpleXfer *xfer)
 	if (xfer->fd != 0)
 		close(xfer->fd);
 
-	if (xfer->dest_fp != NULL) {
-		fclose(xfer->dest_fp);
-		xfer->dest_fp = NULL;
-	}
+	purple_xfer_close_file(xfer);
 
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
@@ -1192,10 +1655,7 @@ purple_xfer_cancel_remote(PurpleXfer *xfer)
 	if (xfer->fd != 0)
 		close(xfer->fd);
 
-	if (xfer->dest_fp != NULL) {
-		fclose(xfer->dest_fp);
-		xfer->dest_fp = NULL;
-	}
+	purple_xfer_close_file(xfer);
 
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
@@ -1259,6 +1719,9 @@ void
 purple_xfers_init(void) {
 	void *handle = purple_xfers_get_handle();
 
+	xfers_data = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)purple_xfer_private_free);
+
 	/* register signals */
 	purple_signal_register(handle, "file-recv-accept",
 	                     purple_marshal_VOID__POINTER, NULL, 1,
@@ -1301,6 +1764,9 @@ purple_xfers_init(void) {
 void
 purple_xfers_uninit(void) {
 	purple_signals_disconnect_by_handle(purple_xfers_get_handle());
+
+	g_hash_table_destroy(xfers_data);
+	xfers_data = NULL;
 }
 
 void
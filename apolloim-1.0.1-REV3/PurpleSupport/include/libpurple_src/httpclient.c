@@ -0,0 +1,973 @@
+/**
+ * @file httpclient.c HTTP client API
+ * @ingroup core
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "internal.h"
+#include "circbuffer.h"
+#include "debug.h"
+#include "eventloop.h"
+#include "httpclient.h"
+#include "proxy.h"
+
+/*
+ * Each server (host and port) gets a small pool of connections.  A
+ * request goes to an idle connection if there is one, or a new one if
+ * the pool isn't full yet.  Failing that, GETs and HEADs are pipelined
+ * onto a connection which has already been kept alive once, and
+ * anything else waits its turn.  Responses are parsed as they arrive,
+ * so nothing is ever scanned twice.
+ */
+
+#define HTTP_MAX_CONNECTIONS 4       /* Per server */
+#define HTTP_MAX_PIPELINE    4       /* Requests in flight per connection */
+#define HTTP_IDLE_TIMEOUT    30      /* Seconds */
+#define HTTP_READ_SIZE       16384
+#define HTTP_MAX_HEADERS     65536
+#define HTTP_MAX_LINE        1024    /* Chunk sizes and trailers */
+#define HTTP_MAX_PREALLOC    (1024 * 1024)
+
+typedef enum
+{
+	HTTP_STATE_HEADERS,
+	HTTP_STATE_BODY,        /* Content-Length bytes of body */
+	HTTP_STATE_BODY_TO_EOF, /* Everything until the server closes */
+	HTTP_STATE_CHUNK_SIZE,
+	HTTP_STATE_CHUNK_DATA,
+	HTTP_STATE_CHUNK_END,   /* The CRLF after a chunk's data */
+	HTTP_STATE_TRAILER
+} PurpleHttpClientState;
+
+/* A buffer which doubles in size whenever it runs out of room */
+typedef struct
+{
+	char *data;
+	gsize len;
+	gsize size;
+} PurpleHttpClientBuffer;
+
+typedef struct
+{
+	char *key;
+	char *host;
+	int port;
+
+	GList *connections;
+	GQueue *pending;
+	guint dispatch_timeout;
+} PurpleHttpClientHost;
+
+typedef struct
+{
+	PurpleHttpClientHost *host;
+
+	PurpleProxyConnectData *connect_data;
+	int fd;
+	guint inpa;
+	guint write_inpa;
+	guint idle_timeout;
+	PurpleCircBuffer *outbuf;
+
+	/* Requests sent, or about to be, in the order they were sent */
+	GQueue *requests;
+	guint served;
+	gboolean keep_alive;
+	gboolean closing;
+
+	/* The response to the request at the head of the queue */
+	PurpleHttpClientBuffer in;
+	gsize scanned;
+	PurpleHttpClientState state;
+	int status;
+	char *headers;
+	gsize headers_len;
+	gboolean response_close;
+	gsize remaining;
+	PurpleHttpClientBuffer body;
+} PurpleHttpClientConn;
+
+struct _PurpleHttpClientRequest
+{
+	PurpleHttpClientHost *host;
+	PurpleHttpClientConn *conn;
+	gboolean finishing;
+
+	char *request;
+	gsize request_len;
+	gboolean pipelinable;
+	gboolean head;
+	gboolean close;
+	gboolean retried;
+
+	PurpleHttpClientCallback callback;
+	gpointer data;
+};
+
+static GHashTable *hosts = NULL;
+
+static void host_schedule_dispatch(PurpleHttpClientHost *host);
+
+/**************************************************************************
+ * Buffers and headers
+ **************************************************************************/
+
+static void
+buffer_reserve(PurpleHttpClientBuffer *buf, gsize len)
+{
+	gsize size = MAX(buf->size, 256);
+
+	/* Always leave room for a nul */
+	while (size - buf->len < len + 1)
+		size *= 2;
+
+	if (size != buf->size) {
+		buf->data = g_realloc(buf->data, size);
+		buf->size = size;
+	}
+}
+
+static void
+buffer_append(PurpleHttpClientBuffer *buf, const char *data, gsize len)
+{
+	buffer_reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+static void
+buffer_consume(PurpleHttpClientBuffer *buf, gsize len)
+{
+	if (len == 0)
+		return;
+
+	memmove(buf->data, buf->data + len, buf->len - len);
+	buf->len -= len;
+	buf->data[buf->len] = '\0';
+}
+
+static void
+buffer_free(PurpleHttpClientBuffer *buf)
+{
+	g_free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->size = 0;
+}
+
+/* Finds needle in data, which may hold nuls */
+static const char *
+http_find(const char *data, gsize len, const char *needle)
+{
+	gsize needle_len = strlen(needle);
+	const char *end = data + len;
+	const char *p = data;
+
+	while (end - p >= (gssize)needle_len &&
+			(p = memchr(p, needle[0], end - p - needle_len + 1)) != NULL) {
+		if (memcmp(p, needle, needle_len) == 0)
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Finds the value of a header, skipping the request or status line.
+ * The value runs to the end of its line.
+ */
+static const char *
+http_header_find(const char *headers, gsize len, const char *name)
+{
+	gsize name_len = strlen(name);
+	const char *end = headers + len;
+	const char *line = memchr(headers, '\n', len);
+
+	while (line != NULL && ++line < end) {
+		if ((gsize)(end - line) > name_len &&
+				g_ascii_strncasecmp(line, name, name_len) == 0 &&
+				line[name_len] == ':') {
+			const char *value = line + name_len + 1;
+
+			while (value < end && (*value == ' ' || *value == '\t'))
+				value++;
+			return value;
+		}
+
+		line = memchr(line, '\n', end - line);
+	}
+
+	return NULL;
+}
+
+/* Checks whether a header's comma separated value contains token */
+static gboolean
+http_header_has_token(const char *headers, gsize len, const char *name,
+		const char *token)
+{
+	const char *value = http_header_find(headers, len, name);
+	gsize token_len = strlen(token);
+	const char *end;
+
+	if (value == NULL)
+		return FALSE;
+
+	for (end = value; end < headers + len && *end != '\r' && *end != '\n'; end++);
+
+	for (; value + token_len <= end; value++)
+		if (g_ascii_strncasecmp(value, token, token_len) == 0)
+			return TRUE;
+
+	return FALSE;
+}
+
+/**************************************************************************
+ * Requests
+ **************************************************************************/
+
+static void
+request_free(PurpleHttpClientRequest *req)
+{
+	g_free(req->request);
+	g_free(req);
+}
+
+/* Hands a request its error, unless it has been canceled meanwhile */
+static void
+request_fail(PurpleHttpClientRequest *req, const char *error_message)
+{
+	req->finishing = TRUE;
+
+	if (req->callback != NULL)
+		req->callback(NULL, error_message, req->data);
+
+	request_free(req);
+}
+
+/**************************************************************************
+ * Connections
+ **************************************************************************/
+
+static void
+conn_reset_response(PurpleHttpClientConn *conn)
+{
+	conn->state = HTTP_STATE_HEADERS;
+	conn->scanned = 0;
+	conn->status = 0;
+	g_free(conn->headers);
+	conn->headers = NULL;
+	conn->headers_len = 0;
+	conn->response_close = FALSE;
+	conn->remaining = 0;
+	buffer_free(&conn->body);
+}
+
+/* Closes the connection.  Any requests on it are the caller's problem. */
+static void
+conn_destroy(PurpleHttpClientConn *conn)
+{
+	PurpleHttpClientHost *host = conn->host;
+
+	host->connections = g_list_remove(host->connections, conn);
+
+	if (conn->connect_data != NULL)
+		purple_proxy_connect_cancel(conn->connect_data);
+	if (conn->inpa > 0)
+		purple_input_remove(conn->inpa);
+	if (conn->write_inpa > 0)
+		purple_input_remove(conn->write_inpa);
+	if (conn->idle_timeout > 0)
+		purple_timeout_remove(conn->idle_timeout);
+	if (conn->fd >= 0)
+		close(conn->fd);
+
+	conn_reset_response(conn);
+	buffer_free(&conn->in);
+	purple_circ_buffer_destroy(conn->outbuf);
+	g_queue_free(conn->requests);
+	g_free(conn);
+}
+
+static void
+host_free(PurpleHttpClientHost *host)
+{
+	PurpleHttpClientRequest *req;
+
+	while (host->connections != NULL) {
+		PurpleHttpClientConn *conn = host->connections->data;
+
+		while ((req = g_queue_pop_head(conn->requests)) != NULL)
+			request_free(req);
+		conn_destroy(conn);
+	}
+
+	while ((req = g_queue_pop_head(host->pending)) != NULL)
+		request_free(req);
+	g_queue_free(host->pending);
+
+	if (host->dispatch_timeout > 0)
+		purple_timeout_remove(host->dispatch_timeout);
+
+	g_free(host->key);
+	g_free(host->host);
+	g_free(host);
+}
+
+/* Forgets about a server once there's nothing left to do for it */
+static void
+host_check(PurpleHttpClientHost *host)
+{
+	if (host->connections == NULL && g_queue_is_empty(host->pending))
+		g_hash_table_remove(hosts, host->key);
+}
+
+/*
+ * Gives up on a connection.  Requests which can safely be sent again
+ * go back to wait for another connection, and the rest fail.
+ */
+static void
+conn_fail(PurpleHttpClientConn *conn, const char *format, ...)
+{
+	PurpleHttpClientHost *host = conn->host;
+	PurpleHttpClientRequest *req;
+	GSList *failed = NULL;
+	gboolean answered;
+	char *error_message;
+	va_list args;
+
+	va_start(args, format);
+	error_message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	purple_debug_info("httpclient", "Connection to %s failed: %s\n",
+			host->key, error_message);
+
+	/* Only the request at the head can have had some of its response */
+	answered = (conn->state != HTTP_STATE_HEADERS || conn->in.len > 0);
+
+	while ((req = g_queue_pop_tail(conn->requests)) != NULL) {
+		gboolean head = g_queue_is_empty(conn->requests);
+
+		req->conn = NULL;
+
+		if (req->callback == NULL) {
+			request_free(req);
+		} else if (conn->served > 0 && !req->retried && !(head && answered)) {
+			/* The server probably closed it while we weren't looking */
+			req->retried = TRUE;
+			g_queue_push_head(host->pending, req);
+		} else {
+			req->finishing = TRUE;
+			failed = g_slist_prepend(failed, req);
+		}
+	}
+
+	conn_destroy(conn);
+
+	if (!g_queue_is_empty(host->pending))
+		host_schedule_dispatch(host);
+
+	while (failed != NULL) {
+		request_fail(failed->data, error_message);
+		failed = g_slist_delete_link(failed, failed);
+	}
+
+	g_free(error_message);
+	host_check(host);
+}
+
+static gboolean
+conn_idle_cb(gpointer data)
+{
+	PurpleHttpClientConn *conn = data;
+	PurpleHttpClientHost *host = conn->host;
+
+	conn->idle_timeout = 0;
+	conn_destroy(conn);
+	host_check(host);
+
+	return FALSE;
+}
+
+/*
+ * Hands the response to its request.  Returns FALSE if that was the
+ * last of the connection.
+ */
+static gboolean
+conn_response_done(PurpleHttpClientConn *conn)
+{
+	PurpleHttpClientHost *host = conn->host;
+	PurpleHttpClientRequest *req = g_queue_pop_head(conn->requests);
+	PurpleHttpClientResponse response;
+
+	buffer_reserve(&conn->body, 0);
+	conn->body.data[conn->body.len] = '\0';
+
+	response.status = conn->status;
+	response.headers = conn->headers;
+	response.headers_len = conn->headers_len;
+	response.body = conn->body.data;
+	response.body_len = conn->body.len;
+
+	conn->served++;
+	if (conn->response_close || req->close)
+		conn->closing = TRUE;
+	else
+		conn->keep_alive = TRUE;
+
+	req->conn = NULL;
+	req->finishing = TRUE;
+	if (req->callback != NULL)
+		req->callback(&response, NULL, req->data);
+	request_free(req);
+
+	conn_reset_response(conn);
+
+	if (conn->closing) {
+		/* Anything pipelined behind it never got an answer, so resend it */
+		while ((req = g_queue_pop_tail(conn->requests)) != NULL) {
+			req->conn = NULL;
+			if (req->callback == NULL)
+				request_free(req);
+			else
+				g_queue_push_head(host->pending, req);
+		}
+
+		conn_destroy(conn);
+
+		if (!g_queue_is_empty(host->pending))
+			host_schedule_dispatch(host);
+		host_check(host);
+
+		return FALSE;
+	}
+
+	if (g_queue_is_empty(conn->requests))
+		conn->idle_timeout = purple_timeout_add_seconds(HTTP_IDLE_TIMEOUT,
+				conn_idle_cb, conn);
+
+	if (!g_queue_is_empty(host->pending))
+		host_schedule_dispatch(host);
+
+	return TRUE;
+}
+
+/* Works out how the body of a response is going to arrive */
+static void
+conn_headers_done(PurpleHttpClientConn *conn)
+{
+	PurpleHttpClientRequest *req = g_queue_peek_head(conn->requests);
+	const char *headers = conn->headers;
+	gsize len = conn->headers_len;
+	gboolean http10 = (strncmp(headers, "HTTP/1.0", 8) == 0);
+	const char *content_length;
+
+	if (http_header_has_token(headers, len, "Connection", "close") ||
+			(http10 && !http_header_has_token(headers, len, "Connection", "keep-alive")))
+		conn->response_close = TRUE;
+
+	if (req->head || conn->status == 204 || conn->status == 304) {
+		conn->state = HTTP_STATE_BODY;
+		conn->remaining = 0;
+	} else if (http_header_has_token(headers, len, "Transfer-Encoding", "chunked")) {
+		conn->state = HTTP_STATE_CHUNK_SIZE;
+	} else if ((content_length = http_header_find(headers, len, "Content-Length")) != NULL) {
+		conn->state = HTTP_STATE_BODY;
+		conn->remaining = strtoul(content_length, NULL, 10);
+
+		/* Don't take the server's word for how much memory to set aside */
+		buffer_reserve(&conn->body, MIN(conn->remaining, HTTP_MAX_PREALLOC));
+	} else {
+		conn->state = HTTP_STATE_BODY_TO_EOF;
+		conn->response_close = TRUE;
+	}
+}
+
+/*
+ * Makes what it can of the data read so far.  Returns FALSE if the
+ * connection is gone.
+ */
+static gboolean
+conn_parse(PurpleHttpClientConn *conn)
+{
+	PurpleHttpClientBuffer *in = &conn->in;
+	gsize pos = 0;
+
+	for (;;) {
+		const char *data = in->data + pos;
+		gsize avail = in->len - pos;
+		const char *end;
+		gsize n;
+
+		if (conn->state == HTTP_STATE_HEADERS) {
+			if (avail == 0)
+				break;
+
+			if (g_queue_is_empty(conn->requests)) {
+				conn_fail(conn, _("Unexpected data from %s"), conn->host->host);
+				return FALSE;
+			}
+
+			/* Carry on from where we stopped looking last time */
+			n = MAX(conn->scanned, pos) - pos;
+			if ((end = http_find(data + n, avail - n, "\r\n\r\n")) == NULL) {
+				if (avail > HTTP_MAX_HEADERS) {
+					conn_fail(conn, _("Invalid response from %s"), conn->host->host);
+					return FALSE;
+				}
+				conn->scanned = in->len > 3 ? in->len - 3 : 0;
+				break;
+			}
+
+			n = end + 4 - data;
+			g_free(conn->headers);
+			conn->headers = g_strndup(data, n);
+			conn->headers_len = n;
+			pos += n;
+			conn->scanned = pos;
+
+			if (sscanf(conn->headers, "HTTP/%*d.%*d %d", &conn->status) != 1) {
+				conn_fail(conn, _("Invalid response from %s"), conn->host->host);
+				return FALSE;
+			}
+
+			purple_debug_misc("httpclient", "Response headers from %s: '%.*s'\n",
+					conn->host->key, (int)conn->headers_len, conn->headers);
+
+			/* "100 Continue" and the like come before the real thing */
+			if (conn->status >= 100 && conn->status < 200)
+				continue;
+
+			conn_headers_done(conn);
+
+		} else if (conn->state == HTTP_STATE_BODY || conn->state == HTTP_STATE_CHUNK_DATA) {
+			n = MIN(avail, conn->remaining);
+			buffer_append(&conn->body, data, n);
+			pos += n;
+			conn->remaining -= n;
+
+			if (conn->remaining > 0)
+				break;
+
+			if (conn->state == HTTP_STATE_CHUNK_DATA) {
+				conn->state = HTTP_STATE_CHUNK_END;
+				continue;
+			}
+
+			buffer_consume(in, pos);
+			pos = 0;
+			if (!conn_response_done(conn))
+				return FALSE;
+
+		} else if (conn->state == HTTP_STATE_BODY_TO_EOF) {
+			buffer_append(&conn->body, data, avail);
+			pos += avail;
+			break;
+
+		} else if (conn->state == HTTP_STATE_CHUNK_END) {
+			if (avail < 2)
+				break;
+
+			if (data[0] != '\r' || data[1] != '\n') {
+				conn_fail(conn, _("Invalid response from %s"), conn->host->host);
+				return FALSE;
+			}
+
+			pos += 2;
+			conn->state = HTTP_STATE_CHUNK_SIZE;
+
+		} else {
+			/* Both of these are a line at a time */
+			if ((end = http_find(data, avail, "\r\n")) == NULL) {
+				if (avail > HTTP_MAX_LINE) {
+					conn_fail(conn, _("Invalid response from %s"), conn->host->host);
+					return FALSE;
+				}
+				break;
+			}
+			pos += end + 2 - data;
+
+			if (conn->state == HTTP_STATE_CHUNK_SIZE) {
+				char *hex_end;
+
+				conn->remaining = strtoul(data, &hex_end, 16);
+				if (hex_end == data) {
+					conn_fail(conn, _("Invalid response from %s"), conn->host->host);
+					return FALSE;
+				}
+
+				if (conn->remaining > 0)
+					conn->state = HTTP_STATE_CHUNK_DATA;
+				else
+					conn->state = HTTP_STATE_TRAILER;
+
+			} else if (end == data) {
+				/* The blank line after the trailers */
+				buffer_consume(in, pos);
+				pos = 0;
+				if (!conn_response_done(conn))
+					return FALSE;
+			}
+		}
+	}
+
+	conn->scanned = conn->scanned > pos ? conn->scanned - pos : 0;
+	buffer_consume(in, pos);
+
+	return TRUE;
+}
+
+/* The server has closed the connection, or it broke */
+static void
+conn_eof(PurpleHttpClientConn *conn, const char *error_message)
+{
+	PurpleHttpClientHost *host = conn->host;
+
+	if (g_queue_is_empty(conn->requests)) {
+		/* It was idle anyway */
+		conn_destroy(conn);
+		host_check(host);
+		return;
+	}
+
+	if (conn->state == HTTP_STATE_BODY_TO_EOF && error_message == NULL) {
+		conn_response_done(conn);
+		return;
+	}
+
+	if (error_message != NULL)
+		conn_fail(conn, _("Error reading from %s: %s"), host->host, error_message);
+	else
+		conn_fail(conn, _("Error reading from %s: %s"), host->host,
+				_("Server closed the connection"));
+}
+
+static void
+conn_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleHttpClientConn *conn = data;
+	PurpleHttpClientBuffer *in = &conn->in;
+	gssize len;
+
+	for (;;) {
+		buffer_reserve(in, HTTP_READ_SIZE);
+
+		len = read(conn->fd, in->data + in->len, in->size - in->len - 1);
+
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		if (len <= 0) {
+			conn_eof(conn, len < 0 ? g_strerror(errno) : NULL);
+			return;
+		}
+
+		in->len += len;
+		in->data[in->len] = '\0';
+
+		if (!conn_parse(conn))
+			return;
+	}
+}
+
+static void
+conn_write_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleHttpClientConn *conn = data;
+	gsize avail;
+	gssize len;
+
+	while ((avail = purple_circ_buffer_get_max_read(conn->outbuf)) > 0) {
+		len = write(conn->fd, conn->outbuf->outptr, avail);
+
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		if (len <= 0) {
+			conn_fail(conn, _("Error writing to %s: %s"), conn->host->host,
+					g_strerror(errno));
+			return;
+		}
+
+		purple_circ_buffer_mark_read(conn->outbuf, len);
+	}
+
+	purple_input_remove(conn->write_inpa);
+	conn->write_inpa = 0;
+}
+
+static void
+conn_connected_cb(gpointer data, gint source, const gchar *error_message)
+{
+	PurpleHttpClientConn *conn = data;
+
+	conn->connect_data = NULL;
+
+	if (source < 0) {
+		conn_fail(conn, _("Unable to connect to %s: %s"), conn->host->host,
+				error_message ? error_message : "");
+		return;
+	}
+
+	conn->fd = source;
+	conn->inpa = purple_input_add(conn->fd, PURPLE_INPUT_READ, conn_read_cb, conn);
+
+	if (conn->outbuf->bufused > 0)
+		conn->write_inpa = purple_input_add(conn->fd, PURPLE_INPUT_WRITE,
+				conn_write_cb, conn);
+}
+
+static PurpleHttpClientConn *
+conn_new(PurpleHttpClientHost *host)
+{
+	PurpleHttpClientConn *conn = g_new0(PurpleHttpClientConn, 1);
+
+	conn->host = host;
+	conn->fd = -1;
+	conn->requests = g_queue_new();
+	conn->outbuf = purple_circ_buffer_new(0);
+
+	conn->connect_data = purple_proxy_connect(NULL, NULL, host->host, host->port,
+			conn_connected_cb, conn);
+
+	if (conn->connect_data == NULL) {
+		purple_circ_buffer_destroy(conn->outbuf);
+		g_queue_free(conn->requests);
+		g_free(conn);
+		return NULL;
+	}
+
+	host->connections = g_list_append(host->connections, conn);
+
+	return conn;
+}
+
+static void
+conn_send(PurpleHttpClientConn *conn, PurpleHttpClientRequest *req)
+{
+	req->conn = conn;
+	g_queue_push_tail(conn->requests, req);
+
+	/* Whatever the server says, this is the last one */
+	if (req->close)
+		conn->closing = TRUE;
+
+	if (conn->idle_timeout > 0) {
+		purple_timeout_remove(conn->idle_timeout);
+		conn->idle_timeout = 0;
+	}
+
+	purple_circ_buffer_append(conn->outbuf, req->request, req->request_len);
+
+	if (conn->fd >= 0 && conn->write_inpa == 0)
+		conn->write_inpa = purple_input_add(conn->fd, PURPLE_INPUT_WRITE,
+				conn_write_cb, conn);
+}
+
+/* Whether req can go out before the responses already due on conn */
+static gboolean
+conn_can_pipeline(PurpleHttpClientConn *conn, PurpleHttpClientRequest *req)
+{
+	GList *l;
+
+	if (!req->pipelinable || !conn->keep_alive || conn->closing ||
+			g_queue_get_length(conn->requests) >= HTTP_MAX_PIPELINE)
+		return FALSE;
+
+	for (l = conn->requests->head; l != NULL; l = l->next)
+		if (!((PurpleHttpClientRequest *)l->data)->pipelinable)
+			return FALSE;
+
+	return TRUE;
+}
+
+/**************************************************************************
+ * Servers
+ **************************************************************************/
+
+static void
+host_dispatch(PurpleHttpClientHost *host)
+{
+	PurpleHttpClientRequest *req;
+
+	while ((req = g_queue_peek_head(host->pending)) != NULL) {
+		PurpleHttpClientConn *conn = NULL, *busy = NULL;
+		GList *l;
+
+		for (l = host->connections; l != NULL; l = l->next) {
+			PurpleHttpClientConn *c = l->data;
+
+			if (c->closing)
+				continue;
+
+			if (g_queue_is_empty(c->requests)) {
+				conn = c;
+				break;
+			}
+
+			if (conn_can_pipeline(c, req) && (busy == NULL ||
+					g_queue_get_length(c->requests) < g_queue_get_length(busy->requests)))
+				busy = c;
+		}
+
+		if (conn == NULL && g_list_length(host->connections) < HTTP_MAX_CONNECTIONS) {
+			conn = conn_new(host);
+
+			if (conn == NULL) {
+				char *error_message = g_strdup_printf(_("Unable to connect to %s"),
+						host->host);
+
+				g_queue_pop_head(host->pending);
+				request_fail(req, error_message);
+				g_free(error_message);
+				continue;
+			}
+		}
+
+		if (conn == NULL)
+			conn = busy;
+
+		/* Wait for a connection to come free */
+		if (conn == NULL)
+			break;
+
+		g_queue_pop_head(host->pending);
+		conn_send(conn, req);
+	}
+}
+
+static gboolean
+host_dispatch_cb(gpointer data)
+{
+	PurpleHttpClientHost *host = data;
+
+	host->dispatch_timeout = 0;
+	host_dispatch(host);
+	host_check(host);
+
+	return FALSE;
+}
+
+static void
+host_schedule_dispatch(PurpleHttpClientHost *host)
+{
+	if (host->dispatch_timeout == 0)
+		host->dispatch_timeout = purple_timeout_add(0, host_dispatch_cb, host);
+}
+
+static PurpleHttpClientHost *
+host_get(const char *name, int port)
+{
+	PurpleHttpClientHost *host;
+	char *key, *tmp;
+
+	tmp = g_strdup_printf("%s:%d", name, port);
+	key = g_ascii_strdown(tmp, -1);
+	g_free(tmp);
+
+	if ((host = g_hash_table_lookup(hosts, key)) != NULL) {
+		g_free(key);
+		return host;
+	}
+
+	host = g_new0(PurpleHttpClientHost, 1);
+	host->key = key;
+	host->host = g_strdup(name);
+	host->port = port;
+	host->pending = g_queue_new();
+	g_hash_table_insert(hosts, host->key, host);
+
+	return host;
+}
+
+/**************************************************************************
+ * HTTP client API
+ **************************************************************************/
+
+PurpleHttpClientRequest *
+purple_httpclient_request(const char *host, int port, const char *request,
+		PurpleHttpClientCallback callback, gpointer data)
+{
+	PurpleHttpClientRequest *req;
+	const char *end;
+	gsize headers_len;
+	gboolean http10;
+
+	g_return_val_if_fail(host     != NULL, NULL);
+	g_return_val_if_fail(request  != NULL, NULL);
+	g_return_val_if_fail(callback != NULL, NULL);
+
+	req = g_new0(PurpleHttpClientRequest, 1);
+	req->request = g_strdup(request);
+	req->request_len = strlen(request);
+	req->callback = callback;
+	req->data = data;
+
+	req->head = (g_ascii_strncasecmp(request, "HEAD ", 5) == 0);
+	req->pipelinable = req->head || (g_ascii_strncasecmp(request, "GET ", 4) == 0);
+
+	end = strstr(request, "\r\n\r\n");
+	headers_len = end ? (gsize)(end - request) : req->request_len;
+	end = strchr(request, '\n');
+	http10 = (end != NULL && g_strstr_len(request, end - request, "HTTP/1.0") != NULL);
+
+	if (http_header_has_token(request, headers_len, "Connection", "close") ||
+			(http10 && !http_header_has_token(request, headers_len, "Connection", "keep-alive")))
+		req->close = TRUE;
+
+	req->host = host_get(host, port);
+	g_queue_push_tail(req->host->pending, req);
+	host_schedule_dispatch(req->host);
+
+	return req;
+}
+
+void
+purple_httpclient_cancel(PurpleHttpClientRequest *req)
+{
+	g_return_if_fail(req != NULL);
+
+	if (req->conn != NULL || req->finishing) {
+		/* Its response will be read and thrown away */
+		req->callback = NULL;
+		return;
+	}
+
+	g_queue_remove(req->host->pending, req);
+	request_free(req);
+}
+
+void
+purple_httpclient_init(void)
+{
+	hosts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)host_free);
+}
+
+void
+purple_httpclient_uninit(void)
+{
+	g_hash_table_destroy(hosts);
+	hosts = NULL;
+}
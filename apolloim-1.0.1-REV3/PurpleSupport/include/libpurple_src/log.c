@@ -27,6 +27,7 @@
 #include "account.h"
 #include "dbus-maybe.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "internal.h"
 #include "log.h"
 #include "prefs.h"
@@ -46,7 +47,32 @@ struct _purple_logsize_user {
 };
 static GHashTable *logsize_users = NULL;
 
+/* Pending purple_log_read_range() requests, by handle. */
+static GHashTable *log_read_ranges = NULL;
+
+/* Loaded search indexes, by account. */
+static GHashTable *log_search_indexes = NULL;
+
+/* Buffered common logger files; see log_writer_message_done(). */
+static GQueue *open_writers = NULL;     /* least recently flushed first */
+static GQueue *dirty_writers = NULL;
+static GHashTable *log_writers = NULL;  /* every log still being written, by path */
+static gsize log_writer_buffered = 0;
+static guint log_writer_timer = 0;
+
 static void log_get_log_sets_common(GHashTable *sets);
+static char *process_txt_log(char *txt, char *to_free);
+struct log_read_range;
+static void log_read_range_free(struct log_read_range *req);
+static guint log_index_count_written(PurpleLog *log);
+static void log_writer_flush_all(void);
+static void log_writers_free_all(void);
+static long log_writer_get_size(const char *path);
+static gboolean log_writers_in_dir(const char *dir);
+static void log_search_add(PurpleLog *log, guint msg, const char *message);
+static void log_search_remove(PurpleLog *log);
+struct log_search_index;
+static void log_search_index_free(struct log_search_index *index);
 
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 							  const char *from, time_t time, const char *message);
@@ -147,13 +173,18 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 	struct _purple_logsize_user *lu;
 	gsize written, total = 0;
 	gpointer ptrsize;
+	guint messages;
 
 	g_return_if_fail(log);
 	g_return_if_fail(log->logger);
 	g_return_if_fail(log->logger->write);
 
+	messages = log_index_count_written(log);
 	written = (log->logger->write)(log, type, from, time, message);
 
+	if (log_index_count_written(log) > messages)
+		log_search_add(log, messages, message);
+
 	lu = g_new(struct _purple_logsize_user, 1);
 
 	lu->name = g_strdup(purple_normalize(log->account, log->name));
@@ -175,7 +206,9 @@ char *purple_log_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	PurpleLogReadFlags mflags;
 	g_return_val_if_fail(log && log->logger, NULL);
 	if (log->logger->read) {
-		char *ret = (log->logger->read)(log, flags ? flags : &mflags);
+		char *ret;
+		log_writer_flush_all();
+		ret = (log->logger->read)(log, flags ? flags : &mflags);
 		purple_str_strip_char(ret, '\r');
 		return ret;
 	}
@@ -591,6 +624,11 @@ void purple_log_init(void)
 	purple_prefs_add_bool("/purple/logging/log_ims", FALSE);
 	purple_prefs_add_bool("/purple/logging/log_chats", FALSE);
 	purple_prefs_add_bool("/purple/logging/log_system", FALSE);
+	purple_prefs_add_bool("/purple/logging/search_index", TRUE);
+	purple_prefs_add_int("/purple/logging/search_merge_postings", 50000);
+	purple_prefs_add_int("/purple/logging/flush_interval", 1000);
+	purple_prefs_add_int("/purple/logging/flush_bytes", 64 * 1024);
+	purple_prefs_add_int("/purple/logging/max_open_files", 32);
 
 	purple_prefs_add_string("/purple/logging/format", "txt");
 
@@ -661,12 +699,43 @@ void purple_log_init(void)
 	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 			(GEqualFunc)_purple_logsize_user_equal,
 			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+
+	log_read_ranges = g_hash_table_new(g_direct_hash, g_direct_equal);
+	log_search_indexes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)log_search_index_free);
+
+	open_writers = g_queue_new();
+	dirty_writers = g_queue_new();
+	log_writers = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void
+log_read_range_cancel_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	purple_timeout_remove(GPOINTER_TO_UINT(key));
+	log_read_range_free(value);
 }
 
 void
 purple_log_uninit(void)
 {
 	purple_signals_unregister_by_instance(purple_log_get_handle());
+
+	g_hash_table_foreach(log_read_ranges, log_read_range_cancel_cb, NULL);
+	g_hash_table_destroy(log_read_ranges);
+	log_read_ranges = NULL;
+
+	g_hash_table_destroy(log_search_indexes);
+	log_search_indexes = NULL;
+
+	/* The last chance for anything still buffered to be written */
+	log_writer_flush_all();
+	if (log_writer_timer != 0) {
+		purple_timeout_remove(log_writer_timer);
+		log_writer_timer = 0;
+	}
+
+	log_writers_free_all();
 }
 
 /****************************************************************************
@@ -796,241 +865,2532 @@ convert_image_tags(const PurpleLog *log, const char *msg)
 	return g_string_free(newmsg, FALSE);
 }
 
-void purple_log_common_writer(PurpleLog *log, const char *ext)
-{
-	PurpleLogCommonLoggerData *data = log->logger_data;
+/****************************************************************************
+ * LOG INDEXES **************************************************************
+ ****************************************************************************/
 
-	if (data == NULL)
-	{
-		/* This log is new */
-		char *dir;
-		struct tm *tm;
-		const char *tz;
-		const char *date;
-		char *filename;
-		char *path;
+/*
+ * Each directory written by the common loggers has a ".logindex" file
+ * holding the size of every file in it, and the total size per extension,
+ * so listing and sizing a buddy's logs doesn't walk and stat the directory.
+ * Its first line records the directory's mtime, which changes whenever a
+ * log is added or removed; a mismatch means the index has to be rebuilt.
+ * mtimes only have a resolution of a second, so the line also records when
+ * the index was built, and an index built in the same second as the last
+ * change may have missed part of it and isn't trusted either.  Logs still
+ * being written keep growing after they are indexed, so their sizes come
+ * from their writers instead.
+ *
+ *   PurpleLogDirIndex 2 <mtime> <built>
+ *   T <size> <extension>
+ *   F <size> <filename>
+ *
+ * Each HTML or text log may also have a "<log>.idx" file holding the
+ * offset, length and time of every message in it, so that a range of
+ * messages can be read without loading the whole log.  Its first line
+ * records how much of the log has been indexed, so a log that has grown
+ * since is only scanned from there on.
+ *
+ *   PurpleLogIndex 1 <indexed bytes>
+ *   <offset> <length> <time>
+ */
+#define LOG_DIR_INDEX_FILE   ".logindex"
+#define LOG_DIR_INDEX_HEADER "PurpleLogDirIndex 2"
+#define LOG_INDEX_EXT        ".idx"
+#define LOG_INDEX_HEADER     "PurpleLogIndex 1"
 
-		dir = purple_log_get_log_dir(log->type, log->name, log->account);
-		if (dir == NULL)
-			return;
+/* How much of a log is scanned for messages per main loop iteration. */
+#define LOG_INDEX_SCAN_CHUNK (256 * 1024)
 
-		purple_build_dir (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+struct log_dir_entry {
+	char *filename;
+	long size;
+};
 
-		tm = localtime(&log->time);
-		tz = purple_escape_filename(purple_utf8_strftime("%Z", tm));
-		date = purple_utf8_strftime("%Y-%m-%d.%H%M%S%z", tm);
+struct log_index_entry {
+	long offset;
+	long length;
+	time_t time;
+};
 
-		filename = g_strdup_printf("%s%s%s", date, tz, ext ? ext : "");
+struct log_index {
+	long indexed;
+	GArray *entries;
+	FILE *scan;
+	gboolean at_line_start;
+	gboolean scanned;
+};
 
-		path = g_build_filename(dir, filename, NULL);
-		g_free(dir);
-		g_free(filename);
+static void
+log_dir_entries_free(GList *entries)
+{
+	while (entries != NULL) {
+		struct log_dir_entry *entry = entries->data;
+		g_free(entry->filename);
+		g_free(entry);
+		entries = g_list_delete_link(entries, entries);
+	}
+}
 
-		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+static gboolean
+log_dir_index_read(const char *index_path, time_t mtime, const char *ext,
+                   GList **entries, long *total)
+{
+	FILE *file;
+	char buf[BUF_LONG];
+	unsigned long recorded, built;
+	gboolean ret;
 
-		data->file = g_fopen(path, "a");
-		if (data->file == NULL)
-		{
-			purple_debug(PURPLE_DEBUG_ERROR, "log",
-					"Could not create log file %s\n", path);
+	if ((file = g_fopen(index_path, "rb")) == NULL)
+		return FALSE;
 
-			if (log->conv != NULL)
-				purple_conversation_write(log->conv, NULL, _("Logging of this conversation failed."),
-										PURPLE_MESSAGE_ERROR, time(NULL));
+	if (fgets(buf, sizeof(buf), file) == NULL ||
+	    sscanf(buf, LOG_DIR_INDEX_HEADER " %lu %lu", &recorded, &built) != 2 ||
+	    (time_t)recorded != mtime || (time_t)built <= mtime)
+	{
+		fclose(file);
+		return FALSE;
+	}
 
-			g_free(path);
-			return;
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		char *name;
+		long size;
+
+		g_strchomp(buf);
+		if (buf[0] == '\0' || buf[1] != ' ')
+			break;
+
+		size = strtol(buf + 2, &name, 10);
+		if (*name != ' ')
+			break;
+		name++;
+
+		if (buf[0] == 'T') {
+			if (total != NULL && ext != NULL && !strcmp(name, ext))
+				*total = size;
+		} else if (buf[0] == 'F') {
+			struct log_dir_entry *entry;
+
+			/* The totals come first, so that's all a sizer reads. */
+			if (entries == NULL)
+				break;
+
+			entry = g_new(struct log_dir_entry, 1);
+			entry->filename = g_strdup(name);
+			entry->size = size;
+			*entries = g_list_prepend(*entries, entry);
 		}
-		g_free(path);
 	}
+
+	ret = !ferror(file);
+	fclose(file);
+
+	if (!ret && entries != NULL) {
+		log_dir_entries_free(*entries);
+		*entries = NULL;
+	}
+
+	return ret;
 }
 
-GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
+static void
+log_dir_total_write(gpointer key, gpointer value, gpointer user_data)
+{
+	fprintf(user_data, "T %ld %s\n", *(long *)value, (const char *)key);
+}
+
+static GList *
+log_dir_index_rebuild(const char *path, const char *index_path)
 {
 	GDir *dir;
-	GList *list = NULL;
+	GList *entries = NULL, *l;
+	GHashTable *totals;
 	const char *filename;
-	char *path;
-
-	if(!account)
-		return NULL;
+	struct stat st;
+	time_t built;
+	FILE *file;
 
-	path = purple_log_get_log_dir(type, name, account);
-	if (path == NULL)
+	/*
+	 * Create the index before looking at the directory, so that its
+	 * creation doesn't change the mtime recorded in it.  It is rewritten
+	 * in place from here on.
+	 */
+	if (!g_file_test(index_path, G_FILE_TEST_EXISTS) &&
+	    (file = g_fopen(index_path, "wb")) != NULL)
+		fclose(file);
+
+	built = time(NULL);
+	if (g_stat(path, &st) || !(dir = g_dir_open(path, 0, NULL)))
 		return NULL;
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
-	{
-		g_free(path);
-		return NULL;
-	}
+	totals = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
 	while ((filename = g_dir_read_name(dir)))
 	{
-		if (purple_str_has_suffix(filename, ext) &&
-		    strlen(filename) >= (17 + strlen(ext)))
-		{
-			PurpleLog *log;
-			PurpleLogCommonLoggerData *data;
-			struct tm tm;
-#if defined (HAVE_TM_GMTOFF) && defined (HAVE_STRUCT_TM_TM_ZONE)
-			long tz_off;
-			const char *rest;
-			time_t stamp = purple_str_to_time(purple_unescape_filename(filename), FALSE, &tm, &tz_off, &rest);
-			char *end;
+		struct log_dir_entry *entry;
+		const char *ext;
+		struct stat fst;
+		char *tmp;
 
-			/* As zero is a valid offset, PURPLE_NO_TZ_OFF means no offset was
-			 * provided. See util.h. Yes, it's kinda ugly. */
-			if (tz_off != PURPLE_NO_TZ_OFF)
-				tm.tm_gmtoff = tz_off - tm.tm_gmtoff;
+		if (!strcmp(filename, LOG_DIR_INDEX_FILE) ||
+		    purple_str_has_suffix(filename, LOG_INDEX_EXT))
+			continue;
 
-			if (stamp == 0 || rest == NULL || (end = strchr(rest, '.')) == NULL || strchr(rest, ' ') != NULL)
-			{
-				log = purple_log_new(type, name, account, NULL, stamp, NULL);
-			}
-			else
-			{
-				char *tmp = g_strndup(rest, end - rest);
-				tm.tm_zone = tmp;
-				log = purple_log_new(type, name, account, NULL, stamp, &tm);
-				g_free(tmp);
+		tmp = g_build_filename(path, filename, NULL);
+		if (g_stat(tmp, &fst))
+		{
+			purple_debug_error("log", "Error stating log file: %s\n", tmp);
+			g_free(tmp);
+			continue;
+		}
+		g_free(tmp);
+
+		entry = g_new(struct log_dir_entry, 1);
+		entry->filename = g_strdup(filename);
+		entry->size = fst.st_size;
+		entries = g_list_prepend(entries, entry);
+
+		if ((ext = strrchr(filename, '.')) != NULL) {
+			long *total = g_hash_table_lookup(totals, ext);
+			if (total == NULL) {
+				total = g_new0(long, 1);
+				g_hash_table_insert(totals, g_strdup(ext), total);
 			}
-#else
-			time_t stamp = purple_str_to_time(filename, FALSE, &tm, NULL, NULL);
-
-			log = purple_log_new(type, name, account, NULL, stamp, (stamp != 0) ?  &tm : NULL);
-#endif
-
-			log->logger = logger;
-			log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
-
-			data->path = g_build_filename(path, filename, NULL);
-			list = g_list_prepend(list, log);
+			*total += entry->size;
 		}
 	}
 	g_dir_close(dir);
-	g_free(path);
-	return list;
+
+	if ((file = g_fopen(index_path, "wb")) != NULL) {
+		fprintf(file, LOG_DIR_INDEX_HEADER " %lu %lu\n",
+		        (unsigned long)st.st_mtime, (unsigned long)built);
+		g_hash_table_foreach(totals, log_dir_total_write, file);
+		for (l = entries; l != NULL; l = l->next) {
+			struct log_dir_entry *entry = l->data;
+			fprintf(file, "F %ld %s\n", entry->size, entry->filename);
+		}
+		if (fclose(file))
+			g_unlink(index_path);
+	} else {
+		purple_debug_error("log", "Unable to write %s: %s\n",
+		                   index_path, g_strerror(errno));
+	}
+
+	g_hash_table_destroy(totals);
+
+	return entries;
 }
 
-int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
+/*
+ * Returns the files in a log directory, or with @a entries NULL just the
+ * total size of those with the extension @a ext, from its index.
+ */
+static void
+log_dir_index_get(const char *path, const char *ext, GList **entries, long *total)
 {
-	GDir *dir;
-	int size = 0;
-	const char *filename;
-	char *path;
+	char *index_path;
+	GList *list = NULL, *l;
+	gboolean writing;
+	struct stat st;
 
-	if(!account)
-		return 0;
+	if (total != NULL)
+		*total = 0;
 
-	path = purple_log_get_log_dir(type, name, account);
-	if (path == NULL)
-		return 0;
+	if (g_stat(path, &st))
+		return;
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
+	index_path = g_build_filename(path, LOG_DIR_INDEX_FILE, NULL);
+	writing = log_writers_in_dir(path);
+
+	/* The recorded totals will do, unless a log here is still growing. */
+	if (entries == NULL && !writing &&
+	    log_dir_index_read(index_path, st.st_mtime, ext, NULL, total))
 	{
-		g_free(path);
-		return 0;
+		g_free(index_path);
+		return;
 	}
 
-	while ((filename = g_dir_read_name(dir)))
-	{
-		if (purple_str_has_suffix(filename, ext) &&
-		    strlen(filename) >= (17 + strlen(ext)))
-		{
-			char *tmp = g_build_filename(path, filename, NULL);
-			struct stat st;
-			if (g_stat(tmp, &st))
-			{
-				purple_debug_error("log", "Error stating log file: %s\n", tmp);
-				g_free(tmp);
-				continue;
-			}
-			g_free(tmp);
-			size += st.st_size;
+	if (!log_dir_index_read(index_path, st.st_mtime, NULL, &list, NULL))
+		list = log_dir_index_rebuild(path, index_path);
+	g_free(index_path);
+
+	if (total != NULL)
+		*total = 0;
+
+	for (l = list; l != NULL; l = l->next) {
+		struct log_dir_entry *entry = l->data;
+
+		if (writing) {
+			char *filename = g_build_filename(path, entry->filename, NULL);
+			long size = log_writer_get_size(filename);
+			if (size >= 0)
+				entry->size = size;
+			g_free(filename);
 		}
+
+		if (total != NULL && ext != NULL &&
+		    purple_str_has_suffix(entry->filename, ext))
+			*total += entry->size;
 	}
-	g_dir_close(dir);
-	g_free(path);
-	return size;
+
+	if (entries != NULL)
+		*entries = list;
+	else
+		log_dir_entries_free(list);
 }
 
-int purple_log_common_sizer(PurpleLog *log)
+/* Called when a log in the directory is added, removed or changes size. */
+static void
+log_dir_index_invalidate(const char *log_path)
 {
-	struct stat st;
-	PurpleLogCommonLoggerData *data = log->logger_data;
-
-	g_return_val_if_fail(data != NULL, 0);
+	char *dir = g_path_get_dirname(log_path);
+	char *index_path = g_build_filename(dir, LOG_DIR_INDEX_FILE, NULL);
 
-	if (!data->path || g_stat(data->path, &st))
-		st.st_size = 0;
+	if (g_file_test(index_path, G_FILE_TEST_EXISTS))
+		g_unlink(index_path);
 
-	return st.st_size;
+	g_free(index_path);
+	g_free(dir);
 }
 
-/* This will build log sets for all loggers that use the common logger
- * functions because they use the same directory structure. */
-static void log_get_log_sets_common(GHashTable *sets)
+static gboolean
+log_index_save(const char *log_path, long indexed, GArray *entries)
 {
-	gchar *log_path = g_build_filename(purple_user_dir(), "logs", NULL);
-	GDir *log_dir = g_dir_open(log_path, 0, NULL);
-	const gchar *protocol;
+	char *index_path = g_strconcat(log_path, LOG_INDEX_EXT, NULL);
+	FILE *file;
+	guint i;
 
-	if (log_dir == NULL) {
-		g_free(log_path);
-		return;
+	if ((file = g_fopen(index_path, "wb")) == NULL) {
+		purple_debug_error("log", "Unable to write %s: %s\n",
+		                   index_path, g_strerror(errno));
+		g_free(index_path);
+		return FALSE;
 	}
 
-	while ((protocol = g_dir_read_name(log_dir)) != NULL) {
-		gchar *protocol_path = g_build_filename(log_path, protocol, NULL);
-		GDir *protocol_dir;
-		const gchar *username;
-		gchar *protocol_unescaped;
-		GList *account_iter;
-		GList *accounts = NULL;
+	fprintf(file, LOG_INDEX_HEADER " %ld\n", indexed);
+	for (i = 0; i < entries->len; i++) {
+		struct log_index_entry *entry =
+			&g_array_index(entries, struct log_index_entry, i);
+		fprintf(file, "%ld %ld %lu\n", entry->offset, entry->length,
+		        (unsigned long)entry->time);
+	}
 
-		if ((protocol_dir = g_dir_open(protocol_path, 0, NULL)) == NULL) {
-			g_free(protocol_path);
-			continue;
-		}
+	if (fclose(file)) {
+		g_unlink(index_path);
+		g_free(index_path);
+		return FALSE;
+	}
 
-		/* Using g_strdup() to cover the one-in-a-million chance that a
-		 * prpl's list_icon function uses purple_unescape_filename(). */
-		protocol_unescaped = g_strdup(purple_unescape_filename(protocol));
+	g_free(index_path);
+	return TRUE;
+}
 
-		/* Find all the accounts for protocol. */
-		for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
-			PurplePlugin *prpl;
-			PurplePluginProtocolInfo *prpl_info;
+static void
+log_index_free(struct log_index *index)
+{
+	if (index->scan != NULL)
+		fclose(index->scan);
+	g_array_free(index->entries, TRUE);
+	g_free(index);
+}
 
-			prpl = purple_find_prpl(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
-			if (!prpl)
-				continue;
-			prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(prpl);
+static struct log_index *
+log_index_load(const char *log_path, long size)
+{
+	struct log_index *index;
+	char *index_path = g_strconcat(log_path, LOG_INDEX_EXT, NULL);
+	char buf[128];
+	FILE *file;
 
-			if (!strcmp(protocol_unescaped, prpl_info->list_icon((PurpleAccount *)account_iter->data, NULL)))
-				accounts = g_list_prepend(accounts, account_iter->data);
-		}
-		g_free(protocol_unescaped);
+	index = g_new0(struct log_index, 1);
+	index->entries = g_array_new(FALSE, FALSE, sizeof(struct log_index_entry));
 
-		while ((username = g_dir_read_name(protocol_dir)) != NULL) {
-			gchar *username_path = g_build_filename(protocol_path, username, NULL);
-			GDir *username_dir;
-			const gchar *username_unescaped;
-			PurpleAccount *account = NULL;
-			gchar *name;
+	file = g_fopen(index_path, "rb");
+	g_free(index_path);
 
-			if ((username_dir = g_dir_open(username_path, 0, NULL)) == NULL) {
-				g_free(username_path);
-				continue;
-			}
+	if (file == NULL)
+		return index;
 
-			/* Find the account for username in the list of accounts for protocol. */
-			username_unescaped = purple_unescape_filename(username);
-			for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
-				if (!strcmp(((PurpleAccount *)account_iter->data)->username, username_unescaped)) {
-					account = account_iter->data;
-					break;
+	if (fgets(buf, sizeof(buf), file) == NULL ||
+	    sscanf(buf, LOG_INDEX_HEADER " %ld", &index->indexed) != 1 ||
+	    index->indexed > size)
+	{
+		/* The log was replaced; index it from scratch. */
+		index->indexed = 0;
+		fclose(file);
+		return index;
+	}
+
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		struct log_index_entry entry;
+		unsigned long when;
+
+		if (sscanf(buf, "%ld %ld %lu", &entry.offset, &entry.length, &when) != 3)
+			continue;
+		entry.time = (time_t)when;
+		g_array_append_val(index->entries, entry);
+	}
+
+	fclose(file);
+	return index;
+}
+
+/*
+ * Whether a line starts a message.  Messages can span lines in both
+ * formats, so this looks for the start the writers give every message:
+ * its timestamp, which in HTML logs is in a small font, possibly inside
+ * a colored one.
+ */
+static gboolean
+log_index_message_starts(const char *line, gboolean html)
+{
+	if (!strncmp(line, "---- ", 5))
+		return TRUE;
+
+	if (!html)
+		return line[0] == '(';
+
+	if (!strncmp(line, "<font color=\"#", 14)) {
+		if ((line = strchr(line + 14, '>')) == NULL)
+			return FALSE;
+		line++;
+	}
+
+	return !strncmp(line, "<font size=\"2\">(", 16);
+}
+
+/*
+ * Finds message boundaries in the part of a log that isn't indexed yet,
+ * reading at most LOG_INDEX_SCAN_CHUNK bytes.  Returns TRUE once the
+ * whole log is indexed.
+ *
+ * The first line of both formats is a header, and HTML logs end with
+ * closing tags.  Every line in between either starts a message or
+ * continues the one before it.
+ */
+static gboolean
+log_index_scan(struct log_index *index, PurpleLog *log, const char *path)
+{
+	char buf[BUF_LONG];
+	long scanned = 0;
+	gboolean html = (log->logger == html_logger);
+
+	if (index->scan == NULL) {
+		if ((index->scan = g_fopen(path, "rb")) == NULL)
+			return TRUE;
+
+		if (index->indexed == 0) {
+			/* Skip the header. */
+			do {
+				if (fgets(buf, sizeof(buf), index->scan) == NULL)
+					return TRUE;
+			} while (strchr(buf, '\n') == NULL);
+			index->indexed = ftell(index->scan);
+		} else {
+			fseek(index->scan, index->indexed, SEEK_SET);
+		}
+		index->at_line_start = TRUE;
+	}
+
+	while (scanned < LOG_INDEX_SCAN_CHUNK) {
+		long offset = ftell(index->scan);
+		gboolean line_start = index->at_line_start;
+		struct log_index_entry *last = NULL;
+		size_t len;
+
+		if (fgets(buf, sizeof(buf), index->scan) == NULL) {
+			fclose(index->scan);
+			index->scan = NULL;
+			return TRUE;
+		}
+
+		len = ftell(index->scan) - offset;
+		scanned += len;
+		index->at_line_start = (*buf != '\0' && buf[strlen(buf) - 1] == '\n');
+
+		if (index->entries->len > 0)
+			last = &g_array_index(index->entries, struct log_index_entry,
+			                      index->entries->len - 1);
+
+		if (line_start && log_index_message_starts(buf, html))
+		{
+			struct log_index_entry entry;
+
+			entry.offset = offset;
+			entry.length = len;
+			/* Only the writer knows when each message was sent. */
+			entry.time = log->time;
+			g_array_append_val(index->entries, entry);
+		}
+		else if (last != NULL && last->offset + last->length == offset &&
+		         !(html && line_start && !strncmp(buf, "</body>", 7)))
+		{
+			last->length += len;
+		}
+
+		index->indexed = offset + len;
+		index->scanned = TRUE;
+	}
+
+	return FALSE;
+}
+
+static char *
+log_index_read_range(struct log_index *index, PurpleLog *log, const char *path,
+                     guint first, guint count)
+{
+	struct log_index_entry *start, *end;
+	char *text;
+	size_t len;
+	FILE *file;
+
+	start = &g_array_index(index->entries, struct log_index_entry, first);
+	end = &g_array_index(index->entries, struct log_index_entry, first + count - 1);
+	len = end->offset + end->length - start->offset;
+
+	if ((file = g_fopen(path, "rb")) == NULL)
+		return NULL;
+
+	text = g_malloc(len + 1);
+	if (fseek(file, start->offset, SEEK_SET) ||
+	    fread(text, 1, len, file) != len)
+	{
+		fclose(file);
+		g_free(text);
+		return NULL;
+	}
+	fclose(file);
+	text[len] = '\0';
+
+	if (log->logger == txt_logger)
+		text = process_txt_log(text, NULL);
+
+	purple_str_strip_char(text, '\r');
+	return text;
+}
+
+struct log_read_range {
+	guint handle;
+	PurpleLog *log;
+	guint first;
+	guint count;
+	PurpleLogReadRangeCallback cb;
+	gpointer data;
+	struct log_index *index;
+	long size;
+};
+
+static void
+log_read_range_free(struct log_read_range *req)
+{
+	if (req->index != NULL)
+		log_index_free(req->index);
+	g_free(req);
+}
+
+static gboolean
+log_read_range_cb(gpointer user_data)
+{
+	struct log_read_range *req = user_data;
+	PurpleLog *log = req->log;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	PurpleLogReadFlags flags = 0;
+	char *text = NULL;
+	guint total, count = 0;
+
+	if ((log->logger != html_logger && log->logger != txt_logger) ||
+	    data == NULL || data->path == NULL)
+	{
+		/* Other loggers can only read a log as a whole. */
+		if (req->first == 0 && req->count > 0) {
+			text = purple_log_read(log, &flags);
+			count = 1;
+		}
+		total = 1;
+	}
+	else
+	{
+		if (req->index == NULL) {
+			struct stat st;
+
+			if (g_stat(data->path, &st))
+				st.st_size = 0;
+			req->size = st.st_size;
+			req->index = log_index_load(data->path, req->size);
+		}
+
+		if (req->index->indexed < req->size &&
+		    !log_index_scan(req->index, log, data->path))
+			return TRUE;
+
+		if (req->index->scanned && data->file == NULL)
+		{
+			/* Save what was scanned, unless a writer still has it open. */
+			log_index_save(data->path, req->index->indexed, req->index->entries);
+		}
+
+		total = req->index->entries->len;
+		if (req->first < total && req->count > 0) {
+			count = MIN(req->count, total - req->first);
+			text = log_index_read_range(req->index, log, data->path,
+			                            req->first, count);
+		}
+
+		if (log->logger == html_logger)
+			flags = PURPLE_LOG_READ_NO_NEWLINE;
+	}
+
+	g_hash_table_remove(log_read_ranges, GUINT_TO_POINTER(req->handle));
+	req->cb(log, text, flags, req->first, count, total, req->data);
+	g_free(text);
+	log_read_range_free(req);
+
+	return FALSE;
+}
+
+guint
+purple_log_read_range(PurpleLog *log, guint first, guint count,
+                      PurpleLogReadRangeCallback cb, gpointer data)
+{
+	struct log_read_range *req;
+
+	g_return_val_if_fail(log != NULL, 0);
+	g_return_val_if_fail(cb != NULL, 0);
+
+	req = g_new0(struct log_read_range, 1);
+	req->log = log;
+	req->first = first;
+	req->count = count;
+	req->cb = cb;
+	req->data = data;
+	req->handle = purple_timeout_add(0, log_read_range_cb, req);
+
+	log_writer_flush_all();
+
+	g_hash_table_insert(log_read_ranges, GUINT_TO_POINTER(req->handle), req);
+
+	return req->handle;
+}
+
+void
+purple_log_read_range_cancel(guint handle)
+{
+	struct log_read_range *req;
+
+	req = g_hash_table_lookup(log_read_ranges, GUINT_TO_POINTER(handle));
+	g_return_if_fail(req != NULL);
+
+	g_hash_table_remove(log_read_ranges, GUINT_TO_POINTER(handle));
+	purple_timeout_remove(handle);
+	log_read_range_free(req);
+}
+
+/****************************************************************************
+ * LOG WRITER ***************************************************************
+ ****************************************************************************/
+
+/*
+ * The HTML and text loggers don't write each message straight to its file.
+ * Messages are appended to a buffer per log, and every buffered log is
+ * written out together /purple/logging/flush_interval milliseconds later,
+ * or as soon as more than /purple/logging/flush_bytes are buffered.  Only
+ * /purple/logging/max_open_files logs keep their files open; the one
+ * flushed least recently is closed to make room, and reopened when needed.
+ *
+ * Whatever can't be written stays buffered, and is tried again with the
+ * next flush, or after LOG_WRITER_RETRY_INTERVAL at the latest.  A log
+ * closed with some of it still unwritten keeps its writer until then.
+ */
+#define LOG_WRITER_RETRY_INTERVAL 1000 /* milliseconds, at least */
+
+struct log_writer {
+	PurpleLogCommonLoggerData *data;
+	GArray *entries;        /* the message index, see log_writer_message_done() */
+	GString *buffer;        /* written, but not flushed yet */
+	long size;              /* the size of the log once flushed */
+	GList *open_link;       /* in open_writers while data->file is open */
+	GList *dirty_link;      /* in dirty_writers while buffer isn't empty */
+	gboolean finished;      /* the log is closed; data is the writer's own */
+};
+
+static void log_writer_free(struct log_writer *writer);
+
+static void
+log_writer_close_file(struct log_writer *writer)
+{
+	if (writer->open_link != NULL) {
+		g_queue_delete_link(open_writers, writer->open_link);
+		writer->open_link = NULL;
+	}
+
+	if (writer->data->file != NULL) {
+		fclose(writer->data->file);
+		writer->data->file = NULL;
+	}
+}
+
+static void
+log_writer_add_open(struct log_writer *writer)
+{
+	int max = purple_prefs_get_int("/purple/logging/max_open_files");
+
+	while (max > 0 && !g_queue_is_empty(open_writers) &&
+	       g_queue_get_length(open_writers) >= (guint)max)
+		log_writer_close_file(g_queue_peek_head(open_writers));
+
+	g_queue_push_tail(open_writers, writer);
+	writer->open_link = g_queue_peek_tail_link(open_writers);
+}
+
+static gboolean
+log_writer_open(struct log_writer *writer)
+{
+	PurpleLogCommonLoggerData *data = writer->data;
+
+	if (data->file != NULL) {
+		g_queue_unlink(open_writers, writer->open_link);
+		g_queue_push_tail_link(open_writers, writer->open_link);
+		return TRUE;
+	}
+
+	if ((data->file = g_fopen(data->path, "a")) == NULL) {
+		purple_debug_error("log", "Unable to reopen log file %s: %s\n",
+		                   data->path, g_strerror(errno));
+		return FALSE;
+	}
+
+	log_writer_add_open(writer);
+	return TRUE;
+}
+
+/* Takes over a log file just opened by purple_log_common_writer(). */
+static struct log_writer *
+log_writer_new(PurpleLogCommonLoggerData *data)
+{
+	struct log_writer *writer;
+	struct stat st;
+
+	writer = g_new0(struct log_writer, 1);
+	writer->data = data;
+	writer->entries = g_array_new(FALSE, FALSE, sizeof(struct log_index_entry));
+	writer->buffer = g_string_new(NULL);
+	if (data->path != NULL && g_stat(data->path, &st) == 0)
+		writer->size = st.st_size;
+
+	log_writer_add_open(writer);
+	data->extra_data = writer;
+	if (data->path != NULL)
+		g_hash_table_insert(log_writers, data->path, writer);
+
+	return writer;
+}
+
+static void
+log_writer_add_dirty(struct log_writer *writer)
+{
+	g_queue_push_tail(dirty_writers, writer);
+	writer->dirty_link = g_queue_peek_tail_link(dirty_writers);
+}
+
+/*
+ * Writes out a log's buffer.  On failure, what didn't make it to the file
+ * stays buffered, and the log goes to the back of dirty_writers.
+ */
+static gboolean
+log_writer_flush_one(struct log_writer *writer)
+{
+	PurpleLogCommonLoggerData *data = writer->data;
+	long start = writer->size - writer->buffer->len;
+	gsize written;
+	struct stat st;
+
+	if (writer->dirty_link != NULL) {
+		g_queue_delete_link(dirty_writers, writer->dirty_link);
+		writer->dirty_link = NULL;
+	}
+
+	if (writer->buffer->len == 0)
+		return TRUE;
+
+	if (!log_writer_open(writer)) {
+		log_writer_add_dirty(writer);
+		return FALSE;
+	}
+
+	if (fwrite(writer->buffer->str, 1, writer->buffer->len, data->file) == writer->buffer->len &&
+	    fflush(data->file) == 0)
+	{
+		log_writer_buffered -= writer->buffer->len;
+		g_string_truncate(writer->buffer, 0);
+		return TRUE;
+	}
+
+	purple_debug_error("log", "Error writing %s: %s\n",
+	                   data->path, g_strerror(errno));
+
+	/* Only the file can say how much of the buffer it got */
+	log_writer_close_file(writer);
+	written = 0;
+	if (g_stat(data->path, &st) == 0 && st.st_size > start)
+		written = MIN((gsize)(st.st_size - start), writer->buffer->len);
+	g_string_erase(writer->buffer, 0, written);
+	log_writer_buffered -= written;
+
+	log_writer_add_dirty(writer);
+	return FALSE;
+}
+
+static gboolean log_writer_timeout_cb(gpointer data);
+
+/* Has another go at whatever couldn't be written just now. */
+static void
+log_writer_retry_later(void)
+{
+	log_writer_timer = purple_timeout_add(
+			MAX(purple_prefs_get_int("/purple/logging/flush_interval"),
+			    LOG_WRITER_RETRY_INTERVAL),
+			log_writer_timeout_cb, NULL);
+}
+
+static void
+log_writer_flush_all(void)
+{
+	guint count;
+
+	if (log_writer_timer != 0) {
+		purple_timeout_remove(log_writer_timer);
+		log_writer_timer = 0;
+	}
+
+	/* Logs that can't be written go to the back, so only go round once. */
+	for (count = g_queue_get_length(dirty_writers); count > 0; count--) {
+		struct log_writer *writer = g_queue_peek_head(dirty_writers);
+
+		if (log_writer_flush_one(writer) && writer->finished)
+			log_writer_free(writer);
+	}
+
+	if (!g_queue_is_empty(dirty_writers))
+		log_writer_retry_later();
+}
+
+static gboolean
+log_writer_timeout_cb(gpointer data)
+{
+	log_writer_timer = 0;
+	log_writer_flush_all();
+	return FALSE;
+}
+
+static gsize
+log_writer_printf(struct log_writer *writer, const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+static gsize
+log_writer_printf(struct log_writer *writer, const char *format, ...)
+{
+	va_list args;
+	char *text;
+	gsize len;
+
+	va_start(args, format);
+	text = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	len = strlen(text);
+	g_string_append_len(writer->buffer, text, len);
+	g_free(text);
+
+	writer->size += len;
+	log_writer_buffered += len;
+
+	if (writer->dirty_link == NULL)
+		log_writer_add_dirty(writer);
+
+	return len;
+}
+
+/* Called by the common loggers once a whole message has been buffered. */
+static void
+log_writer_message_done(struct log_writer *writer, long offset, time_t when)
+{
+	struct log_index_entry entry;
+
+	entry.offset = offset;
+	entry.length = writer->size - offset;
+	entry.time = when;
+	g_array_append_val(writer->entries, entry);
+
+	if (log_writer_buffered >=
+	    (gsize)MAX(purple_prefs_get_int("/purple/logging/flush_bytes"), 0))
+	{
+		log_writer_flush_all();
+		return;
+	}
+
+	if (log_writer_timer == 0)
+		log_writer_timer = purple_timeout_add(
+				MAX(purple_prefs_get_int("/purple/logging/flush_interval"), 0),
+				log_writer_timeout_cb, NULL);
+}
+
+/* Returns the size a log still being written will have, or -1. */
+static long
+log_writer_get_size(const char *path)
+{
+	struct log_writer *writer = g_hash_table_lookup(log_writers, path);
+
+	return (writer != NULL) ? writer->size : -1;
+}
+
+static gboolean
+log_writer_in_dir_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	char *dir = g_path_get_dirname(key);
+	gboolean ret = !strcmp(dir, user_data);
+
+	g_free(dir);
+	return ret;
+}
+
+/* Whether any log in a directory is still being written. */
+static gboolean
+log_writers_in_dir(const char *dir)
+{
+	return g_hash_table_find(log_writers, log_writer_in_dir_cb, (gpointer)dir) != NULL;
+}
+
+/* Returns how many messages the common loggers have written to a log. */
+static guint
+log_index_count_written(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if ((log->logger != html_logger && log->logger != txt_logger) ||
+	    data == NULL || data->extra_data == NULL)
+		return 0;
+
+	return ((struct log_writer *)data->extra_data)->entries->len;
+}
+
+/* Closes a log's file and saves its message index, once it is all written. */
+static void
+log_writer_free(struct log_writer *writer)
+{
+	PurpleLogCommonLoggerData *data = writer->data;
+
+	log_writer_close_file(writer);
+
+	if (data->path != NULL) {
+		g_hash_table_remove(log_writers, data->path);
+		log_index_save(data->path, writer->size, writer->entries);
+		log_dir_index_invalidate(data->path);
+	}
+
+	if (writer->finished) {
+		g_free(data->path);
+		g_slice_free(PurpleLogCommonLoggerData, data);
+	} else {
+		data->extra_data = NULL;
+	}
+
+	g_array_free(writer->entries, TRUE);
+	g_string_free(writer->buffer, TRUE);
+	g_free(writer);
+}
+
+static void
+log_writer_collect_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	GList **writers = user_data;
+
+	*writers = g_list_prepend(*writers, value);
+}
+
+/*
+ * Frees every writer at shutdown.  Logs still open are left without one,
+ * and whatever couldn't be written even by the last flush is dropped.
+ */
+static void
+log_writers_free_all(void)
+{
+	GList *writers = NULL, *l;
+
+	g_hash_table_foreach(log_writers, log_writer_collect_cb, &writers);
+	for (l = open_writers->head; l != NULL; l = l->next)
+		if (g_list_find(writers, l->data) == NULL)
+			writers = g_list_prepend(writers, l->data);
+	for (l = dirty_writers->head; l != NULL; l = l->next)
+		if (g_list_find(writers, l->data) == NULL)
+			writers = g_list_prepend(writers, l->data);
+
+	while (writers != NULL) {
+		struct log_writer *writer = writers->data;
+
+		if (writer->buffer->len > 0)
+			purple_debug_error("log", "Discarding %" G_GSIZE_FORMAT
+			                   " unwritten bytes of %s\n", writer->buffer->len,
+			                   writer->data->path ? writer->data->path : "a log");
+
+		if (writer->dirty_link != NULL) {
+			g_queue_delete_link(dirty_writers, writer->dirty_link);
+			writer->dirty_link = NULL;
+		}
+		log_writer_free(writer);
+
+		writers = g_list_delete_link(writers, writers);
+	}
+
+	g_queue_free(open_writers);
+	open_writers = NULL;
+	g_queue_free(dirty_writers);
+	dirty_writers = NULL;
+	g_hash_table_destroy(log_writers);
+	log_writers = NULL;
+	log_writer_buffered = 0;
+}
+
+/* Called by the common loggers when they finish writing a log. */
+static void
+log_writer_finish(struct log_writer *writer)
+{
+	PurpleLogCommonLoggerData *data = writer->data;
+
+	if (log_writer_flush_one(writer) || data->path == NULL) {
+		log_writer_free(writer);
+		return;
+	}
+
+	/*
+	 * The logger is about to free data, so the writer takes a copy of its
+	 * own and stays around until log_writer_flush_all() gets the rest out.
+	 */
+	g_hash_table_remove(log_writers, data->path);
+	writer->data = g_slice_new0(PurpleLogCommonLoggerData);
+	writer->data->path = g_strdup(data->path);
+	writer->data->file = data->file;
+	writer->data->extra_data = writer;
+	writer->finished = TRUE;
+	g_hash_table_insert(log_writers, writer->data->path, writer);
+
+	data->file = NULL;
+	data->extra_data = NULL;
+
+	if (log_writer_timer == 0)
+		log_writer_retry_later();
+}
+
+/****************************************************************************
+ * LOG SEARCH ***************************************************************
+ ****************************************************************************/
+
+/*
+ * Messages written by the HTML and text loggers are added to a per-account
+ * inverted index under <user dir>/logsearch/<protocol>/<account>/, so that
+ * purple_log_search() doesn't have to read any logs:
+ *
+ *   docs     One line per log: "<id>\t<type>\t<time>\t<logger>\t<path>\t<name>".
+ *   segment  "PLS1", generation, term count, then the sorted dictionary of
+ *            (length, term, offset, length) entries, then the posting lists.
+ *            All integers are 32-bit big-endian.
+ *   pending  Postings added since the segment was written, one
+ *            "<term>\t<log>\t<message>" per line after a
+ *            "PurpleLogSearchPending <generation>" header.
+ *   deleted  The ids of deleted logs whose postings are still in the
+ *            segment, one per line.
+ *
+ * A posting names a message by its log and its position in the log, as used
+ * by purple_log_read_range().  Posting lists are sorted and delta-encoded as
+ * varints: the log delta, then either the message delta (same log) or the
+ * message itself.
+ *
+ * Pending postings are kept in memory and merged into a new segment once
+ * there are /purple/logging/search_merge_postings of them, or once a log
+ * has been deleted.  The merge runs a few hundred terms at a time from a
+ * timeout, so as not to hold up the UI; while it runs, the postings being
+ * merged are in pending.merging and new ones go to a fresh pending file.
+ * The generation in the pending files tells whether one left behind by a
+ * crash has already been merged.
+ */
+#define LOG_SEARCH_MAGIC           "PLS1"
+#define LOG_SEARCH_PENDING_HEADER  "PurpleLogSearchPending"
+#define LOG_SEARCH_MIN_TERM        2
+#define LOG_SEARCH_MAX_TERM        64
+#define LOG_SEARCH_MERGE_TERMS     500        /* per timeout, while merging terms */
+#define LOG_SEARCH_MERGE_BYTES     (64 * 1024) /* per timeout, while copying postings */
+
+#define LOG_SEARCH_KEY(doc, msg)   (((guint64)(doc) << 32) | (guint32)(msg))
+#define LOG_SEARCH_KEY_DOC(key)    ((guint32)((key) >> 32))
+#define LOG_SEARCH_KEY_MSG(key)    ((guint32)(key))
+
+struct log_search_doc {
+	PurpleLogType type;
+	time_t time;
+	char *logger;
+	char *path;
+	char *name;
+	gboolean deleted;
+};
+
+struct log_search_term {
+	char *term;
+	guint32 offset;
+	guint32 length;
+};
+
+struct log_search_index {
+	char *dir;
+
+	GPtrArray *docs;
+	GHashTable *doc_ids;      /* path -> id + 1 */
+	FILE *docs_file;
+
+	GArray *terms;            /* the segment's dictionary */
+	long postings_start;
+	guint32 generation;
+
+	GHashTable *pending;      /* term -> GArray of keys, in write order */
+	guint pending_count;
+	FILE *pending_file;
+
+	GArray *deleted;          /* ids of deleted logs not yet purged */
+	struct log_search_merge *merge;
+};
+
+/* A merge in progress; see log_search_merge_cb(). */
+struct log_search_merge {
+	guint timer;
+
+	GHashTable *pending;      /* what is being merged, as in the index */
+	GPtrArray *pending_terms; /* its terms, sorted */
+	guint purged;             /* how many of index->deleted are being purged */
+
+	guint i, j;               /* the next segment and pending terms */
+	GArray *terms;            /* the new dictionary */
+	guint32 offset;
+	FILE *old;                /* the current segment */
+	FILE *postings;           /* the new posting lists, in dictionary order */
+
+	FILE *out;                /* the new segment, once the terms are done */
+	guint32 left;             /* postings still to be copied to it */
+};
+
+/* Returns the distinct terms in some text, casefolded. */
+static GPtrArray *
+log_search_tokenize(const char *text)
+{
+	GPtrArray *terms = g_ptr_array_new();
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	char *valid = NULL, *folded;
+	const char *p, *start = NULL;
+	glong chars = 0;
+
+	if (!g_utf8_validate(text, -1, NULL))
+		text = valid = purple_utf8_salvage(text);
+	folded = g_utf8_casefold(text, -1);
+	g_free(valid);
+
+	for (p = folded; ; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char(p);
+
+		if (c != 0 && g_unichar_isalnum(c)) {
+			if (start == NULL) {
+				start = p;
+				chars = 0;
+			}
+			chars++;
+			continue;
+		}
+
+		if (start != NULL && chars >= LOG_SEARCH_MIN_TERM &&
+		    chars <= LOG_SEARCH_MAX_TERM)
+		{
+			char *term = g_strndup(start, p - start);
+			if (g_hash_table_lookup(seen, term) == NULL) {
+				g_hash_table_insert(seen, term, term);
+				g_ptr_array_add(terms, term);
+			} else {
+				g_free(term);
+			}
+		}
+		start = NULL;
+
+		if (c == 0)
+			break;
+	}
+
+	g_hash_table_destroy(seen);
+	g_free(folded);
+	return terms;
+}
+
+static void
+log_search_terms_free(GPtrArray *terms)
+{
+	g_ptr_array_foreach(terms, (GFunc)g_free, NULL);
+	g_ptr_array_free(terms, TRUE);
+}
+
+static gint
+log_search_key_compare(gconstpointer a, gconstpointer b)
+{
+	guint64 x = *(const guint64 *)a, y = *(const guint64 *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+log_search_put_varint(GByteArray *out, guint32 value)
+{
+	guint8 byte;
+
+	while (value >= 0x80) {
+		byte = (value & 0x7f) | 0x80;
+		g_byte_array_append(out, &byte, 1);
+		value >>= 7;
+	}
+	byte = value;
+	g_byte_array_append(out, &byte, 1);
+}
+
+static gboolean
+log_search_get_varint(const guint8 **p, const guint8 *end, guint32 *value)
+{
+	int shift = 0;
+
+	*value = 0;
+	while (*p < end && shift < 35) {
+		guint8 byte = *(*p)++;
+		*value |= (guint32)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return TRUE;
+		shift += 7;
+	}
+	return FALSE;
+}
+
+/* Encodes sorted, distinct keys. */
+static void
+log_search_encode(GByteArray *out, GArray *keys)
+{
+	guint32 doc = 0, msg = 0;
+	guint i;
+
+	for (i = 0; i < keys->len; i++) {
+		guint64 key = g_array_index(keys, guint64, i);
+
+		log_search_put_varint(out, LOG_SEARCH_KEY_DOC(key) - doc);
+		if (i > 0 && LOG_SEARCH_KEY_DOC(key) == doc)
+			log_search_put_varint(out, LOG_SEARCH_KEY_MSG(key) - msg);
+		else
+			log_search_put_varint(out, LOG_SEARCH_KEY_MSG(key));
+
+		doc = LOG_SEARCH_KEY_DOC(key);
+		msg = LOG_SEARCH_KEY_MSG(key);
+	}
+}
+
+static void
+log_search_decode(const guint8 *p, gsize len, GArray *keys)
+{
+	const guint8 *end = p + len;
+	guint32 doc = 0, msg = 0, delta, value;
+	gboolean first = TRUE;
+
+	while (p < end) {
+		guint64 key;
+
+		if (!log_search_get_varint(&p, end, &delta) ||
+		    !log_search_get_varint(&p, end, &value))
+			break;
+
+		if (!first && delta == 0)
+			msg += value;
+		else
+			msg = value;
+		doc += delta;
+		first = FALSE;
+
+		key = LOG_SEARCH_KEY(doc, msg);
+		g_array_append_val(keys, key);
+	}
+}
+
+/* Sorts keys and drops duplicates. */
+static void
+log_search_keys_normalize(GArray *keys)
+{
+	guint i, j = 0;
+
+	g_array_sort(keys, log_search_key_compare);
+	for (i = 0; i < keys->len; i++) {
+		if (j > 0 && g_array_index(keys, guint64, i) == g_array_index(keys, guint64, j - 1))
+			continue;
+		g_array_index(keys, guint64, j++) = g_array_index(keys, guint64, i);
+	}
+	g_array_set_size(keys, j);
+}
+
+static void
+log_search_doc_free(struct log_search_doc *doc)
+{
+	g_free(doc->logger);
+	g_free(doc->path);
+	g_free(doc->name);
+	g_free(doc);
+}
+
+static void
+log_search_terms_array_free(GArray *terms)
+{
+	guint i;
+
+	for (i = 0; i < terms->len; i++)
+		g_free(g_array_index(terms, struct log_search_term, i).term);
+	g_array_free(terms, TRUE);
+}
+
+static void log_search_merge_start(struct log_search_index *index);
+static void log_search_merge_abort(struct log_search_index *index);
+
+static void
+log_search_index_free(struct log_search_index *index)
+{
+	/* Its postings go back to the pending file, for next time. */
+	if (index->merge != NULL)
+		log_search_merge_abort(index);
+
+	if (index->docs_file != NULL)
+		fclose(index->docs_file);
+	if (index->pending_file != NULL)
+		fclose(index->pending_file);
+
+	g_ptr_array_foreach(index->docs, (GFunc)log_search_doc_free, NULL);
+	g_ptr_array_free(index->docs, TRUE);
+	g_hash_table_destroy(index->doc_ids);
+	log_search_terms_array_free(index->terms);
+	g_hash_table_destroy(index->pending);
+	g_array_free(index->deleted, TRUE);
+	g_free(index->dir);
+	g_free(index);
+}
+
+static void
+log_search_pending_free(GArray *keys)
+{
+	g_array_free(keys, TRUE);
+}
+
+static GHashTable *
+log_search_pending_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                             (GDestroyNotify)log_search_pending_free);
+}
+
+static void
+log_search_pending_add(struct log_search_index *index, const char *term, guint64 key)
+{
+	GArray *keys = g_hash_table_lookup(index->pending, term);
+
+	if (keys == NULL) {
+		keys = g_array_new(FALSE, FALSE, sizeof(guint64));
+		g_hash_table_insert(index->pending, g_strdup(term), keys);
+	}
+	g_array_append_val(keys, key);
+	index->pending_count++;
+}
+
+static gboolean
+log_search_read_u32(FILE *file, guint32 *value)
+{
+	guint32 raw;
+
+	if (fread(&raw, sizeof(raw), 1, file) != 1)
+		return FALSE;
+	*value = g_ntohl(raw);
+	return TRUE;
+}
+
+static void
+log_search_write_u32(FILE *file, guint32 value)
+{
+	guint32 raw = g_htonl(value);
+	fwrite(&raw, sizeof(raw), 1, file);
+}
+
+static void
+log_search_segment_load(struct log_search_index *index)
+{
+	char *path = g_build_filename(index->dir, "segment", NULL);
+	char magic[4];
+	guint32 count, i;
+	FILE *file;
+
+	file = g_fopen(path, "rb");
+	g_free(path);
+	if (file == NULL)
+		return;
+
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+	    memcmp(magic, LOG_SEARCH_MAGIC, sizeof(magic)) ||
+	    !log_search_read_u32(file, &index->generation) ||
+	    !log_search_read_u32(file, &count))
+	{
+		purple_debug_error("log", "Ignoring corrupt search index in %s\n", index->dir);
+		fclose(file);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct log_search_term term;
+		guint16 len;
+
+		if (fread(&len, sizeof(len), 1, file) != 1)
+			break;
+		len = g_ntohs(len);
+
+		term.term = g_malloc(len + 1);
+		if (fread(term.term, 1, len, file) != len ||
+		    !log_search_read_u32(file, &term.offset) ||
+		    !log_search_read_u32(file, &term.length))
+		{
+			g_free(term.term);
+			break;
+		}
+		term.term[len] = '\0';
+		g_array_append_val(index->terms, term);
+	}
+
+	if (i < count) {
+		purple_debug_error("log", "Ignoring truncated search index in %s\n", index->dir);
+		log_search_terms_array_free(index->terms);
+		index->terms = g_array_new(FALSE, FALSE, sizeof(struct log_search_term));
+		index->generation = 0;
+	}
+
+	index->postings_start = ftell(file);
+	fclose(file);
+}
+
+static void
+log_search_docs_load(struct log_search_index *index)
+{
+	char *path = g_build_filename(index->dir, "docs", NULL);
+	char buf[BUF_LONG];
+	FILE *file;
+
+	if ((file = g_fopen(path, "rb")) != NULL) {
+		while (fgets(buf, sizeof(buf), file) != NULL) {
+			struct log_search_doc *doc;
+			char **fields;
+
+			g_strchomp(buf);
+			fields = g_strsplit(buf, "\t", 6);
+
+			if (g_strv_length(fields) == 6 &&
+			    strtoul(fields[0], NULL, 10) == index->docs->len)
+			{
+				doc = g_new0(struct log_search_doc, 1);
+				doc->type = atoi(fields[1]);
+				doc->time = (time_t)strtoul(fields[2], NULL, 10);
+				doc->logger = g_strdup(fields[3]);
+				doc->path = g_strdup(fields[4]);
+				doc->name = g_strdup(fields[5]);
+				g_ptr_array_add(index->docs, doc);
+				g_hash_table_insert(index->doc_ids, doc->path,
+				                    GUINT_TO_POINTER(index->docs->len));
+			}
+
+			g_strfreev(fields);
+		}
+		fclose(file);
+	}
+
+	index->docs_file = g_fopen(path, "ab");
+	g_free(path);
+
+	path = g_build_filename(index->dir, "deleted", NULL);
+	if ((file = g_fopen(path, "rb")) != NULL) {
+		while (fgets(buf, sizeof(buf), file) != NULL) {
+			guint32 id = strtoul(buf, NULL, 10);
+			struct log_search_doc *doc;
+
+			if (id >= index->docs->len)
+				continue;
+			doc = g_ptr_array_index(index->docs, id);
+			if (!doc->deleted) {
+				doc->deleted = TRUE;
+				g_array_append_val(index->deleted, id);
+			}
+		}
+		fclose(file);
+	}
+	g_free(path);
+}
+
+/* Rewrites the deleted file from index->deleted. */
+static void
+log_search_deleted_write(struct log_search_index *index)
+{
+	char *path = g_build_filename(index->dir, "deleted", NULL);
+	char *tmp_path = g_strconcat(path, ".save", NULL);
+	FILE *file;
+	guint i;
+
+	if (index->deleted->len == 0) {
+		g_unlink(path);
+	} else if ((file = g_fopen(tmp_path, "wb")) == NULL) {
+		purple_debug_error("log", "Unable to write %s: %s\n", tmp_path, g_strerror(errno));
+	} else {
+		for (i = 0; i < index->deleted->len; i++)
+			fprintf(file, "%u\n", g_array_index(index->deleted, guint32, i));
+		if (fclose(file) || g_rename(tmp_path, path)) {
+			purple_debug_error("log", "Unable to write %s\n", path);
+			g_unlink(tmp_path);
+		}
+	}
+
+	g_free(tmp_path);
+	g_free(path);
+}
+
+/*
+ * Opens the pending file for appending, or starts a new one.  While a merge
+ * runs, new postings are on top of the segment it is writing.
+ */
+static void
+log_search_pending_open(struct log_search_index *index, gboolean truncate)
+{
+	char *path = g_build_filename(index->dir, "pending", NULL);
+
+	if (index->pending_file != NULL)
+		fclose(index->pending_file);
+
+	index->pending_file = g_fopen(path, truncate ? "wb" : "ab");
+	if (index->pending_file == NULL)
+		purple_debug_error("log", "Unable to open %s: %s\n", path, g_strerror(errno));
+	else if (truncate)
+		fprintf(index->pending_file, LOG_SEARCH_PENDING_HEADER " %u\n",
+		        index->generation + (index->merge != NULL ? 1 : 0));
+
+	g_free(path);
+}
+
+static void
+log_search_pending_write_keys(gpointer key, gpointer value, gpointer user_data)
+{
+	GArray *keys = value;
+	guint i;
+
+	for (i = 0; i < keys->len; i++) {
+		guint64 k = g_array_index(keys, guint64, i);
+		fprintf(user_data, "%s\t%u\t%u\n", (char *)key,
+		        LOG_SEARCH_KEY_DOC(k), LOG_SEARCH_KEY_MSG(k));
+	}
+}
+
+/*
+ * Writes everything pending to a new pending file, replacing both it and
+ * any pending.merging from a merge that didn't finish.
+ */
+static void
+log_search_pending_rewrite(struct log_search_index *index)
+{
+	char *path = g_build_filename(index->dir, "pending", NULL);
+	char *tmp_path = g_strconcat(path, ".save", NULL);
+	char *merging_path = g_strconcat(path, ".merging", NULL);
+	FILE *file;
+
+	if (index->pending_file != NULL) {
+		fclose(index->pending_file);
+		index->pending_file = NULL;
+	}
+
+	if ((file = g_fopen(tmp_path, "wb")) != NULL) {
+		fprintf(file, LOG_SEARCH_PENDING_HEADER " %u\n", index->generation);
+		g_hash_table_foreach(index->pending, log_search_pending_write_keys, file);
+		if (fclose(file) || g_rename(tmp_path, path)) {
+			purple_debug_error("log", "Unable to write %s\n", path);
+			g_unlink(tmp_path);
+		} else {
+			g_unlink(merging_path);
+		}
+	} else {
+		purple_debug_error("log", "Unable to write %s: %s\n", tmp_path, g_strerror(errno));
+	}
+
+	log_search_pending_open(index, FALSE);
+
+	g_free(merging_path);
+	g_free(tmp_path);
+	g_free(path);
+}
+
+/*
+ * Reads a pending file into index->pending, unless it is older than the
+ * segment and so already merged.
+ */
+static gboolean
+log_search_pending_read(struct log_search_index *index, const char *name,
+                        guint *generation)
+{
+	char *path = g_build_filename(index->dir, name, NULL);
+	char buf[BUF_LONG];
+	FILE *file;
+	gboolean current = FALSE;
+
+	if ((file = g_fopen(path, "rb")) != NULL) {
+		if (fgets(buf, sizeof(buf), file) != NULL &&
+		    sscanf(buf, LOG_SEARCH_PENDING_HEADER " %u", generation) == 1 &&
+		    *generation >= index->generation)
+		{
+			current = TRUE;
+			while (fgets(buf, sizeof(buf), file) != NULL) {
+				char *doc, *msg;
+
+				if (strchr(buf, '\n') == NULL ||
+				    (doc = strchr(buf, '\t')) == NULL ||
+				    (msg = strchr(doc + 1, '\t')) == NULL)
+					continue;
+				*doc++ = '\0';
+				*msg++ = '\0';
+
+				log_search_pending_add(index, buf,
+						LOG_SEARCH_KEY(strtoul(doc, NULL, 10),
+						               strtoul(msg, NULL, 10)));
+			}
+		}
+		fclose(file);
+	}
+	g_free(path);
+
+	return current;
+}
+
+static void
+log_search_pending_load(struct log_search_index *index)
+{
+	guint generation = 0, merging_generation;
+	gboolean merging, current;
+
+	merging = log_search_pending_read(index, "pending.merging", &merging_generation);
+	current = log_search_pending_read(index, "pending", &generation);
+
+	/* A merge was cut short, and left its postings in two files. */
+	if (merging || (current && generation != index->generation))
+		log_search_pending_rewrite(index);
+	else
+		log_search_pending_open(index, !current);
+}
+
+static struct log_search_index *
+log_search_index_get(PurpleAccount *account)
+{
+	struct log_search_index *index;
+	char *protocol, *username;
+
+	index = g_hash_table_lookup(log_search_indexes, account);
+	if (index != NULL)
+		return index;
+
+	protocol = g_strdup(purple_escape_filename(purple_account_get_protocol_id(account)));
+	username = g_strdup(purple_escape_filename(purple_normalize(account,
+				purple_account_get_username(account))));
+
+	index = g_new0(struct log_search_index, 1);
+	index->dir = g_build_filename(purple_user_dir(), "logsearch", protocol, username, NULL);
+	index->docs = g_ptr_array_new();
+	index->doc_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	index->terms = g_array_new(FALSE, FALSE, sizeof(struct log_search_term));
+	index->pending = log_search_pending_new();
+	index->deleted = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	g_free(protocol);
+	g_free(username);
+
+	purple_build_dir(index->dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	log_search_segment_load(index);
+	log_search_docs_load(index);
+	log_search_pending_load(index);
+
+	g_hash_table_insert(log_search_indexes, account, index);
+
+	/* Logs deleted last time, before their postings could be purged */
+	if (index->deleted->len > 0)
+		log_search_merge_start(index);
+
+	return index;
+}
+
+static struct log_search_term *
+log_search_find_term(struct log_search_index *index, const char *term)
+{
+	guint low = 0, high = index->terms->len;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+		struct log_search_term *entry =
+			&g_array_index(index->terms, struct log_search_term, mid);
+		int cmp = strcmp(term, entry->term);
+
+		if (cmp == 0)
+			return entry;
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
+static gboolean
+log_search_read_segment_postings(struct log_search_index *index, FILE *segment,
+                                 struct log_search_term *term, GArray *keys)
+{
+	guint8 *data;
+
+	if (term == NULL || term->length == 0)
+		return TRUE;
+
+	data = g_malloc(term->length);
+	if (fseek(segment, index->postings_start + term->offset, SEEK_SET) ||
+	    fread(data, 1, term->length, segment) != term->length)
+	{
+		g_free(data);
+		return FALSE;
+	}
+
+	log_search_decode(data, term->length, keys);
+	g_free(data);
+	return TRUE;
+}
+
+/* Returns the sorted postings for a term, from the segment and pending. */
+static GArray *
+log_search_postings(struct log_search_index *index, FILE *segment, const char *term)
+{
+	GArray *keys = g_array_new(FALSE, FALSE, sizeof(guint64));
+	GArray *pending;
+	guint len;
+
+	if (segment != NULL)
+		log_search_read_segment_postings(index, segment,
+				log_search_find_term(index, term), keys);
+	len = keys->len;
+
+	/* Including what a merge in progress has yet to write */
+	if ((pending = g_hash_table_lookup(index->pending, term)) != NULL)
+		g_array_append_vals(keys, pending->data, pending->len);
+	if (index->merge != NULL &&
+	    (pending = g_hash_table_lookup(index->merge->pending, term)) != NULL)
+		g_array_append_vals(keys, pending->data, pending->len);
+	if (keys->len > len)
+		log_search_keys_normalize(keys);
+
+	return keys;
+}
+
+static gboolean
+log_search_doc_deleted(struct log_search_index *index, guint32 id)
+{
+	return id < index->docs->len &&
+		((struct log_search_doc *)g_ptr_array_index(index->docs, id))->deleted;
+}
+
+/* Drops the postings of deleted logs. */
+static void
+log_search_keys_purge(struct log_search_index *index, GArray *keys)
+{
+	guint i, j = 0;
+
+	for (i = 0; i < keys->len; i++) {
+		guint64 key = g_array_index(keys, guint64, i);
+		if (!log_search_doc_deleted(index, LOG_SEARCH_KEY_DOC(key)))
+			g_array_index(keys, guint64, j++) = key;
+	}
+	g_array_set_size(keys, j);
+}
+
+/* Copies @a len bytes from the current position of one file to another. */
+static gboolean
+log_search_copy(FILE *from, FILE *to, guint32 len)
+{
+	guint8 buf[8192];
+
+	while (len > 0) {
+		size_t n = fread(buf, 1, MIN(len, sizeof(buf)), from);
+		if (n == 0 || fwrite(buf, 1, n, to) != n)
+			return FALSE;
+		len -= n;
+	}
+
+	return TRUE;
+}
+
+static void
+log_search_collect_pending(gpointer key, gpointer value, gpointer user_data)
+{
+	g_ptr_array_add(user_data, key);
+}
+
+static gint
+log_search_str_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+log_search_merge_free(struct log_search_index *index, struct log_search_merge *merge)
+{
+	char *path;
+
+	if (merge->timer != 0)
+		purple_timeout_remove(merge->timer);
+
+	if (merge->old != NULL)
+		fclose(merge->old);
+	if (merge->postings != NULL)
+		fclose(merge->postings);
+	path = g_build_filename(index->dir, "segment.postings", NULL);
+	g_unlink(path);
+	g_free(path);
+	if (merge->out != NULL) {
+		fclose(merge->out);
+		path = g_build_filename(index->dir, "segment.save", NULL);
+		g_unlink(path);
+		g_free(path);
+	}
+
+	if (merge->terms != NULL)
+		log_search_terms_array_free(merge->terms);
+	g_ptr_array_free(merge->pending_terms, TRUE);
+	g_hash_table_destroy(merge->pending);
+	g_free(merge);
+}
+
+static void
+log_search_pending_restore(gpointer key, gpointer value, gpointer user_data)
+{
+	GArray *keys = value;
+	guint i;
+
+	for (i = 0; i < keys->len; i++)
+		log_search_pending_add(user_data, key, g_array_index(keys, guint64, i));
+}
+
+/* Gives up on a merge, putting what it was merging back in pending. */
+static void
+log_search_merge_abort(struct log_search_index *index)
+{
+	struct log_search_merge *merge = index->merge;
+
+	index->merge = NULL;
+	g_hash_table_foreach(merge->pending, log_search_pending_restore, index);
+	log_search_merge_free(index, merge);
+	log_search_pending_rewrite(index);
+}
+
+/*
+ * Merges the next term into the new segment.  Its posting list is only
+ * rebuilt if it has pending postings or deleted logs are being purged; if
+ * not, it is copied as it is.
+ */
+static gboolean
+log_search_merge_term(struct log_search_index *index)
+{
+	struct log_search_merge *merge = index->merge;
+	struct log_search_term *t = (merge->i < index->terms->len) ?
+		&g_array_index(index->terms, struct log_search_term, merge->i) : NULL;
+	const char *p = (merge->j < merge->pending_terms->len) ?
+		g_ptr_array_index(merge->pending_terms, merge->j) : NULL;
+	int cmp = (t == NULL) ? 1 : (p == NULL) ? -1 : strcmp(t->term, p);
+	struct log_search_term term;
+	GArray *pending = NULL;
+
+	if (cmp <= 0) {
+		term.term = t->term;
+		merge->i++;
+	} else {
+		t = NULL;
+	}
+	if (cmp >= 0) {
+		term.term = (char *)p;
+		pending = g_hash_table_lookup(merge->pending, p);
+		merge->j++;
+	}
+
+	if (pending == NULL && merge->purged == 0) {
+		if (fseek(merge->old, index->postings_start + t->offset, SEEK_SET) ||
+		    !log_search_copy(merge->old, merge->postings, t->length))
+			return FALSE;
+		term.length = t->length;
+	} else {
+		GArray *keys = g_array_new(FALSE, FALSE, sizeof(guint64));
+		GByteArray *postings;
+		gboolean ok;
+
+		if (t != NULL && (merge->old == NULL ||
+		    !log_search_read_segment_postings(index, merge->old, t, keys)))
+		{
+			g_array_free(keys, TRUE);
+			return FALSE;
+		}
+		if (pending != NULL) {
+			g_array_append_vals(keys, pending->data, pending->len);
+			log_search_keys_normalize(keys);
+		}
+		if (merge->purged > 0)
+			log_search_keys_purge(index, keys);
+
+		/* Every posting was for a deleted log */
+		if (keys->len == 0) {
+			g_array_free(keys, TRUE);
+			return TRUE;
+		}
+
+		postings = g_byte_array_new();
+		log_search_encode(postings, keys);
+		ok = (fwrite(postings->data, 1, postings->len, merge->postings) == postings->len);
+		term.length = postings->len;
+		g_byte_array_free(postings, TRUE);
+		g_array_free(keys, TRUE);
+		if (!ok)
+			return FALSE;
+	}
+
+	term.term = g_strdup(term.term);
+	term.offset = merge->offset;
+	merge->offset += term.length;
+	g_array_append_val(merge->terms, term);
+
+	return TRUE;
+}
+
+/* Starts the new segment, once every term has been merged. */
+static gboolean
+log_search_merge_write_dictionary(struct log_search_index *index)
+{
+	struct log_search_merge *merge = index->merge;
+	char *path = g_build_filename(index->dir, "segment.save", NULL);
+	guint k;
+
+	merge->out = g_fopen(path, "wb");
+	g_free(path);
+	if (merge->out == NULL)
+		return FALSE;
+
+	fwrite(LOG_SEARCH_MAGIC, 4, 1, merge->out);
+	log_search_write_u32(merge->out, index->generation + 1);
+	log_search_write_u32(merge->out, merge->terms->len);
+
+	for (k = 0; k < merge->terms->len; k++) {
+		struct log_search_term *t = &g_array_index(merge->terms, struct log_search_term, k);
+		guint16 len = g_htons(strlen(t->term));
+
+		fwrite(&len, sizeof(len), 1, merge->out);
+		fwrite(t->term, 1, strlen(t->term), merge->out);
+		log_search_write_u32(merge->out, t->offset);
+		log_search_write_u32(merge->out, t->length);
+	}
+
+	if (merge->old != NULL) {
+		fclose(merge->old);
+		merge->old = NULL;
+	}
+	merge->left = merge->offset;
+
+	return fflush(merge->postings) == 0 && fseek(merge->postings, 0, SEEK_SET) == 0;
+}
+
+/* Puts the new segment in place of the old one. */
+static gboolean
+log_search_merge_commit(struct log_search_index *index)
+{
+	struct log_search_merge *merge = index->merge;
+	char *path = g_build_filename(index->dir, "segment", NULL);
+	char *tmp_path = g_strconcat(path, ".save", NULL);
+	gboolean ok;
+	guint k;
+
+	ok = (fclose(merge->out) == 0);
+	merge->out = NULL;
+	if (!ok || g_rename(tmp_path, path)) {
+		purple_debug_error("log", "Unable to write search index %s\n", path);
+		g_unlink(tmp_path);
+		g_free(tmp_path);
+		g_free(path);
+		return FALSE;
+	}
+	g_free(tmp_path);
+	g_free(path);
+
+	log_search_terms_array_free(index->terms);
+	index->terms = merge->terms;
+	merge->terms = NULL;
+	index->postings_start = 4 + 4 + 4;
+	for (k = 0; k < index->terms->len; k++)
+		index->postings_start += 2 + strlen(g_array_index(index->terms,
+				struct log_search_term, k).term) + 4 + 4;
+	index->generation++;
+
+	/* The pending file was started for this generation */
+	path = g_build_filename(index->dir, "pending.merging", NULL);
+	g_unlink(path);
+	g_free(path);
+
+	if (merge->purged > 0) {
+		g_array_remove_range(index->deleted, 0, merge->purged);
+		log_search_deleted_write(index);
+	}
+
+	index->merge = NULL;
+	merge->timer = 0;
+	log_search_merge_free(index, merge);
+
+	return TRUE;
+}
+
+/*
+ * Does the next bit of a merge: first LOG_SEARCH_MERGE_TERMS terms' posting
+ * lists, then, once they are all done, LOG_SEARCH_MERGE_BYTES of them at a
+ * time into the new segment after its dictionary.
+ */
+static gboolean
+log_search_merge_cb(gpointer data)
+{
+	struct log_search_index *index = data;
+	struct log_search_merge *merge = index->merge;
+	gboolean ok = TRUE;
+
+	if (merge->out == NULL) {
+		guint n;
+
+		for (n = 0; ok && n < LOG_SEARCH_MERGE_TERMS &&
+		     (merge->i < index->terms->len || merge->j < merge->pending_terms->len); n++)
+			ok = log_search_merge_term(index);
+
+		if (ok && merge->i >= index->terms->len && merge->j >= merge->pending_terms->len)
+			ok = log_search_merge_write_dictionary(index);
+	} else {
+		guint32 n = MIN(merge->left, LOG_SEARCH_MERGE_BYTES);
+
+		ok = log_search_copy(merge->postings, merge->out, n);
+		merge->left -= n;
+
+		if (ok && merge->left == 0) {
+			if (log_search_merge_commit(index)) {
+				/* More may have piled up in the meantime */
+				if (index->pending_count >=
+				    (guint)purple_prefs_get_int("/purple/logging/search_merge_postings") ||
+				    index->deleted->len > 0)
+					log_search_merge_start(index);
+				return FALSE;
+			}
+			ok = FALSE;
+		}
+	}
+
+	if (!ok) {
+		purple_debug_error("log", "Unable to merge search index %s\n", index->dir);
+		merge->timer = 0;
+		log_search_merge_abort(index);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Starts merging everything pending, and purging deleted logs, into a new
+ * segment.  Postings added meanwhile go to a new pending table and file.
+ */
+static void
+log_search_merge_start(struct log_search_index *index)
+{
+	struct log_search_merge *merge;
+	char *path, *merging_path;
+
+	if (index->merge != NULL)
+		return;
+
+	merge = g_new0(struct log_search_merge, 1);
+	merge->pending = index->pending;
+	merge->pending_terms = g_ptr_array_new();
+	g_hash_table_foreach(merge->pending, log_search_collect_pending, merge->pending_terms);
+	g_ptr_array_sort(merge->pending_terms, log_search_str_compare);
+	merge->purged = index->deleted->len;
+	merge->terms = g_array_new(FALSE, FALSE, sizeof(struct log_search_term));
+
+	index->pending = log_search_pending_new();
+	index->pending_count = 0;
+	index->merge = merge;
+
+	path = g_build_filename(index->dir, "segment", NULL);
+	if (index->terms->len > 0)
+		merge->old = g_fopen(path, "rb");
+	g_free(path);
+	path = g_build_filename(index->dir, "segment.postings", NULL);
+	merge->postings = g_fopen(path, "w+b");
+	g_free(path);
+
+	if ((index->terms->len > 0 && merge->old == NULL) || merge->postings == NULL) {
+		purple_debug_error("log", "Unable to merge search index %s\n", index->dir);
+		log_search_merge_abort(index);
+		return;
+	}
+
+	/* Set the pending file aside until the new segment is in place */
+	if (index->pending_file != NULL) {
+		fclose(index->pending_file);
+		index->pending_file = NULL;
+	}
+	path = g_build_filename(index->dir, "pending", NULL);
+	merging_path = g_strconcat(path, ".merging", NULL);
+	if (g_rename(path, merging_path)) {
+		purple_debug_error("log", "Unable to rename %s: %s\n", path, g_strerror(errno));
+		g_free(merging_path);
+		g_free(path);
+		log_search_merge_abort(index);
+		return;
+	}
+	g_free(merging_path);
+	g_free(path);
+	log_search_pending_open(index, TRUE);
+
+	merge->timer = purple_timeout_add(0, log_search_merge_cb, index);
+}
+
+/* Adds message number @a msg of @a log to the search index. */
+static void
+log_search_add(PurpleLog *log, guint msg, const char *message)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	struct log_search_index *index;
+	GPtrArray *terms;
+	guint doc, i;
+	char *plain;
+
+	if (log->account == NULL || data == NULL || data->path == NULL ||
+	    !purple_prefs_get_bool("/purple/logging/search_index"))
+		return;
+
+	index = log_search_index_get(log->account);
+
+	doc = GPOINTER_TO_UINT(g_hash_table_lookup(index->doc_ids, data->path));
+	if (doc == 0) {
+		struct log_search_doc *d = g_new0(struct log_search_doc, 1);
+
+		d->type = log->type;
+		d->time = log->time;
+		d->logger = g_strdup(log->logger->id);
+		d->path = g_strdup(data->path);
+		d->name = g_strdup(log->name);
+		g_ptr_array_add(index->docs, d);
+		doc = index->docs->len;
+		g_hash_table_insert(index->doc_ids, d->path, GUINT_TO_POINTER(doc));
+
+		if (index->docs_file != NULL) {
+			fprintf(index->docs_file, "%u\t%d\t%lu\t%s\t%s\t%s\n", doc - 1,
+			        d->type, (unsigned long)d->time, d->logger, d->path, d->name);
+			fflush(index->docs_file);
+		}
+	}
+	doc--;
+
+	plain = purple_markup_strip_html(message);
+	terms = log_search_tokenize(plain);
+	g_free(plain);
+
+	for (i = 0; i < terms->len; i++) {
+		const char *term = g_ptr_array_index(terms, i);
+
+		log_search_pending_add(index, term, LOG_SEARCH_KEY(doc, msg));
+		if (index->pending_file != NULL)
+			fprintf(index->pending_file, "%s\t%u\t%u\n", term, doc, msg);
+	}
+	if (index->pending_file != NULL)
+		fflush(index->pending_file);
+
+	log_search_terms_free(terms);
+
+	if (index->pending_count >=
+	    (guint)purple_prefs_get_int("/purple/logging/search_merge_postings"))
+		log_search_merge_start(index);
+}
+
+/* Forgets a deleted log, and has its postings purged. */
+static void
+log_search_remove(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	struct log_search_index *index;
+	struct log_search_doc *doc;
+	guint32 id;
+	char *path;
+	FILE *file;
+
+	if (log->account == NULL || data == NULL || data->path == NULL)
+		return;
+
+	index = log_search_index_get(log->account);
+
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(index->doc_ids, data->path));
+	if (id == 0)
+		return;
+	id--;
+
+	/* Another log written to the same file later is another document */
+	doc = g_ptr_array_index(index->docs, id);
+	g_hash_table_remove(index->doc_ids, doc->path);
+	doc->deleted = TRUE;
+	g_array_append_val(index->deleted, id);
+
+	path = g_build_filename(index->dir, "deleted", NULL);
+	if ((file = g_fopen(path, "ab")) != NULL) {
+		fprintf(file, "%u\n", id);
+		fclose(file);
+	} else {
+		purple_debug_error("log", "Unable to open %s: %s\n", path, g_strerror(errno));
+	}
+	g_free(path);
+
+	log_search_merge_start(index);
+}
+
+static GArray *
+log_search_intersect(GArray *a, GArray *b)
+{
+	GArray *out = g_array_new(FALSE, FALSE, sizeof(guint64));
+	guint i = 0, j = 0;
+
+	while (i < a->len && j < b->len) {
+		guint64 x = g_array_index(a, guint64, i);
+		guint64 y = g_array_index(b, guint64, j);
+
+		if (x == y) {
+			g_array_append_val(out, x);
+			i++;
+			j++;
+		} else if (x < y) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+
+	return out;
+}
+
+GList *
+purple_log_search(PurpleAccount *account, const char *query, guint limit)
+{
+	struct log_search_index *index;
+	GPtrArray *terms;
+	GArray *matches = NULL;
+	GList *results = NULL;
+	FILE *segment = NULL;
+	guint i, found = 0;
+
+	g_return_val_if_fail(account != NULL, NULL);
+	g_return_val_if_fail(query != NULL, NULL);
+
+	index = log_search_index_get(account);
+	terms = log_search_tokenize(query);
+
+	if (index->terms->len > 0) {
+		char *path = g_build_filename(index->dir, "segment", NULL);
+		segment = g_fopen(path, "rb");
+		g_free(path);
+	}
+
+	/* Every term has to match. */
+	for (i = 0; i < terms->len; i++) {
+		GArray *keys = log_search_postings(index, segment, g_ptr_array_index(terms, i));
+
+		if (matches != NULL) {
+			GArray *both = log_search_intersect(matches, keys);
+			g_array_free(matches, TRUE);
+			g_array_free(keys, TRUE);
+			matches = both;
+		} else {
+			matches = keys;
+		}
+
+		if (matches->len == 0)
+			break;
+	}
+
+	if (segment != NULL)
+		fclose(segment);
+	log_search_terms_free(terms);
+
+	if (matches == NULL)
+		return NULL;
+
+	/* Newest logs were added last. */
+	for (i = matches->len; i > 0 && (limit == 0 || found < limit); i--) {
+		guint64 key = g_array_index(matches, guint64, i - 1);
+		struct log_search_doc *doc;
+		PurpleLogSearchResult *result;
+		PurpleLogCommonLoggerData *data;
+		PurpleLogLogger *logger = NULL;
+		PurpleLog *log;
+		GSList *l;
+
+		if (LOG_SEARCH_KEY_DOC(key) >= index->docs->len)
+			continue;
+		doc = g_ptr_array_index(index->docs, LOG_SEARCH_KEY_DOC(key));
+		if (doc->deleted)
+			continue;
+
+		for (l = loggers; l != NULL; l = l->next) {
+			if (!strcmp(((PurpleLogLogger *)l->data)->id, doc->logger))
+				logger = l->data;
+		}
+		if (logger != html_logger && logger != txt_logger)
+			continue;
+
+		log = purple_log_new(doc->type, doc->name, account, NULL, doc->time, NULL);
+		log->logger = logger;
+		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+		data->path = g_strdup(doc->path);
+
+		result = g_new(PurpleLogSearchResult, 1);
+		result->log = log;
+		result->message = LOG_SEARCH_KEY_MSG(key);
+		results = g_list_prepend(results, result);
+		found++;
+	}
+
+	g_array_free(matches, TRUE);
+
+	return g_list_reverse(results);
+}
+
+void
+purple_log_search_result_free(PurpleLogSearchResult *result)
+{
+	g_return_if_fail(result != NULL);
+
+	purple_log_free(result->log);
+	g_free(result);
+}
+
+void purple_log_common_writer(PurpleLog *log, const char *ext)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if (data == NULL)
+	{
+		/* This log is new */
+		char *dir;
+		struct tm *tm;
+		const char *tz;
+		const char *date;
+		char *filename;
+		char *path;
+
+		dir = purple_log_get_log_dir(log->type, log->name, log->account);
+		if (dir == NULL)
+			return;
+
+		purple_build_dir (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+		tm = localtime(&log->time);
+		tz = purple_escape_filename(purple_utf8_strftime("%Z", tm));
+		date = purple_utf8_strftime("%Y-%m-%d.%H%M%S%z", tm);
+
+		filename = g_strdup_printf("%s%s%s", date, tz, ext ? ext : "");
+
+		path = g_build_filename(dir, filename, NULL);
+		g_free(dir);
+		g_free(filename);
+
+		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+
+		data->file = g_fopen(path, "a");
+		log_dir_index_invalidate(path);
+		if (data->file == NULL)
+		{
+			purple_debug(PURPLE_DEBUG_ERROR, "log",
+					"Could not create log file %s\n", path);
+
+			if (log->conv != NULL)
+				purple_conversation_write(log->conv, NULL, _("Logging of this conversation failed."),
+										PURPLE_MESSAGE_ERROR, time(NULL));
+
+			g_free(path);
+			return;
+		}
+		data->path = path;
+	}
+}
+
+GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
+{
+	GList *entries = NULL, *l;
+	GList *list = NULL;
+	const char *filename;
+	char *path;
+
+	if(!account)
+		return NULL;
+
+	path = purple_log_get_log_dir(type, name, account);
+	if (path == NULL)
+		return NULL;
+
+	log_dir_index_get(path, ext, &entries, NULL);
+
+	for (l = entries; l != NULL; l = l->next)
+	{
+		filename = ((struct log_dir_entry *)l->data)->filename;
+
+		if (purple_str_has_suffix(filename, ext) &&
+		    strlen(filename) >= (17 + strlen(ext)))
+		{
+			PurpleLog *log;
+			PurpleLogCommonLoggerData *data;
+			struct tm tm;
+#if defined (HAVE_TM_GMTOFF) && defined (HAVE_STRUCT_TM_TM_ZONE)
+			long tz_off;
+			const char *rest;
+			time_t stamp = purple_str_to_time(purple_unescape_filename(filename), FALSE, &tm, &tz_off, &rest);
+			char *end;
+
+			/* As zero is a valid offset, PURPLE_NO_TZ_OFF means no offset was
+			 * provided. See util.h. Yes, it's kinda ugly. */
+			if (tz_off != PURPLE_NO_TZ_OFF)
+				tm.tm_gmtoff = tz_off - tm.tm_gmtoff;
+
+			if (stamp == 0 || rest == NULL || (end = strchr(rest, '.')) == NULL || strchr(rest, ' ') != NULL)
+			{
+				log = purple_log_new(type, name, account, NULL, stamp, NULL);
+			}
+			else
+			{
+				char *tmp = g_strndup(rest, end - rest);
+				tm.tm_zone = tmp;
+				log = purple_log_new(type, name, account, NULL, stamp, &tm);
+				g_free(tmp);
+			}
+#else
+			time_t stamp = purple_str_to_time(filename, FALSE, &tm, NULL, NULL);
+
+			log = purple_log_new(type, name, account, NULL, stamp, (stamp != 0) ?  &tm : NULL);
+#endif
+
+			log->logger = logger;
+			log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+
+			data->path = g_build_filename(path, filename, NULL);
+			list = g_list_prepend(list, log);
+		}
+	}
+	log_dir_entries_free(entries);
+	g_free(path);
+	return list;
+}
+
+int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
+{
+	long size;
+	char *path;
+
+	if(!account)
+		return 0;
+
+	path = purple_log_get_log_dir(type, name, account);
+	if (path == NULL)
+		return 0;
+
+	log_dir_index_get(path, ext, NULL, &size);
+	g_free(path);
+	return size;
+}
+
+int purple_log_common_sizer(PurpleLog *log)
+{
+	struct stat st;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	long size;
+
+	g_return_val_if_fail(data != NULL, 0);
+
+	/* Part of a log still being written may not be on disk yet. */
+	if (data->path != NULL && (size = log_writer_get_size(data->path)) >= 0)
+		return size;
+
+	if (!data->path || g_stat(data->path, &st))
+		st.st_size = 0;
+
+	return st.st_size;
+}
+
+/* This will build log sets for all loggers that use the common logger
+ * functions because they use the same directory structure. */
+static void log_get_log_sets_common(GHashTable *sets)
+{
+	gchar *log_path = g_build_filename(purple_user_dir(), "logs", NULL);
+	GDir *log_dir = g_dir_open(log_path, 0, NULL);
+	const gchar *protocol;
+
+	if (log_dir == NULL) {
+		g_free(log_path);
+		return;
+	}
+
+	while ((protocol = g_dir_read_name(log_dir)) != NULL) {
+		gchar *protocol_path = g_build_filename(log_path, protocol, NULL);
+		GDir *protocol_dir;
+		const gchar *username;
+		gchar *protocol_unescaped;
+		GList *account_iter;
+		GList *accounts = NULL;
+
+		if ((protocol_dir = g_dir_open(protocol_path, 0, NULL)) == NULL) {
+			g_free(protocol_path);
+			continue;
+		}
+
+		/* Using g_strdup() to cover the one-in-a-million chance that a
+		 * prpl's list_icon function uses purple_unescape_filename(). */
+		protocol_unescaped = g_strdup(purple_unescape_filename(protocol));
+
+		/* Find all the accounts for protocol. */
+		for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
+			PurplePlugin *prpl;
+			PurplePluginProtocolInfo *prpl_info;
+
+			prpl = purple_find_prpl(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
+			if (!prpl)
+				continue;
+			prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(prpl);
+
+			if (!strcmp(protocol_unescaped, prpl_info->list_icon((PurpleAccount *)account_iter->data, NULL)))
+				accounts = g_list_prepend(accounts, account_iter->data);
+		}
+		g_free(protocol_unescaped);
+
+		while ((username = g_dir_read_name(protocol_dir)) != NULL) {
+			gchar *username_path = g_build_filename(protocol_path, username, NULL);
+			GDir *username_dir;
+			const gchar *username_unescaped;
+			PurpleAccount *account = NULL;
+			gchar *name;
+
+			if ((username_dir = g_dir_open(username_path, 0, NULL)) == NULL) {
+				g_free(username_path);
+				continue;
+			}
+
+			/* Find the account for username in the list of accounts for protocol. */
+			username_unescaped = purple_unescape_filename(username);
+			for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
+				if (!strcmp(((PurpleAccount *)account_iter->data)->username, username_unescaped)) {
+					account = account_iter->data;
+					break;
 				}
 			}
 
@@ -1104,7 +3464,15 @@ gboolean purple_log_common_deleter(PurpleLog *log)
 
 	ret = g_unlink(data->path);
 	if (ret == 0)
+	{
+		char *index_path = g_strconcat(data->path, LOG_INDEX_EXT, NULL);
+		if (g_file_test(index_path, G_FILE_TEST_EXISTS))
+			g_unlink(index_path);
+		g_free(index_path);
+		log_dir_index_invalidate(data->path);
+		log_search_remove(log);
 		return TRUE;
+	}
 	else if (ret == -1)
 	{
 		purple_debug_error("log", "Failed to delete: %s - %s\n", data->path, strerror(errno));
@@ -1302,7 +3670,9 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	char *header;
 	PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
+	struct log_writer *writer;
 	gsize written = 0;
+	long offset;
 
 	if(!data) {
 		const char *prpl =
@@ -1316,11 +3686,13 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 		if(!data->file)
 			return 0;
 
+		writer = log_writer_new(data);
+
 		date = purple_date_format_full(localtime(&log->time));
 
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
+		written += log_writer_printf(writer, "<html><head>");
+		written += log_writer_printf(writer, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		written += log_writer_printf(writer, "<title>");
 		if (log->type == PURPLE_LOG_SYSTEM)
 			header = g_strdup_printf("System log for account %s (%s) connected at %s",
 					purple_account_get_username(log->account), prpl, date);
@@ -1328,16 +3700,18 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
 					log->name, date, purple_account_get_username(log->account), prpl);
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
+		written += log_writer_printf(writer, "%s", header);
+		written += log_writer_printf(writer, "</title></head><body>");
+		written += log_writer_printf(writer, "<h3>%s</h3>\n", header);
 		g_free(header);
 	}
 
 	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if((writer = data->extra_data) == NULL)
 		return 0;
 
+	offset = writer->size;
+
 	image_corrected_msg = convert_image_tags(log, message);
 	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
 
@@ -1349,45 +3723,46 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
+		written += log_writer_printf(writer, "---- %s @ %s ----<br/>\n", msg_fixed, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
+			written += log_writer_printf(writer, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
+			written += log_writer_printf(writer, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
+			written += log_writer_printf(writer, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+			written += log_writer_printf(writer, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
 					date, from, msg_fixed);
 		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
 			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
+				written += log_writer_printf(writer, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
 			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
+				written += log_writer_printf(writer, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_RECV) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				written += log_writer_printf(writer, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				written += log_writer_printf(writer, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_SEND) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				written += log_writer_printf(writer, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				written += log_writer_printf(writer, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		} else {
 			purple_debug_error("log", "Unhandled message type.");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+			written += log_writer_printf(writer, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		}
 	}
 	g_free(date);
 	g_free(msg_fixed);
-	fflush(data->file);
+
+	log_writer_message_done(writer, offset, time);
 
 	return written;
 }
@@ -1396,9 +3771,9 @@ static void html_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
-		if(data->file) {
-			fprintf(data->file, "</body></html>\n");
-			fclose(data->file);
+		if(data->extra_data) {
+			log_writer_printf(data->extra_data, "</body></html>\n");
+			log_writer_finish(data->extra_data);
 		}
 		g_free(data->path);
 
@@ -1455,8 +3830,10 @@ static gsize txt_logger_write(PurpleLog *log,
 	PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	char *stripped = NULL;
+	struct log_writer *writer;
 
 	gsize written = 0;
+	long offset;
 
 	if (data == NULL) {
 		/* This log is new.  We could use the loggers 'new' function, but
@@ -1473,56 +3850,61 @@ static gsize txt_logger_write(PurpleLog *log,
 		if(!data->file)
 			return 0;
 
+		writer = log_writer_new(data);
+
 		if (log->type == PURPLE_LOG_SYSTEM)
-			written += fprintf(data->file, "System log for account %s (%s) connected at %s\n",
+			written += log_writer_printf(writer, "System log for account %s (%s) connected at %s\n",
 				purple_account_get_username(log->account), prpl,
 				purple_date_format_full(localtime(&log->time)));
 		else
-			written += fprintf(data->file, "Conversation with %s at %s on %s (%s)\n",
+			written += log_writer_printf(writer, "Conversation with %s at %s on %s (%s)\n",
 				log->name, purple_date_format_full(localtime(&log->time)),
 				purple_account_get_username(log->account), prpl);
 	}
 
 	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if((writer = data->extra_data) == NULL)
 		return 0;
 
+	offset = writer->size;
+
 	stripped = purple_markup_strip_html(message);
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----\n", stripped, date);
+		written += log_writer_printf(writer, "---- %s @ %s ----\n", stripped, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SEND ||
 			type & PURPLE_MESSAGE_RECV) {
 			if (type & PURPLE_MESSAGE_AUTO_RESP) {
-				written += fprintf(data->file, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
+				written += log_writer_printf(writer, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
 						from, stripped);
 			} else {
 				if(purple_message_meify(stripped, -1))
-					written += fprintf(data->file, "(%s) ***%s %s\n", date, from,
+					written += log_writer_printf(writer, "(%s) ***%s %s\n", date, from,
 							stripped);
 				else
-					written += fprintf(data->file, "(%s) %s: %s\n", date, from,
+					written += log_writer_printf(writer, "(%s) %s: %s\n", date, from,
 							stripped);
 			}
 		} else if (type & PURPLE_MESSAGE_SYSTEM ||
 			type & PURPLE_MESSAGE_ERROR ||
 			type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "(%s) %s\n", date, stripped);
+			written += log_writer_printf(writer, "(%s) %s\n", date, stripped);
 		else if (type & PURPLE_MESSAGE_NO_LOG) {
 			/* This shouldn't happen */
 			g_free(stripped);
 			return written;
 		} else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "(%s) *%s* %s", date, from, stripped);
+			written += log_writer_printf(writer, "(%s) *%s* %s", date, from, stripped);
 		else
-			written += fprintf(data->file, "(%s) %s%s %s\n", date, from ? from : "",
+			written += log_writer_printf(writer, "(%s) %s%s %s\n", date, from ? from : "",
 					from ? ":" : "", stripped);
 	}
 	g_free(date);
 	g_free(stripped);
-	fflush(data->file);
+
+	log_writer_message_done(writer, offset, time);
 
 	return written;
 }
@@ -1531,8 +3913,8 @@ static void txt_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
-		if(data->file)
-			fclose(data->file);
+		if(data->extra_data)
+			log_writer_finish(data->extra_data);
 		g_free(data->path);
 
 		g_slice_free(PurpleLogCommonLoggerData, data);
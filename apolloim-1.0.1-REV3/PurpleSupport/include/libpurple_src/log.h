@@ -54,6 +54,31 @@ typedef enum {
 
 typedef void (*PurpleLogSetCallback) (GHashTable *sets, PurpleLogSet *set);
 
+/**
+ * A message found by purple_log_search().
+ */
+typedef struct {
+	PurpleLog *log;     /**< The log the message is in */
+	guint message;      /**< The index of the message in @a log, as passed
+	                         to purple_log_read_range() */
+} PurpleLogSearchResult;
+
+/**
+ * Called with a range of messages read by purple_log_read_range().
+ *
+ * @param log   The log that was read.
+ * @param text  The messages in Purple Markup, or @c NULL if none could
+ *              be read.  It is freed when the callback returns.
+ * @param flags The logging flags for @a text.
+ * @param first The index of the first message in @a text.
+ * @param count The number of messages in @a text.
+ * @param total The number of messages in the log.
+ * @param data  The data passed to purple_log_read_range().
+ */
+typedef void (*PurpleLogReadRangeCallback)(PurpleLog *log, const char *text,
+		PurpleLogReadFlags flags, guint first, guint count, guint total,
+		gpointer data);
+
 /**
  * A log logger.
  *
@@ -239,6 +264,58 @@ void purple_log_write(PurpleLog *log,
  */
 char *purple_log_read(PurpleLog *log, PurpleLogReadFlags *flags);
 
+/**
+ * Reads a range of messages from a log, without blocking.
+ *
+ * Logs written by the HTML and plain text loggers are indexed by message,
+ * so only the requested messages are read; the index of an older log is
+ * built a piece at a time the first time it is read.  Logs from other
+ * loggers are returned whole, as a single message.
+ *
+ * Passing a @a count of 0 only finds out how many messages there are.
+ * The log must not be freed while the read is pending.
+ *
+ * @param log   The log to read from.
+ * @param first The index of the first message to read.
+ * @param count The maximum number of messages to read.
+ * @param cb    The function to call with the messages.
+ * @param data  User data to pass to @a cb.
+ *
+ * @return A handle for purple_log_read_range_cancel().
+ */
+guint purple_log_read_range(PurpleLog *log, guint first, guint count,
+                            PurpleLogReadRangeCallback cb, gpointer data);
+
+/**
+ * Cancels a pending purple_log_read_range().
+ *
+ * @param handle The handle returned by purple_log_read_range().
+ */
+void purple_log_read_range_cancel(guint handle);
+
+/**
+ * Searches an account's logs for messages containing every word in
+ * @a query, ignoring case and markup.
+ *
+ * Only messages logged by the HTML and plain text loggers while
+ * /purple/logging/search_index was enabled are indexed.
+ *
+ * @param account The account whose logs to search.
+ * @param query   The words to search for.
+ * @param limit   The maximum number of results, or 0 for no limit.
+ *
+ * @return A list of PurpleLogSearchResults, newest log first, which must be
+ *         freed with purple_log_search_result_free().
+ */
+GList *purple_log_search(PurpleAccount *account, const char *query, guint limit);
+
+/**
+ * Frees a result returned by purple_log_search(), and its log.
+ *
+ * @param result The result to free.
+ */
+void purple_log_search_result_free(PurpleLogSearchResult *result);
+
 /**
  * Returns a list of all available logs
  *
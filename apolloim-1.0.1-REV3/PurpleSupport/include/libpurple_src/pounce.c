@@ -245,7 +245,6 @@ static void
 sync_pounces(void)
 {
 	xmlnode *node;
-	char *data;
 
 	if (!pounces_loaded)
 	{
@@ -255,9 +254,7 @@ sync_pounces(void)
 	}
 
 	node = pounces_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("pounces.xml", data, -1);
-	g_free(data);
+	purple_util_write_xml_to_file("pounces.xml", node);
 	xmlnode_free(node);
 }
 
@@ -194,7 +194,6 @@ static void
 sync_prefs(void)
 {
 	xmlnode *node;
-	char *data;
 
 	if (!prefs_loaded)
 	{
@@ -208,9 +207,7 @@ sync_prefs(void)
 	}
 
 	node = prefs_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("prefs.xml", data, -1);
-	g_free(data);
+	purple_util_write_xml_to_file("prefs.xml", node);
 	xmlnode_free(node);
 }
 
@@ -361,14 +358,53 @@ static GMarkupParser prefs_parser = {
 	NULL
 };
 
+/*
+ * Feeds a prefs file to the parser a piece at a time, so a large
+ * prefs.xml is never held in memory whole.
+ */
+static gboolean
+prefs_parse_file(FILE *file, const char *filename)
+{
+	GMarkupParseContext *context;
+	GError *error = NULL;
+	gchar buf[8192];
+	gsize length;
+	gboolean ret = TRUE;
+
+	context = g_markup_parse_context_new(&prefs_parser, 0, NULL, NULL);
+
+	while ((length = fread(buf, 1, sizeof(buf), file)) > 0) {
+		if (!g_markup_parse_context_parse(context, buf, length, &error)) {
+			ret = FALSE;
+			break;
+		}
+	}
+
+	if (ret && ferror(file)) {
+		purple_debug_error("prefs", "Error reading %s: %s\n",
+				filename, strerror(errno));
+		ret = FALSE;
+	}
+
+	if (ret && !g_markup_parse_context_end_parse(context, &error))
+		ret = FALSE;
+
+	if (error != NULL) {
+		purple_debug_error("prefs", "Error parsing %s: %s\n",
+				filename, error->message);
+		g_error_free(error);
+	}
+
+	g_markup_parse_context_free(context);
+
+	return ret;
+}
+
 gboolean
 purple_prefs_load()
 {
 	gchar *filename = g_build_filename(purple_user_dir(), "prefs.xml", NULL);
-	gchar *contents = NULL;
-	gsize length;
-	GMarkupParseContext *context;
-	GError *error = NULL;
+	FILE *file;
 
 	if (!filename) {
 		prefs_loaded = TRUE;
@@ -377,21 +413,17 @@ purple_prefs_load()
 
 	purple_debug_info("prefs", "Reading %s\n", filename);
 
-	if(!g_file_get_contents(filename, &contents, &length, &error)) {
+	if ((file = g_fopen(filename, "rb")) == NULL) {
 #ifndef _WIN32
 		g_free(filename);
-		g_error_free(error);
-
-		error = NULL;
 
 		filename = g_build_filename(SYSCONFDIR, "purple", "prefs.xml", NULL);
 
 		purple_debug_info("prefs", "Reading %s\n", filename);
 
-		if (!g_file_get_contents(filename, &contents, &length, &error)) {
+		if ((file = g_fopen(filename, "rb")) == NULL) {
 			purple_debug_error("prefs", "Error reading prefs: %s\n",
-					error->message);
-			g_error_free(error);
+					strerror(errno));
 			g_free(filename);
 			prefs_loaded = TRUE;
 
@@ -399,8 +431,7 @@ purple_prefs_load()
 		}
 #else /* _WIN32 */
 		purple_debug_error("prefs", "Error reading prefs: %s\n",
-				error->message);
-		g_error_free(error);
+				strerror(errno));
 		g_free(filename);
 		prefs_loaded = TRUE;
 
@@ -408,21 +439,8 @@ purple_prefs_load()
 #endif /* _WIN32 */
 	}
 
-	context = g_markup_parse_context_new(&prefs_parser, 0, NULL, NULL);
-
-	if(!g_markup_parse_context_parse(context, contents, length, NULL)) {
-		g_markup_parse_context_free(context);
-		g_free(contents);
-		g_free(filename);
-		prefs_loaded = TRUE;
-
-		return FALSE;
-	}
-
-	if(!g_markup_parse_context_end_parse(context, NULL)) {
-		purple_debug_error("prefs", "Error parsing %s\n", filename);
-		g_markup_parse_context_free(context);
-		g_free(contents);
+	if (!prefs_parse_file(file, filename)) {
+		fclose(file);
 		g_free(filename);
 		prefs_loaded = TRUE;
 
@@ -430,8 +448,7 @@ purple_prefs_load()
 	}
 
 	purple_debug_info("prefs", "Finished reading %s\n", filename);
-	g_markup_parse_context_free(context);
-	g_free(contents);
+	fclose(file);
 	g_free(filename);
 	prefs_loaded = TRUE;
 
@@ -60,6 +60,7 @@ typedef struct _JabberBuddyResource {
 	JabberBuddyState state;
 	char *status;
 	JabberCapabilities capabilities;
+	struct _JabberCapsInfo *caps; /* Shared with the caps cache */
 	char *thread_id;
 	enum {
 		JABBER_CHAT_STATES_UNKNOWN,
@@ -0,0 +1,684 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "internal.h"
+#include "cipher.h"
+#include "debug.h"
+#include "util.h"
+
+#include "buddy.h"
+#include "caps.h"
+#include "disco.h"
+#include "iq.h"
+#include "jabber.h"
+#include "jutil.h"
+
+#define DISCO_INFO_NAMESPACE "http://jabber.org/protocol/disco#info"
+
+/* Resources waiting on the answer to a caps query */
+typedef struct _JabberCapsQuery {
+	char *ver;
+	GSList *waiters; /* Full JIDs */
+} JabberCapsQuery;
+
+typedef struct _JabberCapsIdentity {
+	const char *category;
+	const char *type;
+	const char *lang;
+	const char *name;
+} JabberCapsIdentity;
+
+typedef struct _JabberCapsForm {
+	char *form_type;
+	xmlnode *x;
+} JabberCapsForm;
+
+static const char *jabber_caps_own_features[] = {
+	"jabber:iq:last",
+	"jabber:iq:oob",
+	"jabber:iq:time",
+	"xmpp:urn:time",
+	"jabber:iq:version",
+	"jabber:x:conference",
+	"http://jabber.org/protocol/bytestreams",
+	"http://jabber.org/protocol/disco#info",
+	"http://jabber.org/protocol/disco#items",
+#if 0
+	"http://jabber.org/protocol/ibb",
+#endif
+	"http://jabber.org/protocol/muc",
+	"http://jabber.org/protocol/muc#user",
+	"http://jabber.org/protocol/si",
+	"http://jabber.org/protocol/si/profile/file-transfer",
+	"http://jabber.org/protocol/xhtml-im",
+	"urn:xmpp:ping",
+	NULL
+};
+
+static GHashTable *capstable = NULL; /* ver -> JabberCapsInfo */
+static gboolean caps_loaded = FALSE;
+static guint save_timer = 0;
+static char *own_hash = NULL;
+
+/**************************************************************************
+ * The cache
+ **************************************************************************/
+
+static void
+jabber_caps_info_free(gpointer data)
+{
+	JabberCapsInfo *info = data;
+
+	g_free(info->hash);
+	g_free(info->ver);
+	g_hash_table_destroy(info->features);
+	g_free(info);
+}
+
+static JabberCapsInfo *
+jabber_caps_info_new(const char *hash, const char *ver)
+{
+	JabberCapsInfo *info = g_new0(JabberCapsInfo, 1);
+
+	info->hash = g_strdup(hash);
+	info->ver = g_strdup(ver);
+	info->features = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+
+	if(capstable == NULL)
+		capstable = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, jabber_caps_info_free);
+	g_hash_table_insert(capstable, info->ver, info);
+
+	return info;
+}
+
+static void
+jabber_caps_info_add_feature(JabberCapsInfo *info, const char *var)
+{
+	char *feature;
+
+	if(g_hash_table_lookup(info->features, var))
+		return;
+
+	feature = g_strdup(var);
+	g_hash_table_insert(info->features, feature, feature);
+	info->capabilities |= jabber_caps_from_feature(var);
+}
+
+JabberCapsInfo *jabber_caps_lookup(const char *ver)
+{
+	if(capstable == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(capstable, ver);
+}
+
+JabberCapabilities jabber_caps_from_feature(const char *var)
+{
+	if(!strcmp(var, "http://jabber.org/protocol/si"))
+		return JABBER_CAP_SI;
+	else if(!strcmp(var, "http://jabber.org/protocol/si/profile/file-transfer"))
+		return JABBER_CAP_SI_FILE_XFER;
+	else if(!strcmp(var, "http://jabber.org/protocol/bytestreams"))
+		return JABBER_CAP_BYTESTREAMS;
+	else if(!strcmp(var, "http://jabber.org/protocol/ibb"))
+		return JABBER_CAP_IBB;
+	else if(!strcmp(var, "http://jabber.org/protocol/xhtml-im"))
+		return JABBER_CAP_XHTML;
+	else if(!strcmp(var, "http://jabber.org/protocol/chatstates"))
+		return JABBER_CAP_CHAT_STATES;
+	else if(!strcmp(var, "jabber:iq:search"))
+		return JABBER_CAP_IQ_SEARCH;
+	else if(!strcmp(var, "jabber:iq:register"))
+		return JABBER_CAP_IQ_REGISTER;
+
+	return JABBER_CAP_NONE;
+}
+
+static void
+caps_feature_to_xmlnode(gpointer key, gpointer value, gpointer user_data)
+{
+	xmlnode *feature = xmlnode_new_child(user_data, "feature");
+	xmlnode_set_attrib(feature, "var", key);
+}
+
+static void
+caps_info_to_xmlnode(gpointer key, gpointer value, gpointer user_data)
+{
+	JabberCapsInfo *info = value;
+	xmlnode *client = xmlnode_new_child(user_data, "client");
+
+	xmlnode_set_attrib(client, "hash", info->hash);
+	xmlnode_set_attrib(client, "ver", info->ver);
+	g_hash_table_foreach(info->features, caps_feature_to_xmlnode, client);
+}
+
+static void
+jabber_caps_sync(void)
+{
+	xmlnode *root = xmlnode_new("capabilities");
+
+	xmlnode_set_attrib(root, "version", "1.0");
+	if(capstable != NULL)
+		g_hash_table_foreach(capstable, caps_info_to_xmlnode, root);
+
+	purple_util_write_xml_to_file(JABBER_CAPS_FILENAME, root);
+	xmlnode_free(root);
+}
+
+static gboolean
+save_cb(gpointer data)
+{
+	jabber_caps_sync();
+	save_timer = 0;
+	return FALSE;
+}
+
+static void
+jabber_caps_schedule_save(void)
+{
+	/* Without jabber_caps_init() we would overwrite what is on disk */
+	if(!caps_loaded)
+		return;
+
+	if(save_timer == 0)
+		save_timer = purple_timeout_add_seconds(5, save_cb, NULL);
+}
+
+void jabber_caps_init(void)
+{
+	xmlnode *root, *client, *feature;
+
+	if(caps_loaded)
+		return;
+	caps_loaded = TRUE;
+
+	root = purple_util_read_xml_from_file(JABBER_CAPS_FILENAME,
+			_("XMPP capabilities cache"));
+	if(root == NULL)
+		return;
+
+	for(client = xmlnode_get_child(root, "client"); client;
+			client = xmlnode_get_next_twin(client)) {
+		const char *hash = xmlnode_get_attrib(client, "hash");
+		const char *ver = xmlnode_get_attrib(client, "ver");
+		JabberCapsInfo *info;
+
+		if(!hash || !ver || strcmp(hash, "sha-1") || jabber_caps_lookup(ver))
+			continue;
+
+		info = jabber_caps_info_new(hash, ver);
+		for(feature = xmlnode_get_child(client, "feature"); feature;
+				feature = xmlnode_get_next_twin(feature)) {
+			const char *var = xmlnode_get_attrib(feature, "var");
+			if(var)
+				jabber_caps_info_add_feature(info, var);
+		}
+	}
+
+	xmlnode_free(root);
+}
+
+void jabber_caps_uninit(void)
+{
+	if(save_timer != 0) {
+		purple_timeout_remove(save_timer);
+		save_timer = 0;
+		jabber_caps_sync();
+	}
+
+	if(capstable != NULL) {
+		g_hash_table_destroy(capstable);
+		capstable = NULL;
+	}
+
+	g_free(own_hash);
+	own_hash = NULL;
+	caps_loaded = FALSE;
+}
+
+/**************************************************************************
+ * Verification strings
+ **************************************************************************/
+
+static int
+jabber_caps_string_compare(const char *a, const char *b)
+{
+	return strcmp(a ? a : "", b ? b : "");
+}
+
+static gint
+jabber_caps_identity_compare(gconstpointer a, gconstpointer b)
+{
+	const JabberCapsIdentity *ia = a, *ib = b;
+	int ret;
+
+	if((ret = jabber_caps_string_compare(ia->category, ib->category)))
+		return ret;
+	if((ret = jabber_caps_string_compare(ia->type, ib->type)))
+		return ret;
+	if((ret = jabber_caps_string_compare(ia->lang, ib->lang)))
+		return ret;
+	return jabber_caps_string_compare(ia->name, ib->name);
+}
+
+static gint
+jabber_caps_form_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(((const JabberCapsForm *)a)->form_type,
+			((const JabberCapsForm *)b)->form_type);
+}
+
+static gint
+jabber_caps_field_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(xmlnode_get_attrib((xmlnode *)a, "var"),
+			xmlnode_get_attrib((xmlnode *)b, "var"));
+}
+
+/* Returns the only value of the FORM_TYPE field, or NULL */
+static char *
+jabber_caps_get_form_type(xmlnode *x)
+{
+	xmlnode *field, *value;
+
+	for(field = xmlnode_get_child(x, "field"); field;
+			field = xmlnode_get_next_twin(field)) {
+		const char *var = xmlnode_get_attrib(field, "var");
+
+		if(!var || strcmp(var, "FORM_TYPE"))
+			continue;
+
+		value = xmlnode_get_child(field, "value");
+		if(value == NULL || xmlnode_get_next_twin(value) != NULL)
+			return NULL;
+		return xmlnode_get_data(value);
+	}
+
+	return NULL;
+}
+
+static void
+jabber_caps_append_form(GString *s, JabberCapsForm *form)
+{
+	GList *fields = NULL, *values, *l, *v;
+	xmlnode *field, *value;
+
+	g_string_append_printf(s, "%s<", form->form_type);
+
+	for(field = xmlnode_get_child(form->x, "field"); field;
+			field = xmlnode_get_next_twin(field)) {
+		const char *var = xmlnode_get_attrib(field, "var");
+		if(var && strcmp(var, "FORM_TYPE"))
+			fields = g_list_insert_sorted(fields, field,
+					jabber_caps_field_compare);
+	}
+
+	for(l = fields; l; l = l->next) {
+		field = l->data;
+		g_string_append_printf(s, "%s<", xmlnode_get_attrib(field, "var"));
+
+		values = NULL;
+		for(value = xmlnode_get_child(field, "value"); value;
+				value = xmlnode_get_next_twin(value)) {
+			char *data = xmlnode_get_data(value);
+			values = g_list_insert_sorted(values, data ? data : g_strdup(""),
+					(GCompareFunc)strcmp);
+		}
+
+		for(v = values; v; v = v->next) {
+			g_string_append_printf(s, "%s<", (char *)v->data);
+			g_free(v->data);
+		}
+		g_list_free(values);
+	}
+
+	g_list_free(fields);
+}
+
+char *jabber_caps_calculate_hash(xmlnode *query)
+{
+	GList *identities = NULL, *features = NULL, *forms = NULL, *l;
+	GString *s;
+	xmlnode *child;
+	gboolean valid = TRUE;
+	char *hash = NULL;
+	guchar digest[20];
+	size_t digest_len;
+
+	g_return_val_if_fail(query != NULL, NULL);
+
+	for(child = query->child; child; child = child->next) {
+		if(child->type != XMLNODE_TYPE_TAG)
+			continue;
+
+		if(!strcmp(child->name, "identity")) {
+			JabberCapsIdentity *id = g_new0(JabberCapsIdentity, 1);
+
+			id->category = xmlnode_get_attrib(child, "category");
+			id->type = xmlnode_get_attrib(child, "type");
+			id->lang = xmlnode_get_attrib(child, "lang");
+			id->name = xmlnode_get_attrib(child, "name");
+			identities = g_list_insert_sorted(identities, id,
+					jabber_caps_identity_compare);
+		} else if(!strcmp(child->name, "feature")) {
+			const char *var = xmlnode_get_attrib(child, "var");
+			if(var)
+				features = g_list_insert_sorted(features, (gpointer)var,
+						(GCompareFunc)strcmp);
+		} else if(!strcmp(child->name, "x")) {
+			const char *xmlns = xmlnode_get_namespace(child);
+			JabberCapsForm *form;
+			char *form_type;
+
+			if(!xmlns || strcmp(xmlns, "jabber:x:data"))
+				continue;
+
+			/* Forms without a FORM_TYPE are left out of the string */
+			if(!(form_type = jabber_caps_get_form_type(child)))
+				continue;
+
+			form = g_new0(JabberCapsForm, 1);
+			form->form_type = form_type;
+			form->x = child;
+			forms = g_list_insert_sorted(forms, form,
+					jabber_caps_form_compare);
+		}
+	}
+
+	s = g_string_new(NULL);
+
+	/* Duplicates make the string ambiguous, so it must not be trusted */
+	for(l = identities; l; l = l->next) {
+		JabberCapsIdentity *id = l->data;
+
+		if(l->next && !jabber_caps_identity_compare(id, l->next->data))
+			valid = FALSE;
+		g_string_append_printf(s, "%s/%s/%s/%s<",
+				id->category ? id->category : "",
+				id->type ? id->type : "",
+				id->lang ? id->lang : "",
+				id->name ? id->name : "");
+		g_free(id);
+	}
+
+	for(l = features; l; l = l->next) {
+		if(l->next && !strcmp(l->data, l->next->data))
+			valid = FALSE;
+		g_string_append_printf(s, "%s<", (char *)l->data);
+	}
+
+	for(l = forms; l; l = l->next) {
+		JabberCapsForm *form = l->data;
+
+		if(l->next && !jabber_caps_form_compare(form, l->next->data))
+			valid = FALSE;
+		jabber_caps_append_form(s, form);
+		g_free(form->form_type);
+		g_free(form);
+	}
+
+	if(valid && purple_cipher_digest_region("sha1", (guchar *)s->str,
+				s->len, sizeof(digest), digest, &digest_len))
+		hash = purple_base64_encode(digest, digest_len);
+
+	g_list_free(identities);
+	g_list_free(features);
+	g_list_free(forms);
+	g_string_free(s, TRUE);
+
+	return hash;
+}
+
+void jabber_caps_add_own_features(xmlnode *query)
+{
+	xmlnode *identity, *feature;
+	int i;
+
+	identity = xmlnode_new_child(query, "identity");
+	xmlnode_set_attrib(identity, "category", "client");
+	xmlnode_set_attrib(identity, "type", "pc"); /* XXX: bot, console,
+												 * handheld, pc, phone,
+												 * web */
+	xmlnode_set_attrib(identity, "name", PACKAGE);
+
+	for(i = 0; jabber_caps_own_features[i]; i++) {
+		feature = xmlnode_new_child(query, "feature");
+		xmlnode_set_attrib(feature, "var", jabber_caps_own_features[i]);
+	}
+}
+
+const char *jabber_caps_get_own_hash(void)
+{
+	if(own_hash == NULL) {
+		xmlnode *query = xmlnode_new("query");
+
+		jabber_caps_add_own_features(query);
+		own_hash = jabber_caps_calculate_hash(query);
+		xmlnode_free(query);
+	}
+
+	return own_hash;
+}
+
+/**************************************************************************
+ * Resources
+ **************************************************************************/
+
+static JabberBuddyResource *
+jabber_caps_find_resource(JabberStream *js, const char *who)
+{
+	JabberID *jid;
+	JabberBuddy *jb;
+	JabberBuddyResource *jbr = NULL;
+
+	if((jid = jabber_id_new(who))) {
+		if(jid->resource && (jb = jabber_buddy_find(js, who, FALSE)))
+			jbr = jabber_buddy_find_resource(jb, jid->resource);
+		jabber_id_free(jid);
+	}
+
+	return jbr;
+}
+
+static void
+jabber_caps_apply(JabberBuddyResource *jbr, JabberCapsInfo *info)
+{
+	/* Typing notifications may have been seen in use, whatever the caps say */
+	jbr->caps = info;
+	jbr->capabilities = info->capabilities | JABBER_CAP_RETRIEVED |
+			(jbr->capabilities & JABBER_CAP_COMPOSING);
+}
+
+gboolean jabber_resource_has_feature(const JabberBuddyResource *jbr,
+		const char *feature)
+{
+	g_return_val_if_fail(feature != NULL, FALSE);
+
+	if(jbr == NULL || jbr->caps == NULL)
+		return FALSE;
+
+	return g_hash_table_lookup(jbr->caps->features, feature) != NULL;
+}
+
+static void
+jabber_caps_query_free(gpointer data)
+{
+	JabberCapsQuery *q = data;
+
+	while(q->waiters) {
+		g_free(q->waiters->data);
+		q->waiters = g_slist_delete_link(q->waiters, q->waiters);
+	}
+	g_free(q->ver);
+	g_free(q);
+}
+
+gboolean jabber_caps_wait(JabberStream *js, const char *ver, const char *who)
+{
+	JabberCapsQuery *q;
+	GSList *l;
+
+	if(js->caps_pending == NULL)
+		js->caps_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, jabber_caps_query_free);
+
+	if((q = g_hash_table_lookup(js->caps_pending, ver))) {
+		for(l = q->waiters; l; l = l->next)
+			if(!strcmp(l->data, who))
+				return FALSE;
+		q->waiters = g_slist_append(q->waiters, g_strdup(who));
+		return FALSE;
+	}
+
+	q = g_new0(JabberCapsQuery, 1);
+	q->ver = g_strdup(ver);
+	q->waiters = g_slist_append(NULL, g_strdup(who));
+	g_hash_table_insert(js->caps_pending, q->ver, q);
+
+	return TRUE;
+}
+
+static gboolean
+caps_query_has_waiter(gpointer key, gpointer value, gpointer user_data)
+{
+	JabberCapsQuery *q = value;
+	GSList *l;
+
+	for(l = q->waiters; l; l = l->next)
+		if(!strcmp(l->data, user_data))
+			return TRUE;
+
+	return FALSE;
+}
+
+gboolean jabber_caps_is_pending(JabberStream *js, const char *who)
+{
+	if(js->caps_pending == NULL)
+		return FALSE;
+
+	return g_hash_table_find(js->caps_pending, caps_query_has_waiter,
+			(gpointer)who) != NULL;
+}
+
+void jabber_caps_received(JabberStream *js, const char *ver, xmlnode *query)
+{
+	JabberCapsQuery *q;
+	JabberCapsInfo *info = NULL;
+	JabberBuddyResource *jbr;
+	xmlnode *feature;
+	GSList *l;
+
+	if(js->caps_pending == NULL ||
+			!(q = g_hash_table_lookup(js->caps_pending, ver)))
+		return;
+	g_hash_table_steal(js->caps_pending, ver);
+
+	if(query != NULL) {
+		char *hash = jabber_caps_calculate_hash(query);
+
+		if(hash && !strcmp(hash, q->ver)) {
+			if(!(info = jabber_caps_lookup(q->ver))) {
+				info = jabber_caps_info_new("sha-1", q->ver);
+				for(feature = xmlnode_get_child(query, "feature"); feature;
+						feature = xmlnode_get_next_twin(feature)) {
+					const char *var = xmlnode_get_attrib(feature, "var");
+					if(var)
+						jabber_caps_info_add_feature(info, var);
+				}
+				jabber_caps_schedule_save();
+			}
+		} else {
+			purple_debug_warning("jabber", "Capabilities from %s do not "
+					"match the verification string %s\n",
+					(char *)q->waiters->data, q->ver);
+		}
+		g_free(hash);
+	}
+
+	/* Whoever else is waiting gets asked directly if the query failed */
+	for(l = q->waiters; l; l = l->next) {
+		if(info && (jbr = jabber_caps_find_resource(js, l->data)))
+			jabber_caps_apply(jbr, info);
+		jabber_disco_info_resolved(js, l->data, info != NULL);
+	}
+
+	jabber_caps_query_free(q);
+}
+
+static void
+jabber_caps_result_cb(JabberStream *js, xmlnode *packet, gpointer data)
+{
+	JabberCapsQuery *q = data;
+	const char *type = xmlnode_get_attrib(packet, "type");
+	xmlnode *query = NULL;
+
+	if(type && !strcmp(type, "result"))
+		query = xmlnode_get_child_with_namespace(packet, "query",
+				DISCO_INFO_NAMESPACE);
+
+	jabber_caps_received(js, q->ver, query);
+}
+
+void jabber_caps_presence(JabberStream *js, JabberBuddyResource *jbr,
+		const char *who, xmlnode *c)
+{
+	const char *node, *ver, *hash;
+	JabberCapsInfo *info;
+	JabberIq *iq;
+	char *query_node;
+
+	node = xmlnode_get_attrib(c, "node");
+	ver = xmlnode_get_attrib(c, "ver");
+	hash = xmlnode_get_attrib(c, "hash");
+
+	/* Legacy caps don't name a set of features, so those resources are
+	 * still asked directly whenever we need to know */
+	if(!jbr || !node || !ver || !hash || strcmp(hash, "sha-1"))
+		return;
+
+	if((info = jabber_caps_lookup(ver))) {
+		jabber_caps_apply(jbr, info);
+		return;
+	}
+
+	if(!jabber_caps_wait(js, ver, who))
+		return;
+
+	iq = jabber_iq_new_query(js, JABBER_IQ_GET, DISCO_INFO_NAMESPACE);
+	xmlnode_set_attrib(iq->node, "to", who);
+	query_node = g_strdup_printf("%s#%s", node, ver);
+	xmlnode_set_attrib(xmlnode_get_child(iq->node, "query"), "node",
+			query_node);
+	g_free(query_node);
+
+	jabber_iq_set_callback(iq, jabber_caps_result_cb,
+			g_hash_table_lookup(js->caps_pending, ver));
+	jabber_iq_send(iq);
+}
+
+void jabber_caps_free(JabberStream *js)
+{
+	if(js->caps_pending != NULL) {
+		g_hash_table_destroy(js->caps_pending);
+		js->caps_pending = NULL;
+	}
+}
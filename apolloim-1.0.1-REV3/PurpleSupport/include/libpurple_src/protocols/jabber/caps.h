@@ -0,0 +1,74 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _PURPLE_JABBER_CAPS_H_
+#define _PURPLE_JABBER_CAPS_H_
+
+/* XEP-0115: Entity Capabilities */
+
+#include "jabber.h"
+#include "buddy.h"
+
+#define JABBER_CAPS_NAMESPACE "http://jabber.org/protocol/caps"
+#define JABBER_CAPS_FILENAME "xmpp-caps.xml"
+
+/* What a verification string stands for.  These are shared by every
+ * resource advertising the same string, and live until jabber_caps_uninit() */
+typedef struct _JabberCapsInfo {
+	char *hash; /* The hash function, only "sha-1" is used */
+	char *ver;
+	GHashTable *features; /* Set of feature vars */
+	JabberCapabilities capabilities;
+} JabberCapsInfo;
+
+/* Loads the cache from disk and saves it as new entries are verified */
+void jabber_caps_init(void);
+void jabber_caps_uninit(void);
+
+/* Adds our own identity and features to a disco#info <query/> */
+void jabber_caps_add_own_features(xmlnode *query);
+/* The verification string to advertise for our own features */
+const char *jabber_caps_get_own_hash(void);
+
+/* Computes the SHA-1 verification string of a disco#info <query/>.
+ * Returns NULL if it is malformed in a way that forbids caching. */
+char *jabber_caps_calculate_hash(xmlnode *query);
+
+JabberCapabilities jabber_caps_from_feature(const char *var);
+JabberCapsInfo *jabber_caps_lookup(const char *ver);
+
+/* Handles the <c/> of a presence from who, which is tracked as jbr */
+void jabber_caps_presence(JabberStream *js, JabberBuddyResource *jbr,
+		const char *who, xmlnode *c);
+
+/* Adds who to the resources waiting on ver.  Returns TRUE if nobody was
+ * already waiting, in which case the caller has to query who for it. */
+gboolean jabber_caps_wait(JabberStream *js, const char *ver, const char *who);
+gboolean jabber_caps_is_pending(JabberStream *js, const char *who);
+/* Verifies a disco#info <query/> answering ver, caches it and applies it
+ * to everyone waiting on it.  query is NULL if the query failed. */
+void jabber_caps_received(JabberStream *js, const char *ver, xmlnode *query);
+void jabber_caps_free(JabberStream *js);
+
+/* O(1) check of a feature the resource advertised through its caps */
+gboolean jabber_resource_has_feature(const JabberBuddyResource *jbr,
+		const char *feature);
+
+#endif /* _PURPLE_JABBER_CAPS_H_ */
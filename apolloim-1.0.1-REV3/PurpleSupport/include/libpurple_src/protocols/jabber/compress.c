@@ -0,0 +1,173 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "internal.h"
+#include "debug.h"
+
+#include <zlib.h>
+
+#include "compress.h"
+#include "jabber.h"
+#include "parser.h"
+
+gboolean jabber_compress_offered(JabberStream *js, xmlnode *features)
+{
+	xmlnode *compression, *method;
+
+	if(js->zlib_out != NULL ||
+			!purple_account_get_bool(js->gc->account, "compress", TRUE))
+		return FALSE;
+
+	compression = xmlnode_get_child_with_namespace(features, "compression",
+			JABBER_COMPRESS_FEATURE_NAMESPACE);
+	if(compression == NULL)
+		return FALSE;
+
+	for(method = xmlnode_get_child(compression, "method"); method;
+			method = xmlnode_get_next_twin(method)) {
+		char *name = xmlnode_get_data(method);
+		gboolean zlib = (name != NULL && !strcmp(name, "zlib"));
+		g_free(name);
+		if(zlib)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+void jabber_compress_start(JabberStream *js)
+{
+	xmlnode *compress, *method;
+
+	compress = xmlnode_new("compress");
+	xmlnode_set_namespace(compress, JABBER_COMPRESS_NAMESPACE);
+	method = xmlnode_new_child(compress, "method");
+	xmlnode_insert_data(method, "zlib", -1);
+
+	jabber_send(js, compress);
+	xmlnode_free(compress);
+}
+
+static gboolean
+jabber_compress_init(JabberStream *js)
+{
+	js->zlib_out = g_new0(z_stream, 1);
+	js->zlib_in = g_new0(z_stream, 1);
+
+	if(deflateInit(js->zlib_out, Z_DEFAULT_COMPRESSION) != Z_OK ||
+			inflateInit(js->zlib_in) != Z_OK) {
+		g_free(js->zlib_out);
+		g_free(js->zlib_in);
+		js->zlib_out = NULL;
+		js->zlib_in = NULL;
+		return FALSE;
+	}
+
+	js->zlib_buffer = g_string_sized_new(1024);
+
+	return TRUE;
+}
+
+void jabber_compress_parse(JabberStream *js, xmlnode *packet)
+{
+	if(!strcmp(packet->name, "compressed")) {
+		if(!jabber_compress_init(js)) {
+			purple_connection_error(js->gc, _("Unable to initialize compression"));
+			return;
+		}
+
+		/* Everything from the new stream header on is compressed */
+		purple_debug_info("jabber", "Stream compression enabled\n");
+		js->reinit = TRUE;
+	} else if(!strcmp(packet->name, "failure")) {
+		/* Carry on without it */
+		purple_debug_info("jabber", "Server refused stream compression\n");
+		jabber_stream_bind(js);
+	}
+}
+
+void jabber_compress_free(JabberStream *js)
+{
+	if(js->zlib_out) {
+		deflateEnd(js->zlib_out);
+		g_free(js->zlib_out);
+		js->zlib_out = NULL;
+	}
+
+	if(js->zlib_in) {
+		inflateEnd(js->zlib_in);
+		g_free(js->zlib_in);
+		js->zlib_in = NULL;
+	}
+
+	if(js->zlib_buffer) {
+		g_string_free(js->zlib_buffer, TRUE);
+		js->zlib_buffer = NULL;
+	}
+}
+
+const char *jabber_compress_deflate(JabberStream *js, const char *data, int len, int *out_len)
+{
+	z_stream *z = js->zlib_out;
+	gsize used = 0;
+
+	z->next_in = (Bytef *)data;
+	z->avail_in = len;
+
+	/* Flush every write, as the server can't act on half a stanza */
+	do {
+		if(js->zlib_buffer->len - used < 256)
+			g_string_set_size(js->zlib_buffer, js->zlib_buffer->len * 2 + 256);
+
+		z->next_out = (Bytef *)js->zlib_buffer->str + used;
+		z->avail_out = js->zlib_buffer->len - used;
+		deflate(z, Z_SYNC_FLUSH);
+		used = js->zlib_buffer->len - z->avail_out;
+	} while(z->avail_out == 0);
+
+	*out_len = used;
+	return js->zlib_buffer->str;
+}
+
+void jabber_compress_process(JabberStream *js, const char *data, int len)
+{
+	z_stream *z = js->zlib_in;
+	char buf[4096];
+	int ret;
+
+	z->next_in = (Bytef *)data;
+	z->avail_in = len;
+
+	do {
+		z->next_out = (Bytef *)buf;
+		z->avail_out = sizeof(buf);
+
+		/* Z_STREAM_END is the server closing the compressed stream,
+		 * which leaves nothing more to inflate */
+		ret = inflate(z, Z_SYNC_FLUSH);
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			purple_connection_error(js->gc, _("Decompression error"));
+			return;
+		}
+
+		if(z->avail_out < sizeof(buf))
+			jabber_parser_process(js, buf, sizeof(buf) - z->avail_out);
+	} while(ret == Z_OK && (z->avail_in > 0 || z->avail_out == 0));
+}
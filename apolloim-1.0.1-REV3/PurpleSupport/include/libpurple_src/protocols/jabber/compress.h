@@ -0,0 +1,43 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _PURPLE_JABBER_COMPRESS_H_
+#define _PURPLE_JABBER_COMPRESS_H_
+
+/* XEP-0138: Stream Compression, using zlib */
+
+#include "jabber.h"
+
+#define JABBER_COMPRESS_FEATURE_NAMESPACE "http://jabber.org/features/compress"
+#define JABBER_COMPRESS_NAMESPACE "http://jabber.org/protocol/compress"
+
+/* Returns TRUE if the stream features offer zlib and we want to use it */
+gboolean jabber_compress_offered(JabberStream *js, xmlnode *features);
+void jabber_compress_start(JabberStream *js);
+void jabber_compress_parse(JabberStream *js, xmlnode *packet);
+void jabber_compress_free(JabberStream *js);
+
+/* Compresses data to be sent.  The result is only valid until the next call. */
+const char *jabber_compress_deflate(JabberStream *js, const char *data, int len, int *out_len);
+
+/* Decompresses received data and feeds it to the parser */
+void jabber_compress_process(JabberStream *js, const char *data, int len);
+
+#endif /* _PURPLE_JABBER_COMPRESS_H_ */
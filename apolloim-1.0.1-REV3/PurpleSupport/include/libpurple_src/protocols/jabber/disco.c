@@ -24,6 +24,7 @@
 #include "debug.h"
 
 #include "buddy.h"
+#include "caps.h"
 #include "google.h"
 #include "iq.h"
 #include "disco.h"
@@ -36,10 +37,21 @@ struct _jabber_disco_info_cb_data {
 	JabberDiscoInfoCallback *callback;
 };
 
-#define SUPPORT_FEATURE(x) \
-	feature = xmlnode_new_child(query, "feature"); \
-	xmlnode_set_attrib(feature, "var", x);
+/* Both our legacy caps node and the one named by our verification string */
+static gboolean
+jabber_disco_is_own_node(const char *node)
+{
+	const char *hash;
+
+	if(!node || !strcmp(node, CAPS0115_NODE "#" VERSION))
+		return TRUE;
 
+	if(strncmp(node, CAPS0115_NODE "#", sizeof(CAPS0115_NODE)))
+		return FALSE;
+
+	hash = jabber_caps_get_own_hash();
+	return hash && !strcmp(node + sizeof(CAPS0115_NODE), hash);
+}
 
 void jabber_disco_info_parse(JabberStream *js, xmlnode *packet) {
 	const char *from = xmlnode_get_attrib(packet, "from");
@@ -49,7 +61,7 @@ void jabber_disco_info_parse(JabberStream *js, xmlnode *packet) {
 		return;
 
 	if(!strcmp(type, "get")) {
-		xmlnode *query, *identity, *feature;
+		xmlnode *query;
 		JabberIq *iq;
 
 		xmlnode *in_query;
@@ -71,33 +83,8 @@ void jabber_disco_info_parse(JabberStream *js, xmlnode *packet) {
 		if(node)
 			xmlnode_set_attrib(query, "node", node);
 
-		if(!node || !strcmp(node, CAPS0115_NODE "#" VERSION)) {
-
-			identity = xmlnode_new_child(query, "identity");
-			xmlnode_set_attrib(identity, "category", "client");
-			xmlnode_set_attrib(identity, "type", "pc"); /* XXX: bot, console,
-														 * handheld, pc, phone,
-														 * web */
-			xmlnode_set_attrib(identity, "name", PACKAGE);
-
-			SUPPORT_FEATURE("jabber:iq:last")
-			SUPPORT_FEATURE("jabber:iq:oob")
-			SUPPORT_FEATURE("jabber:iq:time")
-			SUPPORT_FEATURE("xmpp:urn:time")
-			SUPPORT_FEATURE("jabber:iq:version")
-			SUPPORT_FEATURE("jabber:x:conference")
-			SUPPORT_FEATURE("http://jabber.org/protocol/bytestreams")
-			SUPPORT_FEATURE("http://jabber.org/protocol/disco#info")
-			SUPPORT_FEATURE("http://jabber.org/protocol/disco#items")
-#if 0
-				SUPPORT_FEATURE("http://jabber.org/protocol/ibb")
-#endif
-			SUPPORT_FEATURE("http://jabber.org/protocol/muc")
-			SUPPORT_FEATURE("http://jabber.org/protocol/muc#user")
-			SUPPORT_FEATURE("http://jabber.org/protocol/si")
-			SUPPORT_FEATURE("http://jabber.org/protocol/si/profile/file-transfer")
-			SUPPORT_FEATURE("http://jabber.org/protocol/xhtml-im")
-			SUPPORT_FEATURE("urn:xmpp:ping")
+		if(jabber_disco_is_own_node(node)) {
+			jabber_caps_add_own_features(query);
 		} else {
 			xmlnode *error, *inf;
 
@@ -155,16 +142,7 @@ void jabber_disco_info_parse(JabberStream *js, xmlnode *packet) {
 				if(!var)
 					continue;
 
-				if(!strcmp(var, "http://jabber.org/protocol/si"))
-					capabilities |= JABBER_CAP_SI;
-				else if(!strcmp(var, "http://jabber.org/protocol/si/profile/file-transfer"))
-					capabilities |= JABBER_CAP_SI_FILE_XFER;
-				else if(!strcmp(var, "http://jabber.org/protocol/bytestreams"))
-					capabilities |= JABBER_CAP_BYTESTREAMS;
-				else if(!strcmp(var, "jabber:iq:search"))
-					capabilities |= JABBER_CAP_IQ_SEARCH;
-				else if(!strcmp(var, "jabber:iq:register"))
-					capabilities |= JABBER_CAP_IQ_REGISTER;
+				capabilities |= jabber_caps_from_feature(var);
 			}
 		}
 
@@ -356,13 +334,23 @@ void jabber_disco_items_server(JabberStream *js)
 	jabber_iq_send(iq);
 }
 
+static void
+jabber_disco_info_query(JabberStream *js, const char *who)
+{
+	JabberIq *iq = jabber_iq_new_query(js, JABBER_IQ_GET,
+			"http://jabber.org/protocol/disco#info");
+
+	xmlnode_set_attrib(iq->node, "to", who);
+
+	jabber_iq_send(iq);
+}
+
 void jabber_disco_info_do(JabberStream *js, const char *who, JabberDiscoInfoCallback *callback, gpointer data)
 {
 	JabberID *jid;
 	JabberBuddy *jb;
 	JabberBuddyResource *jbr = NULL;
 	struct _jabber_disco_info_cb_data *jdicd;
-	JabberIq *iq;
 
 	if((jid = jabber_id_new(who))) {
 		if(jid->resource && (jb = jabber_buddy_find(js, who, TRUE)))
@@ -381,10 +369,37 @@ void jabber_disco_info_do(JabberStream *js, const char *who, JabberDiscoInfoCall
 
 	g_hash_table_insert(js->disco_callbacks, g_strdup(who), jdicd);
 
-	iq = jabber_iq_new_query(js, JABBER_IQ_GET, "http://jabber.org/protocol/disco#info");
-	xmlnode_set_attrib(iq->node, "to", who);
+	/* The caps query already on its way will answer this */
+	if(jabber_caps_is_pending(js, who))
+		return;
 
-	jabber_iq_send(iq);
+	jabber_disco_info_query(js, who);
 }
 
+void jabber_disco_info_resolved(JabberStream *js, const char *who, gboolean cached)
+{
+	JabberID *jid;
+	JabberBuddy *jb;
+	JabberBuddyResource *jbr = NULL;
+	struct _jabber_disco_info_cb_data *jdicd;
+
+	if(!js->disco_callbacks ||
+			!(jdicd = g_hash_table_lookup(js->disco_callbacks, who)))
+		return;
+
+	if(!cached) {
+		jabber_disco_info_query(js, who);
+		return;
+	}
+
+	if((jid = jabber_id_new(who))) {
+		if(jid->resource && (jb = jabber_buddy_find(js, who, FALSE)))
+			jbr = jabber_buddy_find_resource(jb, jid->resource);
+		jabber_id_free(jid);
+	}
+
+	jdicd->callback(js, who, jbr ? jbr->capabilities : JABBER_CAP_NONE,
+			jdicd->data);
+	g_hash_table_remove(js->disco_callbacks, who);
+}
 
@@ -34,5 +34,9 @@ void jabber_disco_items_server(JabberStream *js);
 
 void jabber_disco_info_do(JabberStream *js, const char *who,
 		JabberDiscoInfoCallback *callback, gpointer data);
+/* Called once a caps query who was waiting on is over.  If the caps
+ * were cached, a pending callback is run, otherwise who is asked directly. */
+void jabber_disco_info_resolved(JabberStream *js, const char *who,
+		gboolean cached);
 
 #endif /* _PURPLE_JABBER_DISCO_H_ */
@@ -41,7 +41,9 @@
 
 #include "auth.h"
 #include "buddy.h"
+#include "caps.h"
 #include "chat.h"
+#include "compress.h"
 #include "disco.h"
 #include "google.h"
 #include "iq.h"
@@ -52,6 +54,7 @@
 #include "jabber.h"
 #include "roster.h"
 #include "si.h"
+#include "sm.h"
 #include "xdata.h"
 
 #define JABBER_CONNECT_STEPS (js->gsc ? 8 : 5)
@@ -80,6 +83,8 @@ jabber_session_initialized_cb(JabberStream *js, xmlnode *packet, gpointer data)
 	const char *type = xmlnode_get_attrib(packet, "type");
 	if(type && !strcmp(type, "result")) {
 		jabber_stream_set_state(js, JABBER_STREAM_CONNECTED);
+		if(js->sm_supported)
+			jabber_sm_enable(js);
 	} else {
 		purple_connection_error(js->gc, _("Error initializing session"));
 	}
@@ -127,6 +132,36 @@ static void jabber_bind_result_cb(JabberStream *js, xmlnode *packet,
 	jabber_session_init(js);
 }
 
+/*
+ * Set up the session on an authenticated stream: either resume the
+ * stream we lost, or bind a new resource.
+ */
+void jabber_stream_bind(JabberStream *js)
+{
+	xmlnode *bind, *resource;
+	JabberIq *iq;
+
+	if(js->sm_resuming) {
+		/* We're authenticated again, so pick up where the old stream left off
+		 * instead of binding a new resource */
+		if(js->sm_supported)
+			jabber_sm_resume(js);
+		else
+			purple_connection_error(js->gc, _("Unable to resume the session"));
+		return;
+	}
+
+	iq = jabber_iq_new(js, JABBER_IQ_SET);
+	bind = xmlnode_new_child(iq->node, "bind");
+	xmlnode_set_namespace(bind, "urn:ietf:params:xml:ns:xmpp-bind");
+	resource = xmlnode_new_child(bind, "resource");
+	xmlnode_insert_data(resource, js->user->resource, -1);
+
+	jabber_iq_set_callback(iq, jabber_bind_result_cb, NULL);
+
+	jabber_iq_send(iq);
+}
+
 static void jabber_stream_features_parse(JabberStream *js, xmlnode *packet)
 {
 	if(xmlnode_get_child(packet, "starttls")) {
@@ -134,21 +169,21 @@ static void jabber_stream_features_parse(JabberStream *js, xmlnode *packet)
 			return;
 	}
 
+	js->sm_supported = (xmlnode_get_child_with_namespace(packet, "sm", JABBER_SM_NAMESPACE) != NULL);
+	if(xmlnode_get_child_with_namespace(packet, "ver", JABBER_ROSTER_VER_NAMESPACE))
+		js->roster_versioning = TRUE;
+
 	if(js->registration) {
 		jabber_register_start(js);
 	} else if(xmlnode_get_child(packet, "mechanisms")) {
 		jabber_auth_start(js, packet);
-	} else if(xmlnode_get_child(packet, "bind")) {
-		xmlnode *bind, *resource;
-		JabberIq *iq = jabber_iq_new(js, JABBER_IQ_SET);
-		bind = xmlnode_new_child(iq->node, "bind");
-		xmlnode_set_namespace(bind, "urn:ietf:params:xml:ns:xmpp-bind");
-		resource = xmlnode_new_child(bind, "resource");
-		xmlnode_insert_data(resource, js->user->resource, -1);
-
-		jabber_iq_set_callback(iq, jabber_bind_result_cb, NULL);
-
-		jabber_iq_send(iq);
+	} else if(js->sm_resuming || xmlnode_get_child(packet, "bind")) {
+		/* Compression is negotiated after TLS and SASL, so it covers
+		 * everything from binding on */
+		if(jabber_compress_offered(js, packet))
+			jabber_compress_start(js);
+		else
+			jabber_stream_bind(js);
 	} else /* if(xmlnode_get_child_with_namespace(packet, "auth")) */ {
 		/* If we get an empty stream:features packet, or we explicitly get
 		 * an auth feature with namespace http://jabber.org/features/iq-auth
@@ -181,7 +216,13 @@ void jabber_process_packet(JabberStream *js, xmlnode *packet)
 
 	xmlns = xmlnode_get_namespace(packet);
 
-	if(!strcmp(packet->name, "iq")) {
+	jabber_sm_inbound(js, packet);
+
+	if(xmlns && !strcmp(xmlns, JABBER_SM_NAMESPACE)) {
+		jabber_sm_parse(js, packet);
+	} else if(xmlns && !strcmp(xmlns, JABBER_COMPRESS_NAMESPACE)) {
+		jabber_compress_parse(js, packet);
+	} else if(!strcmp(packet->name, "iq")) {
 		jabber_iq_parse(js, packet);
 	} else if(!strcmp(packet->name, "presence")) {
 		jabber_presence_parse(js, packet);
@@ -215,6 +256,39 @@ void jabber_process_packet(JabberStream *js, xmlnode *packet)
 	}
 }
 
+static void jabber_stream_reconnect(JabberStream *js);
+
+static gboolean jabber_stream_reconnect_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm_reconnect_timer = 0;
+	jabber_stream_reconnect(js);
+
+	return FALSE;
+}
+
+/*
+ * Called when reading from or writing to the server fails.  If the
+ * stream can be resumed, we quietly reconnect and resume it.  That is
+ * done from a timeout, as we can get here while still handling data
+ * read from the old connection.
+ */
+void jabber_connection_lost(JabberStream *js, const char *msg)
+{
+	if(js->sm_reconnect_timer)
+		return;
+
+	if(jabber_sm_can_resume(js)) {
+		purple_debug_info("jabber", "Connection lost (%s), resuming the stream\n", msg);
+		js->sm_resuming = TRUE;
+		js->sm_reconnect_timer = purple_timeout_add(0, jabber_stream_reconnect_cb, js);
+		return;
+	}
+
+	purple_connection_error(js->gc, msg);
+}
+
 static int jabber_do_send(JabberStream *js, const char *data, int len)
 {
 	int ret;
@@ -244,7 +318,7 @@ static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond
 	if (ret < 0 && errno == EAGAIN)
 		return;
 	else if (ret <= 0) {
-		purple_connection_error(js->gc, _("Write error"));
+		jabber_connection_lost(js, _("Write error"));
 		return;
 	}
 
@@ -266,13 +340,21 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 	purple_signal_emit(my_protocol, "jabber-sending-text", js->gc, &data);
 	if (data == NULL)
 		return;
+
+	/* Nothing to write to while we're reconnecting */
+	if (!js->gsc && js->fd<0)
+		return;
+
+	if (len == -1)
+		len = strlen(data);
+
+	if (js->zlib_out)
+		data = jabber_compress_deflate(js, data, len, &len);
 	
 #ifdef HAVE_CYRUS_SASL
 	if (js->sasl_maxbuf>0) {
 		int pos;
 
-		if (!js->gsc && js->fd<0)
-			return;
 		pos = 0;
 		if (len == -1)
 			len = strlen(data);
@@ -297,7 +379,7 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 			}
 
 			if (ret < 0 && errno != EAGAIN)
-				purple_connection_error(js->gc, _("Write error"));
+				jabber_connection_lost(js, _("Write error"));
 			else if (ret < olen) {
 				if (ret < 0)
 					ret = 0;
@@ -325,7 +407,7 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 	}
 
 	if (ret < 0 && errno != EAGAIN)
-		purple_connection_error(js->gc, _("Write error"));
+		jabber_connection_lost(js, _("Write error"));
 	else if (ret < len) {
 		if (ret < 0)
 			ret = 0;
@@ -358,13 +440,30 @@ void jabber_send(JabberStream *js, xmlnode *packet)
 		return;
 
 	txt = xmlnode_to_str(packet, &len);
-	jabber_send_raw(js, txt, len);
+	if(jabber_sm_outbound(js, packet, txt))
+		jabber_send_raw(js, txt, len);
 	g_free(txt);
 }
 
 void jabber_keepalive(PurpleConnection *gc)
 {
-	jabber_send_raw(gc->proto_data, "\t", -1);
+	JabberStream *js = gc->proto_data;
+
+	/* If the ack request isn't answered within JABBER_SM_ACK_TIMEOUT,
+	 * the connection is treated as lost */
+	if(js->sm_state == JABBER_SM_ENABLED)
+		jabber_sm_request_ack(js);
+	else
+		jabber_send_raw(js, "\t", -1);
+}
+
+static void
+jabber_stream_process(JabberStream *js, const char *buf, int len)
+{
+	if(js->zlib_in)
+		jabber_compress_process(js, buf, len);
+	else
+		jabber_parser_process(js, buf, len);
 }
 
 static void
@@ -384,8 +483,9 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 
 	while((len = purple_ssl_read(gsc, buf, sizeof(buf) - 1)) > 0) {
 		buf[len] = '\0';
-		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (ssl)(%d): %s\n", len, buf);
-		jabber_parser_process(js, buf, len);
+		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (ssl)(%d): %s\n", len,
+				js->zlib_in ? "(compressed)" : buf);
+		jabber_stream_process(js, buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
 	}
@@ -393,7 +493,7 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 	if(errno == EAGAIN)
 		return;
 	else
-		purple_connection_error(gc, _("Read Error"));
+		jabber_connection_lost(js, _("Read Error"));
 }
 
 static void
@@ -414,8 +514,9 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 			unsigned int olen;
 			sasl_decode(js->sasl, buf, len, &out, &olen);
 			if (olen>0) {
-				purple_debug(PURPLE_DEBUG_INFO, "jabber", "RecvSASL (%u): %s\n", olen, out);
-				jabber_parser_process(js,out,olen);
+				purple_debug(PURPLE_DEBUG_INFO, "jabber", "RecvSASL (%u): %s\n", olen,
+						js->zlib_in ? "(compressed)" : out);
+				jabber_stream_process(js,out,olen);
 				if(js->reinit)
 					jabber_stream_init(js);
 			}
@@ -423,14 +524,15 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 		}
 #endif
 		buf[len] = '\0';
-		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (%d): %s\n", len, buf);
-		jabber_parser_process(js, buf, len);
+		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (%d): %s\n", len,
+				js->zlib_in ? "(compressed)" : buf);
+		jabber_stream_process(js, buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
 	} else if(errno == EAGAIN) {
 		return;
 	} else {
-		purple_connection_error(gc, _("Read Error"));
+		jabber_connection_lost(js, _("Read Error"));
 	}
 }
 
@@ -539,12 +641,12 @@ static void srv_resolved_cb(PurpleSrvResponse *resp, int results, gpointer data)
 	}
 }
 
+static void jabber_stream_connect(JabberStream *js);
+
 void
 jabber_login(PurpleAccount *account)
 {
 	PurpleConnection *gc = purple_account_get_connection(account);
-	const char *connect_server = purple_account_get_string(account,
-			"connect_server", "");
 	JabberStream *js;
 	JabberBuddy *my_jb = NULL;
 
@@ -590,6 +692,15 @@ jabber_login(PurpleAccount *account)
 	if((my_jb = jabber_buddy_find(js, purple_account_get_username(account), TRUE)))
 		my_jb->subscription |= JABBER_SUB_BOTH;
 
+	jabber_stream_connect(js);
+}
+
+static void jabber_stream_connect(JabberStream *js)
+{
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	const char *connect_server = purple_account_get_string(account,
+			"connect_server", "");
+
 	jabber_stream_set_state(js, JABBER_STREAM_CONNECTING);
 
 	/* if they've got old-ssl mode going, we probably want to ignore SRV lookups */
@@ -616,6 +727,61 @@ jabber_login(PurpleAccount *account)
 	}
 }
 
+/*
+ * Drop the dead connection and open a new one, keeping everything we
+ * know about the session.  Once we've authenticated again, the stream
+ * is resumed instead of binding a new resource, so the roster and
+ * presences don't have to be fetched again.
+ */
+static void jabber_stream_reconnect(JabberStream *js)
+{
+	if(js->gsc) {
+		purple_ssl_close(js->gsc);
+		js->gsc = NULL;
+	} else if(js->fd >= 0) {
+		if(js->gc->inpa)
+			purple_input_remove(js->gc->inpa);
+		close(js->fd);
+	}
+	js->gc->inpa = 0;
+	js->fd = -1;
+
+	if(js->writeh) {
+		purple_input_remove(js->writeh);
+		js->writeh = 0;
+	}
+	purple_circ_buffer_destroy(js->write_buffer);
+	js->write_buffer = purple_circ_buffer_new(512);
+
+	/* Throw away whatever was left of the old stream */
+	jabber_parser_setup(js);
+	while(js->current && js->current->parent)
+		js->current = js->current->parent;
+	if(js->current) {
+		xmlnode_free(js->current);
+		js->current = NULL;
+	}
+	js->reinit = FALSE;
+	g_free(js->expected_rspauth);
+	js->expected_rspauth = NULL;
+	jabber_compress_free(js);
+
+#ifdef HAVE_CYRUS_SASL
+	if(js->sasl) {
+		sasl_dispose(&js->sasl);
+		js->sasl = NULL;
+	}
+	if(js->sasl_mechs) {
+		g_string_free(js->sasl_mechs, TRUE);
+		js->sasl_mechs = NULL;
+	}
+	js->sasl_state = 0;
+	js->sasl_maxbuf = 0;
+#endif
+
+	jabber_stream_connect(js);
+}
+
 
 static gboolean
 conn_close_cb(gpointer data)
@@ -1031,11 +1197,25 @@ void jabber_close(PurpleConnection *gc)
 	g_free(js->server_name);
 	g_free(js->gmail_last_time);
 	g_free(js->gmail_last_tid);
+	if(js->sm_reconnect_timer)
+		purple_timeout_remove(js->sm_reconnect_timer);
+	jabber_sm_free(js);
+	jabber_compress_free(js);
+	jabber_caps_free(js);
 	g_free(js);
 
 	gc->proto_data = NULL;
 }
 
+static void jabber_stream_update_progress(JabberStream *js, const char *text, size_t step)
+{
+	/* The account stays connected while a stream is being resumed */
+	if(js->sm_resuming)
+		return;
+
+	purple_connection_update_progress(js->gc, text, step, JABBER_CONNECT_STEPS);
+}
+
 void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 {
 	js->state = state;
@@ -1043,17 +1223,16 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 		case JABBER_STREAM_OFFLINE:
 			break;
 		case JABBER_STREAM_CONNECTING:
-			purple_connection_update_progress(js->gc, _("Connecting"), 1,
-					JABBER_CONNECT_STEPS);
+			jabber_stream_update_progress(js, _("Connecting"), 1);
 			break;
 		case JABBER_STREAM_INITIALIZING:
-			purple_connection_update_progress(js->gc, _("Initializing Stream"),
-					js->gsc ? 5 : 2, JABBER_CONNECT_STEPS);
+			jabber_stream_update_progress(js, _("Initializing Stream"),
+					js->gsc ? 5 : 2);
 			jabber_stream_init(js);
 			break;
 		case JABBER_STREAM_AUTHENTICATING:
-			purple_connection_update_progress(js->gc, _("Authenticating"),
-					js->gsc ? 6 : 3, JABBER_CONNECT_STEPS);
+			jabber_stream_update_progress(js, _("Authenticating"),
+					js->gsc ? 6 : 3);
 			if(js->protocol_version == JABBER_PROTO_0_9 && js->registration) {
 				jabber_register_start(js);
 			} else if(js->auth_type == JABBER_AUTH_IQ_AUTH) {
@@ -1061,8 +1240,8 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 			}
 			break;
 		case JABBER_STREAM_REINITIALIZING:
-			purple_connection_update_progress(js->gc, _("Re-initializing Stream"),
-					(js->gsc ? 7 : 4), JABBER_CONNECT_STEPS);
+			jabber_stream_update_progress(js, _("Re-initializing Stream"),
+					(js->gsc ? 7 : 4));
 
 			/* The stream will be reinitialized later, in jabber_recv_cb_ssl() */
 			js->reinit = TRUE;
@@ -69,6 +69,14 @@ typedef enum {
 	JABBER_STREAM_CONNECTED
 } JabberStreamState;
 
+typedef enum {
+	JABBER_SM_DISABLED,
+	JABBER_SM_REQUESTED, /* We asked the server to enable it */
+	JABBER_SM_ENABLED
+} JabberSmState;
+
+struct z_stream_s;
+
 typedef struct _JabberStream
 {
 	int fd;
@@ -97,6 +105,7 @@ typedef struct _JabberStream
 
 	GHashTable *buddies;
 	gboolean roster_parsed;
+	gboolean roster_versioning; /* XEP-0237 */
 
 	GHashTable *chats;
 	GList *chat_servers;
@@ -154,13 +163,35 @@ typedef struct _JabberStream
 
 	gboolean vcard_fetched;
 
+	/* XEP-0198 Stream Management */
+	gboolean sm_supported;
+	JabberSmState sm_state;
+	guint32 sm_inbound; /* Stanzas received since it was enabled */
+	guint32 sm_acked; /* Stanzas sent that the server has acknowledged */
+	GQueue *sm_unacked; /* Stanzas sent but not acknowledged yet */
+	guint sm_request_timer;
+	guint sm_ack_timer; /* Waiting for the answer to an ack request */
+	char *sm_resume_id;
+	gboolean sm_resuming; /* Reconnecting to resume the stream */
+	guint sm_reconnect_timer;
+
+	/* XEP-0138 Stream Compression */
+	struct z_stream_s *zlib_out;
+	struct z_stream_s *zlib_in;
+	GString *zlib_buffer; /* Compressed data to be written */
+
+	/* XEP-0115 Entity Capabilities */
+	GHashTable *caps_pending; /* Caps queries in flight, by ver */
+
 } JabberStream;
 
 void jabber_process_packet(JabberStream *js, xmlnode *packet);
 void jabber_send(JabberStream *js, xmlnode *data);
 void jabber_send_raw(JabberStream *js, const char *data, int len);
+void jabber_connection_lost(JabberStream *js, const char *msg);
 
 void jabber_stream_set_state(JabberStream *js, JabberStreamState state);
+void jabber_stream_bind(JabberStream *js);
 
 void jabber_register_parse(JabberStream *js, xmlnode *packet);
 void jabber_register_start(JabberStream *js);
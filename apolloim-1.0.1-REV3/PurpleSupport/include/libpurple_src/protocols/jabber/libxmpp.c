@@ -30,6 +30,7 @@
 #include "accountopt.h"
 #include "version.h"
 
+#include "caps.h"
 #include "iq.h"
 #include "jabber.h"
 #include "chat.h"
@@ -136,6 +137,7 @@ static gboolean load_plugin(PurplePlugin *plugin)
 			     purple_value_new(PURPLE_TYPE_SUBTYPE, PURPLE_SUBTYPE_CONNECTION),
 			     purple_value_new_outgoing(PURPLE_TYPE_STRING));
 			   
+	jabber_caps_init();
 
 	return TRUE;
 }
@@ -147,6 +149,8 @@ static gboolean unload_plugin(PurplePlugin *plugin)
 	purple_signal_unregister(plugin, "jabber-sending-xmlnode");
 	
 	purple_signal_unregister(plugin, "jabber-sending-text");
+
+	jabber_caps_uninit();
 	
 	return TRUE;
 }
@@ -213,6 +217,12 @@ init_plugin(PurplePlugin *plugin)
         prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
                         option);
 
+        option = purple_account_option_bool_new(
+                        _("Use stream compression if available"),
+                        "compress", TRUE);
+        prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+                        option);
+
         option = purple_account_option_int_new(_("Connect port"), "port", 5222);
         prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
                         option);
@@ -70,7 +70,8 @@ jabber_parser_element_start_libxml(void *user_data,
 		if(js->current)
 			node = xmlnode_new_child(js->current, (const char*) element_name);
 		else
-			node = xmlnode_new((const char*) element_name);
+			/* Stanzas are thrown away whole once they've been processed */
+			node = xmlnode_new_arena((const char*) element_name);
 		xmlnode_set_namespace(node, (const char*) namespace);
 
 		for(i=0; i < nb_attributes * 5; i+=5) {
@@ -32,6 +32,7 @@
 #include "xmlnode.h"
 
 #include "buddy.h"
+#include "caps.h"
 #include "chat.h"
 #include "presence.h"
 #include "iq.h"
@@ -178,11 +179,15 @@ xmlnode *jabber_presence_create(JabberBuddyState state, const char *msg, int pri
 		g_free(pstr);
 	}
 
-	/* JEP-0115 */
+	/* XEP-0115 */
 	c = xmlnode_new_child(presence, "c");
-	xmlnode_set_namespace(c, "http://jabber.org/protocol/caps");
+	xmlnode_set_namespace(c, JABBER_CAPS_NAMESPACE);
 	xmlnode_set_attrib(c, "node", CAPS0115_NODE);
-	xmlnode_set_attrib(c, "ver", VERSION);
+	if(jabber_caps_get_own_hash()) {
+		xmlnode_set_attrib(c, "hash", "sha-1");
+		xmlnode_set_attrib(c, "ver", jabber_caps_get_own_hash());
+	} else
+		xmlnode_set_attrib(c, "ver", VERSION);
 
 	return presence;
 }
@@ -273,6 +278,7 @@ void jabber_presence_parse(JabberStream *js, xmlnode *packet)
 	xmlnode *y;
 	gboolean muc = FALSE;
 	char *avatar_hash = NULL;
+	xmlnode *caps = NULL;
 
 	if(!(jb = jabber_buddy_find(js, from, TRUE)))
 		return;
@@ -347,6 +353,10 @@ void jabber_presence_parse(JabberStream *js, xmlnode *packet)
 				priority = atoi(p);
 				g_free(p);
 			}
+		} else if(!strcmp(y->name, "c")) {
+			const char *xmlns = xmlnode_get_namespace(y);
+			if(xmlns && !strcmp(xmlns, JABBER_CAPS_NAMESPACE))
+				caps = y;
 		} else if(!strcmp(y->name, "x")) {
 			const char *xmlns = xmlnode_get_namespace(y);
 			if(xmlns && !strcmp(xmlns, "jabber:x:delay")) {
@@ -509,8 +519,10 @@ void jabber_presence_parse(JabberStream *js, xmlnode *packet)
 				jabber_chat_disco_traffic(chat);
 			}
 
-			jabber_buddy_track_resource(jb, jid->resource, priority, state,
-					status);
+			jbr = jabber_buddy_track_resource(jb, jid->resource, priority,
+					state, status);
+			if(caps && jid->resource)
+				jabber_caps_presence(js, jbr, from, caps);
 
 			jabber_chat_track_handle(chat, jid->resource, real_jid, affiliation, role);
 
@@ -573,6 +585,8 @@ void jabber_presence_parse(JabberStream *js, xmlnode *packet)
 		} else {
 			jbr = jabber_buddy_track_resource(jb, jid->resource, priority,
 					state, status);
+			if(caps && jid->resource)
+				jabber_caps_presence(js, jbr, from, caps);
 		}
 
 		if((found_jbr = jabber_buddy_find_resource(jb, NULL))) {
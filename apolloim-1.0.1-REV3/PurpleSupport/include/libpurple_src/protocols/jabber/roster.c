@@ -32,15 +32,195 @@
 #include <string.h>
 
 
+static void jabber_roster_request_cb(JabberStream *js, xmlnode *packet,
+		gpointer data)
+{
+	const char *type = xmlnode_get_attrib(packet, "type");
+
+	if(type && !strcmp(type, "error")) {
+		/* Servers that choke on the version get asked the old way */
+		if(js->roster_versioning) {
+			purple_debug_warning("jabber", "Versioned roster request failed, "
+					"requesting the full roster\n");
+			js->roster_versioning = FALSE;
+			jabber_roster_request(js);
+		}
+		return;
+	}
+
+	jabber_roster_parse(js, packet);
+}
+
 void jabber_roster_request(JabberStream *js)
 {
 	JabberIq *iq;
 
 	iq = jabber_iq_new_query(js, JABBER_IQ_GET, "jabber:iq:roster");
 
+	if(js->roster_versioning) {
+		PurpleAccount *account = purple_connection_get_account(js->gc);
+		const char *ver = purple_account_get_string(account, "roster_ver", "");
+		GSList *buddies;
+
+		/* Without the buddies we saved, the server has to send everything */
+		if((buddies = purple_find_buddies(account, NULL)) == NULL)
+			ver = "";
+		g_slist_free(buddies);
+
+		xmlnode_set_attrib(xmlnode_get_child(iq->node, "query"), "ver", ver);
+	}
+
+	jabber_iq_set_callback(iq, jabber_roster_request_cb, NULL);
 	jabber_iq_send(iq);
 }
 
+static JabberBuddy *jabber_roster_set_subscription(JabberStream *js,
+		const char *jid, const char *subscription, const char *ask)
+{
+	JabberBuddy *jb;
+
+	if(!(jb = jabber_buddy_find(js, jid, TRUE)))
+		return NULL;
+
+	if(subscription) {
+		gint me = -1;
+		char *jid_norm;
+		const char *username;
+
+		jid_norm = g_strdup(jabber_normalize(js->gc->account, jid));
+		username = purple_account_get_username(js->gc->account);
+		me = g_utf8_collate(jid_norm,
+		                    jabber_normalize(js->gc->account,
+		                                     username));
+		g_free(jid_norm);
+
+		if(me == 0)
+			jb->subscription = JABBER_SUB_BOTH;
+		else if(!strcmp(subscription, "none"))
+			jb->subscription = JABBER_SUB_NONE;
+		else if(!strcmp(subscription, "to"))
+			jb->subscription = JABBER_SUB_TO;
+		else if(!strcmp(subscription, "from"))
+			jb->subscription = JABBER_SUB_FROM;
+		else if(!strcmp(subscription, "both"))
+			jb->subscription = JABBER_SUB_BOTH;
+		else if(!strcmp(subscription, "remove"))
+			jb->subscription = JABBER_SUB_REMOVE;
+		/* XXX: if subscription is now "from" or "none" we need to
+		 * fake a signoff, since we won't get any presence from them
+		 * anymore */
+		/* YYY: I was going to use this, but I'm not sure it's necessary
+		 * anymore, but it's here in case it is. */
+		/*
+		if ((jb->subscription & JABBER_SUB_FROM) ||
+				(jb->subscription & JABBER_SUB_NONE)) {
+			purple_prpl_got_user_status(js->gc->account, jid, "offline", NULL);
+		}
+		*/
+	}
+
+	if(ask && !strcmp(ask, "subscribe"))
+		jb->subscription |= JABBER_SUB_PENDING;
+	else
+		jb->subscription &= ~JABBER_SUB_PENDING;
+
+	return jb;
+}
+
+/* Keep the roster state of a contact with its buddies, so that a versioned
+ * roster request can skip the contacts that haven't changed */
+static void save_roster_item(JabberStream *js, const char *jid,
+		const char *subscription, const char *ask)
+{
+	GSList *buddies;
+
+	buddies = purple_find_buddies(js->gc->account, jid);
+
+	while(buddies) {
+		PurpleBlistNode *node = buddies->data;
+
+		purple_blist_node_set_string(node, "subscription",
+				subscription ? subscription : "none");
+		if(ask)
+			purple_blist_node_set_string(node, "ask", ask);
+		else
+			purple_blist_node_remove_setting(node, "ask");
+
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+}
+
+/* The roster hasn't changed since the version we have, so our buddies
+ * are all there is to it */
+static void restore_roster(JabberStream *js)
+{
+	GSList *buddies;
+	gchar *my_bare_jid;
+
+	buddies = purple_find_buddies(js->gc->account, NULL);
+	my_bare_jid = g_strdup_printf("%s@%s", js->user->node, js->user->domain);
+
+	while(buddies) {
+		PurpleBlistNode *node = buddies->data;
+		const char *name = ((PurpleBuddy *)node)->name;
+		const char *subscription = purple_blist_node_get_string(node, "subscription");
+
+		buddies = g_slist_delete_link(buddies, buddies);
+
+		if(!subscription)
+			continue;
+
+		jabber_roster_set_subscription(js, name, subscription,
+				purple_blist_node_get_string(node, "ask"));
+
+		if(!strcmp(name, my_bare_jid)) {
+			PurplePresence *gpresence;
+			PurpleStatus *status;
+
+			gpresence = purple_account_get_presence(js->gc->account);
+			status = purple_presence_get_active_status(gpresence);
+			jabber_presence_fake_to_self(js, status);
+		}
+	}
+
+	g_free(my_bare_jid);
+}
+
+/* A full roster replaces everything we saved, so contacts that were on
+ * the old roster but aren't on this one have been removed meanwhile */
+static void remove_stale_buddies(JabberStream *js, xmlnode *query)
+{
+	GHashTable *items;
+	GSList *buddies;
+	xmlnode *item;
+
+	items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for(item = xmlnode_get_child(query, "item"); item; item = xmlnode_get_next_twin(item)) {
+		const char *jid = xmlnode_get_attrib(item, "jid");
+		const char *jid_norm;
+
+		if(jid && (jid_norm = jabber_normalize(js->gc->account, jid)))
+			g_hash_table_insert(items, g_strdup(jid_norm), GINT_TO_POINTER(1));
+	}
+
+	buddies = purple_find_buddies(js->gc->account, NULL);
+	while(buddies) {
+		PurpleBuddy *b = buddies->data;
+		const char *jid_norm;
+
+		buddies = g_slist_delete_link(buddies, buddies);
+
+		if(!purple_blist_node_get_string((PurpleBlistNode *)b, "subscription"))
+			continue;
+
+		jid_norm = jabber_normalize(js->gc->account, b->name);
+		if(!jid_norm || !g_hash_table_lookup(items, jid_norm))
+			purple_blist_remove_buddy(b);
+	}
+
+	g_hash_table_destroy(items);
+}
+
 static void remove_purple_buddies(JabberStream *js, const char *jid)
 {
 	GSList *buddies, *l;
@@ -125,10 +305,22 @@ static void add_purple_buddies_to_groups(JabberStream *js, const char *jid,
 	g_slist_free(buddies);
 }
 
+static void jabber_roster_parsed(JabberStream *js)
+{
+	/* if we're just now parsing the roster for the first time,
+	 * then now would be the time to send our initial presence */
+	if(!js->roster_parsed) {
+		js->roster_parsed = TRUE;
+
+		jabber_presence_send(js->gc->account, NULL);
+	}
+}
+
 void jabber_roster_parse(JabberStream *js, xmlnode *packet)
 {
 	xmlnode *query, *item, *group;
 	const char *from = xmlnode_get_attrib(packet, "from");
+	const char *type, *ver;
 
 	if(from) {
 		char *from_norm;
@@ -150,8 +342,23 @@ void jabber_roster_parse(JabberStream *js, xmlnode *packet)
 	}
 
 	query = xmlnode_get_child(packet, "query");
-	if(!query)
+	type = xmlnode_get_attrib(packet, "type");
+
+	/* An empty result to a versioned request means nothing has changed */
+	if(!query) {
+		if(type && !strcmp(type, "result")) {
+			purple_blist_begin_batch();
+			restore_roster(js);
+			purple_blist_end_batch();
+			jabber_roster_parsed(js);
+		}
 		return;
+	}
+
+	purple_blist_begin_batch();
+
+	if(type && !strcmp(type, "result"))
+		remove_stale_buddies(js, query);
 
 	for(item = xmlnode_get_child(query, "item"); item; item = xmlnode_get_next_twin(item))
 	{
@@ -166,51 +373,9 @@ void jabber_roster_parse(JabberStream *js, xmlnode *packet)
 		if(!jid)
 			continue;
 
-		if(!(jb = jabber_buddy_find(js, jid, TRUE)))
+		if(!(jb = jabber_roster_set_subscription(js, jid, subscription, ask)))
 			continue;
 
-		if(subscription) {
-			gint me = -1;
-			char *jid_norm;
-			const char *username;
-
-			jid_norm = g_strdup(jabber_normalize(js->gc->account, jid));
-			username = purple_account_get_username(js->gc->account);
-			me = g_utf8_collate(jid_norm,
-			                    jabber_normalize(js->gc->account,
-			                                     username));
-			g_free(jid_norm);
-
-			if(me == 0)
-				jb->subscription = JABBER_SUB_BOTH;
-			else if(!strcmp(subscription, "none"))
-				jb->subscription = JABBER_SUB_NONE;
-			else if(!strcmp(subscription, "to"))
-				jb->subscription = JABBER_SUB_TO;
-			else if(!strcmp(subscription, "from"))
-				jb->subscription = JABBER_SUB_FROM;
-			else if(!strcmp(subscription, "both"))
-				jb->subscription = JABBER_SUB_BOTH;
-			else if(!strcmp(subscription, "remove"))
-				jb->subscription = JABBER_SUB_REMOVE;
-			/* XXX: if subscription is now "from" or "none" we need to
-			 * fake a signoff, since we won't get any presence from them
-			 * anymore */
-			/* YYY: I was going to use this, but I'm not sure it's necessary
-			 * anymore, but it's here in case it is. */
-			/*
-			if ((jb->subscription & JABBER_SUB_FROM) ||
-					(jb->subscription & JABBER_SUB_NONE)) {
-				purple_prpl_got_user_status(js->gc->account, jid, "offline", NULL);
-			}
-			*/
-		}
-
-		if(ask && !strcmp(ask, "subscribe"))
-			jb->subscription |= JABBER_SUB_PENDING;
-		else
-			jb->subscription &= ~JABBER_SUB_PENDING;
-
 		if(jb->subscription == JABBER_SUB_REMOVE) {
 			remove_purple_buddies(js, jid);
 		} else {
@@ -228,16 +393,17 @@ void jabber_roster_parse(JabberStream *js, xmlnode *packet)
 				if (!jabber_google_roster_incoming(js, item))
 					continue;
 			add_purple_buddies_to_groups(js, jid, name, groups);
+			save_roster_item(js, jid, subscription, ask);
 		}
 	}
 
-	/* if we're just now parsing the roster for the first time,
-	 * then now would be the time to send our initial presence */
-	if(!js->roster_parsed) {
-		js->roster_parsed = TRUE;
+	purple_blist_end_batch();
 
-		jabber_presence_send(js->gc->account, NULL);
-	}
+	/* Only once all of it has been applied are we at this version */
+	if((ver = xmlnode_get_attrib(query, "ver")))
+		purple_account_set_string(js->gc->account, "roster_ver", ver);
+
+	jabber_roster_parsed(js);
 }
 
 static void jabber_roster_update(JabberStream *js, const char *name,
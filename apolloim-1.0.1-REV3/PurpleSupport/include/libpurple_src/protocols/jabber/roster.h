@@ -24,6 +24,8 @@
 
 #include "jabber.h"
 
+#define JABBER_ROSTER_VER_NAMESPACE "urn:xmpp:features:rosterver"
+
 void jabber_roster_request(JabberStream *js);
 
 void jabber_roster_parse(JabberStream *js, xmlnode *packet);
@@ -0,0 +1,269 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "internal.h"
+#include "debug.h"
+
+#include "jabber.h"
+#include "sm.h"
+
+static gboolean
+jabber_sm_is_stanza(xmlnode *packet)
+{
+	return !strcmp(packet->name, "iq") || !strcmp(packet->name, "message") ||
+			!strcmp(packet->name, "presence");
+}
+
+void jabber_sm_enable(JabberStream *js)
+{
+	xmlnode *enable;
+
+	if (js->sm_state != JABBER_SM_DISABLED)
+		return;
+
+	enable = xmlnode_new("enable");
+	xmlnode_set_namespace(enable, JABBER_SM_NAMESPACE);
+	xmlnode_set_attrib(enable, "resume", "true");
+	jabber_send(js, enable);
+	xmlnode_free(enable);
+
+	/* The server counts our stanzas from here on */
+	js->sm_state = JABBER_SM_REQUESTED;
+	js->sm_acked = 0;
+	js->sm_unacked = g_queue_new();
+}
+
+void jabber_sm_free(JabberStream *js)
+{
+	if (js->sm_request_timer) {
+		purple_timeout_remove(js->sm_request_timer);
+		js->sm_request_timer = 0;
+	}
+
+	if (js->sm_ack_timer) {
+		purple_timeout_remove(js->sm_ack_timer);
+		js->sm_ack_timer = 0;
+	}
+
+	if (js->sm_unacked) {
+		while (!g_queue_is_empty(js->sm_unacked))
+			g_free(g_queue_pop_head(js->sm_unacked));
+		g_queue_free(js->sm_unacked);
+		js->sm_unacked = NULL;
+	}
+
+	g_free(js->sm_resume_id);
+	js->sm_resume_id = NULL;
+	js->sm_state = JABBER_SM_DISABLED;
+}
+
+void jabber_sm_inbound(JabberStream *js, xmlnode *packet)
+{
+	if (js->sm_state == JABBER_SM_ENABLED && jabber_sm_is_stanza(packet))
+		js->sm_inbound++;
+}
+
+static gboolean
+jabber_sm_request_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm_request_timer = 0;
+	jabber_sm_request_ack(js);
+
+	return FALSE;
+}
+
+gboolean jabber_sm_outbound(JabberStream *js, xmlnode *packet, const char *txt)
+{
+	if (js->sm_state == JABBER_SM_DISABLED || !jabber_sm_is_stanza(packet))
+		return TRUE;
+
+	g_queue_push_tail(js->sm_unacked, g_strdup(txt));
+
+	if (js->sm_resuming)
+		return FALSE;
+
+	if (js->sm_state != JABBER_SM_ENABLED)
+		return TRUE;
+
+	/* Don't let the copies pile up while the server takes its time */
+	if (g_queue_get_length(js->sm_unacked) > JABBER_SM_REQUEST_STANZAS &&
+			js->sm_ack_timer == 0)
+		jabber_sm_request_ack(js);
+	else if (js->sm_request_timer == 0)
+		js->sm_request_timer = purple_timeout_add(JABBER_SM_REQUEST_DELAY,
+				jabber_sm_request_cb, js);
+
+	return TRUE;
+}
+
+static gboolean
+jabber_sm_ack_timeout_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm_ack_timer = 0;
+
+	/* Already reconnecting, so the answer isn't coming anyway */
+	if (js->sm_resuming)
+		return FALSE;
+
+	jabber_connection_lost(js, _("Ping timed out"));
+
+	return FALSE;
+}
+
+void jabber_sm_request_ack(JabberStream *js)
+{
+	if (js->sm_state != JABBER_SM_ENABLED || js->sm_resuming)
+		return;
+
+	if (js->sm_request_timer) {
+		purple_timeout_remove(js->sm_request_timer);
+		js->sm_request_timer = 0;
+	}
+
+	jabber_send_raw(js, "<r xmlns='" JABBER_SM_NAMESPACE "'/>", -1);
+
+	if (js->sm_ack_timer == 0)
+		js->sm_ack_timer = purple_timeout_add(JABBER_SM_ACK_TIMEOUT,
+				jabber_sm_ack_timeout_cb, js);
+}
+
+/* Forget the stanzas the server says it has handled */
+static void
+jabber_sm_handle_ack(JabberStream *js, const char *h)
+{
+	guint32 handled, count;
+
+	if (h == NULL)
+		return;
+
+	/* This answers every request we've made so far */
+	if (js->sm_ack_timer) {
+		purple_timeout_remove(js->sm_ack_timer);
+		js->sm_ack_timer = 0;
+	}
+
+	handled = strtoul(h, NULL, 10);
+	count = handled - js->sm_acked;
+	if (count > g_queue_get_length(js->sm_unacked)) {
+		purple_debug_warning("jabber", "Server acknowledged %u stanzas, "
+				"but only %u were sent\n", count,
+				g_queue_get_length(js->sm_unacked));
+		count = g_queue_get_length(js->sm_unacked);
+	}
+
+	js->sm_acked += count;
+	while (count-- > 0)
+		g_free(g_queue_pop_head(js->sm_unacked));
+}
+
+static void
+jabber_sm_handle_enabled(JabberStream *js, xmlnode *packet)
+{
+	const char *resume = xmlnode_get_attrib(packet, "resume");
+	const char *id = xmlnode_get_attrib(packet, "id");
+
+	js->sm_state = JABBER_SM_ENABLED;
+	js->sm_inbound = 0;
+
+	if (resume && id && (!strcmp(resume, "true") || !strcmp(resume, "1")))
+		js->sm_resume_id = g_strdup(id);
+
+	purple_debug_info("jabber", "Stream management enabled%s\n",
+			js->sm_resume_id ? ", stream can be resumed" : "");
+
+	if (!g_queue_is_empty(js->sm_unacked) && js->sm_request_timer == 0)
+		js->sm_request_timer = purple_timeout_add(JABBER_SM_REQUEST_DELAY,
+				jabber_sm_request_cb, js);
+}
+
+static void
+jabber_sm_handle_resumed(JabberStream *js, xmlnode *packet)
+{
+	GList *l;
+
+	jabber_sm_handle_ack(js, xmlnode_get_attrib(packet, "h"));
+
+	js->sm_resuming = FALSE;
+	js->state = JABBER_STREAM_CONNECTED;
+
+	purple_debug_info("jabber", "Stream resumed, resending %u stanzas\n",
+			g_queue_get_length(js->sm_unacked));
+
+	for (l = js->sm_unacked->head; l != NULL; l = l->next)
+		jabber_send_raw(js, l->data, -1);
+
+	jabber_sm_request_ack(js);
+}
+
+void jabber_sm_parse(JabberStream *js, xmlnode *packet)
+{
+	if (!strcmp(packet->name, "enabled")) {
+		if (js->sm_state == JABBER_SM_REQUESTED)
+			jabber_sm_handle_enabled(js, packet);
+	} else if (!strcmp(packet->name, "r")) {
+		if (js->sm_state == JABBER_SM_ENABLED) {
+			char *ack = g_strdup_printf("<a xmlns='" JABBER_SM_NAMESPACE "' h='%u'/>",
+					js->sm_inbound);
+			jabber_send_raw(js, ack, -1);
+			g_free(ack);
+		}
+	} else if (!strcmp(packet->name, "a")) {
+		if (js->sm_state == JABBER_SM_ENABLED)
+			jabber_sm_handle_ack(js, xmlnode_get_attrib(packet, "h"));
+	} else if (!strcmp(packet->name, "resumed")) {
+		if (js->sm_resuming)
+			jabber_sm_handle_resumed(js, packet);
+	} else if (!strcmp(packet->name, "failed")) {
+		if (js->sm_resuming) {
+			/* The session is gone, so start over with a new one */
+			purple_connection_error(js->gc, _("Unable to resume the session"));
+		} else {
+			purple_debug_info("jabber", "Server refused to enable stream management\n");
+			jabber_sm_free(js);
+		}
+	}
+}
+
+gboolean jabber_sm_can_resume(JabberStream *js)
+{
+	return js->sm_state == JABBER_SM_ENABLED && js->sm_resume_id != NULL &&
+			js->state == JABBER_STREAM_CONNECTED && !js->sm_resuming;
+}
+
+void jabber_sm_resume(JabberStream *js)
+{
+	xmlnode *resume;
+	char *h;
+
+	h = g_strdup_printf("%u", js->sm_inbound);
+
+	resume = xmlnode_new("resume");
+	xmlnode_set_namespace(resume, JABBER_SM_NAMESPACE);
+	xmlnode_set_attrib(resume, "h", h);
+	xmlnode_set_attrib(resume, "previd", js->sm_resume_id);
+	jabber_send(js, resume);
+	xmlnode_free(resume);
+
+	g_free(h);
+}
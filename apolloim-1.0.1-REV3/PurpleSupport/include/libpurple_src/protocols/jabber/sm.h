@@ -0,0 +1,58 @@
+/**
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _PURPLE_JABBER_SM_H_
+#define _PURPLE_JABBER_SM_H_
+
+/* XEP-0198: Stream Management */
+
+#include "jabber.h"
+
+#define JABBER_SM_NAMESPACE "urn:xmpp:sm:3"
+
+/* Ask the server to acknowledge stanzas this long after sending one */
+#define JABBER_SM_REQUEST_DELAY 2000
+
+/* ...or right away, once this many are waiting to be acknowledged */
+#define JABBER_SM_REQUEST_STANZAS 20
+
+/* Give up on the connection if an ack request goes unanswered this long */
+#define JABBER_SM_ACK_TIMEOUT 60000
+
+void jabber_sm_enable(JabberStream *js);
+void jabber_sm_free(JabberStream *js);
+void jabber_sm_parse(JabberStream *js, xmlnode *packet);
+
+/* Counts a stanza we received */
+void jabber_sm_inbound(JabberStream *js, xmlnode *packet);
+
+/* Keeps a copy of a stanza we are sending until the server acknowledges it.
+ * Returns FALSE if the stanza must not be written now, because it will be
+ * resent once the stream is resumed.
+ */
+gboolean jabber_sm_outbound(JabberStream *js, xmlnode *packet, const char *txt);
+
+void jabber_sm_request_ack(JabberStream *js);
+
+/* Returns TRUE if the stream can be resumed after losing the connection */
+gboolean jabber_sm_can_resume(JabberStream *js);
+void jabber_sm_resume(JabberStream *js);
+
+#endif /* _PURPLE_JABBER_SM_H_ */
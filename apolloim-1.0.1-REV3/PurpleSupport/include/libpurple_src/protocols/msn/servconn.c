@@ -79,7 +79,7 @@ msn_servconn_destroy(MsnServConn *servconn)
 	g_free(servconn->host);
 
 	purple_circ_buffer_destroy(servconn->tx_buf);
-	if (servconn->tx_handler > 0)
+	if (servconn->tx_handler != -1)
 		purple_input_remove(servconn->tx_handler);
 
 	msn_cmdproc_destroy(servconn->cmdproc);
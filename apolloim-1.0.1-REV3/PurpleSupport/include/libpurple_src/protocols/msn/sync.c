@@ -27,6 +27,33 @@
 
 static MsnTable *cbs_table;
 
+static gboolean
+sync_batch_end_cb(gpointer data)
+{
+	MsnSync *sync = data;
+
+	sync->batch_timer = 0;
+	purple_blist_end_batch();
+
+	return FALSE;
+}
+
+/*
+ * The list arrives as LSG and LST commands, as many at a time as one read
+ * brings in.  The buddy list changes from each such burst go to the UI
+ * together, once the read has been handled, rather than the batch staying
+ * open while the next one is on its way.
+ */
+static void
+sync_batch(MsnSync *sync)
+{
+	if (sync->batch_timer != 0)
+		return;
+
+	purple_blist_begin_batch();
+	sync->batch_timer = purple_timeout_add(0, sync_batch_end_cb, sync);
+}
+
 static void
 blp_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
 {
@@ -92,6 +119,8 @@ lsg_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
 	const char *name;
 	int group_id;
 
+	sync_batch(session->sync);
+
 	group_id = atoi(cmd->params[0]);
 	name = purple_url_decode(cmd->params[1]);
 
@@ -129,6 +158,8 @@ lst_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
 	int list_op;
 	MsnUser *user;
 
+	sync_batch(session->sync);
+
 	passport = cmd->params[0];
 	friend   = purple_url_decode(cmd->params[1]);
 	list_op  = atoi(cmd->params[2]);
@@ -254,5 +285,11 @@ msn_sync_new(MsnSession *session)
 void
 msn_sync_destroy(MsnSync *sync)
 {
+	if (sync->batch_timer != 0)
+	{
+		purple_timeout_remove(sync->batch_timer);
+		purple_blist_end_batch();
+	}
+
 	g_free(sync);
 }
@@ -41,6 +41,8 @@ struct _MsnSync
 	int num_groups;
 	int total_groups;
 	MsnUser *last_user;
+
+	guint batch_timer; /**< Ends the buddy list batch for this burst. */
 };
 
 void msn_sync_init(void);
@@ -47,6 +47,135 @@
 
 static int aim_ssi_addmoddel(OscarData *od);
 
+#define AIM_SSI_ITEM_ID(gid, bid) GUINT_TO_POINTER(((guint)(gid) << 16) | (bid))
+
+static struct aim_ssi_index *
+aim_ssi_index_new(void)
+{
+	struct aim_ssi_index *index;
+
+	index = g_new0(struct aim_ssi_index, 1);
+	index->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	return index;
+}
+
+static void
+aim_ssi_index_free_bucket(gpointer key, gpointer value, gpointer data)
+{
+	g_slist_free(value);
+}
+
+static void
+aim_ssi_index_free(struct aim_ssi_index *index)
+{
+	if (index == NULL)
+		return;
+
+	g_hash_table_foreach(index->ids, aim_ssi_index_free_bucket, NULL);
+	g_hash_table_destroy(index->ids);
+	g_hash_table_foreach(index->names, aim_ssi_index_free_bucket, NULL);
+	g_hash_table_destroy(index->names);
+	g_slist_free(index->unnamed);
+	g_free(index);
+}
+
+/**
+ * Return the key a name is indexed under, so that names that aim_sncmp()
+ * considers equal share a key.  Free it with g_free().
+ */
+static char *
+aim_ssi_index_key(const char *name)
+{
+	char *key, *cur;
+
+	key = cur = g_malloc(strlen(name) + 1);
+	for (; *name != '\0'; name++)
+		if (*name != ' ')
+			*cur++ = toupper(*name);
+	*cur = '\0';
+
+	return key;
+}
+
+/* The table takes the key, or frees it if it already has an equal one. */
+static void
+aim_ssi_index_insert(GHashTable *table, gpointer key, struct aim_ssi_item *item)
+{
+	GSList *bucket = g_hash_table_lookup(table, key);
+
+	g_hash_table_insert(table, key, g_slist_append(bucket, item));
+}
+
+static void
+aim_ssi_index_remove(GHashTable *table, gconstpointer key, struct aim_ssi_item *item)
+{
+	gpointer orig_key, value;
+	GSList *bucket;
+
+	if (!g_hash_table_lookup_extended(table, key, &orig_key, &value))
+		return;
+
+	bucket = g_slist_remove(value, item);
+	if (bucket == NULL) {
+		g_hash_table_remove(table, key);
+	} else if (bucket != value) {
+		g_hash_table_steal(table, key);
+		g_hash_table_insert(table, orig_key, bucket);
+	}
+}
+
+/**
+ * Add an item to the index of its list.  This has to be undone with
+ * aim_ssi_item_unindex() before changing the item's name, gid or bid.
+ */
+static void
+aim_ssi_item_index(struct aim_ssi_item *item)
+{
+	struct aim_ssi_index *index = item->index;
+
+	aim_ssi_index_insert(index->ids, AIM_SSI_ITEM_ID(item->gid, item->bid), item);
+	if (item->name)
+		aim_ssi_index_insert(index->names, aim_ssi_index_key(item->name), item);
+	else
+		index->unnamed = g_slist_append(index->unnamed, item);
+}
+
+static void
+aim_ssi_item_unindex(struct aim_ssi_item *item)
+{
+	struct aim_ssi_index *index = item->index;
+
+	aim_ssi_index_remove(index->ids, AIM_SSI_ITEM_ID(item->gid, item->bid), item);
+	if (item->name) {
+		char *key = aim_ssi_index_key(item->name);
+		aim_ssi_index_remove(index->names, key, item);
+		g_free(key);
+	} else
+		index->unnamed = g_slist_remove(index->unnamed, item);
+}
+
+/**
+ * Return the items of a list with a name aim_sncmp() considers equal to
+ * the given one.  The returned list belongs to the index.
+ */
+static GSList *
+aim_ssi_itemlist_named(struct aim_ssi_item *list, const char *name)
+{
+	char *key;
+	GSList *items;
+
+	if (!list || !name)
+		return NULL;
+
+	key = aim_ssi_index_key(name);
+	items = g_hash_table_lookup(list->index->names, key);
+	g_free(key);
+
+	return items;
+}
+
 /**
  * Locally rebuild the 0x00c8 TLV in the additional data of the given group.
  *
@@ -98,10 +227,14 @@ aim_ssi_itemlist_rebuildgroup(struct aim_ssi_item *list, const char *name)
 	}
 }
 
+/* Lists are kept in ascending order of group ID# and then buddy ID#. */
+#define AIM_SSI_ITEM_BEFORE(a, b) (((a)->gid < (b)->gid) || (((a)->gid == (b)->gid) && ((a)->bid < (b)->bid)))
+
 /**
- * Locally add a new item to the given item list.
+ * Create a new item for the given item list, without adding it to the list.
  *
- * @param list A pointer to a pointer to the current list of items.
+ * @param list The current list of items.
+ * @param index The index of the list.
  * @param name A null terminated string of the name of the new item, or NULL if the
  *        item should have no name.
  * @param gid The group ID# you want the new item to have, or 0xFFFF if we should pick something.
@@ -110,10 +243,11 @@ aim_ssi_itemlist_rebuildgroup(struct aim_ssi_item *list, const char *name)
  * @param data The additional data for the new item.
  * @return A pointer to the newly created item.
  */
-static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
+static struct aim_ssi_item *aim_ssi_item_new(struct aim_ssi_item *list, struct aim_ssi_index *index, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
 {
 	gboolean exists;
 	struct aim_ssi_item *cur, *new;
+	GSList *l;
 
 	new = (struct aim_ssi_item *)g_malloc(sizeof(struct aim_ssi_item));
 
@@ -132,8 +266,8 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 			do {
 				new->gid += 0x0001;
 				exists = FALSE;
-				for (cur = *list; cur != NULL; cur = cur->next)
-					if ((cur->type == AIM_SSI_TYPE_GROUP) && (cur->gid == new->gid)) {
+				for (l = g_hash_table_lookup(index->ids, AIM_SSI_ITEM_ID(new->gid, 0x0000)); l; l = l->next)
+					if (((struct aim_ssi_item *)l->data)->type == AIM_SSI_TYPE_GROUP) {
 						exists = TRUE;
 						break;
 					}
@@ -144,7 +278,7 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 			do {
 				new->bid += 0x0001;
 				exists = FALSE;
-				for (cur = *list; cur != NULL; cur = cur->next)
+				for (cur = list; cur != NULL; cur = cur->next)
 					if ((cur->bid >= new->bid) || (cur->gid >= new->bid)) {
 						exists = TRUE;
 						break;
@@ -155,12 +289,7 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 		if (new->bid == 0xFFFF) {
 			do {
 				new->bid += 0x0001;
-				exists = FALSE;
-				for (cur = *list; cur != NULL; cur = cur->next)
-					if ((cur->bid == new->bid) && (cur->gid == new->gid)) {
-						exists = TRUE;
-						break;
-					}
+				exists = (g_hash_table_lookup(index->ids, AIM_SSI_ITEM_ID(new->gid, new->bid)) != NULL);
 			} while (exists);
 		}
 	}
@@ -171,25 +300,115 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 	/* Set the TLV list */
 	new->data = aim_tlvlist_copy(data);
 
+	new->next = NULL;
+	new->index = index;
+
+	return new;
+}
+
+/**
+ * Locally add a new item to the given item list.
+ *
+ * @param list A pointer to a pointer to the current list of items.
+ * @param index The index of the list.
+ * @param name A null terminated string of the name of the new item, or NULL if the
+ *        item should have no name.
+ * @param gid The group ID# you want the new item to have, or 0xFFFF if we should pick something.
+ * @param bid The buddy ID# you want the new item to have, or 0xFFFF if we should pick something.
+ * @param type The type of the item, 0x0000 for a contact, 0x0001 for a group, etc.
+ * @param data The additional data for the new item.
+ * @return A pointer to the newly created item.
+ */
+static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, struct aim_ssi_index *index, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
+{
+	struct aim_ssi_item *cur, *new;
+
+	new = aim_ssi_item_new(*list, index, name, gid, bid, type, data);
+
 	/* Add the item to the list in the correct numerical position.  Fancy, eh? */
-	if (*list) {
-		if ((new->gid < (*list)->gid) || ((new->gid == (*list)->gid) && (new->bid < (*list)->bid))) {
-			new->next = *list;
-			*list = new;
-		} else {
-			struct aim_ssi_item *prev;
-			for ((prev=*list, cur=(*list)->next); (cur && ((new->gid > cur->gid) || ((new->gid == cur->gid) && (new->bid > cur->bid)))); prev=cur, cur=cur->next);
-			new->next = prev->next;
-			prev->next = new;
-		}
-	} else {
+	if (!(*list) || AIM_SSI_ITEM_BEFORE(new, *list)) {
 		new->next = *list;
 		*list = new;
+	} else if (!AIM_SSI_ITEM_BEFORE(new, index->last)) {
+		/* Copying a list adds everything in order, so try the end first */
+		index->last->next = new;
+	} else {
+		struct aim_ssi_item *prev;
+		for ((prev=*list, cur=(*list)->next); (cur && AIM_SSI_ITEM_BEFORE(cur, new)); prev=cur, cur=cur->next);
+		new->next = prev->next;
+		prev->next = new;
 	}
+	if (!new->next)
+		index->last = new;
+
+	aim_ssi_item_index(new);
 
 	return new;
 }
 
+/**
+ * Locally add a new item to the end of the given item list, leaving the
+ * list out of order.  Use aim_ssi_itemlist_sort() once you're done adding.
+ *
+ * @param list A pointer to a pointer to the current list of items.
+ * @param index The index of the list.
+ * The other parameters are as for aim_ssi_itemlist_add().
+ */
+static void aim_ssi_itemlist_append(struct aim_ssi_item **list, struct aim_ssi_index *index, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
+{
+	struct aim_ssi_item *new;
+
+	new = aim_ssi_item_new(*list, index, name, gid, bid, type, data);
+
+	if (*list)
+		index->last->next = new;
+	else
+		*list = new;
+	index->last = new;
+
+	aim_ssi_item_index(new);
+}
+
+static gint aim_ssi_item_compare(gconstpointer a, gconstpointer b)
+{
+	const struct aim_ssi_item *item1 = a, *item2 = b;
+
+	if (AIM_SSI_ITEM_BEFORE(item1, item2))
+		return -1;
+	if (AIM_SSI_ITEM_BEFORE(item2, item1))
+		return 1;
+	return 0;
+}
+
+/**
+ * Put an item list built with aim_ssi_itemlist_append() back in numerical
+ * order.
+ *
+ * @param list A pointer to a pointer to the current list of items.
+ * @param index The index of the list.
+ */
+static void aim_ssi_itemlist_sort(struct aim_ssi_item **list, struct aim_ssi_index *index)
+{
+	GSList *items = NULL, *l;
+	struct aim_ssi_item *cur;
+
+	if (!(*list))
+		return;
+
+	for (cur=*list; cur; cur=cur->next)
+		items = g_slist_prepend(items, cur);
+	items = g_slist_sort(g_slist_reverse(items), aim_ssi_item_compare);
+
+	*list = items->data;
+	for (l=items; l; l=l->next) {
+		cur = l->data;
+		cur->next = l->next ? l->next->data : NULL;
+	}
+	index->last = cur;
+
+	g_slist_free(items);
+}
+
 /**
  * Locally delete an item from the given item list.
  *
@@ -205,14 +424,19 @@ static int aim_ssi_itemlist_del(struct aim_ssi_item **list, struct aim_ssi_item
 	/* Remove the item from the list */
 	if (*list == del) {
 		*list = (*list)->next;
+		if (del->index->last == del)
+			del->index->last = NULL;
 	} else {
 		struct aim_ssi_item *cur;
 		for (cur=*list; (cur->next && (cur->next!=del)); cur=cur->next);
 		if (cur->next)
 			cur->next = del->next;
+		if (del->index->last == del)
+			del->index->last = cur;
 	}
 
 	/* Free the removed item */
+	aim_ssi_item_unindex(del);
 	g_free(del->name);
 	aim_tlvlist_free(del->data);
 	g_free(del);
@@ -281,11 +505,11 @@ static gboolean aim_ssi_itemlist_valid(struct aim_ssi_item *list, struct aim_ssi
  */
 struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_item *list, guint16 gid, guint16 bid)
 {
-	struct aim_ssi_item *cur;
-	for (cur=list; cur; cur=cur->next)
-		if ((cur->gid == gid) && (cur->bid == bid))
-			return cur;
-	return NULL;
+	GSList *items;
+	if (!list)
+		return NULL;
+	items = g_hash_table_lookup(list->index->ids, AIM_SSI_ITEM_ID(gid, bid));
+	return items ? items->data : NULL;
 }
 
 /**
@@ -301,35 +525,42 @@ struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_item *list, guint16 gi
 struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_item *list, const char *gn, const char *sn, guint16 type)
 {
 	struct aim_ssi_item *cur;
+	GSList *l;
 	if (!list)
 		return NULL;
 
 	if (gn && sn) { /* For finding buddies in groups */
-		for (cur=list; cur; cur=cur->next)
-			if ((cur->type == type) && (cur->name) && !(aim_sncmp(cur->name, sn))) {
-				struct aim_ssi_item *curg;
-				for (curg=list; curg; curg=curg->next)
-					if ((curg->type == AIM_SSI_TYPE_GROUP) && (curg->gid == cur->gid) && (curg->name) && !(aim_sncmp(curg->name, gn)))
+		GSList *groups = aim_ssi_itemlist_named(list, gn);
+		for (l = aim_ssi_itemlist_named(list, sn); l; l = l->next) {
+			cur = l->data;
+			if (cur->type == type) {
+				GSList *g;
+				for (g = groups; g; g = g->next) {
+					struct aim_ssi_item *curg = g->data;
+					if ((curg->type == AIM_SSI_TYPE_GROUP) && (curg->gid == cur->gid))
 						return cur;
+				}
 			}
+		}
 
 	} else if (gn) { /* For finding groups */
-		for (cur=list; cur; cur=cur->next) {
-			if ((cur->type == type) && (cur->bid == 0x0000) && (cur->name) && !(aim_sncmp(cur->name, gn))) {
+		for (l = aim_ssi_itemlist_named(list, gn); l; l = l->next) {
+			cur = l->data;
+			if ((cur->type == type) && (cur->bid == 0x0000))
 				return cur;
-			}
 		}
 
 	} else if (sn) { /* For finding permits, denies, and ignores */
-		for (cur=list; cur; cur=cur->next) {
-			if ((cur->type == type) && (cur->name) && !(aim_sncmp(cur->name, sn))) {
+		for (l = aim_ssi_itemlist_named(list, sn); l; l = l->next) {
+			cur = l->data;
+			if (cur->type == type)
 				return cur;
-			}
 		}
 
 	/* For stuff without names--permit deny setting, visibility mask, etc. */
-	} else for (cur=list; cur; cur=cur->next) {
-		if ((cur->type == type) && (!cur->name))
+	} else for (l = list->index->unnamed; l; l = l->next) {
+		cur = l->data;
+		if (cur->type == type)
 			return cur;
 	}
 
@@ -345,12 +576,10 @@ struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_item *list, const
  */
 struct aim_ssi_item *aim_ssi_itemlist_exists(struct aim_ssi_item *list, const char *sn)
 {
-	struct aim_ssi_item *cur;
-	if (!list || !sn)
-		return NULL;
-	for (cur=list; cur; cur=cur->next)
-		if ((cur->type == AIM_SSI_TYPE_BUDDY) && (cur->name) && (!aim_sncmp(cur->name, sn)))
-			return cur;
+	GSList *l;
+	for (l = aim_ssi_itemlist_named(list, sn); l; l = l->next)
+		if (((struct aim_ssi_item *)l->data)->type == AIM_SSI_TYPE_BUDDY)
+			return l->data;
 	return NULL;
 }
 
@@ -630,6 +859,11 @@ aim_ssi_freelist(OscarData *od)
 		g_free(deltmp);
 	}
 
+	aim_ssi_index_free(od->ssi.official_index);
+	aim_ssi_index_free(od->ssi.local_index);
+	od->ssi.official_index = aim_ssi_index_new();
+	od->ssi.local_index = aim_ssi_index_new();
+
 	od->ssi.numitems = 0;
 	od->ssi.official = NULL;
 	od->ssi.local = NULL;
@@ -677,20 +911,23 @@ int aim_ssi_cleanlist(OscarData *od)
 		cur = next;
 	}
 
-	/* Make sure there aren't any duplicate buddies in a group, or duplicate permits or denies */
+	/*
+	 * Make sure there aren't any duplicate buddies in a group, or duplicate
+	 * permits or denies.  Walking the list in order, the first of a set of
+	 * duplicates is the one we keep.
+	 */
 	cur = od->ssi.local;
 	while (cur) {
-		if ((cur->type == AIM_SSI_TYPE_BUDDY) || (cur->type == AIM_SSI_TYPE_PERMIT) || (cur->type == AIM_SSI_TYPE_DENY))
+		if (((cur->type == AIM_SSI_TYPE_BUDDY) || (cur->type == AIM_SSI_TYPE_PERMIT) || (cur->type == AIM_SSI_TYPE_DENY)) && (cur->name != NULL))
 		{
-			struct aim_ssi_item *cur2, *next2;
-			cur2 = cur->next;
-			while (cur2) {
-				next2 = cur2->next;
-				if ((cur->type == cur2->type) && (cur->gid == cur2->gid) && (cur->name != NULL) && (cur2->name != NULL) && (!aim_sncmp(cur->name, cur2->name))) {
+			GSList *dups, *l;
+			dups = g_slist_copy(aim_ssi_itemlist_named(od->ssi.local, cur->name));
+			for (l = dups; l; l = l->next) {
+				struct aim_ssi_item *cur2 = l->data;
+				if ((cur2 != cur) && (cur->type == cur2->type) && (cur->gid == cur2->gid))
 					aim_ssi_itemlist_del(&od->ssi.local, cur2);
-				}
-				cur2 = next2;
 			}
+			g_slist_free(dups);
 		}
 		cur = cur->next;
 	}
@@ -726,10 +963,10 @@ int aim_ssi_addbuddy(OscarData *od, const char *name, const char *group, GSList
 	if (!(parent = aim_ssi_itemlist_finditem(od->ssi.local, group, NULL, AIM_SSI_TYPE_GROUP))) {
 		/* Find the parent's parent (the master group) */
 		if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-			aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+			aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
 		/* Add the parent */
-		parent = aim_ssi_itemlist_add(&od->ssi.local, group, 0xFFFF, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+		parent = aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, group, 0xFFFF, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
 		/* Modify the parent's parent (the master group) */
 		aim_ssi_itemlist_rebuildgroup(od->ssi.local, NULL);
@@ -746,7 +983,7 @@ int aim_ssi_addbuddy(OscarData *od, const char *name, const char *group, GSList
 		aim_tlvlist_add_str(&data, 0x013c, comment);
 
 	/* Add that bad boy */
-	aim_ssi_itemlist_add(&od->ssi.local, name, parent->gid, 0xFFFF, AIM_SSI_TYPE_BUDDY, data);
+	aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, name, parent->gid, 0xFFFF, AIM_SSI_TYPE_BUDDY, data);
 	aim_tlvlist_free(data);
 
 	/* Modify the parent group */
@@ -771,10 +1008,10 @@ int aim_ssi_addpermit(OscarData *od, const char *name)
 
 	/* Make sure the master group exists */
 	if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-		aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+		aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
 	/* Add that bad boy */
-	aim_ssi_itemlist_add(&od->ssi.local, name, 0x0000, 0xFFFF, AIM_SSI_TYPE_PERMIT, NULL);
+	aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, name, 0x0000, 0xFFFF, AIM_SSI_TYPE_PERMIT, NULL);
 
 	/* Sync our local list with the server list */
 	return aim_ssi_sync(od);
@@ -795,10 +1032,10 @@ int aim_ssi_adddeny(OscarData *od, const char *name)
 
 	/* Make sure the master group exists */
 	if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-		aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+		aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
 	/* Add that bad boy */
-	aim_ssi_itemlist_add(&od->ssi.local, name, 0x0000, 0xFFFF, AIM_SSI_TYPE_DENY, NULL);
+	aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, name, 0x0000, 0xFFFF, AIM_SSI_TYPE_DENY, NULL);
 
 	/* Sync our local list with the server list */
 	return aim_ssi_sync(od);
@@ -1027,9 +1264,11 @@ int aim_ssi_rename_group(OscarData *od, const char *oldgn, const char *newgn)
 	if (!(group = aim_ssi_itemlist_finditem(od->ssi.local, oldgn, NULL, AIM_SSI_TYPE_GROUP)))
 		return -EINVAL;
 
+	aim_ssi_item_unindex(group);
 	g_free(group->name);
 	group->name = (char *)g_malloc((strlen(newgn)+1)*sizeof(char));
 	strcpy(group->name, newgn);
+	aim_ssi_item_index(group);
 
 	/* Sync our local list with the server list */
 	return aim_ssi_sync(od);
@@ -1060,9 +1299,9 @@ int aim_ssi_setpermdeny(OscarData *od, guint8 permdeny, guint32 vismask)
 	if (!(tmp = aim_ssi_itemlist_finditem(od->ssi.local, NULL, NULL, AIM_SSI_TYPE_PDINFO))) {
 		/* Make sure the master group exists */
 		if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-			aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+			aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
-		tmp = aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0xFFFF, AIM_SSI_TYPE_PDINFO, NULL);
+		tmp = aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0xFFFF, AIM_SSI_TYPE_PDINFO, NULL);
 	}
 
 	/* Need to add the 0x00ca TLV to the TLV chain */
@@ -1095,9 +1334,9 @@ int aim_ssi_seticon(OscarData *od, const guint8 *iconsum, guint8 iconsumlen)
 	if (!(tmp = aim_ssi_itemlist_finditem(od->ssi.local, NULL, "1", AIM_SSI_TYPE_ICONINFO))) {
 		/* Make sure the master group exists */
 		if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-			aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+			aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
-		tmp = aim_ssi_itemlist_add(&od->ssi.local, "1", 0x0000, 0xFFFF, AIM_SSI_TYPE_ICONINFO, NULL);
+		tmp = aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, "1", 0x0000, 0xFFFF, AIM_SSI_TYPE_ICONINFO, NULL);
 	}
 
 	/* Need to add the 0x00d5 TLV to the TLV chain */
@@ -1153,9 +1392,9 @@ int aim_ssi_setpresence(OscarData *od, guint32 presence) {
 	if (!(tmp = aim_ssi_itemlist_finditem(od->ssi.local, NULL, NULL, AIM_SSI_TYPE_PRESENCEPREFS))) {
 		/* Make sure the master group exists */
 		if (aim_ssi_itemlist_find(od->ssi.local, 0x0000, 0x0000) == NULL)
-			aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+			aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
 
-		tmp = aim_ssi_itemlist_add(&od->ssi.local, NULL, 0x0000, 0xFFFF, AIM_SSI_TYPE_PRESENCEPREFS, NULL);
+		tmp = aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, NULL, 0x0000, 0xFFFF, AIM_SSI_TYPE_PRESENCEPREFS, NULL);
 	}
 
 	/* Need to add the x00c9 TLV to the TLV chain */
@@ -1297,7 +1536,7 @@ static int parsedata(OscarData *od, FlapConnection *conn, aim_module_t *mod, Fla
 		bid = byte_stream_get16(bs);
 		type = byte_stream_get16(bs);
 		data = aim_tlvlist_readlen(bs, byte_stream_get16(bs));
-		aim_ssi_itemlist_add(&od->ssi.official, name, gid, bid, type, data);
+		aim_ssi_itemlist_append(&od->ssi.official, od->ssi.official_index, name, gid, bid, type, data);
 		g_free(name);
 		aim_tlvlist_free(data);
 	}
@@ -1308,8 +1547,9 @@ static int parsedata(OscarData *od, FlapConnection *conn, aim_module_t *mod, Fla
 	if (!(snac->flags & 0x0001)) {
 		/* Make a copy of the list */
 		struct aim_ssi_item *cur;
+		aim_ssi_itemlist_sort(&od->ssi.official, od->ssi.official_index);
 		for (cur=od->ssi.official; cur; cur=cur->next)
-			aim_ssi_itemlist_add(&od->ssi.local, cur->name, cur->gid, cur->bid, cur->type, cur->data);
+			aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, cur->name, cur->gid, cur->bid, cur->type, cur->data);
 
 		od->ssi.received_data = TRUE;
 
@@ -1419,8 +1659,8 @@ static int parseadd(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 		else
 			data = NULL;
 
-		aim_ssi_itemlist_add(&od->ssi.local, name, gid, bid, type, data);
-		aim_ssi_itemlist_add(&od->ssi.official, name, gid, bid, type, data);
+		aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, name, gid, bid, type, data);
+		aim_ssi_itemlist_add(&od->ssi.official, od->ssi.official_index, name, gid, bid, type, data);
 		aim_tlvlist_free(data);
 
 		if ((userfunc = aim_callhandler(od, snac->family, snac->subtype)))
@@ -1461,6 +1701,7 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 
 		/* Replace the 2 local items with the given one */
 		if ((item = aim_ssi_itemlist_find(od->ssi.local, gid, bid))) {
+			aim_ssi_item_unindex(item);
 			item->type = type;
 			g_free(item->name);
 			if (name) {
@@ -1468,11 +1709,13 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				strcpy(item->name, name);
 			} else
 				item->name = NULL;
+			aim_ssi_item_index(item);
 			aim_tlvlist_free(item->data);
 			item->data = aim_tlvlist_copy(data);
 		}
 
 		if ((item = aim_ssi_itemlist_find(od->ssi.official, gid, bid))) {
+			aim_ssi_item_unindex(item);
 			item->type = type;
 			g_free(item->name);
 			if (name) {
@@ -1480,6 +1723,7 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				strcpy(item->name, name);
 			} else
 				item->name = NULL;
+			aim_ssi_item_index(item);
 			aim_tlvlist_free(item->data);
 			item->data = aim_tlvlist_copy(data);
 		}
@@ -1570,12 +1814,14 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				if (aim_ssi_itemlist_valid(od->ssi.local, cur->item)) {
 					struct aim_ssi_item *cur1;
 					if ((cur1 = aim_ssi_itemlist_find(od->ssi.official, cur->item->gid, cur->item->bid))) {
+						aim_ssi_item_unindex(cur->item);
 						g_free(cur->item->name);
 						if (cur1->name) {
 							cur->item->name = (char *)g_malloc((strlen(cur1->name)+1)*sizeof(char));
 							strcpy(cur->item->name, cur1->name);
 						} else
 							cur->item->name = NULL;
+						aim_ssi_item_index(cur->item);
 						aim_tlvlist_free(cur->item->data);
 						cur->item->data = aim_tlvlist_copy(cur1->data);
 					}
@@ -1585,7 +1831,7 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 			} else if (cur->action == SNAC_SUBTYPE_FEEDBAG_DEL) {
 				/* Add the item back into the local list */
 				if (aim_ssi_itemlist_valid(od->ssi.official, cur->item)) {
-					aim_ssi_itemlist_add(&od->ssi.local, cur->item->name, cur->item->gid, cur->item->bid, cur->item->type, cur->item->data);
+					aim_ssi_itemlist_add(&od->ssi.local, od->ssi.local_index, cur->item->name, cur->item->gid, cur->item->bid, cur->item->type, cur->item->data);
 				} else
 					cur->item = NULL;
 			}
@@ -1595,7 +1841,7 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 			if (cur->action == SNAC_SUBTYPE_FEEDBAG_ADD) {
 			/* Add the local item to the official list */
 				if (aim_ssi_itemlist_valid(od->ssi.local, cur->item)) {
-					aim_ssi_itemlist_add(&od->ssi.official, cur->item->name, cur->item->gid, cur->item->bid, cur->item->type, cur->item->data);
+					aim_ssi_itemlist_add(&od->ssi.official, od->ssi.official_index, cur->item->name, cur->item->gid, cur->item->bid, cur->item->type, cur->item->data);
 				} else
 					cur->item = NULL;
 
@@ -1604,12 +1850,14 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				if (aim_ssi_itemlist_valid(od->ssi.local, cur->item)) {
 					struct aim_ssi_item *cur1;
 					if ((cur1 = aim_ssi_itemlist_find(od->ssi.official, cur->item->gid, cur->item->bid))) {
+						aim_ssi_item_unindex(cur1);
 						g_free(cur1->name);
 						if (cur->item->name) {
 							cur1->name = (char *)g_malloc((strlen(cur->item->name)+1)*sizeof(char));
 							strcpy(cur1->name, cur->item->name);
 						} else
 							cur1->name = NULL;
+						aim_ssi_item_index(cur1);
 						aim_tlvlist_free(cur1->data);
 						cur1->data = aim_tlvlist_copy(cur->item->data);
 					}
@@ -1996,6 +2244,11 @@ static void
 ssi_shutdown(OscarData *od, aim_module_t *mod)
 {
 	aim_ssi_freelist(od);
+
+	aim_ssi_index_free(od->ssi.official_index);
+	aim_ssi_index_free(od->ssi.local_index);
+	od->ssi.official_index = NULL;
+	od->ssi.local_index = NULL;
 }
 
 int
@@ -2010,5 +2263,8 @@ ssi_modfirst(OscarData *od, aim_module_t *mod)
 	mod->snachandler = snachandler;
 	mod->shutdown = ssi_shutdown;
 
+	od->ssi.official_index = aim_ssi_index_new();
+	od->ssi.local_index = aim_ssi_index_new();
+
 	return 0;
 }
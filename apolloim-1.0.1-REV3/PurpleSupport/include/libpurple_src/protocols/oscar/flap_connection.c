@@ -33,6 +33,64 @@
 #include "win32dep.h"
 #endif
 
+/*
+ * Incoming FLAP payloads are read into buffers from a pool of a few
+ * size classes, so that a busy connection doesn't have to allocate
+ * and free a buffer for every frame it receives.  The TLV chains read
+ * out of a frame point into its buffer.
+ */
+#define FLAP_BUFFER_CLASSES 5
+#define FLAP_BUFFER_CLASS_SIZE(i) (256 << (2 * (i))) /* 256 bytes to 64KB */
+#define FLAP_BUFFER_POOL_SIZE 4 /* Free buffers kept per size class */
+
+static GSList *flap_buffer_pool[FLAP_BUFFER_CLASSES];
+static guint flap_buffer_pool_count[FLAP_BUFFER_CLASSES];
+
+static int
+flap_buffer_class(guint16 len)
+{
+	int i;
+
+	for (i = 0; FLAP_BUFFER_CLASS_SIZE(i) < len; i++);
+
+	return i;
+}
+
+static guint8 *
+flap_buffer_new(guint16 len)
+{
+	int i = flap_buffer_class(len);
+	guint8 *buffer;
+
+	if (flap_buffer_pool[i] == NULL)
+		return g_malloc(FLAP_BUFFER_CLASS_SIZE(i));
+
+	buffer = flap_buffer_pool[i]->data;
+	flap_buffer_pool[i] = g_slist_delete_link(flap_buffer_pool[i], flap_buffer_pool[i]);
+	flap_buffer_pool_count[i]--;
+
+	return buffer;
+}
+
+/* len has to be the length the buffer was allocated for */
+static void
+flap_buffer_free(guint8 *buffer, guint16 len)
+{
+	int i = flap_buffer_class(len);
+
+	if (buffer == NULL)
+		return;
+
+	if (flap_buffer_pool_count[i] >= FLAP_BUFFER_POOL_SIZE)
+	{
+		g_free(buffer);
+		return;
+	}
+
+	flap_buffer_pool[i] = g_slist_prepend(flap_buffer_pool[i], buffer);
+	flap_buffer_pool_count[i]++;
+}
+
 /**
  * This sends a channel 1 SNAC containing the FLAP version.
  * The FLAP version is sent by itself at the beginning of every
@@ -75,21 +133,11 @@ flap_connection_send_version_with_cookie(OscarData *od, FlapConnection *conn, gu
 static struct rateclass *
 flap_connection_get_rateclass(FlapConnection *conn, guint16 family, guint16 subtype)
 {
-	GSList *tmp1;
 	gconstpointer key;
 
 	key = GUINT_TO_POINTER((family << 16) + subtype);
 
-	for (tmp1 = conn->rateclasses; tmp1 != NULL; tmp1 = tmp1->next)
-	{
-		struct rateclass *rateclass;
-		rateclass = tmp1->data;
-
-		if (g_hash_table_lookup(rateclass->members, key))
-			return rateclass;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(conn->rateclass_members, key);
 }
 
 /*
@@ -107,44 +155,120 @@ rateclass_get_new_current(FlapConnection *conn, struct rateclass *rateclass, str
 	return MIN(((rateclass->current * (rateclass->windowsize - 1)) + timediff) / rateclass->windowsize, rateclass->max);
 }
 
-static gboolean flap_connection_send_queued(gpointer data)
+/*
+ * Calculate how many milliseconds from now we have to wait before
+ * sending a SNAC in this rateclass keeps us above the alert level.
+ * This solves the formula in rateclass_get_new_current() for timediff.
+ */
+static guint32
+rateclass_get_delay(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
 {
-	FlapConnection *conn;
-	struct timeval now;
+	guint64 needed, elapsed;
+	guint32 threshold;
 
-	conn = data;
-	gettimeofday(&now, NULL);
+	/* (Add 100ms padding to account for inaccuracies in the calculation) */
+	threshold = MIN(rateclass->alert + 100, rateclass->max);
+	if (rateclass_get_new_current(conn, rateclass, now) >= threshold)
+		return 0;
+
+	needed = (guint64)threshold * rateclass->windowsize;
+	if (needed <= (guint64)rateclass->current * (rateclass->windowsize - 1))
+		return 0;
+	needed -= (guint64)rateclass->current * (rateclass->windowsize - 1);
 
-	while (!g_queue_is_empty(conn->queued_snacs))
+	elapsed = (now->tv_sec - rateclass->last.tv_sec) * 1000 + (now->tv_usec - rateclass->last.tv_usec) / 1000;
+
+	return (needed > elapsed) ? MIN(needed - elapsed, G_MAXUINT32) : 1;
+}
+
+static void
+rateclass_sent(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
+{
+	rateclass->current = rateclass_get_new_current(conn, rateclass, now);
+	rateclass->last.tv_sec = now->tv_sec;
+	rateclass->last.tv_usec = now->tv_usec;
+}
+
+/*
+ * Messages the user is waiting on are sent ahead of bulk requests
+ * like buddy list changes and profile fetches in the same rateclass.
+ */
+static gboolean
+flap_connection_snac_is_lead(guint16 family, guint16 subtype)
+{
+	return (family == SNAC_FAMILY_ICBM) || (family == SNAC_FAMILY_CHAT);
+}
+
+static gboolean flap_connection_send_queued(gpointer data);
+
+/*
+ * Make sure the queue timeout fires when the first rateclass with
+ * queued SNACs may send again.
+ */
+static void
+flap_connection_schedule_queued(FlapConnection *conn, struct timeval *now)
+{
+	GSList *l;
+	guint32 delay = G_MAXUINT32;
+
+	for (l = conn->rateclasses; l != NULL; l = l->next)
 	{
-		QueuedSnac *queued_snac;
-		struct rateclass *rateclass;
+		struct rateclass *rateclass = l->data;
 
-		queued_snac = g_queue_peek_head(conn->queued_snacs);
+		if (g_queue_is_empty(rateclass->queued_snacs) &&
+				g_queue_is_empty(rateclass->queued_lead_snacs))
+			continue;
 
-		rateclass = flap_connection_get_rateclass(conn, queued_snac->family, queued_snac->subtype);
-		if (rateclass != NULL)
-		{
-			guint32 new_current;
+		delay = MIN(delay, rateclass_get_delay(conn, rateclass, now));
+	}
 
-			new_current = rateclass_get_new_current(conn, rateclass, &now);
+	if (conn->queued_timeout != 0)
+	{
+		purple_timeout_remove(conn->queued_timeout);
+		conn->queued_timeout = 0;
+	}
 
-			/* (Add 100ms padding to account for inaccuracies in the calculation) */
-			if (new_current < rateclass->alert + 100)
-				/* Not ready to send this SNAC yet--keep waiting. */
-				return TRUE;
+	if (delay != G_MAXUINT32)
+		conn->queued_timeout = purple_timeout_add(MAX(delay, 10), flap_connection_send_queued, conn);
+}
 
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
-		}
+/*
+ * Send as many queued SNACs of this rateclass as it allows right now.
+ */
+static void
+rateclass_send_queued(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
+{
+	while (rateclass_get_delay(conn, rateclass, now) == 0)
+	{
+		QueuedSnac *queued_snac;
 
+		queued_snac = g_queue_pop_head(rateclass->queued_lead_snacs);
+		if (queued_snac == NULL)
+			queued_snac = g_queue_pop_head(rateclass->queued_snacs);
+		if (queued_snac == NULL)
+			break;
+
+		rateclass_sent(conn, rateclass, now);
 		flap_connection_send(conn, queued_snac->frame);
 		g_free(queued_snac);
-		g_queue_pop_head(conn->queued_snacs);
 	}
+}
+
+static gboolean flap_connection_send_queued(gpointer data)
+{
+	FlapConnection *conn;
+	struct timeval now;
+	GSList *l;
 
+	conn = data;
+	gettimeofday(&now, NULL);
 	conn->queued_timeout = 0;
+
+	for (l = conn->rateclasses; l != NULL; l = l->next)
+		rateclass_send_queued(conn, l->data, &now);
+
+	flap_connection_schedule_queued(conn, &now);
+
 	return FALSE;
 }
 
@@ -152,7 +276,10 @@ static gboolean flap_connection_send_queued(gpointer data)
  * This sends a channel 2 FLAP containing a SNAC.  The SNAC family and
  * subtype are looked up in the rate info for this connection, and if
  * sending this SNAC will induce rate limiting then we delay sending
- * of the SNAC by putting it into an outgoing holding queue.
+ * of the SNAC by putting it into an outgoing holding queue for its
+ * rateclass.  Each rateclass is throttled on its own, and instant
+ * messages and chat messages overtake other SNACs waiting in the
+ * same rateclass.
  *
  * @param data The optional bytestream that makes up the data portion
  *        of this SNAC.  For empty SNACs this should be NULL.
@@ -162,8 +289,10 @@ flap_connection_send_snac(OscarData *od, FlapConnection *conn, guint16 family, g
 {
 	FlapFrame *frame;
 	guint32 length;
-	gboolean enqueue = FALSE;
+	gboolean lead;
 	struct rateclass *rateclass;
+	struct timeval now;
+	QueuedSnac *queued_snac;
 
 	length = data != NULL ? data->offset : 0;
 
@@ -176,47 +305,33 @@ flap_connection_send_snac(OscarData *od, FlapConnection *conn, guint16 family, g
 		byte_stream_putbs(&frame->data, data, length);
 	}
 
-	if (conn->queued_timeout != 0)
-		enqueue = TRUE;
-	else if ((rateclass = flap_connection_get_rateclass(conn, family, subtype)) != NULL)
+	if ((rateclass = flap_connection_get_rateclass(conn, family, subtype)) == NULL)
 	{
-		struct timeval now;
-		guint32 new_current;
-
-		gettimeofday(&now, NULL);
-		new_current = rateclass_get_new_current(conn, rateclass, &now);
-
-		/* (Add 100ms padding to account for inaccuracies in the calculation) */
-		if (new_current < rateclass->alert + 100)
-		{
-			enqueue = TRUE;
-		}
-		else
-		{
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
-		}
+		flap_connection_send(conn, frame);
+		return;
 	}
 
-	if (enqueue)
-	{
-		/* We've been sending too fast, so delay this message */
-		QueuedSnac *queued_snac;
-
-		queued_snac = g_new(QueuedSnac, 1);
-		queued_snac->family = family;
-		queued_snac->subtype = subtype;
-		queued_snac->frame = frame;
-		g_queue_push_tail(conn->queued_snacs, queued_snac);
-
-		if (conn->queued_timeout == 0)
-			conn->queued_timeout = purple_timeout_add(500, flap_connection_send_queued, conn);
+	gettimeofday(&now, NULL);
+	lead = flap_connection_snac_is_lead(family, subtype);
 
+	/* Don't overtake anything that is queued ahead of this SNAC */
+	if (g_queue_is_empty(rateclass->queued_lead_snacs) &&
+			(lead || g_queue_is_empty(rateclass->queued_snacs)) &&
+			(rateclass_get_delay(conn, rateclass, &now) == 0))
+	{
+		rateclass_sent(conn, rateclass, &now);
+		flap_connection_send(conn, frame);
 		return;
 	}
 
-	flap_connection_send(conn, frame);
+	/* We've been sending too fast, so delay this message */
+	queued_snac = g_new(QueuedSnac, 1);
+	queued_snac->family = family;
+	queued_snac->subtype = subtype;
+	queued_snac->frame = frame;
+	g_queue_push_tail(lead ? rateclass->queued_lead_snacs : rateclass->queued_snacs, queued_snac);
+
+	flap_connection_schedule_queued(conn, &now);
 }
 
 /**
@@ -270,7 +385,7 @@ flap_connection_new(OscarData *od, int type)
 	conn->fd = -1;
 	conn->subtype = -1;
 	conn->type = type;
-	conn->queued_snacs = g_queue_new();
+	conn->rateclass_members = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	od->oscar_connections = g_slist_prepend(od->oscar_connections, conn);
 
@@ -324,20 +439,13 @@ flap_connection_close(OscarData *od, FlapConnection *conn)
 		conn->watcher_outgoing = 0;
 	}
 
-	g_free(conn->buffer_incoming.data.data);
+	flap_buffer_free(conn->buffer_incoming.data.data, conn->buffer_incoming.data.len);
 	conn->buffer_incoming.data.data = NULL;
 
 	purple_circ_buffer_destroy(conn->buffer_outgoing);
 	conn->buffer_outgoing = NULL;
 }
 
-static void
-flap_connection_destroy_rateclass(struct rateclass *rateclass)
-{
-	g_hash_table_destroy(rateclass->members);
-	g_free(rateclass);
-}
-
 /**
  * Free a FlapFrame
  *
@@ -350,6 +458,27 @@ flap_frame_destroy(FlapFrame *frame)
 	g_free(frame);
 }
 
+static void
+flap_connection_destroy_queued_snacs(GQueue *queued_snacs)
+{
+	while (!g_queue_is_empty(queued_snacs))
+	{
+		QueuedSnac *queued_snac;
+		queued_snac = g_queue_pop_head(queued_snacs);
+		flap_frame_destroy(queued_snac->frame);
+		g_free(queued_snac);
+	}
+	g_queue_free(queued_snacs);
+}
+
+static void
+flap_connection_destroy_rateclass(struct rateclass *rateclass)
+{
+	flap_connection_destroy_queued_snacs(rateclass->queued_snacs);
+	flap_connection_destroy_queued_snacs(rateclass->queued_lead_snacs);
+	g_free(rateclass);
+}
+
 static gboolean
 flap_connection_destroy_cb(gpointer data)
 {
@@ -424,15 +553,8 @@ flap_connection_destroy_cb(gpointer data)
 		flap_connection_destroy_rateclass(conn->rateclasses->data);
 		conn->rateclasses = g_slist_delete_link(conn->rateclasses, conn->rateclasses);
 	}
+	g_hash_table_destroy(conn->rateclass_members);
 
-	while (!g_queue_is_empty(conn->queued_snacs))
-	{
-		QueuedSnac *queued_snac;
-		queued_snac = g_queue_pop_head(conn->queued_snacs);
-		flap_frame_destroy(queued_snac->frame);
-		g_free(queued_snac);
-	}
-	g_queue_free(conn->queued_snacs);
 	if (conn->queued_timeout > 0)
 		purple_timeout_remove(conn->queued_timeout);
 
@@ -843,7 +965,7 @@ flap_connection_recv_cb(gpointer data, gint source, PurpleInputCondition cond)
 			conn->buffer_incoming.channel = aimutil_get8(&conn->header[1]);
 			conn->buffer_incoming.seqnum = aimutil_get16(&conn->header[2]);
 			conn->buffer_incoming.data.len = aimutil_get16(&conn->header[4]);
-			conn->buffer_incoming.data.data = g_new(guint8, conn->buffer_incoming.data.len);
+			conn->buffer_incoming.data.data = flap_buffer_new(conn->buffer_incoming.data.len);
 			conn->buffer_incoming.data.offset = 0;
 		}
 
@@ -886,7 +1008,7 @@ flap_connection_recv_cb(gpointer data, gint source, PurpleInputCondition cond)
 		parse_flap(conn->od, conn, &conn->buffer_incoming);
 		conn->lastactivity = time(NULL);
 
-		g_free(conn->buffer_incoming.data.data);
+		flap_buffer_free(conn->buffer_incoming.data.data, conn->buffer_incoming.data.len);
 		conn->buffer_incoming.data.data = NULL;
 
 		conn->header_received = 0;
@@ -4781,6 +4781,8 @@ static int purple_ssi_parselist(OscarData *od, FlapConnection *conn, FlapFrame *
 	/* Clean the buddy list */
 	aim_ssi_cleanlist(od);
 
+	purple_blist_begin_batch();
+
 	{ /* If not in server list then prune from local list */
 		PurpleBlistNode *gnode, *cnode, *bnode;
 		PurpleBuddyList *blist;
@@ -4974,6 +4976,8 @@ static int purple_ssi_parselist(OscarData *od, FlapConnection *conn, FlapFrame *
 		} /* End of switch on curitem->type */
 	} /* End of for loop */
 
+	purple_blist_end_batch();
+
 	oscar_set_extendedstatus(gc);
 
 	/* Activate SSI */
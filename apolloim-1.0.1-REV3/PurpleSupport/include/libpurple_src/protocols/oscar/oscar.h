@@ -405,9 +405,9 @@ struct _FlapConnection
 	guint16 seqnum_in; /**< The sequence number of most recently received packet. */
 	GSList *groups;
 	GSList *rateclasses; /* Contains nodes of struct rateclass. */
+	GHashTable *rateclass_members; /* Key is family and subtype, value is the struct rateclass. */
 
-	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
-	guint queued_timeout;
+	guint queued_timeout; /**< Fires when the first rate class with queued SNACs may send again. */
 
 	void *internal; /* internal conn-specific libfaim data */
 };
@@ -506,6 +506,8 @@ struct _OscarData
 		guint16 numitems;
 		struct aim_ssi_item *official;
 		struct aim_ssi_item *local;
+		struct aim_ssi_index *official_index;
+		struct aim_ssi_index *local_index;
 		struct aim_ssi_tmp *pending;
 		time_t timestamp;
 		gboolean waiting_for_ack;
@@ -1176,9 +1178,23 @@ struct aim_ssi_item
 	guint16 bid;
 	guint16 type;
 	GSList *data;
+	struct aim_ssi_index *index; /* Of the list this item is in */
 	struct aim_ssi_item *next;
 };
 
+/*
+ * Lookup tables over one of the item lists, so finding an item doesn't
+ * mean walking the whole list.  Buckets are GSLists of items in the order
+ * they were added.
+ */
+struct aim_ssi_index
+{
+	GHashTable *ids;   /* (gid << 16 | bid) -> items */
+	GHashTable *names; /* name, without spaces and in upper case -> items */
+	GSList *unnamed;   /* items without a name */
+	struct aim_ssi_item *last; /* the end of the list */
+};
+
 struct aim_ssi_tmp
 {
 	guint16 action;
@@ -1359,6 +1375,7 @@ typedef struct aim_tlv_s
 	guint16 type;
 	guint16 length;
 	guint8 *value;
+	gboolean view; /* value points into the buffer the TLV was read from */
 } aim_tlv_t;
 
 /* TLV handling functions */
@@ -1585,9 +1602,11 @@ struct rateclass {
 	guint32 current;
 	guint32 max;
 	guint8 unknown[5]; /* only present in versions >= 3 */
-	GHashTable *members; /* Key is family and subtype, value is TRUE. */
 
 	struct timeval last; /**< The time when we last sent a SNAC of this rate class. */
+
+	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
+	GQueue *queued_lead_snacs; /**< Contains QueuedSnacs that are sent before queued_snacs. */
 };
 
 int aim_cachecookie(OscarData *od, IcbmCookie *cookie);
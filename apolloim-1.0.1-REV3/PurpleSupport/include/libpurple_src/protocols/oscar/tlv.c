@@ -25,10 +25,11 @@ createtlv(guint16 type, guint16 length, guint8 *value)
 {
 	aim_tlv_t *ret;
 
-	ret = g_new(aim_tlv_t, 1);
+	ret = g_slice_new(aim_tlv_t);
 	ret->type = type;
 	ret->length = length;
 	ret->value = value;
+	ret->view = FALSE;
 
 	return ret;
 }
@@ -36,8 +37,9 @@ createtlv(guint16 type, guint16 length, guint8 *value)
 static void
 freetlv(aim_tlv_t *oldtlv)
 {
-	g_free(oldtlv->value);
-	g_free(oldtlv);
+	if (!oldtlv->view)
+		g_free(oldtlv->value);
+	g_slice_free(aim_tlv_t, oldtlv);
 }
 
 static GSList *
@@ -74,14 +76,12 @@ aim_tlv_read(GSList *list, ByteStream *bs)
 		return NULL;
 	}
 
+	/* Point into the buffer rather than copying the value out of it */
 	tlv = createtlv(type, length, NULL);
 	if (tlv->length > 0) {
-		tlv->value = byte_stream_getraw(bs, length);
-		if (!tlv->value) {
-			freetlv(tlv);
-			aim_tlvlist_free(list);
-			return NULL;
-		}
+		tlv->value = &bs->data[bs->offset];
+		tlv->view = TRUE;
+		byte_stream_advance(bs, length);
 	}
 
 	return g_slist_prepend(list, tlv);
@@ -95,11 +95,10 @@ aim_tlv_read(GSList *list, ByteStream *bs)
  * routines.  When done with a TLV chain, aim_tlvlist_free() should
  * be called to free the dynamic substructures.
  *
- * TODO: There should be a flag setable here to have the tlvlist contain
- * bstream references, so that at least the ->value portion of each
- * element doesn't need to be malloc/memcpy'd.  This could prove to be
- * just as efficient as the in-place TLV parsing used in a couple places
- * in libfaim.
+ * The values of the TLVs point into the buffer of the bstream rather
+ * than being copied out of it, so the chain has to be freed before the
+ * buffer is, or be copied with aim_tlvlist_copy() if it needs to be
+ * kept around longer.
  *
  * @param bs Input bstream
  * @return Return the TLV chain read
@@ -125,11 +124,10 @@ GSList *aim_tlvlist_read(ByteStream *bs)
  * routines.  When done with a TLV chain, aim_tlvlist_free() should
  * be called to free the dynamic substructures.
  *
- * TODO: There should be a flag setable here to have the tlvlist contain
- * bstream references, so that at least the ->value portion of each
- * element doesn't need to be malloc/memcpy'd.  This could prove to be
- * just as efficient as the in-place TLV parsing used in a couple places
- * in libfaim.
+ * The values of the TLVs point into the buffer of the bstream rather
+ * than being copied out of it, so the chain has to be freed before the
+ * buffer is, or be copied with aim_tlvlist_copy() if it needs to be
+ * kept around longer.
  *
  * @param bs Input bstream
  * @param num The max number of TLVs that will be read, or -1 if unlimited.
@@ -160,11 +158,10 @@ GSList *aim_tlvlist_readnum(ByteStream *bs, guint16 num)
  * routines.  When done with a TLV chain, aim_tlvlist_free() should
  * be called to free the dynamic substructures.
  *
- * TODO: There should be a flag setable here to have the tlvlist contain
- * bstream references, so that at least the ->value portion of each
- * element doesn't need to be malloc/memcpy'd.  This could prove to be
- * just as efficient as the in-place TLV parsing used in a couple places
- * in libfaim.
+ * The values of the TLVs point into the buffer of the bstream rather
+ * than being copied out of it, so the chain has to be freed before the
+ * buffer is, or be copied with aim_tlvlist_copy() if it needs to be
+ * kept around longer.
  *
  * @param bs Input bstream
  * @param len The max length in bytes that will be read.
@@ -529,7 +526,9 @@ int aim_tlvlist_replace_raw(GSList **list, const guint16 type, const guint16 len
 		/* TLV does not exist, so add a new one */
 		return aim_tlvlist_add_raw(list, type, length, value);
 
-	g_free(tlv->value);
+	if (!tlv->view)
+		g_free(tlv->value);
+	tlv->view = FALSE;
 	tlv->length = length;
 	if (tlv->length > 0) {
 		tlv->value = g_memdup(value, length);
@@ -631,8 +630,7 @@ void aim_tlvlist_remove(GSList **list, const guint16 type)
 		{
 			/* Delete this TLV */
 			*list = g_slist_delete_link(*list, cur);
-			g_free(tlv->value);
-			g_free(tlv);
+			freetlv(tlv);
 		}
 
 		cur = next;
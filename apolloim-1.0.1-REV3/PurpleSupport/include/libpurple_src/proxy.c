@@ -56,6 +56,14 @@ struct _PurpleProxyConnectData {
 	 */
 	GSList *hosts;
 
+	/*
+	 * Connections to addresses from hosts which are still in progress.
+	 * Another one is started every PROXY_CONNECT_STAGGER milliseconds,
+	 * or as soon as one fails, until one of them succeeds.
+	 */
+	GSList *attempts;
+	guint stagger_timeout;
+
 	/*
 	 * All of the following variables are used when establishing a
 	 * connection through a proxy.
@@ -85,7 +93,11 @@ static PurpleProxyInfo *global_proxy_info = NULL;
 
 static GSList *handles = NULL;
 
+/* How long to wait on a connection before also trying the next address */
+#define PROXY_CONNECT_STAGGER 250
+
 static void try_connect(PurpleProxyConnectData *connect_data);
+static void proxy_attempts_cancel(PurpleProxyConnectData *connect_data);
 
 /*
  * TODO: Eventually (GObjectification) this bad boy will be removed, because it is
@@ -321,6 +333,8 @@ purple_proxy_connect_data_destroy(PurpleProxyConnectData *connect_data)
 static void
 purple_proxy_connect_data_disconnect(PurpleProxyConnectData *connect_data, const gchar *error_message)
 {
+	proxy_attempts_cancel(connect_data);
+
 	if (connect_data->inpa > 0)
 	{
 		purple_input_remove(connect_data->inpa);
@@ -388,122 +402,6 @@ purple_proxy_connect_data_connected(PurpleProxyConnectData *connect_data)
 	purple_proxy_connect_data_destroy(connect_data);
 }
 
-static void
-socket_ready_cb(gpointer data, gint source, PurpleInputCondition cond)
-{
-	PurpleProxyConnectData *connect_data = data;
-	int error = 0;
-	int ret;
-
-	/* If the socket-connected message had already been triggered when connect_data
- 	 * was destroyed via purple_proxy_connect_cancel(), we may get here with a freed connect_data.
- 	 */
-	if (!PURPLE_PROXY_CONNECT_DATA_IS_VALID(connect_data))
-		return;
-	
-	purple_debug_info("proxy", "Connected to %s:%d.\n",
-					connect_data->host, connect_data->port);
-
-	/*
-	 * purple_input_get_error after a non-blocking connect returns -1 if something is
-	 * really messed up (bad descriptor, usually). Otherwise, it returns 0 and
-	 * error holds what connect would have returned if it blocked until now.
-	 * Thus, error == 0 is success, error == EINPROGRESS means "try again",
-	 * and anything else is a real error.
-	 *
-	 * (error == EINPROGRESS can happen after a select because the kernel can
-	 * be overly optimistic sometimes. select is just a hint that you might be
-	 * able to do something.)
-	 */
-	ret = purple_input_get_error(connect_data->fd, &error);
-
-	if (ret == 0 && error == EINPROGRESS) {
-		/* No worries - we'll be called again later */
-		/* TODO: Does this ever happen? */
-		purple_debug_info("proxy", "(ret == 0 && error == EINPROGRESS)");
-		return;
-	}
-
-	if (ret != 0 || error != 0) {
-		if (ret != 0)
-			error = errno;
-		purple_debug_info("proxy", "Error connecting to %s:%d (%s).\n",
-						connect_data->host, connect_data->port, strerror(error));
-
-		purple_proxy_connect_data_disconnect(connect_data, strerror(error));
-		return;
-	}
-
-	purple_proxy_connect_data_connected(connect_data);
-}
-
-static gboolean
-clean_connect(gpointer data)
-{
-	purple_proxy_connect_data_connected(data);
-
-	return FALSE;
-}
-
-static void
-proxy_connect_none(PurpleProxyConnectData *connect_data, struct sockaddr *addr, socklen_t addrlen)
-{
-	purple_debug_info("proxy", "Connecting to %s:%d with no proxy\n",
-			connect_data->host, connect_data->port);
-
-	connect_data->fd = socket(addr->sa_family, SOCK_STREAM, 0);
-	if (connect_data->fd < 0)
-	{
-		purple_proxy_connect_data_disconnect_formatted(connect_data,
-				_("Unable to create socket:\n%s"), strerror(errno));
-		return;
-	}
-
-	fcntl(connect_data->fd, F_SETFL, O_NONBLOCK);
-#ifndef _WIN32
-	fcntl(connect_data->fd, F_SETFD, FD_CLOEXEC);
-#endif
-
-	if (connect(connect_data->fd, addr, addrlen) != 0)
-	{
-		if ((errno == EINPROGRESS) || (errno == EINTR))
-		{
-			purple_debug_info("proxy", "Connection in progress\n");
-			connect_data->inpa = purple_input_add(connect_data->fd,
-					PURPLE_INPUT_WRITE, socket_ready_cb, connect_data);
-		}
-		else
-		{
-			purple_proxy_connect_data_disconnect(connect_data, strerror(errno));
-		}
-	}
-	else
-	{
-		/*
-		 * The connection happened IMMEDIATELY... strange, but whatever.
-		 */
-		int error = ETIMEDOUT;
-		int ret;
-
-		purple_debug_info("proxy", "Connected immediately.\n");
-
-		ret = purple_input_get_error(connect_data->fd, &error);
-		if ((ret != 0) || (error != 0))
-		{
-			if (ret != 0)
-				error = errno;
-			purple_proxy_connect_data_disconnect(connect_data, strerror(error));
-			return;
-		}
-
-		/*
-		 * We want to call the "connected" callback eventually, but we
-		 * don't want to call it before we return, just in case.
-		 */
-		purple_timeout_add(10, clean_connect, connect_data);
-	}
-}
-
 /**
  * This is a utility function used by the HTTP, SOCKS4 and SOCKS5
  * connect functions.  It writes data from a buffer to a socket.
@@ -861,66 +759,6 @@ http_canwrite(gpointer data, gint source, PurpleInputCondition cond)
 	proxy_do_write(connect_data, connect_data->fd, cond);
 }
 
-static void
-proxy_connect_http(PurpleProxyConnectData *connect_data, struct sockaddr *addr, socklen_t addrlen)
-{
-	purple_debug_info("proxy",
-			   "Connecting to %s:%d via %s:%d using HTTP\n",
-			   connect_data->host, connect_data->port,
-			   (purple_proxy_info_get_host(connect_data->gpi) ? purple_proxy_info_get_host(connect_data->gpi) : "(null)"),
-			   purple_proxy_info_get_port(connect_data->gpi));
-
-	connect_data->fd = socket(addr->sa_family, SOCK_STREAM, 0);
-	if (connect_data->fd < 0)
-	{
-		purple_proxy_connect_data_disconnect_formatted(connect_data,
-				_("Unable to create socket:\n%s"), strerror(errno));
-		return;
-	}
-
-	fcntl(connect_data->fd, F_SETFL, O_NONBLOCK);
-#ifndef _WIN32
-	fcntl(connect_data->fd, F_SETFD, FD_CLOEXEC);
-#endif
-
-	if (connect(connect_data->fd, addr, addrlen) != 0)
-	{
-		if ((errno == EINPROGRESS) || (errno == EINTR)) {
-			purple_debug_info("proxy", "Connection in progress\n");
-
-			if (connect_data->port != 80)
-			{
-				/* we need to do CONNECT first */
-				connect_data->inpa = purple_input_add(connect_data->fd,
-						PURPLE_INPUT_WRITE, http_canwrite, connect_data);
-			}
-			else
-			{
-				/*
-				 * If we're trying to connect to something running on
-				 * port 80 then we assume the traffic using this
-				 * connection is going to be HTTP traffic.  If it's
-				 * not then this will fail (uglily).  But it's good
-				 * to avoid using the CONNECT method because it's
-				 * not always allowed.
-				 */
-				purple_debug_info("proxy", "HTTP proxy connection established\n");
-				purple_proxy_connect_data_connected(connect_data);
-			}
-		}
-		else
-		{
-			purple_proxy_connect_data_disconnect(connect_data, strerror(errno));
-		}
-	}
-	else
-	{
-		purple_debug_info("proxy", "Connected immediately.\n");
-
-		http_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
-	}
-}
-
 static void
 s4_canread(gpointer data, gint source, PurpleInputCondition cond)
 {
@@ -1016,49 +854,6 @@ s4_canwrite(gpointer data, gint source, PurpleInputCondition cond)
 	proxy_do_write(connect_data, connect_data->fd, cond);
 }
 
-static void
-proxy_connect_socks4(PurpleProxyConnectData *connect_data, struct sockaddr *addr, socklen_t addrlen)
-{
-	purple_debug_info("proxy",
-			   "Connecting to %s:%d via %s:%d using SOCKS4\n",
-			   connect_data->host, connect_data->port,
-			   purple_proxy_info_get_host(connect_data->gpi),
-			   purple_proxy_info_get_port(connect_data->gpi));
-
-	connect_data->fd = socket(addr->sa_family, SOCK_STREAM, 0);
-	if (connect_data->fd < 0)
-	{
-		purple_proxy_connect_data_disconnect_formatted(connect_data,
-				_("Unable to create socket:\n%s"), strerror(errno));
-		return;
-	}
-
-	fcntl(connect_data->fd, F_SETFL, O_NONBLOCK);
-#ifndef _WIN32
-	fcntl(connect_data->fd, F_SETFD, FD_CLOEXEC);
-#endif
-
-	if (connect(connect_data->fd, addr, addrlen) != 0)
-	{
-		if ((errno == EINPROGRESS) || (errno == EINTR))
-		{
-			purple_debug_info("proxy", "Connection in progress.\n");
-			connect_data->inpa = purple_input_add(connect_data->fd,
-					PURPLE_INPUT_WRITE, s4_canwrite, connect_data);
-		}
-		else
-		{
-			purple_proxy_connect_data_disconnect(connect_data, strerror(errno));
-		}
-	}
-	else
-	{
-		purple_debug_info("proxy", "Connected immediately.\n");
-
-		s4_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
-	}
-}
-
 static gboolean
 s5_ensure_buffer_length(PurpleProxyConnectData *connect_data, int len)
 {
@@ -1584,97 +1379,271 @@ s5_canwrite(gpointer data, gint source, PurpleInputCondition cond)
 	proxy_do_write(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
 }
 
+typedef struct
+{
+	PurpleProxyConnectData *connect_data;
+	int fd;
+	guint inpa;
+} PurpleProxyConnectAttempt;
+
+static void
+proxy_attempt_destroy(PurpleProxyConnectAttempt *attempt)
+{
+	PurpleProxyConnectData *connect_data = attempt->connect_data;
+
+	connect_data->attempts = g_slist_remove(connect_data->attempts, attempt);
+
+	if (attempt->inpa > 0)
+		purple_input_remove(attempt->inpa);
+	if (attempt->fd >= 0)
+		close(attempt->fd);
+
+	g_free(attempt);
+}
+
 static void
-proxy_connect_socks5(PurpleProxyConnectData *connect_data, struct sockaddr *addr, socklen_t addrlen)
+proxy_attempts_cancel(PurpleProxyConnectData *connect_data)
 {
-	purple_debug_info("proxy",
-			   "Connecting to %s:%d via %s:%d using SOCKS5\n",
-			   connect_data->host, connect_data->port,
-			   purple_proxy_info_get_host(connect_data->gpi),
-			   purple_proxy_info_get_port(connect_data->gpi));
-
-	connect_data->fd = socket(addr->sa_family, SOCK_STREAM, 0);
-	if (connect_data->fd < 0)
+	while (connect_data->attempts != NULL)
+		proxy_attempt_destroy(connect_data->attempts->data);
+
+	if (connect_data->stagger_timeout > 0)
 	{
-		purple_proxy_connect_data_disconnect_formatted(connect_data,
-				_("Unable to create socket:\n%s"), strerror(errno));
+		purple_timeout_remove(connect_data->stagger_timeout);
+		connect_data->stagger_timeout = 0;
+	}
+}
+
+/**
+ * Carries on once we're connected to the proxy, or to the host itself
+ * if there's no proxy.
+ */
+static void
+proxy_connected(PurpleProxyConnectData *connect_data)
+{
+	switch (purple_proxy_info_get_type(connect_data->gpi)) {
+		case PURPLE_PROXY_HTTP:
+		case PURPLE_PROXY_USE_ENVVAR:
+			if (connect_data->port != 80)
+			{
+				/* we need to do CONNECT first */
+				http_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+				return;
+			}
+
+			/*
+			 * If we're trying to connect to something running on
+			 * port 80 then we assume the traffic using this
+			 * connection is going to be HTTP traffic.  If it's
+			 * not then this will fail (uglily).  But it's good
+			 * to avoid using the CONNECT method because it's
+			 * not always allowed.
+			 */
+			purple_debug_info("proxy", "HTTP proxy connection established\n");
+			break;
+
+		case PURPLE_PROXY_SOCKS4:
+			s4_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+			return;
+
+		case PURPLE_PROXY_SOCKS5:
+			s5_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+			return;
+
+		default:
+			break;
+	}
+
+	purple_proxy_connect_data_connected(connect_data);
+}
+
+static void
+proxy_attempt_failed(PurpleProxyConnectAttempt *attempt, const char *error_message)
+{
+	PurpleProxyConnectData *connect_data = attempt->connect_data;
+
+	proxy_attempt_destroy(attempt);
+
+	if (connect_data->hosts != NULL)
+		/* No need to wait for the stagger to run out */
+		try_connect(connect_data);
+	else if (connect_data->attempts == NULL)
+		/* That was the last one */
+		purple_proxy_connect_data_disconnect(connect_data, error_message);
+}
+
+static void
+socket_ready_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleProxyConnectData *connect_data = data;
+	PurpleProxyConnectAttempt *attempt = NULL;
+	GSList *l;
+	int error = 0;
+	int ret;
+
+	/* If the socket-connected message had already been triggered when connect_data
+ 	 * was destroyed via purple_proxy_connect_cancel(), we may get here with a freed connect_data.
+ 	 */
+	if (!PURPLE_PROXY_CONNECT_DATA_IS_VALID(connect_data))
+		return;
+
+	for (l = connect_data->attempts; l != NULL; l = l->next)
+		if (((PurpleProxyConnectAttempt *)l->data)->fd == source)
+			attempt = l->data;
+
+	/* Same goes for attempts which lost the race */
+	if (attempt == NULL)
+		return;
+
+	/*
+	 * purple_input_get_error after a non-blocking connect returns -1 if something is
+	 * really messed up (bad descriptor, usually). Otherwise, it returns 0 and
+	 * error holds what connect would have returned if it blocked until now.
+	 * Thus, error == 0 is success, error == EINPROGRESS means "try again",
+	 * and anything else is a real error.
+	 *
+	 * (error == EINPROGRESS can happen after a select because the kernel can
+	 * be overly optimistic sometimes. select is just a hint that you might be
+	 * able to do something.)
+	 */
+	ret = purple_input_get_error(source, &error);
+
+	if (ret == 0 && error == EINPROGRESS) {
+		/* No worries - we'll be called again later */
+		/* TODO: Does this ever happen? */
+		purple_debug_info("proxy", "(ret == 0 && error == EINPROGRESS)");
 		return;
 	}
 
-	fcntl(connect_data->fd, F_SETFL, O_NONBLOCK);
+	if (ret != 0 || error != 0) {
+		if (ret != 0)
+			error = errno;
+		purple_debug_info("proxy", "Error connecting to %s:%d (%s).\n",
+						connect_data->host, connect_data->port, strerror(error));
+
+		proxy_attempt_failed(attempt, strerror(error));
+		return;
+	}
+
+	purple_debug_info("proxy", "Connected to %s:%d.\n",
+					connect_data->host, connect_data->port);
+
+	/* We have a winner, so the others can stop */
+	connect_data->fd = attempt->fd;
+	attempt->fd = -1;
+	proxy_attempts_cancel(connect_data);
+
+	proxy_connected(connect_data);
+}
+
+/**
+ * Starts a non-blocking connection to addr.
+ *
+ * @return 0 if the connection is in progress, otherwise the error.
+ */
+static int
+proxy_attempt_start(PurpleProxyConnectData *connect_data, struct sockaddr *addr, socklen_t addrlen)
+{
+	PurpleProxyConnectAttempt *attempt;
+	int fd;
+
+	fd = socket(addr->sa_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return errno;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
 #ifndef _WIN32
-	fcntl(connect_data->fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
 #endif
 
-	if (connect(connect_data->fd, addr, addrlen) != 0)
+	if (connect(fd, addr, addrlen) != 0 && errno != EINPROGRESS && errno != EINTR)
 	{
-		if ((errno == EINPROGRESS) || (errno == EINTR))
-		{
-			purple_debug_info("socks5 proxy", "Connection in progress\n");
-			connect_data->inpa = purple_input_add(connect_data->fd,
-					PURPLE_INPUT_WRITE, s5_canwrite, connect_data);
-		}
-		else
-		{
-			purple_proxy_connect_data_disconnect(connect_data, strerror(errno));
-		}
+		int error = errno;
+		close(fd);
+		return error;
 	}
-	else
-	{
-		purple_debug_info("proxy", "Connected immediately.\n");
 
-		s5_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
-	}
+	/*
+	 * Even if we connected immediately, we hear about it from the
+	 * event loop, so that the callback isn't called before we return.
+	 */
+	attempt = g_new0(PurpleProxyConnectAttempt, 1);
+	attempt->connect_data = connect_data;
+	attempt->fd = fd;
+	attempt->inpa = purple_input_add(fd, PURPLE_INPUT_WRITE,
+			socket_ready_cb, connect_data);
+	connect_data->attempts = g_slist_append(connect_data->attempts, attempt);
+
+	return 0;
+}
+
+static gboolean
+stagger_cb(gpointer data)
+{
+	PurpleProxyConnectData *connect_data = data;
+
+	connect_data->stagger_timeout = 0;
+	purple_debug_info("proxy", "No connection yet, trying the next address too\n");
+	try_connect(connect_data);
+
+	return FALSE;
 }
 
 /**
  * This function attempts to connect to the next IP address in the list
- * of IP addresses returned to us by purple_dnsquery_a() and attemps
- * to connect to each one.  This is called after the hostname is
- * resolved, and each time a connection attempt fails (assuming there
- * is another IP address to try).
+ * of IP addresses returned to us by purple_dnsquery_a().  This is called
+ * after the hostname is resolved, each time a connection attempt fails,
+ * and each time an attempt has been left waiting for PROXY_CONNECT_STAGGER
+ * milliseconds, so that a dead address doesn't hold up the others for a
+ * whole TCP timeout.  The first connection to succeed is kept.
  */
 static void try_connect(PurpleProxyConnectData *connect_data)
 {
 	size_t addrlen;
 	struct sockaddr *addr;
 	char ipaddr[INET6_ADDRSTRLEN];
+	int error = 0;
 
-	addrlen = GPOINTER_TO_INT(connect_data->hosts->data);
-	connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
-	addr = connect_data->hosts->data;
-	connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
-
-	inet_ntop(addr->sa_family, &((struct sockaddr_in *)addr)->sin_addr,
-			ipaddr, sizeof(ipaddr));
-	purple_debug_info("proxy", "Attempting connection to %s\n", ipaddr);
-
-	switch (purple_proxy_info_get_type(connect_data->gpi)) {
-		case PURPLE_PROXY_NONE:
-			proxy_connect_none(connect_data, addr, addrlen);
-			break;
+	if (connect_data->stagger_timeout > 0)
+	{
+		purple_timeout_remove(connect_data->stagger_timeout);
+		connect_data->stagger_timeout = 0;
+	}
 
-		case PURPLE_PROXY_HTTP:
-			proxy_connect_http(connect_data, addr, addrlen);
-			break;
+	while (connect_data->hosts != NULL)
+	{
+		addrlen = GPOINTER_TO_INT(connect_data->hosts->data);
+		connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
+		addr = connect_data->hosts->data;
+		connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
 
-		case PURPLE_PROXY_SOCKS4:
-			proxy_connect_socks4(connect_data, addr, addrlen);
-			break;
+		if (addr->sa_family == AF_INET6)
+			inet_ntop(AF_INET6, &((struct sockaddr_in6 *)addr)->sin6_addr,
+					ipaddr, sizeof(ipaddr));
+		else
+			inet_ntop(addr->sa_family, &((struct sockaddr_in *)addr)->sin_addr,
+					ipaddr, sizeof(ipaddr));
+		purple_debug_info("proxy", "Attempting connection to %s\n", ipaddr);
 
-		case PURPLE_PROXY_SOCKS5:
-			proxy_connect_socks5(connect_data, addr, addrlen);
-			break;
+		error = proxy_attempt_start(connect_data, addr, addrlen);
+		g_free(addr);
 
-		case PURPLE_PROXY_USE_ENVVAR:
-			proxy_connect_http(connect_data, addr, addrlen);
-			break;
+		if (error == 0)
+		{
+			if (connect_data->hosts != NULL)
+				connect_data->stagger_timeout = purple_timeout_add(
+						PROXY_CONNECT_STAGGER, stagger_cb, connect_data);
+			return;
+		}
 
-		default:
-			break;
+		purple_debug_info("proxy", "Connection attempt failed: %s\n",
+				strerror(error));
 	}
 
-	g_free(addr);
+	if (connect_data->attempts == NULL)
+		/* Everything failed, and there's nothing left to wait for */
+		purple_proxy_connect_data_disconnect(connect_data,
+				error ? strerror(error) : _("Unable to connect"));
 }
 
 static void
@@ -1700,6 +1669,15 @@ connection_host_resolved(GSList *hosts, gpointer data,
 
 	connect_data->hosts = hosts;
 
+	if (purple_proxy_info_get_type(connect_data->gpi) == PURPLE_PROXY_NONE)
+		purple_debug_info("proxy", "Connecting to %s:%d with no proxy\n",
+				connect_data->host, connect_data->port);
+	else
+		purple_debug_info("proxy", "Connecting to %s:%d via %s:%d\n",
+				connect_data->host, connect_data->port,
+				purple_proxy_info_get_host(connect_data->gpi),
+				purple_proxy_info_get_port(connect_data->gpi));
+
 	try_connect(connect_data);
 }
 
@@ -46,6 +46,21 @@ typedef struct
 typedef struct
 {
 	gulong id;
+	PurpleCallback cb;
+	void *handle;
+	void *data;
+	gboolean use_vargs;
+	int priority;
+	gboolean removed;
+
+} PurpleSignalHandlerData;
+
+typedef struct _PurpleSignal PurpleSignalData;
+
+struct _PurpleSignal
+{
+	gulong id;
+	char *name;
 
 	PurpleSignalMarshalFunc marshal;
 
@@ -56,19 +71,20 @@ typedef struct
 	GList *handlers;
 	size_t handler_count;
 
-	gulong next_handler_id;
-} PurpleSignalData;
-
-typedef struct
-{
-	gulong id;
-	PurpleCallback cb;
-	void *handle;
-	void *data;
-	gboolean use_vargs;
-	int priority;
+	/*
+	 * The handlers in priority order, rebuilt when one is connected or
+	 * disconnected so that emission is a walk over a flat array.  While
+	 * the signal is being emitted the array is left alone: disconnected
+	 * handlers are only flagged as removed and freed afterwards.
+	 */
+	PurpleSignalHandlerData **handler_array;
+	size_t handler_array_len;
+	gboolean handler_array_dirty;
+	int emitting;
+	GSList *removed_handlers;
 
-} PurpleSignalHandlerData;
+	gulong next_handler_id;
+};
 
 static GHashTable *instance_table = NULL;
 
@@ -85,6 +101,10 @@ destroy_signal_data(PurpleSignalData *signal_data)
 {
 	g_list_foreach(signal_data->handlers, (GFunc)g_free, NULL);
 	g_list_free(signal_data->handlers);
+	g_slist_foreach(signal_data->removed_handlers, (GFunc)g_free, NULL);
+	g_slist_free(signal_data->removed_handlers);
+	g_free(signal_data->handler_array);
+	g_free(signal_data->name);
 
 	if (signal_data->values != NULL)
 	{
@@ -125,7 +145,7 @@ purple_signal_register(void *instance, const char *signal,
 		instance_data->next_signal_id = 1;
 
 		instance_data->signals =
-			g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
 								  (GDestroyNotify)destroy_signal_data);
 
 		g_hash_table_insert(instance_table, instance, instance_data);
@@ -133,6 +153,7 @@ purple_signal_register(void *instance, const char *signal,
 
 	signal_data = g_new0(PurpleSignalData, 1);
 	signal_data->id              = instance_data->next_signal_id;
+	signal_data->name            = g_strdup(signal);
 	signal_data->marshal         = marshal;
 	signal_data->next_handler_id = 1;
 	signal_data->ret_value       = ret_value;
@@ -152,8 +173,8 @@ purple_signal_register(void *instance, const char *signal,
 		va_end(args);
 	}
 
-	g_hash_table_insert(instance_data->signals,
-						g_strdup(signal), signal_data);
+	g_hash_table_replace(instance_data->signals,
+						 signal_data->name, signal_data);
 
 	instance_data->next_signal_id++;
 	instance_data->signal_count++;
@@ -233,6 +254,74 @@ purple_signal_get_values(void *instance, const char *signal,
 		*ret_value = signal_data->ret_value;
 }
 
+static void
+rebuild_handler_array(PurpleSignalData *signal_data)
+{
+	GList *l;
+	size_t i = 0;
+
+	if (signal_data->emitting > 0)
+	{
+		signal_data->handler_array_dirty = TRUE;
+		return;
+	}
+
+	g_free(signal_data->handler_array);
+	signal_data->handler_array = NULL;
+	signal_data->handler_array_len = signal_data->handler_count;
+	signal_data->handler_array_dirty = FALSE;
+
+	if (signal_data->handler_count == 0)
+		return;
+
+	signal_data->handler_array =
+		g_new(PurpleSignalHandlerData *, signal_data->handler_count);
+
+	for (l = signal_data->handlers; l != NULL; l = l->next)
+		signal_data->handler_array[i++] = l->data;
+}
+
+static void
+remove_handler(PurpleSignalData *signal_data, GList *link)
+{
+	PurpleSignalHandlerData *handler_data = link->data;
+
+	signal_data->handlers = g_list_delete_link(signal_data->handlers, link);
+	signal_data->handler_count--;
+
+	if (signal_data->emitting > 0)
+	{
+		/* The array being walked still points to it. */
+		handler_data->removed = TRUE;
+		signal_data->removed_handlers =
+			g_slist_prepend(signal_data->removed_handlers, handler_data);
+	}
+	else
+		g_free(handler_data);
+
+	rebuild_handler_array(signal_data);
+}
+
+static void
+emit_begin(PurpleSignalData *signal_data)
+{
+	signal_data->emitting++;
+}
+
+static void
+emit_end(PurpleSignalData *signal_data)
+{
+	if (--signal_data->emitting > 0)
+		return;
+
+	g_slist_foreach(signal_data->removed_handlers, (GFunc)g_free, NULL);
+	g_slist_free(signal_data->removed_handlers);
+	signal_data->removed_handlers = NULL;
+
+	if (signal_data->handler_array_dirty)
+		rebuild_handler_array(signal_data);
+}
+
 static gint handler_priority(void * a, void * b) {
 	PurpleSignalHandlerData *ah = (PurpleSignalHandlerData*)a;
 	PurpleSignalHandlerData *bh = (PurpleSignalHandlerData*)b;
@@ -290,6 +379,8 @@ signal_connect_common(void *instance, const char *signal, void *handle,
 	signal_data->handler_count++;
 	signal_data->next_handler_id++;
 
+	rebuild_handler_array(signal_data);
+
 	return handler_data->id;
 }
 
@@ -360,11 +451,7 @@ purple_signal_disconnect(void *instance, const char *signal,
 
 		if (handler_data->handle == handle && handler_data->cb == func)
 		{
-			g_free(handler_data);
-
-			signal_data->handlers = g_list_remove(signal_data->handlers,
-												  handler_data);
-			signal_data->handler_count--;
+			remove_handler(signal_data, l);
 
 			found = TRUE;
 
@@ -393,13 +480,7 @@ disconnect_handle_from_signals(const char *signal,
 		l_next = l->next;
 
 		if (handler_data->handle == handle)
-		{
-			g_free(handler_data);
-
-			signal_data->handler_count--;
-			signal_data->handlers = g_list_remove(signal_data->handlers,
-												  handler_data);
-		}
+			remove_handler(signal_data, l);
 	}
 }
 
@@ -434,22 +515,16 @@ purple_signal_emit(void *instance, const char *signal, ...)
 	va_end(args);
 }
 
-void
-purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
+static PurpleSignalData *
+find_signal_data(void *instance, const char *signal)
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
-
-	g_return_if_fail(instance != NULL);
-	g_return_if_fail(signal   != NULL);
 
 	instance_data =
 		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
 
-	g_return_if_fail(instance_data != NULL);
+	g_return_val_if_fail(instance_data != NULL, NULL);
 
 	signal_data =
 		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
@@ -458,38 +533,120 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 	{
 		purple_debug(PURPLE_DEBUG_ERROR, "signals",
 				   "Signal data for %s not found!\n", signal);
-		return;
 	}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
+	return signal_data;
+}
+
+static void
+signal_emit(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData **handlers;
+	size_t i, len;
+	va_list tmp;
+
+	handlers = signal_data->handler_array;
+	len = signal_data->handler_array_len;
+
+	if (len > 0)
 	{
-		l_next = l->next;
+		emit_begin(signal_data);
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+		for (i = 0; i < len; i++)
+		{
+			PurpleSignalHandlerData *handler_data = handlers[i];
+
+			if (handler_data->removed)
+				continue;
+
+			/* This is necessary because a va_list may only be
+			 * evaluated once */
+			G_VA_COPY(tmp, args);
+
+			if (handler_data->use_vargs)
+			{
+				((void (*)(va_list, void *))handler_data->cb)(tmp,
+															  handler_data->data);
+			}
+			else
+			{
+				signal_data->marshal(handler_data->cb, tmp,
+									 handler_data->data, NULL);
+			}
+
+			va_end(tmp);
+		}
 
-		/* This is necessary because a va_list may only be
-		 * evaluated once */
-		G_VA_COPY(tmp, args);
+		emit_end(signal_data);
+	}
+
+#ifdef HAVE_DBUS
+	purple_dbus_signal_emit_purple(signal_data->name, signal_data->num_values,
+				   signal_data->values, args);
+#endif	/* HAVE_DBUS */
+}
 
+static void *
+signal_emit_return_1(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData **handlers;
+	size_t i, len;
+	void *ret_val = NULL;
+	va_list tmp;
+
+#ifdef HAVE_DBUS
+	G_VA_COPY(tmp, args);
+	purple_dbus_signal_emit_purple(signal_data->name, signal_data->num_values,
+				   signal_data->values, tmp);
+	va_end(tmp);
+#endif	/* HAVE_DBUS */
+
+	handlers = signal_data->handler_array;
+	len = signal_data->handler_array_len;
+
+	if (len == 0)
+		return NULL;
+
+	emit_begin(signal_data);
+
+	for (i = 0; i < len && ret_val == NULL; i++)
+	{
+		PurpleSignalHandlerData *handler_data = handlers[i];
+
+		if (handler_data->removed)
+			continue;
+
+		G_VA_COPY(tmp, args);
 		if (handler_data->use_vargs)
 		{
-			((void (*)(va_list, void *))handler_data->cb)(tmp,
-														  handler_data->data);
+			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
+				tmp, handler_data->data);
 		}
 		else
 		{
 			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, NULL);
+								 handler_data->data, &ret_val);
 		}
-
 		va_end(tmp);
 	}
 
-#ifdef HAVE_DBUS
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values, 
-				   signal_data->values, args);
-#endif	/* HAVE_DBUS */
+	emit_end(signal_data);
 
+	return ret_val;
+}
+
+void
+purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_if_fail(instance != NULL);
+	g_return_if_fail(signal   != NULL);
+
+	if ((signal_data = find_signal_data(instance, signal)) == NULL)
+		return;
+
+	signal_emit(signal_data, args);
 }
 
 void *
@@ -512,63 +669,63 @@ void *
 purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 								va_list args)
 {
-	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_val_if_fail(instance != NULL, NULL);
 	g_return_val_if_fail(signal   != NULL, NULL);
 
-	instance_data =
-		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+	if ((signal_data = find_signal_data(instance, signal)) == NULL)
+		return NULL;
 
-	g_return_val_if_fail(instance_data != NULL, NULL);
+	return signal_emit_return_1(signal_data, args);
+}
 
-	signal_data =
-		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+PurpleSignal *
+purple_signal_lookup(void *instance, const char *signal)
+{
+	g_return_val_if_fail(instance != NULL, NULL);
+	g_return_val_if_fail(signal   != NULL, NULL);
 
-	if (signal_data == NULL)
-	{
-		purple_debug(PURPLE_DEBUG_ERROR, "signals",
-				   "Signal data for %s not found!\n", signal);
-		return 0;
-	}
+	return find_signal_data(instance, signal);
+}
+
+gboolean
+purple_signal_has_handlers(PurpleSignal *signal)
+{
+	g_return_val_if_fail(signal != NULL, FALSE);
 
 #ifdef HAVE_DBUS
-	G_VA_COPY(tmp, args);
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values, 
-				   signal_data->values, tmp);
-	va_end(tmp);
-#endif	/* HAVE_DBUS */
+	return TRUE;
+#else
+	return signal->handler_count > 0;
+#endif
+}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		void *ret_val = NULL;
+void
+purple_signal_emit_by_signal(PurpleSignal *signal, ...)
+{
+	va_list args;
 
-		l_next = l->next;
+	g_return_if_fail(signal != NULL);
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+	va_start(args, signal);
+	signal_emit(signal, args);
+	va_end(args);
+}
 
-		G_VA_COPY(tmp, args);
-		if (handler_data->use_vargs)
-		{
-			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
-				tmp, handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, &ret_val);
-		}
-		va_end(tmp);
+void *
+purple_signal_emit_by_signal_return_1(PurpleSignal *signal, ...)
+{
+	void *ret_val;
+	va_list args;
 
-		if (ret_val != NULL)
-			return ret_val;
-	}
+	g_return_val_if_fail(signal != NULL, NULL);
 
-	return NULL;
+	va_start(args, signal);
+	ret_val = signal_emit_return_1(signal, args);
+	va_end(args);
+
+	return ret_val;
 }
 
 void
@@ -34,6 +34,11 @@ typedef void (*PurpleCallback)(void);
 typedef void (*PurpleSignalMarshalFunc)(PurpleCallback cb, va_list args,
 									  void *data, void **return_val);
 
+/**
+ * A registered signal, as returned by purple_signal_lookup().
+ */
+typedef struct _PurpleSignal PurpleSignal;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -254,6 +259,52 @@ void *purple_signal_emit_return_1(void *instance, const char *signal, ...);
 void *purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 									  va_list args);
 
+/**
+ * Looks up a registered signal, so that it can be emitted repeatedly
+ * without resolving its instance and name each time.
+ *
+ * The returned signal is valid until it is unregistered.
+ *
+ * @param instance The instance the signal is registered in.
+ * @param signal   The signal name.
+ *
+ * @return The signal, or NULL if it is not registered.
+ */
+PurpleSignal *purple_signal_lookup(void *instance, const char *signal);
+
+/**
+ * Returns whether emitting a signal would reach anything.
+ *
+ * Callers can use this to skip building expensive arguments for a
+ * signal nobody is listening to.
+ *
+ * @param signal The signal.
+ *
+ * @return TRUE if the signal has handlers (or is exported over D-Bus).
+ */
+gboolean purple_signal_has_handlers(PurpleSignal *signal);
+
+/**
+ * Emits a signal looked up with purple_signal_lookup().
+ *
+ * @param signal The signal being emitted.
+ *
+ * @see purple_signal_emit()
+ */
+void purple_signal_emit_by_signal(PurpleSignal *signal, ...);
+
+/**
+ * Emits a signal looked up with purple_signal_lookup() and returns the
+ * first non-NULL return value.
+ *
+ * @param signal The signal being emitted.
+ *
+ * @return The first non-NULL return value
+ *
+ * @see purple_signal_emit_return_1()
+ */
+void *purple_signal_emit_by_signal_return_1(PurpleSignal *signal, ...);
+
 /**
  * Initializes the signals subsystem.
  */
@@ -72,7 +72,6 @@ struct _PurplePresence
 	time_t login_time;
 
 	GList *statuses;
-	GHashTable *status_table;
 
 	PurpleStatus *active_status;
 
@@ -100,14 +99,17 @@ struct _PurplePresence
 
 /**
  * An active status.
+ *
+ * Every buddy gets one of these per status type of its account, so they
+ * are kept small.  attr_values is NULL while every attribute still has its
+ * default value; lookups then fall through to the defaults shared by the
+ * status type, and the table is only created once an attribute is set.
  */
 struct _PurpleStatus
 {
 	PurpleStatusType *type;
 	PurplePresence *presence;
 
-	const char *title;
-
 	gboolean active;
 
 	GHashTable *attr_values;
@@ -548,33 +550,49 @@ PurpleStatus *
 purple_status_new(PurpleStatusType *status_type, PurplePresence *presence)
 {
 	PurpleStatus *status;
-	GList *l;
 
 	g_return_val_if_fail(status_type != NULL, NULL);
 	g_return_val_if_fail(presence    != NULL, NULL);
 
-	status = g_new0(PurpleStatus, 1);
+	status = g_slice_new0(PurpleStatus);
 	PURPLE_DBUS_REGISTER_POINTER(status, PurpleStatus);
 
 	status->type     = status_type;
 	status->presence = presence;
 
-	status->attr_values =
-		g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-		(GDestroyNotify)purple_value_destroy);
+	return status;
+}
 
-	for (l = purple_status_type_get_attrs(status_type); l != NULL; l = l->next)
+/*
+ * Returns a value of the status's own that can be changed, copying the
+ * status type's defaults the first time an attribute is set.
+ */
+static PurpleValue *
+status_get_attr_value_for_write(PurpleStatus *status, const char *id)
+{
+	GList *l;
+
+	if (status->attr_values == NULL)
 	{
-		PurpleStatusAttr *attr = (PurpleStatusAttr *)l->data;
-		PurpleValue *value = purple_status_attr_get_value(attr);
-		PurpleValue *new_value = purple_value_dup(value);
+		if (purple_status_type_get_attr(status->type, id) == NULL)
+			return NULL;
+
+		status->attr_values =
+			g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)purple_value_destroy);
 
-		g_hash_table_insert(status->attr_values,
-							g_strdup(purple_status_attr_get_id(attr)),
-							new_value);
+		for (l = purple_status_type_get_attrs(status->type); l != NULL; l = l->next)
+		{
+			PurpleStatusAttr *attr = (PurpleStatusAttr *)l->data;
+
+			/* The attribute, and so its ID, lives as long as the type. */
+			g_hash_table_insert(status->attr_values,
+								(char *)purple_status_attr_get_id(attr),
+								purple_value_dup(purple_status_attr_get_value(attr)));
+		}
 	}
 
-	return status;
+	return (PurpleValue *)g_hash_table_lookup(status->attr_values, id);
 }
 
 /*
@@ -586,10 +604,11 @@ purple_status_destroy(PurpleStatus *status)
 {
 	g_return_if_fail(status != NULL);
 
-	g_hash_table_destroy(status->attr_values);
+	if (status->attr_values != NULL)
+		g_hash_table_destroy(status->attr_values);
 
 	PURPLE_DBUS_UNREGISTER_POINTER(status);
-	g_free(status);
+	g_slice_free(PurpleStatus, status);
 }
 
 static void
@@ -828,6 +847,13 @@ purple_status_set_active_with_attrs_list(PurpleStatus *status, gboolean active,
 
 		l = l->next;
 	}
+
+	/* Everything is back to its default, so the shared defaults will do. */
+	if (specified_attr_ids == NULL && status->attr_values != NULL)
+	{
+		g_hash_table_destroy(status->attr_values);
+		status->attr_values = NULL;
+	}
 	g_list_free(specified_attr_ids);
 
 	if (!changed)
@@ -849,6 +875,10 @@ purple_status_set_attr_boolean(PurpleStatus *status, const char *id,
 	g_return_if_fail(attr_value != NULL);
 	g_return_if_fail(purple_value_get_type(attr_value) == PURPLE_TYPE_BOOLEAN);
 
+	if (status->attr_values == NULL && purple_value_get_boolean(attr_value) == value)
+		return;
+
+	attr_value = status_get_attr_value_for_write(status, id);
 	purple_value_set_boolean(attr_value, value);
 }
 
@@ -865,6 +895,10 @@ purple_status_set_attr_int(PurpleStatus *status, const char *id, int value)
 	g_return_if_fail(attr_value != NULL);
 	g_return_if_fail(purple_value_get_type(attr_value) == PURPLE_TYPE_INT);
 
+	if (status->attr_values == NULL && purple_value_get_int(attr_value) == value)
+		return;
+
+	attr_value = status_get_attr_value_for_write(status, id);
 	purple_value_set_int(attr_value, value);
 }
 
@@ -892,6 +926,16 @@ purple_status_set_attr_string(PurpleStatus *status, const char *id,
 	}
 	g_return_if_fail(purple_value_get_type(attr_value) == PURPLE_TYPE_STRING);
 
+	if (status->attr_values == NULL)
+	{
+		const char *current = purple_value_get_string(attr_value);
+
+		if ((current == NULL && value == NULL) ||
+			(current != NULL && value != NULL && !strcmp(current, value)))
+			return;
+	}
+
+	attr_value = status_get_attr_value_for_write(status, id);
 	purple_value_set_string(attr_value, value);
 }
 
@@ -975,10 +1019,18 @@ purple_status_is_online(const PurpleStatus *status)
 PurpleValue *
 purple_status_get_attr_value(const PurpleStatus *status, const char *id)
 {
+	PurpleStatusAttr *attr;
+
 	g_return_val_if_fail(status != NULL, NULL);
 	g_return_val_if_fail(id     != NULL, NULL);
 
-	return (PurpleValue *)g_hash_table_lookup(status->attr_values, id);
+	if (status->attr_values != NULL)
+		return (PurpleValue *)g_hash_table_lookup(status->attr_values, id);
+
+	if ((attr = purple_status_type_get_attr(status->type, id)) == NULL)
+		return NULL;
+
+	return purple_status_attr_get_value(attr);
 }
 
 gboolean
@@ -1078,10 +1130,6 @@ purple_presence_new(PurplePresenceContext context)
 
 	presence->context = context;
 
-	presence->status_table =
-		g_hash_table_new_full(g_str_hash, g_str_equal,
-							  g_free, NULL);
-
 	return presence;
 }
 
@@ -1149,8 +1197,6 @@ purple_presence_destroy(PurplePresence *presence)
 	g_list_foreach(presence->statuses, (GFunc)purple_status_destroy, NULL);
 	g_list_free(presence->statuses);
 
-	g_hash_table_destroy(presence->status_table);
-
 	PURPLE_DBUS_UNREGISTER_POINTER(presence);
 	g_free(presence);
 }
@@ -1162,9 +1208,6 @@ purple_presence_add_status(PurplePresence *presence, PurpleStatus *status)
 	g_return_if_fail(status   != NULL);
 
 	presence->statuses = g_list_append(presence->statuses, status);
-
-	g_hash_table_insert(presence->status_table,
-	g_strdup(purple_status_get_id(status)), status);
 }
 
 void
@@ -1407,32 +1450,24 @@ purple_presence_get_statuses(const PurplePresence *presence)
 PurpleStatus *
 purple_presence_get_status(const PurplePresence *presence, const char *status_id)
 {
-	PurpleStatus *status;
-	GList *l = NULL;
+	GList *l;
 
 	g_return_val_if_fail(presence  != NULL, NULL);
 	g_return_val_if_fail(status_id != NULL, NULL);
 
-	/* What's the purpose of this hash table? */
-	status = (PurpleStatus *)g_hash_table_lookup(presence->status_table,
-						   status_id);
-
-	if (status == NULL) {
-		for (l = purple_presence_get_statuses(presence);
-			 l != NULL && status == NULL; l = l->next)
-		{
-			PurpleStatus *temp_status = l->data;
-
-			if (!strcmp(status_id, purple_status_get_id(temp_status)))
-				status = temp_status;
-		}
+	/*
+	 * A presence only has a handful of statuses, so this is cheaper than
+	 * keeping a hash table for every buddy.
+	 */
+	for (l = purple_presence_get_statuses(presence); l != NULL; l = l->next)
+	{
+		PurpleStatus *status = l->data;
 
-		if (status != NULL)
-			g_hash_table_insert(presence->status_table,
-								g_strdup(purple_status_get_id(status)), status);
+		if (!strcmp(status_id, purple_status_get_id(status)))
+			return status;
 	}
 
-	return status;
+	return NULL;
 }
 
 PurpleStatus *
@@ -3,19 +3,63 @@
 
 #include "../core.h"
 #include "../eventloop.h"
+#include "../plugin.h"
+#include "../prpl.h"
 #include "../util.h"
+#include "../version.h"
 
 #include "tests.h"
 
 /******************************************************************************
  * libpurple goodies
  *****************************************************************************/
+#define PURPLE_CHECK_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define PURPLE_CHECK_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} PurpleCheckIOClosure;
+
+static gboolean
+purple_check_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	PurpleCheckIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & PURPLE_CHECK_READ_COND)
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & PURPLE_CHECK_WRITE_COND)
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source), purple_cond);
+
+	return TRUE;
+}
+
 static guint
 purple_check_input_add(gint fd, PurpleInputCondition condition,
                      PurpleInputFunction function, gpointer data)
 {
-	/* this is a no-op for now, feel free to implement it */
-	return 0;
+	PurpleCheckIOClosure *closure = g_new0(PurpleCheckIOClosure, 1);
+	GIOChannel *channel;
+	GIOCondition cond = 0;
+	guint result;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= PURPLE_CHECK_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= PURPLE_CHECK_WRITE_COND;
+
+	channel = g_io_channel_unix_new(fd);
+	result = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+			purple_check_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return result;
 }
 
 static PurpleEventLoopUiOps eventloop_ui_ops = {
@@ -34,6 +78,69 @@ static PurpleEventLoopUiOps eventloop_ui_ops = {
 	NULL
 };
 
+/******************************************************************************
+ * A protocol for the tests' accounts
+ *****************************************************************************/
+static PurplePluginInfo null_plugin_info;
+static PurplePluginProtocolInfo null_prpl_info;
+
+static const char *
+purple_check_list_icon(PurpleAccount *account, PurpleBuddy *buddy)
+{
+	return "null";
+}
+
+static GList *
+purple_check_status_types(PurpleAccount *account)
+{
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+			PURPLE_STATUS_AVAILABLE, "available", NULL, TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING),
+			NULL));
+	types = g_list_append(types, purple_status_type_new(
+			PURPLE_STATUS_OFFLINE, "offline", NULL, TRUE));
+
+	return types;
+}
+
+/* Accounts need a protocol with status types before buddies can be added
+ * for them, so the tests create theirs with PURPLE_CHECK_PRPL_ID.  It is
+ * registered along with the static protocols, ahead of loading accounts.xml
+ * from the last run. */
+static void
+purple_check_register_prpl(void)
+{
+	PurplePlugin *plugin;
+
+	null_prpl_info.list_icon = purple_check_list_icon;
+	null_prpl_info.status_types = purple_check_status_types;
+
+	null_plugin_info.magic = PURPLE_PLUGIN_MAGIC;
+	null_plugin_info.major_version = PURPLE_MAJOR_VERSION;
+	null_plugin_info.minor_version = PURPLE_MINOR_VERSION;
+	null_plugin_info.type = PURPLE_PLUGIN_PROTOCOL;
+	null_plugin_info.id = PURPLE_CHECK_PRPL_ID;
+	null_plugin_info.name = "Null";
+	null_plugin_info.extra_info = &null_prpl_info;
+
+	plugin = purple_plugin_new(TRUE, NULL);
+	plugin->info = &null_plugin_info;
+	purple_plugin_register(plugin);
+}
+
+static PurpleCoreUiOps core_ui_ops = {
+	purple_check_register_prpl, /* ui_prefs_init */
+	NULL, /* debug_ui_init */
+	NULL, /* ui_init */
+	NULL, /* quit */
+	NULL, /* get_ui_info */
+	NULL,
+	NULL,
+	NULL
+};
+
 static void
 purple_check_init(void) {
 	gchar *home_dir;
@@ -41,10 +148,11 @@ purple_check_init(void) {
 	purple_eventloop_set_ui_ops(&eventloop_ui_ops);
 
 	/* build our fake home directory */
-	home_dir = g_build_path(BUILDDIR, "libpurple", "tests", "home", NULL);
+	home_dir = g_build_filename(BUILDDIR, "libpurple", "tests", "home", NULL);
 	purple_util_set_user_dir(home_dir);
 	g_free(home_dir);
 
+	purple_core_set_ui_ops(&core_ui_ops);
 	purple_core_init("check");
 }
 
@@ -71,9 +179,24 @@ int main(void)
 
 	sr = srunner_create (master_suite());
 
+	srunner_add_suite(sr, blist_suite());
 	srunner_add_suite(sr, cipher_suite());
+	srunner_add_suite(sr, dnsresolver_suite());
+	srunner_add_suite(sr, ft_suite());
+	srunner_add_suite(sr, httpclient_suite());
+	srunner_add_suite(sr, jabber_caps_suite());
+	srunner_add_suite(sr, jabber_compress_suite());
 	srunner_add_suite(sr, jabber_jutil_suite());
+	srunner_add_suite(sr, jabber_roster_suite());
+	srunner_add_suite(sr, jabber_sm_suite());
+	srunner_add_suite(sr, log_suite());
+	srunner_add_suite(sr, msn_sync_suite());
+	srunner_add_suite(sr, oscar_feedbag_suite());
+	srunner_add_suite(sr, proxy_suite());
+	srunner_add_suite(sr, signals_suite());
+	srunner_add_suite(sr, status_suite());
 	srunner_add_suite(sr, util_suite());
+	srunner_add_suite(sr, xmlnode_suite());
 
 	/* make this a libpurple "ui" */
 	purple_check_init();
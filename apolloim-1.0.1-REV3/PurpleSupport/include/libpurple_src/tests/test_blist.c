@@ -0,0 +1,356 @@
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../util.h"
+#include "../xmlnode.h"
+
+#define ACCOUNT_NAME "journal@example.com"
+#define ACCOUNT_PROTO PURPLE_CHECK_PRPL_ID
+
+static PurpleAccount *account;
+static char *blist_filename;
+static char *journal_filename;
+
+static void
+blist_setup(void)
+{
+	/* The UI normally creates the buddy list */
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+
+	account = purple_account_new(ACCOUNT_NAME, ACCOUNT_PROTO);
+	purple_accounts_add(account);
+
+	blist_filename = g_build_filename(purple_user_dir(), "blist.xml", NULL);
+	journal_filename = g_build_filename(purple_user_dir(), "blist.xml.journal", NULL);
+	unlink(blist_filename);
+	unlink(journal_filename);
+}
+
+/* Empties the buddy list, so that it can be loaded again */
+static void
+blist_clear(void)
+{
+	GSList *buddies = purple_find_buddies(account, NULL);
+	PurpleGroup *group;
+
+	while (buddies) {
+		purple_blist_remove_buddy(buddies->data);
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+	if ((group = purple_find_group("Friends")))
+		purple_blist_remove_group(group);
+}
+
+static void
+blist_teardown(void)
+{
+	blist_clear();
+
+	purple_accounts_remove(account);
+	purple_account_destroy(account);
+	account = NULL;
+
+	unlink(blist_filename);
+	unlink(journal_filename);
+	g_free(blist_filename);
+	g_free(journal_filename);
+}
+
+/* Writes a blist.xml with one buddy per name in the Friends group */
+static void
+write_blist(int buddies, const char *note)
+{
+	GString *xml = g_string_new("<?xml version='1.0' encoding='UTF-8' ?>\n"
+			"<purple version='1.0'><blist><group name='Friends'>"
+			"<setting name='color' type='string'>red</setting>");
+	int i;
+
+	for (i = 0; i < buddies; i++)
+		g_string_append_printf(xml,
+				"<contact><buddy account='" ACCOUNT_NAME "' proto='" ACCOUNT_PROTO "'>"
+				"<name>buddy%d</name>"
+				"<setting name='note' type='string'>%s</setting>"
+				"</buddy></contact>", i, note);
+
+	g_string_append(xml, "</group></blist><privacy/></purple>\n");
+
+	fail_unless(purple_util_write_data_to_file("blist.xml", xml->str, xml->len), NULL);
+	g_string_free(xml, TRUE);
+}
+
+/* A record as blist_journal_append() writes them */
+static char *
+journal_record(int buddy, const char *key, const char *value)
+{
+	if (value == NULL)
+		return g_strdup_printf("<buddy group='Friends' account='" ACCOUNT_NAME
+				"' proto='" ACCOUNT_PROTO "'><name>buddy%d</name>"
+				"<setting name='%s'/></buddy>\n", buddy, key);
+
+	return g_strdup_printf("<buddy group='Friends' account='" ACCOUNT_NAME
+			"' proto='" ACCOUNT_PROTO "'><name>buddy%d</name>"
+			"<setting name='%s' type='string'>%s</setting></buddy>\n",
+			buddy, key, value);
+}
+
+static void
+write_journal(const char *contents, gssize len)
+{
+	FILE *file = fopen(journal_filename, "wb");
+
+	fail_unless(file != NULL, NULL);
+	if (len < 0)
+		len = strlen(contents);
+	fail_unless(fwrite(contents, 1, len, file) == (size_t)len, NULL);
+	fclose(file);
+}
+
+static const char *
+buddy_setting(int buddy, const char *key)
+{
+	char name[32];
+	PurpleBuddy *b;
+
+	g_snprintf(name, sizeof(name), "buddy%d", buddy);
+	b = purple_find_buddy(account, name);
+	fail_unless(b != NULL, NULL);
+
+	return purple_blist_node_get_string((PurpleBlistNode *)b, key);
+}
+
+static off_t
+file_size(const char *filename)
+{
+	struct stat st;
+
+	if (stat(filename, &st) != 0)
+		return -1;
+
+	return st.st_size;
+}
+
+START_TEST(test_blist_journal_replay_stale)
+{
+	char *first = journal_record(0, "note", "new");
+	char *second = journal_record(1, "note", NULL);
+	char *third = journal_record(0, "note", "newer");
+	char *journal = g_strconcat(first, second, third, NULL);
+	char *contents;
+	GTimer *timer;
+
+	/* blist.xml was written before any of the journaled changes */
+	write_blist(2, "old");
+	write_journal(journal, -1);
+
+	purple_blist_load();
+
+	/* Later records win, and removals stick */
+	assert_string_equal("newer", buddy_setting(0, "note"));
+	fail_unless(buddy_setting(1, "note") == NULL, NULL);
+	assert_string_equal("red",
+			purple_blist_node_get_string((PurpleBlistNode *)purple_find_group("Friends"), "color"));
+
+	/* The replay is folded back into blist.xml by the next full save,
+	 * and only then does the journal go away */
+	timer = g_timer_new();
+	while (g_file_test(journal_filename, G_FILE_TEST_EXISTS) &&
+			g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	fail_if(g_file_test(journal_filename, G_FILE_TEST_EXISTS), NULL);
+	fail_unless(g_file_get_contents(blist_filename, &contents, NULL, NULL), NULL);
+	fail_unless(strstr(contents, ">newer<") != NULL, NULL);
+	fail_unless(strstr(contents, ">old<") == NULL, NULL);
+	g_free(contents);
+
+	g_free(journal);
+	g_free(first);
+	g_free(second);
+	g_free(third);
+}
+END_TEST
+
+START_TEST(test_blist_journal_torn)
+{
+	char *first = journal_record(0, "note", "new");
+	char *second = journal_record(1, "note", "lost");
+	char *journal = g_strconcat(first, second, NULL);
+
+	write_blist(2, "old");
+
+	/* A crash in the middle of appending the second record */
+	write_journal(journal, strlen(first) + strlen(second) / 2);
+
+	purple_blist_load();
+
+	assert_string_equal("new", buddy_setting(0, "note"));
+	assert_string_equal("old", buddy_setting(1, "note"));
+
+	g_free(journal);
+	g_free(first);
+	g_free(second);
+}
+END_TEST
+
+START_TEST(test_blist_journal_truncated)
+{
+	char *first = journal_record(0, "note", "new");
+	char *second = journal_record(1, "note", "late");
+	char *journal = g_strconcat(first, second, NULL);
+
+	write_blist(2, "old");
+
+	/* Cut off in the middle of the first record, and again right after
+	 * a record's closing tag but before its newline */
+	write_journal(journal, strlen(first) / 2);
+	purple_blist_load();
+	assert_string_equal("old", buddy_setting(0, "note"));
+	assert_string_equal("old", buddy_setting(1, "note"));
+	blist_clear();
+
+	write_journal("", 0);
+	purple_blist_load();
+	assert_string_equal("old", buddy_setting(0, "note"));
+	blist_clear();
+
+	write_journal(journal, strlen(journal) - 1);
+	purple_blist_load();
+	assert_string_equal("new", buddy_setting(0, "note"));
+	assert_string_equal("late", buddy_setting(1, "note"));
+
+	g_free(journal);
+	g_free(first);
+	g_free(second);
+}
+END_TEST
+
+START_TEST(test_blist_load_broken)
+{
+	char *backup = g_strconcat(blist_filename, "~", NULL);
+	off_t size;
+
+	write_blist(3, "old");
+
+	/* Lost the end of the file, part of the way through the second buddy */
+	size = file_size(blist_filename) / 2;
+	fail_unless(truncate(blist_filename, size) == 0, NULL);
+
+	purple_blist_load();
+
+	/* Nothing of what was read before the error is left behind */
+	fail_unless(purple_find_buddy(account, "buddy0") == NULL, NULL);
+	fail_unless(purple_find_group("Friends") == NULL, NULL);
+
+	/* And the list isn't saved over the file the user is told about */
+	fail_unless(file_size(backup) == size, NULL);
+	fail_unless(file_size(blist_filename) == size, NULL);
+
+	unlink(backup);
+	g_free(backup);
+}
+END_TEST
+
+START_TEST(test_blist_journal_append)
+{
+	PurpleBlistNode *buddy;
+	off_t blist_size;
+	char *contents, *record;
+
+	write_blist(2, "old");
+	purple_blist_load();
+	blist_size = file_size(blist_filename);
+
+	buddy = (PurpleBlistNode *)purple_find_buddy(account, "buddy1");
+	purple_blist_node_set_string(buddy, "note", "changed");
+
+	/* The change is on disk right away, without touching blist.xml */
+	fail_unless(g_file_get_contents(journal_filename, &contents, NULL, NULL), NULL);
+	record = journal_record(1, "note", "changed");
+	assert_string_equal(record, contents);
+	fail_unless(file_size(blist_filename) == blist_size, NULL);
+
+	g_free(record);
+	g_free(contents);
+}
+END_TEST
+
+/*
+ * Not a pass/fail test so much as a measurement: what one setting change
+ * costs through the journal, next to what rewriting blist.xml costs.
+ */
+START_TEST(test_blist_journal_benchmark)
+{
+	const int buddies = 2000, changes = 400;
+	PurpleBlistNode *buddy;
+	xmlnode *node;
+	GTimer *timer;
+	double journaled, rewritten;
+	off_t blist_size;
+	char *contents, *line;
+	int i;
+
+	write_blist(buddies, "old");
+	purple_blist_load();
+	blist_size = file_size(blist_filename);
+
+	timer = g_timer_new();
+	for (i = 0; i < changes; i++) {
+		char name[32], note[32];
+
+		g_snprintf(name, sizeof(name), "buddy%d", i % buddies);
+		g_snprintf(note, sizeof(note), "change %d", i);
+		buddy = (PurpleBlistNode *)purple_find_buddy(account, name);
+		purple_blist_node_set_string(buddy, "note", note);
+	}
+	journaled = g_timer_elapsed(timer, NULL) / changes;
+
+	/* Every change went to the journal, and none needed a full save */
+	fail_unless(g_file_get_contents(journal_filename, &contents, NULL, NULL), NULL);
+	for (i = 0, line = contents; (line = strchr(line, '\n')) != NULL; line++)
+		i++;
+	fail_unless(i == changes, NULL);
+	fail_unless(file_size(blist_filename) == blist_size, NULL);
+	g_free(contents);
+
+	/* A full save writes a tree the same size as the one just loaded */
+	node = purple_util_read_xml_from_file("blist.xml", "buddy list");
+	fail_unless(node != NULL, NULL);
+	g_timer_start(timer);
+	for (i = 0; i < 10; i++)
+		purple_util_write_xml_to_file("blist.xml", node);
+	rewritten = g_timer_elapsed(timer, NULL) / 10;
+	xmlnode_free(node);
+	g_timer_destroy(timer);
+
+	g_print("blist: %d buddies, %ld byte blist.xml: %.1f us per journaled "
+			"change, %.1f us per rewrite\n", buddies, (long)blist_size,
+			journaled * 1e6, rewritten * 1e6);
+}
+END_TEST
+
+Suite *
+blist_suite(void)
+{
+	Suite *s = suite_create("Buddy List");
+
+	TCase *tc = tcase_create("Journal");
+	tcase_add_checked_fixture(tc, blist_setup, blist_teardown);
+	/* The replayed journal goes away with a full save, five seconds later */
+	tcase_set_timeout(tc, 15);
+	tcase_add_test(tc, test_blist_journal_replay_stale);
+	tcase_add_test(tc, test_blist_journal_torn);
+	tcase_add_test(tc, test_blist_journal_truncated);
+	tcase_add_test(tc, test_blist_load_broken);
+	tcase_add_test(tc, test_blist_journal_append);
+	tcase_add_test(tc, test_blist_journal_benchmark);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,419 @@
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../dnsquery.h"
+#include "../dnsresolver.h"
+#include "../dnssrv.h"
+#include "../eventloop.h"
+
+/* The zone our stand-in nameserver answers from */
+static const struct {
+	const char *name;
+	guint16 type;
+	guint32 ttl;
+	const char *addr;    /* A and AAAA */
+	guint16 priority;    /* SRV */
+	guint16 port;        /* SRV */
+	const char *target;  /* SRV */
+} zone[] = {
+	{ "login.example.com", PURPLE_DNS_RR_A, 300, "192.0.2.1", 0, 0, NULL },
+	{ "login.example.com", PURPLE_DNS_RR_AAAA, 300, "2001:db8::1", 0, 0, NULL },
+	{ "volatile.example.com", PURPLE_DNS_RR_A, 0, "192.0.2.2", 0, 0, NULL },
+	{ "_xmpp-client._tcp.example.com", PURPLE_DNS_RR_SRV, 300, NULL, 10, 5222, "xmpp2.example.com" },
+	{ "_xmpp-client._tcp.example.com", PURPLE_DNS_RR_SRV, 300, NULL, 5, 5223, "xmpp1.example.com" },
+	{ NULL, 0, 0, NULL, 0, 0, NULL }
+};
+
+static int server_fd;
+static guint server_inpa;
+static int server_queries;
+static int pending;
+
+static guchar *
+server_put16(guchar *p, guint16 val)
+{
+	*p++ = val >> 8;
+	*p++ = val & 0xff;
+	return p;
+}
+
+static guchar *
+server_put32(guchar *p, guint32 val)
+{
+	p = server_put16(p, val >> 16);
+	return server_put16(p, val & 0xffff);
+}
+
+static guchar *
+server_put_name(guchar *p, const char *name)
+{
+	char **labels = g_strsplit(name, ".", -1);
+	int i;
+
+	for (i = 0; labels[i] != NULL; i++) {
+		*p++ = strlen(labels[i]);
+		memcpy(p, labels[i], strlen(labels[i]));
+		p += strlen(labels[i]);
+	}
+	*p++ = 0;
+	g_strfreev(labels);
+
+	return p;
+}
+
+static void
+server_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	guchar buf[512], out[512], *p, *rdlen;
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	GString *qname = g_string_new(NULL);
+	gboolean known = FALSE;
+	int len, pos = 12, ancount = 0, i;
+	guint16 qtype;
+
+	len = recvfrom(source, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+	if (len < 12)
+		return;
+	server_queries++;
+
+	while (buf[pos] != 0) {
+		if (qname->len > 0)
+			g_string_append_c(qname, '.');
+		g_string_append_len(qname, (char *)buf + pos + 1, buf[pos]);
+		pos += buf[pos] + 1;
+	}
+	pos++;
+	qtype = (buf[pos] << 8) | buf[pos + 1];
+	pos += 4;
+
+	/* Echo the question, and answer it pointing back at its name */
+	memcpy(out, buf, pos);
+	out[2] = 0x81;
+	out[3] = 0x80;
+	p = out + pos;
+
+	for (i = 0; zone[i].name != NULL; i++) {
+		if (strcmp(zone[i].name, qname->str) != 0)
+			continue;
+		known = TRUE;
+		if (zone[i].type != qtype)
+			continue;
+
+		p = server_put16(p, 0xc00c);
+		p = server_put16(p, qtype);
+		p = server_put16(p, 1);
+		p = server_put32(p, zone[i].ttl);
+		rdlen = p;
+		p += 2;
+		if (qtype == PURPLE_DNS_RR_A) {
+			inet_pton(AF_INET, zone[i].addr, p);
+			p += 4;
+		} else if (qtype == PURPLE_DNS_RR_AAAA) {
+			inet_pton(AF_INET6, zone[i].addr, p);
+			p += 16;
+		} else {
+			p = server_put16(p, zone[i].priority);
+			p = server_put16(p, 0);
+			p = server_put16(p, zone[i].port);
+			p = server_put_name(p, zone[i].target);
+		}
+		server_put16(rdlen, p - rdlen - 2);
+		ancount++;
+	}
+
+	out[6] = 0;
+	out[7] = ancount;
+	if (ancount == 0) {
+		/* NXDOMAIN or no data, with an SOA allowing a minute of caching */
+		if (!known)
+			out[3] |= 3;
+		out[9] = 1;
+		p = server_put16(p, 0xc00c);
+		p = server_put16(p, PURPLE_DNS_RR_SOA);
+		p = server_put16(p, 1);
+		p = server_put32(p, 3600);
+		p = server_put16(p, 22);
+		*p++ = 0;
+		*p++ = 0;
+		p = server_put32(p, 1);
+		p = server_put32(p, 3600);
+		p = server_put32(p, 600);
+		p = server_put32(p, 86400);
+		p = server_put32(p, 60);
+	}
+
+	sendto(source, out, p - out, 0, (struct sockaddr *)&from, fromlen);
+	g_string_free(qname, TRUE);
+}
+
+static void
+resolver_setup(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(server_fd, (struct sockaddr *)&sin, sizeof(sin));
+	getsockname(server_fd, (struct sockaddr *)&sin, &len);
+	server_inpa = purple_input_add(server_fd, PURPLE_INPUT_READ, server_cb, NULL);
+
+	purple_dnsresolver_set_nameserver("127.0.0.1", ntohs(sin.sin_port));
+	server_queries = 0;
+	pending = 0;
+}
+
+static void
+resolver_teardown(void)
+{
+	purple_dnsresolver_set_nameserver(NULL, 0);
+	purple_input_remove(server_inpa);
+	close(server_fd);
+}
+
+static void
+resolver_run(void)
+{
+	time_t give_up = time(NULL) + 10;
+
+	while (pending > 0 && time(NULL) < give_up)
+		g_main_context_iteration(NULL, TRUE);
+	fail_unless(pending == 0, NULL);
+}
+
+typedef struct {
+	gboolean called;
+	PurpleDnsResolverResult result;
+	int count;
+	guchar addr[16];
+} LookupResult;
+
+static void
+lookup_cb(PurpleDnsResolverResult result, GSList *records, gpointer data)
+{
+	LookupResult *res = data;
+
+	res->called = TRUE;
+	res->result = result;
+	res->count = g_slist_length(records);
+	if (records != NULL)
+		memcpy(res->addr, ((PurpleDnsRecord *)records->data)->addr, 16);
+	pending--;
+}
+
+static void
+lookup(const char *name, PurpleDnsRRType type, LookupResult *res)
+{
+	memset(res, 0, sizeof(LookupResult));
+	pending++;
+	purple_dnsresolver_query(name, type, lookup_cb, res);
+}
+
+START_TEST(test_resolver_shared)
+{
+	LookupResult res[20];
+	guchar addr[4] = { 192, 0, 2, 1 };
+	int i;
+
+	fail_unless(purple_dnsresolver_can_resolve("login.example.com"), NULL);
+
+	/* Everyone reconnecting at once only costs one query */
+	for (i = 0; i < 20; i++)
+		lookup("login.example.com", PURPLE_DNS_RR_A, &res[i]);
+	resolver_run();
+
+	fail_unless(server_queries == 1, NULL);
+	for (i = 0; i < 20; i++) {
+		fail_unless(res[i].result == PURPLE_DNS_RESOLVER_OK, NULL);
+		fail_unless(res[i].count == 1, NULL);
+		fail_unless(memcmp(res[i].addr, addr, 4) == 0, NULL);
+	}
+
+	/* And those coming later are answered from the cache */
+	lookup("Login.Example.com.", PURPLE_DNS_RR_A, &res[0]);
+	fail_if(res[0].called, NULL);
+	resolver_run();
+	fail_unless(server_queries == 1, NULL);
+	fail_unless(res[0].result == PURPLE_DNS_RESOLVER_OK, NULL);
+	fail_unless(memcmp(res[0].addr, addr, 4) == 0, NULL);
+}
+END_TEST
+
+START_TEST(test_resolver_negative)
+{
+	LookupResult res;
+
+	lookup("missing.example.com", PURPLE_DNS_RR_A, &res);
+	resolver_run();
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_NOT_FOUND, NULL);
+
+	lookup("missing.example.com", PURPLE_DNS_RR_A, &res);
+	resolver_run();
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_NOT_FOUND, NULL);
+	fail_unless(server_queries == 1, NULL);
+
+	/* A name with no records of the type asked for is cached the same way */
+	lookup("volatile.example.com", PURPLE_DNS_RR_AAAA, &res);
+	resolver_run();
+	lookup("volatile.example.com", PURPLE_DNS_RR_AAAA, &res);
+	resolver_run();
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_NOT_FOUND, NULL);
+	fail_unless(server_queries == 2, NULL);
+}
+END_TEST
+
+START_TEST(test_resolver_ttl_zero)
+{
+	LookupResult res;
+
+	lookup("volatile.example.com", PURPLE_DNS_RR_A, &res);
+	resolver_run();
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_OK, NULL);
+
+	lookup("volatile.example.com", PURPLE_DNS_RR_A, &res);
+	resolver_run();
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_OK, NULL);
+	fail_unless(server_queries == 2, NULL);
+}
+END_TEST
+
+START_TEST(test_resolver_cancel)
+{
+	PurpleDnsResolverQuery *query;
+	LookupResult res, cancelled;
+
+	memset(&cancelled, 0, sizeof(cancelled));
+	query = purple_dnsresolver_query("login.example.com", PURPLE_DNS_RR_A,
+			lookup_cb, &cancelled);
+	lookup("login.example.com", PURPLE_DNS_RR_A, &res);
+	purple_dnsresolver_cancel(query);
+	resolver_run();
+
+	fail_unless(res.result == PURPLE_DNS_RESOLVER_OK, NULL);
+	fail_if(cancelled.called, NULL);
+}
+END_TEST
+
+static void
+srv_cb(PurpleSrvResponse *resp, int results, gpointer data)
+{
+	fail_unless(results == 2, NULL);
+	assert_string_equal("xmpp1.example.com", resp[0].hostname);
+	fail_unless(resp[0].port == 5223, NULL);
+	assert_string_equal("xmpp2.example.com", resp[1].hostname);
+	fail_unless(resp[1].pref == 10, NULL);
+	g_free(resp);
+	pending--;
+}
+
+START_TEST(test_resolver_srv)
+{
+	pending++;
+	fail_unless(purple_srv_resolve("xmpp-client", "tcp", "example.com",
+				srv_cb, NULL) != NULL, NULL);
+	resolver_run();
+	fail_unless(server_queries == 1, NULL);
+}
+END_TEST
+
+static void
+dnsquery_cb(GSList *hosts, gpointer data, const char *error_message)
+{
+	struct sockaddr_in *sin;
+
+	fail_unless(error_message == NULL, NULL);
+	fail_unless(g_slist_length(hosts) == 4, NULL);
+
+	/* The A record comes before the AAAA one */
+	fail_unless(GPOINTER_TO_SIZE(hosts->data) == sizeof(struct sockaddr_in), NULL);
+	sin = hosts->next->data;
+	fail_unless(sin->sin_family == AF_INET, NULL);
+	fail_unless(ntohs(sin->sin_port) == 5222, NULL);
+	fail_unless(sin->sin_addr.s_addr == inet_addr("192.0.2.1"), NULL);
+	fail_unless(((struct sockaddr *)hosts->next->next->next->data)->sa_family == AF_INET6, NULL);
+
+	while (hosts != NULL) {
+		hosts = g_slist_delete_link(hosts, hosts);
+		g_free(hosts->data);
+		hosts = g_slist_delete_link(hosts, hosts);
+	}
+	pending--;
+}
+
+START_TEST(test_resolver_dnsquery)
+{
+	pending++;
+	fail_unless(purple_dnsquery_a("login.example.com", 5222,
+				dnsquery_cb, NULL) != NULL, NULL);
+	resolver_run();
+	fail_unless(server_queries == 2, NULL);
+}
+END_TEST
+
+static gboolean
+ui_resolve_host(PurpleDnsQueryData *query_data, PurpleDnsQueryResolvedCallback resolved_cb,
+		PurpleDnsQueryFailedCallback failed_cb)
+{
+	failed_cb(query_data, "Resolved by the UI");
+	return TRUE;
+}
+
+static PurpleDnsQueryUiOps ui_ops = {
+	ui_resolve_host,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void
+ui_dnsquery_cb(GSList *hosts, gpointer data, const char *error_message)
+{
+	assert_string_equal("Resolved by the UI", error_message);
+	pending--;
+}
+
+START_TEST(test_resolver_dnsquery_ui)
+{
+	/* A UI with its own resolver keeps it */
+	purple_dnsquery_set_ui_ops(&ui_ops);
+	pending++;
+	fail_unless(purple_dnsquery_a("login.example.com", 5222,
+				ui_dnsquery_cb, NULL) != NULL, NULL);
+	resolver_run();
+	purple_dnsquery_set_ui_ops(NULL);
+	fail_unless(server_queries == 0, NULL);
+}
+END_TEST
+
+Suite *
+dnsresolver_suite(void)
+{
+	Suite *s = suite_create("DNS Resolver");
+
+	TCase *tc = tcase_create("Resolver");
+	tcase_add_checked_fixture(tc, resolver_setup, resolver_teardown);
+	tcase_add_test(tc, test_resolver_shared);
+	tcase_add_test(tc, test_resolver_negative);
+	tcase_add_test(tc, test_resolver_ttl_zero);
+	tcase_add_test(tc, test_resolver_cancel);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Callers");
+	tcase_add_checked_fixture(tc, resolver_setup, resolver_teardown);
+	tcase_add_test(tc, test_resolver_srv);
+	tcase_add_test(tc, test_resolver_dnsquery);
+	tcase_add_test(tc, test_resolver_dnsquery_ui);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
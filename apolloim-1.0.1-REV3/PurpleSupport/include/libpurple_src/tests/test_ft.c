@@ -0,0 +1,357 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../eventloop.h"
+#include "../ft.h"
+
+/* Bigger than the read-ahead ring, so that it wraps around */
+#define FILE_SIZE (3 * 1024 * 1024 + 17)
+
+static PurpleAccount *account;
+static char *filename;
+static char *received_filename;
+static guchar *contents;
+
+static int fds[2];
+static guint reader;
+static guint writer;
+static gsize written;
+static GString *received;
+static int progress_updates;
+static gboolean done_announced;
+static gboolean done_on_disk;
+
+static int acks;
+static int null_acks;
+static gboolean ack_mismatch;
+
+static void
+ft_setup(void)
+{
+	GError *error = NULL;
+	int fd, i;
+
+	/* The UI normally creates the buddy list; errors look the sender up in it */
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+
+	account = purple_account_new("me@example.com", PURPLE_CHECK_PRPL_ID);
+
+	contents = g_malloc(FILE_SIZE);
+	for (i = 0; i < FILE_SIZE; i++)
+		contents[i] = g_random_int_range(0, 256);
+
+	fd = g_file_open_tmp("purple-ft-XXXXXX", &filename, &error);
+	fail_unless(fd >= 0, NULL);
+	fail_unless(write(fd, contents, FILE_SIZE) == FILE_SIZE, NULL);
+	close(fd);
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, NULL);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	received = g_string_new(NULL);
+	received_filename = g_strdup_printf("%s.received", filename);
+	written = 0;
+	progress_updates = 0;
+	done_announced = done_on_disk = FALSE;
+	acks = null_acks = 0;
+	ack_mismatch = FALSE;
+}
+
+static void
+ft_teardown(void)
+{
+	if (reader)
+		purple_input_remove(reader);
+	reader = 0;
+	if (writer)
+		purple_input_remove(writer);
+	writer = 0;
+	close(fds[1]);
+
+	g_string_free(received, TRUE);
+	unlink(received_filename);
+	g_free(received_filename);
+	unlink(filename);
+	g_free(filename);
+	g_free(contents);
+	purple_account_destroy(account);
+}
+
+static void
+ft_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	char buf[8192];
+	int len;
+
+	while ((len = read(source, buf, sizeof(buf))) > 0)
+		g_string_append_len(received, buf, len);
+}
+
+static void
+ft_ack(PurpleXfer *xfer, const guchar *buffer, size_t size)
+{
+	size_t offset = purple_xfer_get_bytes_sent(xfer) - size;
+
+	acks++;
+	if (buffer == NULL)
+		null_acks++;
+	else if (memcmp(buffer, contents + offset, size) != 0)
+		ack_mismatch = TRUE;
+}
+
+/* Writes a little at a time, like a prpl with small frames would */
+static gssize
+ft_write(const guchar *buffer, size_t size, PurpleXfer *xfer)
+{
+	gssize r = write(xfer->fd, buffer, MIN(size, 1000));
+
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	if (r > 0 && (purple_xfer_get_bytes_sent(xfer) + r) >= purple_xfer_get_size(xfer))
+		purple_xfer_set_completed(xfer, TRUE);
+
+	return r;
+}
+
+static void
+ft_send(gboolean framed)
+{
+	PurpleXfer *xfer = purple_xfer_new(account, PURPLE_XFER_SEND, "bob@example.com");
+	GTimer *timer = g_timer_new();
+
+	purple_xfer_set_local_filename(xfer, filename);
+	purple_xfer_set_size(xfer, FILE_SIZE);
+	purple_xfer_set_ack_fnc(xfer, ft_ack);
+	if (framed)
+		purple_xfer_set_write_fnc(xfer, ft_write);
+
+	/* Keep it around after the transfer ends */
+	purple_xfer_ref(xfer);
+
+	reader = purple_input_add(fds[1], PURPLE_INPUT_READ, ft_read_cb, NULL);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	while (received->len < FILE_SIZE && g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	fail_unless(purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_DONE, NULL);
+	fail_unless(purple_xfer_get_bytes_sent(xfer) == FILE_SIZE, NULL);
+	fail_unless(received->len == FILE_SIZE, NULL);
+	fail_unless(memcmp(received->str, contents, FILE_SIZE) == 0, NULL);
+	fail_unless(acks > 0, NULL);
+	fail_if(ack_mismatch, NULL);
+
+	purple_xfer_unref(xfer);
+}
+
+static void
+ft_write_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	int len;
+
+	while (written < FILE_SIZE &&
+			(len = write(source, contents + written, FILE_SIZE - written)) > 0)
+		written += len;
+
+	if (written == FILE_SIZE) {
+		purple_input_remove(writer);
+		writer = 0;
+	}
+}
+
+/* Hands over a little at a time, like a prpl with small frames would */
+static gssize
+ft_read(guchar **buffer, PurpleXfer *xfer)
+{
+	gssize r;
+
+	*buffer = g_malloc(1000);
+	r = read(xfer->fd, *buffer, 1000);
+
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	if (r > 0 && (purple_xfer_get_bytes_sent(xfer) + r) >= purple_xfer_get_size(xfer))
+		purple_xfer_set_completed(xfer, TRUE);
+
+	return r;
+}
+
+static void
+ft_update_progress(PurpleXfer *xfer, double percent)
+{
+	gchar *data;
+	gsize len;
+
+	progress_updates++;
+
+	/* By the time the UI hears it's done, the file has to be complete */
+	if (purple_xfer_is_completed(xfer) && !done_announced) {
+		done_announced = TRUE;
+		if (g_file_get_contents(received_filename, &data, &len, NULL)) {
+			done_on_disk = (len == FILE_SIZE && memcmp(data, contents, FILE_SIZE) == 0);
+			g_free(data);
+		}
+	}
+}
+
+static PurpleXferUiOps ui_ops = {
+	NULL,
+	NULL,
+	NULL,
+	ft_update_progress,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void
+ft_receive(gboolean framed)
+{
+	PurpleXfer *xfer;
+	GTimer *timer = g_timer_new();
+	gchar *data;
+	gsize len;
+
+	purple_xfers_set_ui_ops(&ui_ops);
+	xfer = purple_xfer_new(account, PURPLE_XFER_RECEIVE, "bob@example.com");
+	purple_xfers_set_ui_ops(NULL);
+
+	purple_xfer_set_local_filename(xfer, received_filename);
+	purple_xfer_set_size(xfer, FILE_SIZE);
+	purple_xfer_set_ack_fnc(xfer, ft_ack);
+	if (framed)
+		purple_xfer_set_read_fnc(xfer, ft_read);
+
+	/* Keep it around after the transfer ends */
+	purple_xfer_ref(xfer);
+
+	writer = purple_input_add(fds[1], PURPLE_INPUT_WRITE, ft_write_cb, NULL);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	while (purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_STARTED &&
+			g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	fail_unless(purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_DONE, NULL);
+	fail_unless(purple_xfer_get_bytes_sent(xfer) == FILE_SIZE, NULL);
+	fail_unless(purple_xfer_get_throughput(xfer) > 0, NULL);
+	fail_unless(purple_xfer_get_stall_time(xfer) >= 0, NULL);
+	fail_unless(acks > 0, NULL);
+	fail_unless(null_acks == 0, NULL);
+	fail_if(ack_mismatch, NULL);
+	fail_unless(done_announced, NULL);
+	fail_unless(done_on_disk, NULL);
+
+	/* Everything made it to the disk by the time the transfer ended */
+	fail_unless(g_file_get_contents(received_filename, &data, &len, NULL), NULL);
+	fail_unless(len == FILE_SIZE, NULL);
+	fail_unless(memcmp(data, contents, FILE_SIZE) == 0, NULL);
+	g_free(data);
+
+	purple_xfer_unref(xfer);
+}
+
+START_TEST(test_ft_send_raw)
+{
+	ft_send(FALSE);
+
+#if defined(__linux__) || defined(__APPLE__)
+	/* None of it needed copying */
+	fail_unless(null_acks == acks, NULL);
+#endif
+}
+END_TEST
+
+START_TEST(test_ft_send_framed)
+{
+	ft_send(TRUE);
+
+	fail_unless(null_acks == 0, NULL);
+	fail_unless(acks >= FILE_SIZE / 1000, NULL);
+}
+END_TEST
+
+START_TEST(test_ft_receive_raw)
+{
+	ft_receive(FALSE);
+}
+END_TEST
+
+START_TEST(test_ft_receive_framed)
+{
+	ft_receive(TRUE);
+
+	/* Not one per frame */
+	fail_unless(acks >= FILE_SIZE / 1000, NULL);
+	fail_unless(progress_updates < acks / 10, NULL);
+}
+END_TEST
+
+#ifdef __linux__
+START_TEST(test_ft_receive_write_error)
+{
+	PurpleXfer *xfer;
+	GTimer *timer = g_timer_new();
+
+	purple_xfers_set_ui_ops(&ui_ops);
+	xfer = purple_xfer_new(account, PURPLE_XFER_RECEIVE, "bob@example.com");
+	purple_xfers_set_ui_ops(NULL);
+
+	/* Small enough that the disk only fills up at the final flush */
+	purple_xfer_set_local_filename(xfer, "/dev/full");
+	purple_xfer_set_size(xfer, 1000);
+	purple_xfer_ref(xfer);
+
+	writer = purple_input_add(fds[1], PURPLE_INPUT_WRITE, ft_write_cb, NULL);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	while (purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_STARTED &&
+			g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	/* Cancelled, without ever saying it was done */
+	fail_unless(purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_CANCEL_LOCAL, NULL);
+	fail_if(done_announced, NULL);
+
+	purple_xfer_unref(xfer);
+}
+END_TEST
+#endif
+
+Suite *
+ft_suite(void)
+{
+	Suite *s = suite_create("File Transfer");
+
+	TCase *tc = tcase_create("Sending");
+	tcase_add_checked_fixture(tc, ft_setup, ft_teardown);
+	tcase_add_test(tc, test_ft_send_raw);
+	tcase_add_test(tc, test_ft_send_framed);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Receiving");
+	tcase_add_checked_fixture(tc, ft_setup, ft_teardown);
+	tcase_add_test(tc, test_ft_receive_raw);
+	tcase_add_test(tc, test_ft_receive_framed);
+#ifdef __linux__
+	tcase_add_test(tc, test_ft_receive_write_error);
+#endif
+	suite_add_tcase(s, tc);
+
+	return s;
+}
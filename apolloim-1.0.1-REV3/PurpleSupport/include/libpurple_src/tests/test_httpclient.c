@@ -0,0 +1,312 @@
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../eventloop.h"
+#include "../httpclient.h"
+#include "../util.h"
+
+/*
+ * A stand-in web server on the loopback.  The path asks for the
+ * response:
+ *   /len/<text>    <text>, with a Content-Length
+ *   /chunked       "Hello, world!" in chunks, with a trailer
+ *   /close         "bye", then the server hangs up without saying so
+ *   /redirect      a redirect to /len/moved
+ *   /hang          nothing at all
+ */
+static int listen_fd;
+static guint listen_inpa;
+static int port;
+static int connections;
+static GSList *clients;
+
+typedef struct
+{
+	int fd;
+	guint inpa;
+	GString *in;
+} HttpClient;
+
+/* What the fetches came back with */
+static int fetched;
+static GSList *bodies;
+static char *fetch_error;
+
+static void
+http_client_free(HttpClient *client)
+{
+	clients = g_slist_remove(clients, client);
+	purple_input_remove(client->inpa);
+	close(client->fd);
+	g_string_free(client->in, TRUE);
+	g_free(client);
+}
+
+static void
+http_respond(HttpClient *client, const char *path)
+{
+	char *response;
+
+	if (strncmp(path, "/len/", 5) == 0)
+		response = g_strdup_printf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s",
+				(int)strlen(path + 5), path + 5);
+	else if (strcmp(path, "/chunked") == 0)
+		response = g_strdup("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+				"5\r\nHello\r\n" "8;ext=1\r\n, world!\r\n" "0\r\nX-Trailer: yes\r\n\r\n");
+	else if (strcmp(path, "/close") == 0)
+		response = g_strdup("HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nbye");
+	else if (strcmp(path, "/redirect") == 0)
+		response = g_strdup_printf("HTTP/1.1 302 Found\r\n"
+				"Location: http://127.0.0.1:%d/len/moved\r\nContent-Length: 0\r\n\r\n", port);
+	else
+		return;
+
+	write(client->fd, response, strlen(response));
+	g_free(response);
+
+	if (strcmp(path, "/close") == 0)
+		http_client_free(client);
+}
+
+static void
+http_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	HttpClient *client = data;
+	char buf[1024], path[256];
+	char *end;
+	int len;
+
+	len = read(source, buf, sizeof(buf));
+	if (len <= 0) {
+		http_client_free(client);
+		return;
+	}
+	g_string_append_len(client->in, buf, len);
+
+	/* Answer every whole request, even pipelined ones */
+	while ((end = strstr(client->in->str, "\r\n\r\n")) != NULL) {
+		gboolean gone = FALSE;
+
+		if (sscanf(client->in->str, "GET %255s", path) == 1) {
+			gone = (strcmp(path, "/close") == 0);
+			http_respond(client, path);
+		}
+		if (gone)
+			return;
+
+		g_string_erase(client->in, 0, end + 4 - client->in->str);
+	}
+}
+
+static void
+http_accept_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	HttpClient *client = g_new0(HttpClient, 1);
+
+	client->fd = accept(source, NULL, NULL);
+	client->in = g_string_new(NULL);
+	client->inpa = purple_input_add(client->fd, PURPLE_INPUT_READ, http_read_cb, client);
+	clients = g_slist_prepend(clients, client);
+	connections++;
+}
+
+static void
+httpclient_setup(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+	fail_unless(bind(listen_fd, (struct sockaddr *)&sin, sizeof(sin)) == 0, NULL);
+	fail_unless(listen(listen_fd, 16) == 0, NULL);
+	getsockname(listen_fd, (struct sockaddr *)&sin, &len);
+	port = ntohs(sin.sin_port);
+	listen_inpa = purple_input_add(listen_fd, PURPLE_INPUT_READ, http_accept_cb, NULL);
+
+	connections = 0;
+	fetched = 0;
+	bodies = NULL;
+	fetch_error = NULL;
+}
+
+static void
+httpclient_teardown(void)
+{
+	/* Start over with no connections */
+	purple_httpclient_uninit();
+	purple_httpclient_init();
+
+	while (clients != NULL)
+		http_client_free(clients->data);
+	purple_input_remove(listen_inpa);
+	close(listen_fd);
+
+	while (bodies != NULL) {
+		g_free(bodies->data);
+		bodies = g_slist_delete_link(bodies, bodies);
+	}
+	g_free(fetch_error);
+}
+
+static void
+httpclient_fetch_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
+		const gchar *url_text, gsize len, const gchar *error_message)
+{
+	fetched++;
+
+	if (url_text != NULL) {
+		fail_unless(url_text[len] == '\0', NULL);
+		bodies = g_slist_append(bodies, g_strdup(url_text));
+	} else {
+		g_free(fetch_error);
+		fetch_error = g_strdup(error_message);
+	}
+}
+
+static PurpleUtilFetchUrlData *
+httpclient_fetch(const char *path)
+{
+	char *url = g_strdup_printf("http://127.0.0.1:%d%s", port, path);
+	PurpleUtilFetchUrlData *url_data;
+
+	url_data = purple_util_fetch_url(url, FALSE, NULL, TRUE, httpclient_fetch_cb, NULL);
+	g_free(url);
+
+	return url_data;
+}
+
+static void
+httpclient_wait(int count)
+{
+	GTimer *timer = g_timer_new();
+
+	while (fetched < count && g_timer_elapsed(timer, NULL) < 5)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	fail_unless(fetched == count, NULL);
+}
+
+START_TEST(test_httpclient_keep_alive)
+{
+	httpclient_fetch("/len/one");
+	httpclient_wait(1);
+	httpclient_fetch("/len/two");
+	httpclient_wait(2);
+
+	fail_unless(fetch_error == NULL, NULL);
+	assert_string_equal("one", bodies->data);
+	assert_string_equal("two", bodies->next->data);
+	fail_unless(connections == 1, NULL);
+}
+END_TEST
+
+START_TEST(test_httpclient_pipelining)
+{
+	char path[32];
+	GSList *l;
+	int i;
+
+	httpclient_fetch("/len/first");
+	httpclient_wait(1);
+
+	for (i = 0; i < 12; i++) {
+		g_snprintf(path, sizeof(path), "/len/%d", i);
+		httpclient_fetch(path);
+	}
+	httpclient_wait(13);
+
+	/* Never more connections than the pool allows */
+	fail_unless(fetch_error == NULL, NULL);
+	fail_unless(connections <= 4, NULL);
+
+	/* Everyone got their own answer */
+	for (i = 0; i < 12; i++) {
+		g_snprintf(path, sizeof(path), "%d", i);
+		for (l = bodies; l != NULL; l = l->next)
+			if (strcmp(l->data, path) == 0)
+				break;
+		fail_unless(l != NULL, NULL);
+	}
+}
+END_TEST
+
+START_TEST(test_httpclient_chunked)
+{
+	httpclient_fetch("/chunked");
+	httpclient_wait(1);
+
+	fail_unless(fetch_error == NULL, NULL);
+	assert_string_equal("Hello, world!", bodies->data);
+
+	/* The connection survives a chunked response */
+	httpclient_fetch("/len/again");
+	httpclient_wait(2);
+	fail_unless(connections == 1, NULL);
+}
+END_TEST
+
+START_TEST(test_httpclient_server_closed)
+{
+	httpclient_fetch("/close");
+	httpclient_wait(1);
+	httpclient_fetch("/len/after");
+	httpclient_wait(2);
+
+	fail_unless(fetch_error == NULL, NULL);
+	assert_string_equal("bye", bodies->data);
+	assert_string_equal("after", bodies->next->data);
+	fail_unless(connections == 2, NULL);
+}
+END_TEST
+
+START_TEST(test_httpclient_redirect)
+{
+	httpclient_fetch("/redirect");
+	httpclient_wait(1);
+
+	fail_unless(fetch_error == NULL, NULL);
+	assert_string_equal("moved", bodies->data);
+}
+END_TEST
+
+START_TEST(test_httpclient_cancel)
+{
+	GTimer *timer = g_timer_new();
+
+	purple_util_fetch_url_cancel(httpclient_fetch("/hang"));
+	purple_util_fetch_url_cancel(httpclient_fetch("/len/never"));
+
+	while (g_timer_elapsed(timer, NULL) < 0.2)
+		g_main_context_iteration(NULL, FALSE);
+	g_timer_destroy(timer);
+
+	fail_unless(fetched == 0, NULL);
+}
+END_TEST
+
+Suite *
+httpclient_suite(void)
+{
+	Suite *s = suite_create("HTTP Client");
+
+	TCase *tc = tcase_create("Fetching");
+	tcase_add_checked_fixture(tc, httpclient_setup, httpclient_teardown);
+	tcase_add_test(tc, test_httpclient_keep_alive);
+	tcase_add_test(tc, test_httpclient_pipelining);
+	tcase_add_test(tc, test_httpclient_chunked);
+	tcase_add_test(tc, test_httpclient_server_closed);
+	tcase_add_test(tc, test_httpclient_redirect);
+	tcase_add_test(tc, test_httpclient_cancel);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
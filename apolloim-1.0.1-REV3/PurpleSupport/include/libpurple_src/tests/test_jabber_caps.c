@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../xmlnode.h"
+#include "../protocols/jabber/buddy.h"
+#include "../protocols/jabber/caps.h"
+#include "../protocols/jabber/jabber.h"
+
+/* XEP-0115, section 5.2 */
+#define SIMPLE_QUERY \
+	"<query xmlns='http://jabber.org/protocol/disco#info'>" \
+	"<identity category='client' name='Exodus 0.9.1' type='pc'/>" \
+	"<feature var='http://jabber.org/protocol/caps'/>" \
+	"<feature var='http://jabber.org/protocol/disco#info'/>" \
+	"<feature var='http://jabber.org/protocol/disco#items'/>" \
+	"<feature var='http://jabber.org/protocol/muc'/>" \
+	"</query>"
+#define SIMPLE_VER "QgayPKawpkPSDYmwT/WM94uAlu0="
+
+/* XEP-0115, section 5.3 */
+#define COMPLEX_QUERY \
+	"<query xmlns='http://jabber.org/protocol/disco#info'>" \
+	"<identity xml:lang='en' category='client' name='Psi 0.11' type='pc'/>" \
+	"<identity xml:lang='el' category='client' name='\xce\xa8 0.11' type='pc'/>" \
+	"<feature var='http://jabber.org/protocol/caps'/>" \
+	"<feature var='http://jabber.org/protocol/disco#info'/>" \
+	"<feature var='http://jabber.org/protocol/disco#items'/>" \
+	"<feature var='http://jabber.org/protocol/muc'/>" \
+	"<x xmlns='jabber:x:data' type='result'>" \
+	"<field var='FORM_TYPE' type='hidden'><value>urn:xmpp:dataforms:softwareinfo</value></field>" \
+	"<field var='ip_version'><value>ipv4</value><value>ipv6</value></field>" \
+	"<field var='os'><value>Mac</value></field>" \
+	"<field var='os_version'><value>10.5.1</value></field>" \
+	"<field var='software'><value>Psi</value></field>" \
+	"<field var='software_version'><value>0.11</value></field>" \
+	"</x>" \
+	"</query>"
+#define COMPLEX_VER "q07IKJEyjvHSyhy//CH0CxmKi8w="
+
+static JabberStream *js;
+
+static void
+caps_setup(void)
+{
+	js = g_new0(JabberStream, 1);
+	js->gc = g_new0(PurpleConnection, 1);
+	js->buddies = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)jabber_buddy_free);
+	js->disco_callbacks = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+}
+
+static void
+caps_teardown(void)
+{
+	jabber_caps_free(js);
+	jabber_caps_uninit();
+	g_hash_table_destroy(js->disco_callbacks);
+	g_hash_table_destroy(js->buddies);
+	g_free(js->gc);
+	g_free(js);
+	js = NULL;
+}
+
+static char *
+caps_hash(const char *txt)
+{
+	xmlnode *query = xmlnode_from_str(txt, -1);
+	char *hash = jabber_caps_calculate_hash(query);
+	xmlnode_free(query);
+	return hash;
+}
+
+static JabberBuddyResource *
+caps_client(int i, char **who)
+{
+	JabberBuddy *jb;
+
+	*who = g_strdup_printf("user%d@example.com/home", i);
+	jb = jabber_buddy_find(js, *who, TRUE);
+	return jabber_buddy_track_resource(jb, "home", 0,
+			JABBER_BUDDY_STATE_ONLINE, NULL);
+}
+
+START_TEST(test_caps_hash)
+{
+	char *hash;
+
+	hash = caps_hash(SIMPLE_QUERY);
+	assert_string_equal_free(SIMPLE_VER, hash);
+
+	hash = caps_hash(COMPLEX_QUERY);
+	assert_string_equal_free(COMPLEX_VER, hash);
+
+	/* Duplicate features can't be told apart from another feature set */
+	hash = caps_hash("<query xmlns='http://jabber.org/protocol/disco#info'>"
+			"<feature var='urn:xmpp:ping'/><feature var='urn:xmpp:ping'/>"
+			"</query>");
+	fail_unless(hash == NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_caps_own_hash)
+{
+	xmlnode *query = xmlnode_new("query");
+	char *hash;
+
+	jabber_caps_add_own_features(query);
+	hash = jabber_caps_calculate_hash(query);
+	fail_unless(hash != NULL, NULL);
+	assert_string_equal_free(jabber_caps_get_own_hash(), hash);
+	xmlnode_free(query);
+}
+END_TEST
+
+/* The server hands us presence from many clients with the same caps */
+START_TEST(test_caps_shared)
+{
+	JabberBuddyResource *jbr[50];
+	char *who[50];
+	JabberCapsInfo *info;
+	xmlnode *query, *c;
+	int i, queries = 0;
+
+	fail_unless(jabber_caps_lookup(SIMPLE_VER) == NULL, NULL);
+
+	for(i = 0; i < 50; i++) {
+		jbr[i] = caps_client(i, &who[i]);
+		if(jabber_caps_wait(js, SIMPLE_VER, who[i]))
+			queries++;
+	}
+	fail_unless(queries == 1, NULL);
+	fail_unless(jabber_caps_is_pending(js, who[49]), NULL);
+
+	query = xmlnode_from_str(SIMPLE_QUERY, -1);
+	jabber_caps_received(js, SIMPLE_VER, query);
+	xmlnode_free(query);
+
+	fail_unless(!jabber_caps_is_pending(js, who[0]), NULL);
+	info = jabber_caps_lookup(SIMPLE_VER);
+	fail_unless(info != NULL, NULL);
+	for(i = 0; i < 50; i++) {
+		fail_unless(jbr[i]->caps == info, NULL);
+		fail_unless(jbr[i]->capabilities & JABBER_CAP_RETRIEVED, NULL);
+		fail_unless(jabber_resource_has_feature(jbr[i],
+					"http://jabber.org/protocol/muc"), NULL);
+		fail_if(jabber_resource_has_feature(jbr[i], "urn:xmpp:ping"), NULL);
+		g_free(who[i]);
+	}
+
+	/* Later clients are answered from the cache without a query */
+	jbr[0] = caps_client(50, &who[0]);
+	c = xmlnode_from_str("<c xmlns='http://jabber.org/protocol/caps' "
+			"hash='sha-1' node='http://code.google.com/p/exodus' "
+			"ver='" SIMPLE_VER "'/>", -1);
+	jabber_caps_presence(js, jbr[0], who[0], c);
+	fail_unless(jbr[0]->caps == info, NULL);
+	fail_unless(!jabber_caps_is_pending(js, who[0]), NULL);
+	xmlnode_free(c);
+	g_free(who[0]);
+}
+END_TEST
+
+START_TEST(test_caps_mismatch)
+{
+	JabberBuddyResource *jbr;
+	xmlnode *query;
+	char *who;
+
+	jbr = caps_client(0, &who);
+	fail_unless(jabber_caps_wait(js, COMPLEX_VER, who), NULL);
+
+	/* An answer that doesn't hash to the ver it claims is not cached */
+	query = xmlnode_from_str(SIMPLE_QUERY, -1);
+	jabber_caps_received(js, COMPLEX_VER, query);
+	xmlnode_free(query);
+
+	fail_unless(jabber_caps_lookup(COMPLEX_VER) == NULL, NULL);
+	fail_unless(jbr->caps == NULL, NULL);
+	fail_unless(!jabber_caps_is_pending(js, who), NULL);
+	g_free(who);
+}
+END_TEST
+
+Suite *
+jabber_caps_suite(void)
+{
+	Suite *s = suite_create("Jabber Entity Capabilities");
+
+	TCase *tc = tcase_create("Verification strings");
+	tcase_add_test(tc, test_caps_hash);
+	tcase_add_test(tc, test_caps_own_hash);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Cache");
+	tcase_add_checked_fixture(tc, caps_setup, caps_teardown);
+	tcase_add_test(tc, test_caps_shared);
+	tcase_add_test(tc, test_caps_mismatch);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <zlib.h>
+
+#include "tests.h"
+#include "../signals.h"
+#include "../xmlnode.h"
+#include "../protocols/jabber/jabber.h"
+#include "../protocols/jabber/compress.h"
+#include "../protocols/jabber/parser.h"
+
+static JabberStream *js;
+static z_stream inflater;
+
+static void
+compress_setup(void)
+{
+	xmlnode *compressed;
+
+	js = g_new0(JabberStream, 1);
+	js->fd = -1;
+
+	compressed = xmlnode_from_str("<compressed xmlns='http://jabber.org/protocol/compress'/>", -1);
+	jabber_compress_parse(js, compressed);
+	xmlnode_free(compressed);
+
+	memset(&inflater, 0, sizeof(inflater));
+	inflateInit(&inflater);
+}
+
+static void
+compress_teardown(void)
+{
+	inflateEnd(&inflater);
+	jabber_compress_free(js);
+	g_free(js);
+	js = NULL;
+}
+
+/* Inflate what jabber_compress_deflate() produced, like the server would */
+static char *
+compress_roundtrip(const char *data)
+{
+	const char *out;
+	int out_len, ret;
+	char buf[4096];
+	GString *in;
+
+	out = jabber_compress_deflate(js, data, strlen(data), &out_len);
+	fail_unless(out_len > 0, NULL);
+
+	in = g_string_new(NULL);
+	inflater.next_in = (Bytef *)out;
+	inflater.avail_in = out_len;
+	do {
+		inflater.next_out = (Bytef *)buf;
+		inflater.avail_out = sizeof(buf);
+		ret = inflate(&inflater, Z_SYNC_FLUSH);
+		fail_unless(ret == Z_OK || ret == Z_BUF_ERROR, NULL);
+		g_string_append_len(in, buf, sizeof(buf) - inflater.avail_out);
+	} while (inflater.avail_in > 0 || inflater.avail_out == 0);
+
+	return g_string_free(in, FALSE);
+}
+
+START_TEST(test_compress_enabled)
+{
+	fail_unless(js->zlib_out != NULL, NULL);
+	fail_unless(js->zlib_in != NULL, NULL);
+	fail_unless(js->reinit, NULL);
+}
+END_TEST
+
+START_TEST(test_compress_deflate)
+{
+	const char *stanza = "<presence from='a@example.com/Home'><show>away</show></presence>";
+	GString *big;
+	int i;
+
+	/* Each write has to be complete in itself */
+	assert_string_equal_free(stanza, compress_roundtrip(stanza));
+	assert_string_equal_free(stanza, compress_roundtrip(stanza));
+
+	/* Bigger than the buffer we start out with */
+	big = g_string_new(NULL);
+	for (i = 0; i < 2000; i++)
+		g_string_append_printf(big, "<item jid='buddy%d@example.com'/>", i);
+	assert_string_equal_free(big->str, compress_roundtrip(big->str));
+	g_string_free(big, TRUE);
+}
+END_TEST
+
+static PurplePlugin compress_plugin;
+static GString *received;
+
+/* Keeps the packets away from the rest of the prpl */
+static void
+compress_receiving_cb(PurpleConnection *gc, xmlnode **packet, gpointer data)
+{
+	g_string_append_printf(received, "%s;", (*packet)->name);
+	*packet = NULL;
+}
+
+START_TEST(test_compress_stream_end)
+{
+	const char *stream = "<stream:stream xmlns='jabber:client' "
+			"xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+			"<presence/><message/>";
+	z_stream deflater;
+	char buf[1024];
+
+	purple_signal_register(&compress_plugin, "jabber-receiving-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, NULL, 0);
+	purple_signal_connect(&compress_plugin, "jabber-receiving-xmlnode",
+			&compress_plugin, PURPLE_CALLBACK(compress_receiving_cb), NULL);
+	jabber_init_plugin(&compress_plugin);
+	received = g_string_new(NULL);
+
+	/* The server finishes its compressed stream right after the stanzas */
+	memset(&deflater, 0, sizeof(deflater));
+	deflateInit(&deflater, Z_DEFAULT_COMPRESSION);
+	deflater.next_in = (Bytef *)stream;
+	deflater.avail_in = strlen(stream);
+	deflater.next_out = (Bytef *)buf;
+	deflater.avail_out = sizeof(buf);
+	fail_unless(deflate(&deflater, Z_FINISH) == Z_STREAM_END, NULL);
+
+	/* Which isn't a decompression error */
+	jabber_compress_process(js, buf, sizeof(buf) - deflater.avail_out);
+	assert_string_equal("presence;message;", received->str);
+
+	deflateEnd(&deflater);
+	jabber_parser_setup(js);
+	g_string_free(received, TRUE);
+	purple_signals_unregister_by_instance(&compress_plugin);
+}
+END_TEST
+
+Suite *
+jabber_compress_suite(void)
+{
+	Suite *s = suite_create("Jabber Stream Compression");
+
+	TCase *tc = tcase_create("Deflate");
+	tcase_add_checked_fixture(tc, compress_setup, compress_teardown);
+	tcase_add_test(tc, test_compress_enabled);
+	tcase_add_test(tc, test_compress_deflate);
+	tcase_add_test(tc, test_compress_stream_end);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../xmlnode.h"
+#include "../protocols/jabber/buddy.h"
+#include "../protocols/jabber/jabber.h"
+#include "../protocols/jabber/jutil.h"
+#include "../protocols/jabber/roster.h"
+
+static JabberStream *js;
+static PurpleAccount *account;
+
+static void
+roster_login(void)
+{
+	js = g_new0(JabberStream, 1);
+	js->gc = g_new0(PurpleConnection, 1);
+	js->gc->account = account;
+	js->user = jabber_id_new("me@example.com/home");
+	js->buddies = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)jabber_buddy_free);
+	js->roster_versioning = TRUE;
+
+	/* Keeps jabber_roster_parse() from sending our initial presence */
+	js->roster_parsed = TRUE;
+}
+
+static void
+roster_logout(void)
+{
+	g_hash_table_destroy(js->buddies);
+	jabber_id_free(js->user);
+	g_free(js->gc);
+	g_free(js);
+	js = NULL;
+}
+
+static void
+roster_setup(void)
+{
+	/* The UI normally creates the buddy list */
+	if(purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+
+	account = purple_account_new("me@example.com/home", PURPLE_CHECK_PRPL_ID);
+	roster_login();
+}
+
+static void
+roster_teardown(void)
+{
+	GSList *buddies = purple_find_buddies(account, NULL);
+	PurpleGroup *group;
+
+	while(buddies) {
+		purple_blist_remove_buddy(buddies->data);
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+	if((group = purple_find_group("Friends")))
+		purple_blist_remove_group(group);
+
+	roster_logout();
+	purple_account_destroy(account);
+	account = NULL;
+}
+
+static void
+roster_parse(const char *txt)
+{
+	xmlnode *packet = xmlnode_from_str(txt, -1);
+	jabber_roster_parse(js, packet);
+	xmlnode_free(packet);
+}
+
+static int
+roster_subscription(const char *jid)
+{
+	JabberBuddy *jb = jabber_buddy_find(js, jid, FALSE);
+	return jb ? (int)jb->subscription : -1;
+}
+
+#define FULL_ROSTER \
+	"<iq type='result' id='r1'>" \
+	"<query xmlns='jabber:iq:roster' ver='ver1'>" \
+	"<item jid='alice@example.com' subscription='both'><group>Friends</group></item>" \
+	"<item jid='bob@example.com' subscription='to'><group>Friends</group></item>" \
+	"<item jid='carol@example.com' subscription='none' ask='subscribe'/>" \
+	"</query></iq>"
+
+START_TEST(test_roster_full)
+{
+	roster_parse(FULL_ROSTER);
+
+	fail_unless(purple_find_buddy(account, "alice@example.com") != NULL, NULL);
+	fail_unless(purple_find_buddy(account, "carol@example.com") != NULL, NULL);
+	assert_string_equal("ver1", purple_account_get_string(account, "roster_ver", NULL));
+	fail_unless(roster_subscription("bob@example.com") == JABBER_SUB_TO, NULL);
+	fail_unless(roster_subscription("carol@example.com") == JABBER_SUB_PENDING, NULL);
+}
+END_TEST
+
+START_TEST(test_roster_push)
+{
+	roster_parse(FULL_ROSTER);
+
+	roster_parse("<iq type='set' id='p1'><query xmlns='jabber:iq:roster' ver='ver2'>"
+			"<item jid='alice@example.com' subscription='remove'/></query></iq>");
+	roster_parse("<iq type='set' id='p2'><query xmlns='jabber:iq:roster' ver='ver3'>"
+			"<item jid='bob@example.com' subscription='both'><group>Friends</group></item>"
+			"</query></iq>");
+
+	fail_unless(purple_find_buddy(account, "alice@example.com") == NULL, NULL);
+	fail_unless(roster_subscription("bob@example.com") == JABBER_SUB_BOTH, NULL);
+	assert_string_equal("ver3", purple_account_get_string(account, "roster_ver", NULL));
+}
+END_TEST
+
+START_TEST(test_roster_unchanged)
+{
+	roster_parse(FULL_ROSTER);
+
+	/* Log in again, and the server has nothing new for us */
+	roster_logout();
+	roster_login();
+	fail_unless(roster_subscription("bob@example.com") == -1, NULL);
+
+	roster_parse("<iq type='result' id='r2'/>");
+
+	fail_unless(purple_find_buddy(account, "alice@example.com") != NULL, NULL);
+	fail_unless(roster_subscription("alice@example.com") == JABBER_SUB_BOTH, NULL);
+	fail_unless(roster_subscription("bob@example.com") == JABBER_SUB_TO, NULL);
+	fail_unless(roster_subscription("carol@example.com") == JABBER_SUB_PENDING, NULL);
+	assert_string_equal("ver1", purple_account_get_string(account, "roster_ver", NULL));
+}
+END_TEST
+
+START_TEST(test_roster_stale)
+{
+	PurpleBuddy *local;
+	PurpleGroup *group;
+
+	roster_parse(FULL_ROSTER);
+
+	/* Never made it to the server, so not removed */
+	group = purple_find_group("Friends");
+	local = purple_buddy_new(account, "dave@example.com", NULL);
+	purple_blist_add_buddy(local, NULL, group, NULL);
+
+	roster_parse("<iq type='result' id='r2'><query xmlns='jabber:iq:roster' ver='ver9'>"
+			"<item jid='bob@example.com' subscription='both'><group>Friends</group></item>"
+			"</query></iq>");
+
+	fail_unless(purple_find_buddy(account, "alice@example.com") == NULL, NULL);
+	fail_unless(purple_find_buddy(account, "carol@example.com") == NULL, NULL);
+	fail_unless(purple_find_buddy(account, "bob@example.com") != NULL, NULL);
+	fail_unless(purple_find_buddy(account, "dave@example.com") == local, NULL);
+}
+END_TEST
+
+Suite *
+jabber_roster_suite(void)
+{
+	Suite *s = suite_create("Jabber Roster Versioning");
+
+	TCase *tc = tcase_create("Roster");
+	tcase_add_checked_fixture(tc, roster_setup, roster_teardown);
+	tcase_add_test(tc, test_roster_full);
+	tcase_add_test(tc, test_roster_push);
+	tcase_add_test(tc, test_roster_unchanged);
+	tcase_add_test(tc, test_roster_stale);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,340 @@
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "tests.h"
+#include "../eventloop.h"
+#include "../signals.h"
+#include "../xmlnode.h"
+#include "../protocols/jabber/jabber.h"
+#include "../protocols/jabber/parser.h"
+#include "../protocols/jabber/sm.h"
+
+static JabberStream *js;
+
+static void
+sm_setup(void)
+{
+	xmlnode *enabled;
+
+	js = g_new0(JabberStream, 1);
+	js->fd = -1;
+	js->state = JABBER_STREAM_CONNECTED;
+
+	/* What jabber_sm_enable() leaves behind, without sending anything */
+	js->sm_state = JABBER_SM_REQUESTED;
+	js->sm_unacked = g_queue_new();
+
+	enabled = xmlnode_from_str("<enabled xmlns='urn:xmpp:sm:3' id='some-id' resume='true'/>", -1);
+	jabber_sm_parse(js, enabled);
+	xmlnode_free(enabled);
+}
+
+static void
+sm_teardown(void)
+{
+	jabber_sm_free(js);
+	g_free(js);
+	js = NULL;
+}
+
+static void
+sm_outbound(const char *txt)
+{
+	xmlnode *packet = xmlnode_from_str(txt, -1);
+	fail_unless(jabber_sm_outbound(js, packet, txt), NULL);
+	xmlnode_free(packet);
+}
+
+static void
+sm_parse(const char *txt)
+{
+	xmlnode *packet = xmlnode_from_str(txt, -1);
+	jabber_sm_parse(js, packet);
+	xmlnode_free(packet);
+}
+
+START_TEST(test_sm_enabled)
+{
+	fail_unless(js->sm_state == JABBER_SM_ENABLED, NULL);
+	assert_string_equal("some-id", js->sm_resume_id);
+	fail_unless(jabber_sm_can_resume(js), NULL);
+}
+END_TEST
+
+START_TEST(test_sm_ack)
+{
+	sm_outbound("<message to='a@example.com'><body>1</body></message>");
+	sm_outbound("<presence/>");
+	sm_outbound("<iq type='get' id='x'/>");
+	sm_outbound("<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
+	fail_unless(g_queue_get_length(js->sm_unacked) == 3, NULL);
+
+	sm_parse("<a xmlns='urn:xmpp:sm:3' h='2'/>");
+	fail_unless(g_queue_get_length(js->sm_unacked) == 1, NULL);
+	assert_string_equal("<iq type='get' id='x'/>", g_queue_peek_head(js->sm_unacked));
+
+	/* Acknowledging more than was sent only counts what was sent */
+	sm_parse("<a xmlns='urn:xmpp:sm:3' h='7'/>");
+	fail_unless(g_queue_is_empty(js->sm_unacked), NULL);
+	fail_unless(js->sm_acked == 3, NULL);
+	sm_outbound("<presence/>");
+	sm_parse("<a xmlns='urn:xmpp:sm:3' h='4'/>");
+	fail_unless(g_queue_is_empty(js->sm_unacked), NULL);
+}
+END_TEST
+
+START_TEST(test_sm_inbound)
+{
+	xmlnode *packet;
+
+	packet = xmlnode_from_str("<message from='a@example.com'/>", -1);
+	jabber_sm_inbound(js, packet);
+	jabber_sm_inbound(js, packet);
+	xmlnode_free(packet);
+
+	packet = xmlnode_from_str("<r xmlns='urn:xmpp:sm:3'/>", -1);
+	jabber_sm_inbound(js, packet);
+	xmlnode_free(packet);
+
+	fail_unless(js->sm_inbound == 2, NULL);
+}
+END_TEST
+
+START_TEST(test_sm_resuming)
+{
+	xmlnode *packet;
+	const char *txt = "<message to='a@example.com'><body>2</body></message>";
+
+	js->sm_resuming = TRUE;
+	fail_if(jabber_sm_can_resume(js), NULL);
+
+	/* Held back until the stream is resumed */
+	packet = xmlnode_from_str(txt, -1);
+	fail_if(jabber_sm_outbound(js, packet, txt), NULL);
+	xmlnode_free(packet);
+	fail_unless(g_queue_get_length(js->sm_unacked) == 1, NULL);
+}
+END_TEST
+
+/******************************************************************************
+ * Talking to a stand-in server
+ *****************************************************************************/
+#define SM_STREAM_HEADER "<stream:stream xmlns='jabber:client' " \
+		"xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+
+static PurplePlugin sm_plugin;
+static int server_fd;
+static guint client_watch, server_watch;
+static GString *server_in;
+
+/* Does what jabber_recv_cb() does with what the server sends */
+static void
+sm_client_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	char buf[4096];
+	int len;
+
+	if ((len = read(source, buf, sizeof(buf))) > 0) {
+		jabber_parser_process(js, buf, len);
+		return;
+	}
+
+	purple_input_remove(client_watch);
+	client_watch = 0;
+	jabber_connection_lost(js, "Read Error");
+}
+
+static void
+sm_server_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	char buf[4096];
+	int len;
+
+	if ((len = read(source, buf, sizeof(buf))) > 0)
+		g_string_append_len(server_in, buf, len);
+}
+
+static void
+sm_server_send(const char *txt)
+{
+	fail_unless(write(server_fd, txt, strlen(txt)) == (ssize_t)strlen(txt), NULL);
+}
+
+/* Connects the stream to a fresh stand-in server */
+static void
+sm_connect(void)
+{
+	int fds[2];
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, NULL);
+	js->fd = fds[0];
+	server_fd = fds[1];
+	g_string_truncate(server_in, 0);
+
+	client_watch = purple_input_add(js->fd, PURPLE_INPUT_READ, sm_client_read_cb, NULL);
+	server_watch = purple_input_add(server_fd, PURPLE_INPUT_READ, sm_server_read_cb, NULL);
+
+	jabber_parser_setup(js);
+	sm_server_send(SM_STREAM_HEADER);
+}
+
+static void
+sm_disconnect(void)
+{
+	if (client_watch)
+		purple_input_remove(client_watch);
+	client_watch = 0;
+	if (js->fd >= 0)
+		close(js->fd);
+	js->fd = -1;
+
+	if (server_watch)
+		purple_input_remove(server_watch);
+	server_watch = 0;
+	if (server_fd >= 0)
+		close(server_fd);
+	server_fd = -1;
+}
+
+/* Runs the event loop until the server has received the given text */
+static void
+sm_server_wait_for(const char *txt)
+{
+	while (strstr(server_in->str, txt) == NULL)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+static void
+sm_send_message(const char *body)
+{
+	xmlnode *message = xmlnode_new("message");
+	xmlnode_set_attrib(message, "to", "a@example.com");
+	xmlnode_insert_data(xmlnode_new_child(message, "body"), body, -1);
+	jabber_send(js, message);
+	xmlnode_free(message);
+}
+
+static void
+sm_loopback_setup(void)
+{
+	/* Writing to the closed connection mustn't kill us */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* What libxmpp.c registers */
+	purple_signal_register(&sm_plugin, "jabber-receiving-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, NULL, 0);
+	purple_signal_register(&sm_plugin, "jabber-sending-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, NULL, 0);
+	purple_signal_register(&sm_plugin, "jabber-sending-text",
+			purple_marshal_VOID__POINTER_POINTER, NULL, 0);
+	jabber_init_plugin(&sm_plugin);
+
+	sm_setup();
+	js->write_buffer = purple_circ_buffer_new(512);
+	server_in = g_string_new(NULL);
+	server_fd = -1;
+	sm_connect();
+}
+
+static void
+sm_loopback_teardown(void)
+{
+	sm_disconnect();
+	jabber_parser_setup(js);
+	purple_circ_buffer_destroy(js->write_buffer);
+	g_string_free(server_in, TRUE);
+	sm_teardown();
+	purple_signals_unregister_by_instance(&sm_plugin);
+}
+
+START_TEST(test_sm_request_threshold)
+{
+	char *txt;
+	int i;
+
+	/* Ask for an ack without waiting, once enough stanzas are waiting */
+	for (i = 0; i <= JABBER_SM_REQUEST_STANZAS; i++) {
+		fail_unless(js->sm_ack_timer == 0, NULL);
+		txt = g_strdup_printf("<message to='a@example.com'><body>%d</body></message>", i);
+		sm_outbound(txt);
+		g_free(txt);
+	}
+	fail_unless(js->sm_ack_timer != 0, NULL);
+	fail_unless(js->sm_request_timer == 0, NULL);
+
+	sm_parse("<a xmlns='urn:xmpp:sm:3' h='5'/>");
+	fail_unless(js->sm_ack_timer == 0, NULL);
+}
+END_TEST
+
+START_TEST(test_sm_resume_replay)
+{
+	sm_send_message("one");
+	sm_send_message("two");
+	sm_send_message("three");
+	sm_server_wait_for("three");
+
+	sm_server_send("<a xmlns='urn:xmpp:sm:3' h='1'/>");
+	while (g_queue_get_length(js->sm_unacked) != 2)
+		g_main_context_iteration(NULL, TRUE);
+
+	/* The server goes away */
+	purple_input_remove(server_watch);
+	server_watch = 0;
+	close(server_fd);
+	server_fd = -1;
+	while (!js->sm_resuming)
+		g_main_context_iteration(NULL, TRUE);
+
+	/* Reconnecting is up to us here, not jabber_stream_reconnect() */
+	fail_unless(js->sm_reconnect_timer != 0, NULL);
+	purple_timeout_remove(js->sm_reconnect_timer);
+	js->sm_reconnect_timer = 0;
+
+	/* Held back until the stream has been resumed */
+	sm_send_message("four");
+	fail_unless(g_queue_get_length(js->sm_unacked) == 3, NULL);
+
+	sm_disconnect();
+	sm_connect();
+	jabber_sm_resume(js);
+	sm_server_wait_for("previd='some-id'");
+
+	/* The server got one and two, so only three and four are resent */
+	sm_server_send("<resumed xmlns='urn:xmpp:sm:3' h='2' previd='some-id'/>");
+	sm_server_wait_for("<r xmlns='urn:xmpp:sm:3'/>");
+	fail_if(js->sm_resuming, NULL);
+	fail_unless(strstr(server_in->str, "two") == NULL, NULL);
+	fail_unless(strstr(server_in->str, "three") < strstr(server_in->str, "four"), NULL);
+	fail_unless(strstr(server_in->str, "four") < strstr(server_in->str, "<r "), NULL);
+	fail_unless(g_queue_get_length(js->sm_unacked) == 2, NULL);
+
+	sm_server_send("<a xmlns='urn:xmpp:sm:3' h='4'/>");
+	while (!g_queue_is_empty(js->sm_unacked))
+		g_main_context_iteration(NULL, TRUE);
+	fail_unless(js->sm_ack_timer == 0, NULL);
+}
+END_TEST
+
+Suite *
+jabber_sm_suite(void)
+{
+	Suite *s = suite_create("Jabber Stream Management");
+
+	TCase *tc = tcase_create("Acknowledgements");
+	tcase_add_checked_fixture(tc, sm_setup, sm_teardown);
+	tcase_add_test(tc, test_sm_enabled);
+	tcase_add_test(tc, test_sm_ack);
+	tcase_add_test(tc, test_sm_inbound);
+	tcase_add_test(tc, test_sm_resuming);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Loopback");
+	tcase_add_checked_fixture(tc, sm_loopback_setup, sm_loopback_teardown);
+	tcase_add_test(tc, test_sm_request_threshold);
+	tcase_add_test(tc, test_sm_resume_replay);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
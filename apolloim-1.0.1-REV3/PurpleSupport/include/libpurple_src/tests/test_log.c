@@ -0,0 +1,602 @@
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../log.h"
+#include "../prefs.h"
+#include "../util.h"
+
+static PurpleAccount *account;
+static char *log_dir;
+
+static void
+log_remove_dir(const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		char *file = g_build_filename(path, name, NULL);
+		unlink(file);
+		g_free(file);
+	}
+	g_dir_close(dir);
+	rmdir(path);
+}
+
+static void
+log_setup(void)
+{
+	purple_prefs_set_string("/purple/logging/format", "html");
+
+	account = purple_account_new("me@example.com", PURPLE_CHECK_PRPL_ID);
+	log_dir = purple_log_get_log_dir(PURPLE_LOG_IM, "bob", account);
+	log_remove_dir(log_dir);
+}
+
+static void
+log_teardown(void)
+{
+	log_remove_dir(log_dir);
+	g_free(log_dir);
+	purple_account_destroy(account);
+	account = NULL;
+}
+
+static void
+log_write_file(const char *name, const char *contents)
+{
+	char *path;
+	FILE *file;
+
+	purple_build_dir(log_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	path = g_build_filename(log_dir, name, NULL);
+	file = fopen(path, "wb");
+	fail_unless(file != NULL, NULL);
+	fail_unless(fwrite(contents, 1, strlen(contents), file) == strlen(contents), NULL);
+	fclose(file);
+	g_free(path);
+}
+
+static guint
+log_count(void)
+{
+	GList *logs = purple_log_get_logs(PURPLE_LOG_IM, "bob", account);
+	guint count = g_list_length(logs);
+
+	while (logs != NULL) {
+		purple_log_free(logs->data);
+		logs = g_list_delete_link(logs, logs);
+	}
+
+	return count;
+}
+
+static PurpleLog *
+log_new(void)
+{
+	time_t now = time(NULL);
+
+	return purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, now, localtime(&now));
+}
+
+START_TEST(test_log_dir_index_same_second)
+{
+	PurpleLog *log = log_new();
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "hello");
+	purple_log_free(log);
+
+	/* Builds the index */
+	fail_unless(log_count() == 1, NULL);
+
+	/* Another log turns up before the clock has ticked over */
+	log_write_file("2001-02-03.040506+0000UTC.html",
+			"<html><head><title>old</title></head><body><h3>old</h3>\n"
+			"</body></html>\n");
+	fail_unless(log_count() == 2, NULL);
+}
+END_TEST
+
+START_TEST(test_log_dir_index_growing)
+{
+	PurpleLog *log = log_new();
+	int size, total;
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "hello");
+	size = purple_log_get_size(log);
+	total = purple_log_common_total_sizer(PURPLE_LOG_IM, "bob", account, ".html");
+	fail_unless(size > 0, NULL);
+	fail_unless(total == size, NULL);
+
+	/* Still buffered, but already counted */
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "hello again");
+	fail_unless(purple_log_get_size(log) > size, NULL);
+	fail_unless(purple_log_common_total_sizer(PURPLE_LOG_IM, "bob", account, ".html") ==
+			purple_log_get_size(log), NULL);
+
+	size = purple_log_get_size(log);
+	purple_log_free(log);
+	fail_unless(purple_log_common_total_sizer(PURPLE_LOG_IM, "bob", account, ".html") >= size, NULL);
+}
+END_TEST
+
+struct read_range_result {
+	gboolean done;
+	char *text;
+	guint count;
+	guint total;
+};
+
+static void
+log_read_range_cb(PurpleLog *log, const char *text, PurpleLogReadFlags flags,
+		guint first, guint count, guint total, gpointer data)
+{
+	struct read_range_result *result = data;
+
+	result->done = TRUE;
+	result->text = g_strdup(text);
+	result->count = count;
+	result->total = total;
+}
+
+static void
+log_read_range(PurpleLog *log, guint first, guint count,
+		struct read_range_result *result)
+{
+	memset(result, 0, sizeof(*result));
+	purple_log_read_range(log, first, count, log_read_range_cb, result);
+	while (!result->done)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+START_TEST(test_log_scan_multiline)
+{
+	struct read_range_result result;
+	GList *logs;
+
+	/* A log from before message indexes, with no .idx to go by */
+	log_write_file("2001-02-03.040506+0000UTC.html",
+			"<html><head><title>old</title></head><body><h3>old</h3>\n"
+			"<font color=\"#A82F2F\"><font size=\"2\">(04:05:06)</font> <b>bob:</b></font> one<br/>\n"
+			"<font color=\"#A82F2F\"><font size=\"2\">(04:05:07)</font> <b>bob:</b></font> two\n"
+			"(and a bit)\n"
+			"<font size=\"4\">lines</font><br/>\n"
+			"<font size=\"2\">(04:05:08)</font><b> bob has left</b><br/>\n"
+			"</body></html>\n");
+
+	logs = purple_log_get_logs(PURPLE_LOG_IM, "bob", account);
+	fail_unless(g_list_length(logs) == 1, NULL);
+
+	log_read_range(logs->data, 1, 1, &result);
+	fail_unless(result.total == 3, NULL);
+	fail_unless(result.count == 1, NULL);
+	fail_unless(strstr(result.text, "two\n(and a bit)\n<font size=\"4\">lines</font><br/>") != NULL, NULL);
+	fail_unless(strstr(result.text, "one") == NULL, NULL);
+	fail_unless(strstr(result.text, "left") == NULL, NULL);
+	g_free(result.text);
+
+	/* The closing tags aren't part of the last message */
+	log_read_range(logs->data, 2, 1, &result);
+	fail_unless(strstr(result.text, "</body>") == NULL, NULL);
+	g_free(result.text);
+
+	purple_log_free(logs->data);
+	g_list_free(logs);
+}
+END_TEST
+
+static char *
+log_read_file(const char *path)
+{
+	gchar *contents;
+
+	fail_unless(g_file_get_contents(path, &contents, NULL, NULL), NULL);
+	return contents;
+}
+
+/* Whether each string is in @a text, after the one before it. */
+static gboolean
+log_in_order(const char *text, ...)
+{
+	const char *s;
+	va_list args;
+
+	va_start(args, text);
+	while (text != NULL && (s = va_arg(args, const char *)) != NULL)
+		if ((text = strstr(text, s)) != NULL)
+			text += strlen(s);
+	va_end(args);
+
+	return text != NULL;
+}
+
+START_TEST(test_log_writer_reopen_failure)
+{
+	time_t then = time(NULL) - 3600;
+	PurpleLog *log, *other;
+	struct read_range_result result;
+	char *path, *aside, *contents;
+	GTimer *timer;
+	GList *logs, *l;
+
+	/* Flushed after every message, with one file open at a time */
+	purple_prefs_set_int("/purple/logging/flush_bytes", 1);
+	purple_prefs_set_int("/purple/logging/max_open_files", 1);
+
+	log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, then, localtime(&then));
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then, "one");
+	path = g_strdup(((PurpleLogCommonLoggerData *)log->logger_data)->path);
+	aside = g_strconcat(path, ".aside", NULL);
+
+	/* Another log takes the open file, and this one can't be reopened */
+	other = log_new();
+	purple_log_write(other, PURPLE_MESSAGE_RECV, "bob", time(NULL), "other");
+	fail_unless(rename(path, aside) == 0, NULL);
+	fail_unless(mkdir(path, S_IRWXU) == 0, NULL);
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then + 1, "two");
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then + 2, "three");
+
+	/* Nothing is lost, or out of order, once it can be */
+	fail_unless(rmdir(path) == 0, NULL);
+	fail_unless(rename(aside, path) == 0, NULL);
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then + 3, "four");
+	contents = log_read_file(path);
+	fail_unless(log_in_order(contents, "one", "two", "three", "four", NULL), NULL);
+	g_free(contents);
+
+	/* Nor when the log is closed while it can't be written */
+	fail_unless(rename(path, aside) == 0, NULL);
+	fail_unless(mkdir(path, S_IRWXU) == 0, NULL);
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then + 4, "five");
+	purple_log_free(log);
+	fail_unless(rmdir(path) == 0, NULL);
+	fail_unless(rename(aside, path) == 0, NULL);
+
+	timer = g_timer_new();
+	contents = log_read_file(path);
+	while (strstr(contents, "</html>") == NULL && g_timer_elapsed(timer, NULL) < 10) {
+		g_main_context_iteration(NULL, TRUE);
+		g_free(contents);
+		contents = log_read_file(path);
+	}
+	g_timer_destroy(timer);
+	fail_unless(log_in_order(contents, "one", "two", "three", "four", "five",
+			"</body></html>", NULL), NULL);
+	g_free(contents);
+
+	/* And its message index was saved with the rest */
+	logs = purple_log_get_logs(PURPLE_LOG_IM, "bob", account);
+	for (l = logs; l != NULL; l = l->next) {
+		if (((PurpleLog *)l->data)->time == then) {
+			log_read_range(l->data, 4, 1, &result);
+			fail_unless(result.total == 5, NULL);
+			fail_unless(strstr(result.text, "five") != NULL, NULL);
+			g_free(result.text);
+		}
+		purple_log_free(l->data);
+	}
+	g_list_free(logs);
+
+	purple_log_free(other);
+	g_free(aside);
+	g_free(path);
+}
+END_TEST
+
+START_TEST(test_log_writer_uninit)
+{
+	PurpleLog *log, *other;
+	char *path;
+	GTimer *timer;
+
+	purple_prefs_set_int("/purple/logging/flush_bytes", 1);
+	purple_prefs_set_int("/purple/logging/max_open_files", 1);
+
+	log = log_new();
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "one");
+	path = g_strdup(((PurpleLogCommonLoggerData *)log->logger_data)->path);
+
+	/* Another log takes the open file, and this one can't be reopened,
+	 * so a retry is pending when logging shuts down */
+	other = purple_log_new(PURPLE_LOG_IM, "alice", account, NULL, time(NULL), NULL);
+	purple_log_write(other, PURPLE_MESSAGE_RECV, "alice", time(NULL), "other");
+	fail_unless(unlink(path) == 0, NULL);
+	fail_unless(mkdir(path, S_IRWXU) == 0, NULL);
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "two");
+
+	purple_log_uninit();
+	fail_unless(rmdir(path) == 0, NULL);
+
+	/* Nothing is left to go off afterwards */
+	timer = g_timer_new();
+	while (g_timer_elapsed(timer, NULL) < 1.5)
+		g_main_context_iteration(NULL, FALSE);
+	g_timer_destroy(timer);
+	fail_if(g_file_test(path, G_FILE_TEST_EXISTS), NULL);
+
+	/* And the logs still open outlive their writers */
+	purple_log_free(log);
+	purple_log_free(other);
+	fail_if(g_file_test(path, G_FILE_TEST_EXISTS), NULL);
+
+	g_free(path);
+}
+END_TEST
+
+/*
+ * Not a pass/fail test so much as a measurement: what a message costs with
+ * the writer's buffering, next to writing and flushing each one.
+ */
+START_TEST(test_log_writer_benchmark)
+{
+	const int messages = 5000;
+	time_t then = time(NULL) - 3600;
+	PurpleLog *log;
+	GTimer *timer;
+	double buffered, unbuffered;
+	int i;
+
+	timer = g_timer_new();
+	log = log_new();
+	for (i = 0; i < messages; i++)
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "hello there");
+	purple_log_free(log);
+	buffered = g_timer_elapsed(timer, NULL) / messages;
+
+	purple_prefs_set_int("/purple/logging/flush_bytes", 0);
+	g_timer_start(timer);
+	log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL, then, localtime(&then));
+	for (i = 0; i < messages; i++)
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", then, "hello there");
+	purple_log_free(log);
+	unbuffered = g_timer_elapsed(timer, NULL) / messages;
+	g_timer_destroy(timer);
+
+	g_print("log writer: %.1f us per message buffered, %.1f us flushing "
+			"each one\n", buffered * 1e6, unbuffered * 1e6);
+}
+END_TEST
+
+static char *search_dir;
+
+static void
+log_search_setup(void)
+{
+	log_setup();
+
+	search_dir = g_build_filename(purple_user_dir(), "logsearch", PURPLE_CHECK_PRPL_ID,
+			purple_escape_filename(purple_normalize(account,
+					purple_account_get_username(account))), NULL);
+	log_remove_dir(search_dir);
+	purple_prefs_set_bool("/purple/logging/search_index", TRUE);
+}
+
+static void
+log_search_teardown(void)
+{
+	log_remove_dir(search_dir);
+	g_free(search_dir);
+	log_teardown();
+}
+
+static gboolean
+log_search_file_exists(const char *name)
+{
+	char *path = g_build_filename(search_dir, name, NULL);
+	gboolean exists = g_file_test(path, G_FILE_TEST_EXISTS);
+
+	g_free(path);
+	return exists;
+}
+
+/* Runs the main loop until any merge or purge has finished. */
+static void
+log_search_wait(void)
+{
+	GTimer *timer = g_timer_new();
+
+	while ((log_search_file_exists("pending.merging") ||
+	        log_search_file_exists("deleted")) &&
+	       g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+
+	fail_if(log_search_file_exists("pending.merging"), NULL);
+}
+
+static guint
+log_search_count(const char *query)
+{
+	GList *results = purple_log_search(account, query, 0);
+	guint count = g_list_length(results);
+
+	while (results != NULL) {
+		purple_log_search_result_free(results->data);
+		results = g_list_delete_link(results, results);
+	}
+
+	return count;
+}
+
+static gboolean
+log_search_segment_has(const char *term)
+{
+	char *path = g_build_filename(search_dir, "segment", NULL);
+	gchar *contents;
+	gsize len, i, term_len = strlen(term);
+	gboolean found = FALSE;
+
+	fail_unless(g_file_get_contents(path, &contents, &len, NULL), NULL);
+	for (i = 0; i + term_len <= len && !found; i++)
+		found = !memcmp(contents + i, term, term_len);
+
+	g_free(contents);
+	g_free(path);
+	return found;
+}
+
+START_TEST(test_log_search_merge)
+{
+	PurpleLog *log = log_new();
+	int i;
+
+	purple_prefs_set_int("/purple/logging/search_merge_postings", 20);
+
+	/* Three postings a message; the seventh starts a merge */
+	for (i = 0; i < 7; i++)
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL),
+				"apple <b>banana</b> cherry");
+
+	/* ... which hasn't run yet, but the postings it holds are searchable */
+	fail_unless(log_search_file_exists("pending.merging"), NULL);
+	fail_if(log_search_file_exists("segment"), NULL);
+	fail_unless(log_search_count("apple") == 7, NULL);
+
+	/* As are those written while it runs */
+	for (; i < 10; i++)
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL),
+				"apple banana cherry");
+	fail_unless(log_search_count("banana apple") == 10, NULL);
+
+	log_search_wait();
+	fail_unless(log_search_file_exists("segment"), NULL);
+	fail_unless(log_search_count("apple banana") == 10, NULL);
+	fail_unless(log_search_count("CHERRY") == 10, NULL);
+	fail_unless(log_search_count("apple durian") == 0, NULL);
+
+	purple_log_free(log);
+}
+END_TEST
+
+START_TEST(test_log_search_delete)
+{
+	time_t then = time(NULL) - 3600;
+	PurpleLog *old_log = purple_log_new(PURPLE_LOG_IM, "bob", account, NULL,
+			then, localtime(&then));
+	PurpleLog *log = log_new();
+	GList *logs, *l;
+	GList *results;
+
+	purple_log_write(old_log, PURPLE_MESSAGE_RECV, "bob", then, "zebra giraffe");
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), "giraffe");
+	purple_log_free(old_log);
+	purple_log_free(log);
+	fail_unless(log_search_count("giraffe") == 2, NULL);
+
+	logs = purple_log_get_logs(PURPLE_LOG_IM, "bob", account);
+	for (l = logs; l != NULL; l = l->next) {
+		if (((PurpleLog *)l->data)->time == then)
+			fail_unless(purple_log_delete(l->data), NULL);
+		purple_log_free(l->data);
+	}
+	g_list_free(logs);
+
+	/* Gone from the results straight away */
+	fail_unless(log_search_count("zebra") == 0, NULL);
+	results = purple_log_search(account, "giraffe", 0);
+	fail_unless(g_list_length(results) == 1, NULL);
+	fail_unless(((PurpleLogSearchResult *)results->data)->log->time != then, NULL);
+	purple_log_search_result_free(results->data);
+	g_list_free(results);
+
+	/* And from the index once the purge has run */
+	log_search_wait();
+	fail_if(log_search_file_exists("deleted"), NULL);
+	fail_if(log_search_segment_has("zebra"), NULL);
+	fail_unless(log_search_segment_has("giraffe"), NULL);
+	fail_unless(log_search_count("giraffe") == 1, NULL);
+}
+END_TEST
+
+/*
+ * Not a pass/fail test so much as a measurement: how long a merge keeps
+ * the main loop busy at a stretch, next to how long it takes in all.
+ */
+START_TEST(test_log_search_benchmark)
+{
+	const int messages = 2000, words = 10;
+	PurpleLog *log = log_new();
+	GTimer *timer, *step;
+	double write_max = 0, step_max = 0, merge;
+	guint steps = 0;
+	int i, j;
+
+	purple_prefs_set_int("/purple/logging/search_merge_postings", messages * words);
+
+	timer = g_timer_new();
+	step = g_timer_new();
+	for (i = 0; i < messages; i++) {
+		GString *message = g_string_new(NULL);
+
+		for (j = 0; j < words; j++)
+			g_string_append_printf(message, "w%dx%d ", i, j);
+
+		g_timer_start(step);
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", time(NULL), message->str);
+		write_max = MAX(write_max, g_timer_elapsed(step, NULL));
+		g_string_free(message, TRUE);
+	}
+	fail_unless(log_search_file_exists("pending.merging"), NULL);
+
+	g_timer_start(timer);
+	while (log_search_file_exists("pending.merging") && g_timer_elapsed(timer, NULL) < 60) {
+		g_timer_start(step);
+		g_main_context_iteration(NULL, TRUE);
+		step_max = MAX(step_max, g_timer_elapsed(step, NULL));
+		steps++;
+	}
+	merge = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(step);
+	g_timer_destroy(timer);
+
+	g_print("log search: merged %d postings in %.1f ms over %u main loop "
+			"iterations; longest iteration %.1f ms, longest write %.1f ms\n",
+			messages * words, merge * 1e3, steps, step_max * 1e3, write_max * 1e3);
+
+	fail_if(log_search_file_exists("pending.merging"), NULL);
+	fail_unless(log_search_count("w1999x9") == 1, NULL);
+	fail_unless(steps > 1, NULL);
+	fail_unless(step_max < merge, NULL);
+
+	purple_log_free(log);
+}
+END_TEST
+
+Suite *
+log_suite(void)
+{
+	Suite *s = suite_create("Logging");
+
+	TCase *tc = tcase_create("Indexes");
+	tcase_add_checked_fixture(tc, log_setup, log_teardown);
+	tcase_add_test(tc, test_log_dir_index_same_second);
+	tcase_add_test(tc, test_log_dir_index_growing);
+	tcase_add_test(tc, test_log_scan_multiline);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Writer");
+	tcase_add_checked_fixture(tc, log_setup, log_teardown);
+	tcase_add_test(tc, test_log_writer_reopen_failure);
+	tcase_add_test(tc, test_log_writer_uninit);
+	tcase_add_test(tc, test_log_writer_benchmark);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Search");
+	tcase_add_checked_fixture(tc, log_search_setup, log_search_teardown);
+	tcase_add_test(tc, test_log_search_merge);
+	tcase_add_test(tc, test_log_search_delete);
+	tcase_add_test(tc, test_log_search_benchmark);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,161 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../protocols/msn/msn.h"
+#include "../protocols/msn/command.h"
+#include "../protocols/msn/cmdproc.h"
+#include "../protocols/msn/session.h"
+#include "../protocols/msn/sync.h"
+
+static PurpleAccount *account;
+static MsnSession *session;
+static MsnCmdProc *cmdproc;
+static GString *updates;
+
+static void
+sync_update(PurpleBuddyList *list, PurpleBlistNode *node)
+{
+	if (PURPLE_BLIST_NODE_IS_GROUP(node))
+		g_string_append_printf(updates, "%s;", ((PurpleGroup *)node)->name);
+}
+
+static PurpleBlistUiOps sync_blist_ops = {
+	NULL, /* new_list */
+	NULL, /* new_node */
+	NULL, /* show */
+	sync_update,
+	NULL, /* remove */
+	NULL, /* destroy */
+	NULL, /* set_visible */
+	NULL, /* request_add_buddy */
+	NULL, /* request_add_chat */
+	NULL, /* request_add_group */
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void
+sync_setup(void)
+{
+	/* The UI normally creates the buddy list */
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+	purple_blist_set_ui_ops(&sync_blist_ops);
+	updates = g_string_new(NULL);
+
+	/* The first group in an empty list never goes through update() */
+	purple_blist_add_group(purple_group_new("Buddies"), NULL);
+
+	msn_sync_init();
+
+	account = purple_account_new("me@example.com", PURPLE_CHECK_PRPL_ID);
+	session = msn_session_new(account);
+	cmdproc = session->notification->cmdproc;
+
+	/* As the SYN handler in notification.c does */
+	session->sync = msn_sync_new(session);
+	session->sync->total_users = 100;
+	session->sync->old_cbs_table = cmdproc->cbs_table;
+	cmdproc->cbs_table = session->sync->cbs_table;
+}
+
+static void
+sync_teardown(void)
+{
+	PurpleBlistNode *node;
+
+	msn_session_destroy(session);
+	session = NULL;
+	purple_account_destroy(account);
+	account = NULL;
+
+	while ((node = purple_blist_get_root()) != NULL)
+		purple_blist_remove_group((PurpleGroup *)node);
+
+	msn_sync_end();
+	purple_blist_set_ui_ops(NULL);
+	g_string_free(updates, TRUE);
+}
+
+static void
+sync_command(const char *text)
+{
+	MsnCommand *cmd = msn_command_from_string(text);
+
+	msn_cmdproc_process_cmd(cmdproc, cmd);
+	msn_command_destroy(cmd);
+}
+
+/* Lets the event loop run whatever is due right away. */
+static void
+sync_idle(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+START_TEST(test_msn_sync_burst)
+{
+	/* One read's worth of commands */
+	sync_command("LSG 1 Friends");
+	sync_command("LSG 2 Family");
+	sync_command("LSG 3 Work");
+
+	/* Shown together, once the read has been handled */
+	assert_string_equal("", updates->str);
+	sync_idle();
+	assert_string_equal("Friends;Family;Work;", updates->str);
+}
+END_TEST
+
+START_TEST(test_msn_sync_bursts)
+{
+	sync_command("LSG 1 Friends");
+	sync_idle();
+	assert_string_equal("Friends;", updates->str);
+
+	/* The batch didn't stay open waiting for the rest of the list */
+	purple_blist_add_group(purple_group_new("Local"), NULL);
+	assert_string_equal("Friends;Local;", updates->str);
+
+	sync_command("LSG 2 Family");
+	assert_string_equal("Friends;Local;", updates->str);
+	sync_idle();
+	assert_string_equal("Friends;Local;Family;", updates->str);
+}
+END_TEST
+
+START_TEST(test_msn_sync_destroyed)
+{
+	/* Logging out in the middle of a burst */
+	sync_command("LSG 1 Friends");
+	msn_sync_destroy(session->sync);
+	session->sync = NULL;
+
+	assert_string_equal("Friends;", updates->str);
+	sync_idle();
+	assert_string_equal("Friends;", updates->str);
+
+	purple_blist_add_group(purple_group_new("Local"), NULL);
+	assert_string_equal("Friends;Local;", updates->str);
+}
+END_TEST
+
+Suite *
+msn_sync_suite(void)
+{
+	Suite *s = suite_create("MSN List Synchronization");
+
+	TCase *tc = tcase_create("Batching");
+	tcase_add_checked_fixture(tc, sync_setup, sync_teardown);
+	tcase_add_test(tc, test_msn_sync_burst);
+	tcase_add_test(tc, test_msn_sync_bursts);
+	tcase_add_test(tc, test_msn_sync_destroyed);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,205 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../protocols/oscar/oscar.h"
+
+#define FEEDBAG_GROUPS 20
+#define FEEDBAG_BUDDIES 1000
+
+static OscarData *od;
+
+static void
+feedbag_setup(void)
+{
+	char name[32], group[32];
+	int i;
+
+	od = oscar_data_new();
+
+	/* Replay a large buddy list download into the local list */
+	for (i = 0; i < FEEDBAG_BUDDIES; i++) {
+		g_snprintf(name, sizeof(name), "buddy %d", i);
+		g_snprintf(group, sizeof(group), "Group %d", i % FEEDBAG_GROUPS);
+		aim_ssi_addbuddy(od, name, group, NULL,
+				(i % 2) ? name : NULL, NULL, NULL, FALSE);
+	}
+}
+
+static void
+feedbag_teardown(void)
+{
+	oscar_data_destroy(od);
+	od = NULL;
+}
+
+START_TEST(test_feedbag_finditem)
+{
+	struct aim_ssi_item *group, *buddy;
+
+	group = aim_ssi_itemlist_finditem(od->ssi.local, "Group 7", NULL, AIM_SSI_TYPE_GROUP);
+	fail_unless(group != NULL, NULL);
+	fail_unless(group->bid == 0x0000, NULL);
+	assert_string_equal("Group 7", group->name);
+
+	/* Names are compared without spaces and case */
+	buddy = aim_ssi_itemlist_finditem(od->ssi.local, "group7", "BUDDY 27", AIM_SSI_TYPE_BUDDY);
+	fail_unless(buddy != NULL, NULL);
+	fail_unless(buddy->gid == group->gid, NULL);
+	assert_string_equal("buddy 27", buddy->name);
+
+	fail_unless(aim_ssi_itemlist_find(od->ssi.local, buddy->gid, buddy->bid) == buddy, NULL);
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, "Group 8", "buddy 27", AIM_SSI_TYPE_BUDDY) == NULL, NULL);
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, NULL, "buddy 27", AIM_SSI_TYPE_BUDDY) == buddy, NULL);
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, NULL, NULL, AIM_SSI_TYPE_GROUP) != NULL, NULL);
+	fail_unless(aim_ssi_itemlist_exists(od->ssi.local, "buddy999") != NULL, NULL);
+	fail_unless(aim_ssi_itemlist_exists(od->ssi.local, "buddy 1000") == NULL, NULL);
+
+	assert_string_equal("Group 19", aim_ssi_itemlist_findparentname(od->ssi.local, "buddy 999"));
+	assert_string_equal_free("buddy 999", aim_ssi_getalias(od->ssi.local, "Group 19", "buddy 999"));
+}
+END_TEST
+
+START_TEST(test_feedbag_unique_ids)
+{
+	struct aim_ssi_item *cur, *found;
+	int buddies = 0;
+
+	for (cur = od->ssi.local; cur; cur = cur->next) {
+		found = aim_ssi_itemlist_find(od->ssi.local, cur->gid, cur->bid);
+		fail_unless(found == cur, "Duplicate ID 0x%04hx/0x%04hx", cur->gid, cur->bid);
+		if (cur->type == AIM_SSI_TYPE_BUDDY)
+			buddies++;
+	}
+	fail_unless(buddies == FEEDBAG_BUDDIES, NULL);
+}
+END_TEST
+
+START_TEST(test_feedbag_move_delete)
+{
+	struct aim_ssi_item *buddy;
+
+	aim_ssi_movebuddy(od, "Group 3", "Group 4", "buddy 3");
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, "Group 3", "buddy 3", AIM_SSI_TYPE_BUDDY) == NULL, NULL);
+	buddy = aim_ssi_itemlist_finditem(od->ssi.local, "Group 4", "buddy 3", AIM_SSI_TYPE_BUDDY);
+	fail_unless(buddy != NULL, NULL);
+	assert_string_equal_free("buddy 3", aim_ssi_getalias(od->ssi.local, "Group 4", "buddy 3"));
+
+	aim_ssi_delbuddy(od, "buddy 3", "Group 4");
+	fail_unless(aim_ssi_itemlist_exists(od->ssi.local, "buddy 3") == NULL, NULL);
+
+	aim_ssi_rename_group(od, "Group 5", "Renamed");
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, "Group 5", NULL, AIM_SSI_TYPE_GROUP) == NULL, NULL);
+	fail_unless(aim_ssi_itemlist_finditem(od->ssi.local, "Renamed", "buddy 5", AIM_SSI_TYPE_BUDDY) != NULL, NULL);
+}
+END_TEST
+
+static void
+feedbag_assert_sorted(struct aim_ssi_item *list, int count)
+{
+	struct aim_ssi_item *cur;
+	int n = 0;
+
+	for (cur = list; cur; cur = cur->next) {
+		if (cur->next)
+			fail_unless((cur->gid < cur->next->gid) ||
+					((cur->gid == cur->next->gid) && (cur->bid < cur->next->bid)),
+					"0x%04hx/0x%04hx is before 0x%04hx/0x%04hx",
+					cur->gid, cur->bid, cur->next->gid, cur->next->bid);
+		n++;
+	}
+	fail_unless(n == count, "Expecting %d items but got %d", count, n);
+}
+
+/* Hands one SNAC of a buddy list download to the feedbag module. */
+static void
+feedbag_receive_list(int first, int count, int step, gboolean more)
+{
+	aim_module_t *mod = aim__findmodule(od, "feedbag");
+	aim_modsnac_t snac;
+	ByteStream bs;
+	char name[32];
+	int i, id;
+
+	byte_stream_new(&bs, 3 + count * (2 + sizeof(name) + 8) + 4);
+	byte_stream_put8(&bs, 0x00);
+	byte_stream_put16(&bs, count);
+	for (i = 0; i < count; i++) {
+		/* Out of order, like the server may send them */
+		id = (first + i * step) % FEEDBAG_BUDDIES + 1;
+		g_snprintf(name, sizeof(name), "buddy %d", id);
+		byte_stream_put16(&bs, strlen(name));
+		byte_stream_putstr(&bs, name);
+		byte_stream_put16(&bs, id % FEEDBAG_GROUPS + 1);
+		byte_stream_put16(&bs, id);
+		byte_stream_put16(&bs, AIM_SSI_TYPE_BUDDY);
+		byte_stream_put16(&bs, 0);
+	}
+	byte_stream_put32(&bs, 0);
+	bs.len = bs.offset;
+	byte_stream_rewind(&bs);
+
+	snac.family = SNAC_FAMILY_FEEDBAG;
+	snac.subtype = SNAC_SUBTYPE_FEEDBAG_LIST;
+	snac.flags = more ? 0x0001 : 0x0000;
+	snac.id = 0;
+	mod->snachandler(od, NULL, mod, NULL, &snac, &bs);
+
+	g_free(bs.data);
+}
+
+START_TEST(test_feedbag_download)
+{
+	struct aim_ssi_item *buddy;
+
+	/* Start from nothing, as when signing on */
+	oscar_data_destroy(od);
+	od = oscar_data_new();
+
+	/* 7 is coprime with the number of buddies, so every one comes once */
+	feedbag_receive_list(0, FEEDBAG_BUDDIES / 2, 7, TRUE);
+	fail_unless(od->ssi.local == NULL, NULL);
+	feedbag_receive_list(FEEDBAG_BUDDIES / 2 * 7, FEEDBAG_BUDDIES / 2, 7, FALSE);
+
+	feedbag_assert_sorted(od->ssi.official, FEEDBAG_BUDDIES);
+	feedbag_assert_sorted(od->ssi.local, FEEDBAG_BUDDIES);
+
+	buddy = aim_ssi_itemlist_exists(od->ssi.local, "buddy 1000");
+	fail_unless(buddy != NULL, NULL);
+	fail_unless(buddy->gid == 1000 % FEEDBAG_GROUPS + 1, NULL);
+	fail_unless(buddy->bid == 1000, NULL);
+	fail_unless(aim_ssi_itemlist_find(od->ssi.official, buddy->gid, buddy->bid) != NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_feedbag_order)
+{
+	struct aim_ssi_item *last;
+
+	feedbag_assert_sorted(od->ssi.local, FEEDBAG_GROUPS + 1 + FEEDBAG_BUDDIES);
+
+	/* Take the end of the list away, then add after it again */
+	for (last = od->ssi.local; last->next; last = last->next);
+	aim_ssi_delbuddy(od, last->name, "Group 19");
+	aim_ssi_addbuddy(od, "buddy 1000", "Group 19", NULL, NULL, NULL, NULL, FALSE);
+	aim_ssi_addbuddy(od, "buddy 1001", "Group 0", NULL, NULL, NULL, NULL, FALSE);
+
+	feedbag_assert_sorted(od->ssi.local, FEEDBAG_GROUPS + 1 + FEEDBAG_BUDDIES + 1);
+}
+END_TEST
+
+Suite *
+oscar_feedbag_suite(void)
+{
+	Suite *s = suite_create("OSCAR Feedbag");
+
+	TCase *tc = tcase_create("Item List");
+	tcase_add_checked_fixture(tc, feedbag_setup, feedbag_teardown);
+	tcase_add_test(tc, test_feedbag_finditem);
+	tcase_add_test(tc, test_feedbag_unique_ids);
+	tcase_add_test(tc, test_feedbag_move_delete);
+	tcase_add_test(tc, test_feedbag_order);
+	tcase_add_test(tc, test_feedbag_download);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
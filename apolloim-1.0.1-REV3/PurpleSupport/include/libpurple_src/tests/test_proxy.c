@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../dnsquery.h"
+#include "../eventloop.h"
+#include "../proxy.h"
+
+/*
+ * Everything happens on the loopback.  A live server listens on
+ * 127.0.0.1, and 127.0.0.2 has a listener on the same port whose
+ * backlog is full, so that connections to it are never answered.
+ * Nothing listens on 127.0.0.3, so connections to it are refused.
+ */
+#define LIVE      "127.0.0.1"
+#define BLACKHOLE "127.0.0.2"
+#define REFUSED   "127.0.0.3"
+
+static int live_fd, blackhole_fd;
+static int blackhole_fillers[4];
+static int port;
+static const char **addresses;
+
+static gboolean done;
+static int connected_fd;
+static char *connect_error;
+
+static int
+proxy_listen(const char *ip, int backlog)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = inet_addr(ip);
+	sin.sin_port = htons(port);
+	fail_unless(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0, NULL);
+	fail_unless(listen(fd, backlog) == 0, NULL);
+	getsockname(fd, (struct sockaddr *)&sin, &len);
+	port = ntohs(sin.sin_port);
+
+	return fd;
+}
+
+/* Hands out the addresses the test wants instead of resolving anything */
+static gboolean
+proxy_resolve_host(PurpleDnsQueryData *query_data,
+		PurpleDnsQueryResolvedCallback resolved_cb,
+		PurpleDnsQueryFailedCallback failed_cb)
+{
+	GSList *hosts = NULL;
+	int i;
+
+	for (i = 0; addresses[i] != NULL; i++) {
+		struct sockaddr_in *sin = g_new0(struct sockaddr_in, 1);
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = inet_addr(addresses[i]);
+		sin->sin_port = htons(purple_dnsquery_get_port(query_data));
+		hosts = g_slist_append(hosts, GINT_TO_POINTER(sizeof(struct sockaddr_in)));
+		hosts = g_slist_append(hosts, sin);
+	}
+
+	resolved_cb(query_data, hosts);
+	return TRUE;
+}
+
+static PurpleDnsQueryUiOps dns_ui_ops = {
+	proxy_resolve_host,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void
+proxy_setup(void)
+{
+	struct sockaddr_in sin;
+	int i;
+
+	port = 0;
+	live_fd = proxy_listen(LIVE, 5);
+	blackhole_fd = proxy_listen(BLACKHOLE, 0);
+
+	/* Fill up the blackhole's backlog */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = inet_addr(BLACKHOLE);
+	sin.sin_port = htons(port);
+	for (i = 0; i < 4; i++) {
+		blackhole_fillers[i] = socket(AF_INET, SOCK_STREAM, 0);
+		fcntl(blackhole_fillers[i], F_SETFL, O_NONBLOCK);
+		connect(blackhole_fillers[i], (struct sockaddr *)&sin, sizeof(sin));
+	}
+
+	purple_dnsquery_set_ui_ops(&dns_ui_ops);
+
+	done = FALSE;
+	connected_fd = -1;
+	connect_error = NULL;
+}
+
+static void
+proxy_teardown(void)
+{
+	int i;
+
+	purple_dnsquery_set_ui_ops(NULL);
+
+	for (i = 0; i < 4; i++)
+		close(blackhole_fillers[i]);
+	close(blackhole_fd);
+	close(live_fd);
+	if (connected_fd >= 0)
+		close(connected_fd);
+	g_free(connect_error);
+}
+
+static void
+proxy_connect_cb(gpointer data, gint source, const gchar *error_message)
+{
+	done = TRUE;
+	connected_fd = source;
+	connect_error = g_strdup(error_message);
+}
+
+/* Returns how many seconds it took */
+static double
+proxy_connect(const char **hosts)
+{
+	GTimer *timer = g_timer_new();
+	double elapsed;
+
+	addresses = hosts;
+	fail_unless(purple_proxy_connect(NULL, NULL, "racer", port,
+				proxy_connect_cb, NULL) != NULL, NULL);
+
+	while (!done && g_timer_elapsed(timer, NULL) < 10)
+		g_main_context_iteration(NULL, TRUE);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+	fail_unless(done, NULL);
+
+	return elapsed;
+}
+
+static void
+assert_connected_to_live(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	fail_unless(connected_fd >= 0, NULL);
+	fail_unless(getpeername(connected_fd, (struct sockaddr *)&sin, &len) == 0, NULL);
+	fail_unless(sin.sin_addr.s_addr == inet_addr(LIVE), NULL);
+}
+
+START_TEST(test_proxy_race_blackholes)
+{
+	const char *hosts[] = { BLACKHOLE, BLACKHOLE, LIVE, NULL };
+
+	/* One at a time, this would take two whole TCP timeouts */
+	fail_unless(proxy_connect(hosts) < 2, NULL);
+	assert_connected_to_live();
+}
+END_TEST
+
+START_TEST(test_proxy_race_http)
+{
+	const char *hosts[] = { BLACKHOLE, LIVE, NULL };
+	PurpleProxyInfo *info = purple_global_proxy_get_info();
+
+	/* The race is for the proxy's address, whatever its type */
+	purple_proxy_info_set_type(info, PURPLE_PROXY_HTTP);
+	purple_proxy_info_set_host(info, "racer");
+	purple_proxy_info_set_port(info, port);
+
+	addresses = hosts;
+	fail_unless(purple_proxy_connect(NULL, NULL, "www.example.com", 80,
+				proxy_connect_cb, NULL) != NULL, NULL);
+	while (!done)
+		g_main_context_iteration(NULL, TRUE);
+	assert_connected_to_live();
+
+	purple_proxy_info_set_type(info, PURPLE_PROXY_NONE);
+	purple_proxy_info_set_host(info, NULL);
+	purple_proxy_info_set_port(info, 0);
+}
+END_TEST
+
+START_TEST(test_proxy_race_refused)
+{
+	const char *hosts[] = { REFUSED, REFUSED, BLACKHOLE, LIVE, NULL };
+
+	proxy_connect(hosts);
+	assert_connected_to_live();
+}
+END_TEST
+
+START_TEST(test_proxy_race_all_failed)
+{
+	const char *hosts[] = { REFUSED, REFUSED, NULL };
+
+	proxy_connect(hosts);
+	fail_unless(connected_fd == -1, NULL);
+	fail_unless(connect_error != NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_proxy_race_cancel)
+{
+	const char *hosts[] = { BLACKHOLE, BLACKHOLE, NULL };
+	PurpleProxyConnectData *connect_data;
+	GTimer *timer = g_timer_new();
+
+	addresses = hosts;
+	connect_data = purple_proxy_connect(NULL, NULL, "racer", port,
+			proxy_connect_cb, NULL);
+
+	/* Let both attempts get going */
+	while (g_timer_elapsed(timer, NULL) < 0.5)
+		g_main_context_iteration(NULL, FALSE);
+	g_timer_destroy(timer);
+
+	purple_proxy_connect_cancel(connect_data);
+	g_main_context_iteration(NULL, FALSE);
+	fail_if(done, NULL);
+}
+END_TEST
+
+Suite *
+proxy_suite(void)
+{
+	Suite *s = suite_create("Proxy");
+
+	TCase *tc = tcase_create("Connection racing");
+	tcase_add_checked_fixture(tc, proxy_setup, proxy_teardown);
+	tcase_add_test(tc, test_proxy_race_blackholes);
+	tcase_add_test(tc, test_proxy_race_http);
+	tcase_add_test(tc, test_proxy_race_refused);
+	tcase_add_test(tc, test_proxy_race_all_failed);
+	tcase_add_test(tc, test_proxy_race_cancel);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
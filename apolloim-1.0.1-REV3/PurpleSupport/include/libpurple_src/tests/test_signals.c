@@ -0,0 +1,148 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../signals.h"
+
+static int signals_instance;
+static int signals_handle;
+static GString *calls;
+
+static void
+signals_setup(void)
+{
+	purple_signal_register(&signals_instance, "test-signal",
+						 purple_marshal_VOID__POINTER, NULL, 1,
+						 purple_value_new(PURPLE_TYPE_POINTER));
+	purple_signal_register(&signals_instance, "test-signal-return",
+						 purple_marshal_POINTER__POINTER_POINTER,
+						 purple_value_new(PURPLE_TYPE_POINTER), 2,
+						 purple_value_new(PURPLE_TYPE_POINTER),
+						 purple_value_new(PURPLE_TYPE_POINTER));
+	calls = g_string_new(NULL);
+}
+
+static void
+signals_teardown(void)
+{
+	purple_signals_disconnect_by_handle(&signals_handle);
+	purple_signals_unregister_by_instance(&signals_instance);
+	g_string_free(calls, TRUE);
+}
+
+static void
+handler_a(const char *arg, gpointer data)
+{
+	g_string_append_printf(calls, "a%s", arg);
+}
+
+static void
+handler_b(const char *arg, gpointer data)
+{
+	g_string_append_printf(calls, "b%s", arg);
+}
+
+static void
+handler_c(const char *arg, gpointer data)
+{
+	g_string_append_printf(calls, "c%s", arg);
+}
+
+static void
+handler_disconnect_b(const char *arg, gpointer data)
+{
+	g_string_append(calls, "d");
+	purple_signal_disconnect(&signals_instance, "test-signal",
+						   &signals_handle, PURPLE_CALLBACK(handler_b));
+	purple_signal_connect(&signals_instance, "test-signal",
+						&signals_handle, PURPLE_CALLBACK(handler_c), NULL);
+}
+
+static void *
+handler_return(const char *arg, gpointer unused, gpointer data)
+{
+	g_string_append(calls, arg);
+	return data;
+}
+
+START_TEST(test_signals_priority)
+{
+	PurpleSignal *signal;
+
+	signal = purple_signal_lookup(&signals_instance, "test-signal");
+	fail_unless(signal != NULL, NULL);
+
+	purple_signal_connect(&signals_instance, "test-signal",
+						&signals_handle, PURPLE_CALLBACK(handler_a), NULL);
+	purple_signal_connect_priority(&signals_instance, "test-signal",
+						&signals_handle, PURPLE_CALLBACK(handler_b), NULL,
+						PURPLE_SIGNAL_PRIORITY_LOWEST);
+
+	purple_signal_emit(&signals_instance, "test-signal", "1");
+	purple_signal_emit_by_signal(signal, "2");
+	assert_string_equal("b1a1b2a2", calls->str);
+
+	purple_signal_disconnect(&signals_instance, "test-signal",
+						   &signals_handle, PURPLE_CALLBACK(handler_b));
+	purple_signal_emit_by_signal(signal, "3");
+	assert_string_equal("b1a1b2a2a3", calls->str);
+}
+END_TEST
+
+START_TEST(test_signals_change_during_emit)
+{
+	PurpleSignal *signal;
+
+	signal = purple_signal_lookup(&signals_instance, "test-signal");
+
+	purple_signal_connect_priority(&signals_instance, "test-signal",
+						&signals_handle, PURPLE_CALLBACK(handler_disconnect_b),
+						NULL, PURPLE_SIGNAL_PRIORITY_LOWEST);
+	purple_signal_connect(&signals_instance, "test-signal",
+						&signals_handle, PURPLE_CALLBACK(handler_b), NULL);
+
+	/* b is skipped once disconnected, c only runs from the next emission. */
+	purple_signal_emit_by_signal(signal, "1");
+	assert_string_equal("d", calls->str);
+
+	purple_signal_disconnect(&signals_instance, "test-signal",
+						   &signals_handle, PURPLE_CALLBACK(handler_disconnect_b));
+	purple_signal_emit_by_signal(signal, "2");
+	assert_string_equal("dc2", calls->str);
+}
+END_TEST
+
+START_TEST(test_signals_return_1)
+{
+	PurpleSignal *signal;
+	int result;
+
+	signal = purple_signal_lookup(&signals_instance, "test-signal-return");
+	fail_unless(purple_signal_emit_by_signal_return_1(signal, "x", NULL) == NULL, NULL);
+
+	purple_signal_connect(&signals_instance, "test-signal-return",
+						&signals_handle, PURPLE_CALLBACK(handler_return), &result);
+	purple_signal_connect_priority(&signals_instance, "test-signal-return",
+						&signals_handle, PURPLE_CALLBACK(handler_return), NULL,
+						PURPLE_SIGNAL_PRIORITY_HIGHEST);
+
+	fail_unless(purple_signal_emit_by_signal_return_1(signal, "1", NULL) == &result, NULL);
+	fail_unless(purple_signal_emit_return_1(&signals_instance,
+				"test-signal-return", "2", NULL) == &result, NULL);
+	assert_string_equal("12", calls->str);
+}
+END_TEST
+
+Suite *
+signals_suite(void)
+{
+	Suite *s = suite_create("Signals");
+
+	TCase *tc = tcase_create("Emission");
+	tcase_add_checked_fixture(tc, signals_setup, signals_teardown);
+	tcase_add_test(tc, test_signals_priority);
+	tcase_add_test(tc, test_signals_change_during_emit);
+	tcase_add_test(tc, test_signals_return_1);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,274 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../prefs.h"
+#include "../signals.h"
+#include "../status.h"
+
+static PurpleStatusType *type;
+static PurplePresence *presence;
+static PurpleStatus *status;
+
+static void
+status_setup(void)
+{
+	PurpleValue *priority = purple_value_new(PURPLE_TYPE_INT);
+
+	purple_value_set_int(priority, 5);
+	type = purple_status_type_new_with_attrs(PURPLE_STATUS_AWAY, "away", "Away",
+			TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING),
+			"priority", "Priority", priority,
+			NULL);
+	presence = purple_presence_new(PURPLE_PRESENCE_CONTEXT_CONV);
+	status = purple_status_new(type, presence);
+	purple_presence_add_status(presence, status);
+}
+
+static void
+status_teardown(void)
+{
+	purple_presence_destroy(presence);
+	purple_status_type_destroy(type);
+}
+
+static const PurpleValue *
+default_value(const char *id)
+{
+	return purple_status_attr_get_value(purple_status_type_get_attr(type, id));
+}
+
+START_TEST(test_status_attr_defaults)
+{
+	fail_unless(purple_status_get_attr_string(status, "message") == NULL, NULL);
+	fail_unless(purple_status_get_attr_int(status, "priority") == 5, NULL);
+	fail_unless(purple_status_get_attr_value(status, "unknown") == NULL, NULL);
+	fail_unless(purple_presence_get_status(presence, "away") == status, NULL);
+	fail_unless(purple_presence_get_status(presence, "available") == NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_status_attr_set)
+{
+	GList *attrs = NULL;
+
+	attrs = g_list_append(attrs, "message");
+	attrs = g_list_append(attrs, "Out to lunch");
+	purple_status_set_active_with_attrs_list(status, TRUE, attrs);
+	g_list_free(attrs);
+
+	assert_string_equal("Out to lunch", purple_status_get_attr_string(status, "message"));
+	purple_status_set_attr_int(status, "priority", 7);
+	fail_unless(purple_status_get_attr_int(status, "priority") == 7, NULL);
+
+	/* The defaults shared by the status type must not change. */
+	fail_unless(purple_value_get_string(default_value("message")) == NULL, NULL);
+	fail_unless(purple_value_get_int(default_value("priority")) == 5, NULL);
+
+	/* Activating without attributes resets them all. */
+	purple_status_set_active(status, TRUE);
+	fail_unless(purple_status_get_attr_string(status, "message") == NULL, NULL);
+	fail_unless(purple_status_get_attr_int(status, "priority") == 5, NULL);
+}
+END_TEST
+
+static PurpleAccount *account;
+static PurpleBuddy *buddy, *carol;
+static PurpleStatusType *available_type;
+static PurpleStatus *available, *away, *carol_away;
+static GString *changes;
+static gboolean rearm;
+
+static void
+status_changed_cb(PurpleBuddy *b, PurpleStatus *old_status, PurpleStatus *new_status)
+{
+	const char *message = purple_status_get_attr_string(new_status, "message");
+
+	g_string_append_printf(changes, "%s->%s(%s);", purple_status_get_id(old_status),
+			purple_status_get_id(new_status), message ? message : "");
+}
+
+static void got_status(PurpleStatus *new_status, const char *message);
+
+/* Changes bob's status again from inside the first round of handlers */
+static void
+rearm_cb(PurpleBuddy *b, PurpleStatus *old_status, PurpleStatus *new_status)
+{
+	if (rearm && b == buddy) {
+		rearm = FALSE;
+		got_status(available, NULL);
+	}
+}
+
+/* Gives a buddy an active available status and an inactive away one */
+static PurpleStatus *
+add_statuses(PurpleBuddy *b, PurpleStatus **away_status)
+{
+	PurplePresence *buddy_presence = purple_buddy_get_presence(b);
+	PurpleStatus *available_status;
+
+	available_status = purple_status_new(available_type, buddy_presence);
+	*away_status = purple_status_new(type, buddy_presence);
+	purple_presence_add_status(buddy_presence, available_status);
+	purple_presence_add_status(buddy_presence, *away_status);
+	purple_status_set_active(available_status, TRUE);
+
+	return available_status;
+}
+
+static void
+coalesce_setup(void)
+{
+	/* The UI normally creates the buddy list */
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+
+	account = purple_account_new("me@example.com", PURPLE_CHECK_PRPL_ID);
+	buddy = purple_buddy_new(account, "bob@example.com", NULL);
+	purple_blist_add_buddy(buddy, NULL, NULL, NULL);
+	carol = purple_buddy_new(account, "carol@example.com", NULL);
+	purple_blist_add_buddy(carol, NULL, NULL, NULL);
+
+	status_setup();
+	available_type = purple_status_type_new(PURPLE_STATUS_AVAILABLE, "available",
+			"Available", TRUE);
+	available = add_statuses(buddy, &away);
+	add_statuses(carol, &carol_away);
+
+	changes = g_string_new(NULL);
+	rearm = FALSE;
+	purple_signal_connect(purple_blist_get_handle(), "buddy-status-changed",
+			&changes, PURPLE_CALLBACK(status_changed_cb), NULL);
+	purple_signal_connect(purple_blist_get_handle(), "buddy-status-changed",
+			&changes, PURPLE_CALLBACK(rearm_cb), NULL);
+	purple_prefs_set_int("/purple/buddies/status_coalesce_interval", 50);
+}
+
+static void
+coalesce_teardown(void)
+{
+	PurpleGroup *group = purple_buddy_get_group(buddy);
+
+	purple_signals_disconnect_by_handle(&changes);
+	g_string_free(changes, TRUE);
+
+	purple_blist_remove_buddy(buddy);
+	purple_blist_remove_buddy(carol);
+	purple_blist_remove_group(group);
+	purple_account_destroy(account);
+	status_teardown();
+	purple_status_type_destroy(available_type);
+}
+
+/* As purple_prpl_got_user_status() does it */
+static void
+got_buddy_status(PurpleBuddy *b, PurpleStatus *new_status, const char *message)
+{
+	PurpleStatus *old_status =
+		purple_presence_get_active_status(purple_buddy_get_presence(b));
+	GList *attrs = NULL;
+
+	if (message != NULL) {
+		attrs = g_list_append(attrs, "message");
+		attrs = g_list_append(attrs, (char *)message);
+	}
+	purple_status_set_active_with_attrs_list(new_status, TRUE, attrs);
+	g_list_free(attrs);
+
+	purple_blist_update_buddy_status(b, old_status);
+}
+
+static void
+got_status(PurpleStatus *new_status, const char *message)
+{
+	got_buddy_status(buddy, new_status, message);
+}
+
+/* Runs the event loop until the coalesced changes have gone out. */
+static void
+coalesce_wait(void)
+{
+	GTimer *timer = g_timer_new();
+
+	while (g_timer_elapsed(timer, NULL) < 0.2)
+		g_main_context_iteration(NULL, FALSE);
+	g_timer_destroy(timer);
+}
+
+START_TEST(test_status_coalesce)
+{
+	got_status(away, "lunch");
+	got_status(available, NULL);
+	got_status(away, "meeting");
+	assert_string_equal("", changes->str);
+
+	coalesce_wait();
+	assert_string_equal("available->away(meeting);", changes->str);
+}
+END_TEST
+
+START_TEST(test_status_coalesce_noop)
+{
+	got_status(away, "lunch");
+	coalesce_wait();
+	g_string_truncate(changes, 0);
+
+	/* Back where it started, so nothing to report */
+	got_status(available, NULL);
+	got_status(away, "lunch");
+	coalesce_wait();
+	assert_string_equal("", changes->str);
+
+	/* But a new message on the same status is a change */
+	got_status(available, NULL);
+	got_status(away, "meeting");
+	coalesce_wait();
+	assert_string_equal("away->away(meeting);", changes->str);
+	g_string_truncate(changes, 0);
+
+	got_status(away, "gone home");
+	coalesce_wait();
+	assert_string_equal("away->away(gone home);", changes->str);
+}
+END_TEST
+
+START_TEST(test_status_coalesce_rearm)
+{
+	got_status(away, "lunch");
+	got_buddy_status(carol, carol_away, "meeting");
+	rearm = TRUE;
+
+	while (changes->len == 0)
+		g_main_context_iteration(NULL, TRUE);
+
+	/* Carol still goes out with bob; bob's change from the handler waits */
+	assert_string_equal("available->away(lunch);available->away(meeting);", changes->str);
+
+	coalesce_wait();
+	assert_string_equal("available->away(lunch);available->away(meeting);"
+			"away->available();", changes->str);
+}
+END_TEST
+
+Suite *
+status_suite(void)
+{
+	Suite *s = suite_create("Status");
+
+	TCase *tc = tcase_create("Attributes");
+	tcase_add_checked_fixture(tc, status_setup, status_teardown);
+	tcase_add_test(tc, test_status_attr_defaults);
+	tcase_add_test(tc, test_status_attr_set);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Coalescing");
+	tcase_add_checked_fixture(tc, coalesce_setup, coalesce_teardown);
+	tcase_add_test(tc, test_status_coalesce);
+	tcase_add_test(tc, test_status_coalesce_noop);
+	tcase_add_test(tc, test_status_coalesce_rearm);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../xmlnode.h"
+
+struct stream_data {
+	int opened;
+	int elements;
+	GString *names;
+};
+
+static void
+stream_open_cb(xmlnode *node, gpointer user_data)
+{
+	struct stream_data *data = user_data;
+
+	fail_unless(node->child == NULL || node->child->type == XMLNODE_TYPE_ATTRIB, NULL);
+	data->opened++;
+}
+
+static void
+stream_element_cb(xmlnode *node, xmlnode *parent, gpointer user_data)
+{
+	struct stream_data *data = user_data;
+
+	fail_unless(node->parent == NULL, NULL);
+	fail_unless(parent != NULL, NULL);
+	assert_string_equal("group", parent->name);
+
+	g_string_append(data->names, xmlnode_get_attrib(node, "name"));
+	data->elements++;
+
+	xmlnode_free(node);
+}
+
+START_TEST(test_xmlnode_stream_chunks)
+{
+	const char *doc =
+		"<?xml version='1.0' encoding='UTF-8' ?>\n"
+		"<blist>\n"
+		"\t<group name='a'>\n"
+		"\t\t<buddy name='1'><alias>one</alias></buddy>\n"
+		"\t\t<buddy name='2'/>\n"
+		"\t</group>\n"
+		"\t<group name='b'><buddy name='3'/></group>\n"
+		"</blist>\n";
+	struct stream_data data = { 0, 0, NULL };
+	xmlnode_stream *stream;
+	xmlnode *root, *group;
+	size_t i;
+
+	data.names = g_string_new(NULL);
+	stream = xmlnode_stream_new(2, stream_open_cb, stream_element_cb, &data);
+
+	/* Feed it a byte at a time to make sure nothing depends on chunking */
+	for (i = 0; i < strlen(doc); i++)
+		fail_unless(xmlnode_stream_feed(stream, doc + i, 1), NULL);
+
+	root = xmlnode_stream_end(stream);
+	fail_unless(root != NULL, NULL);
+	assert_string_equal("blist", root->name);
+
+	fail_unless(data.opened == 3, NULL);
+	fail_unless(data.elements == 3, NULL);
+	assert_string_equal("123", data.names->str);
+
+	/* The skeleton keeps the groups and their attributes, nothing else */
+	group = xmlnode_get_child(root, "group");
+	fail_unless(group != NULL, NULL);
+	assert_string_equal("a", xmlnode_get_attrib(group, "name"));
+	fail_unless(xmlnode_get_child(group, "buddy") == NULL, NULL);
+	fail_unless(xmlnode_get_data(root) == NULL, NULL);
+
+	xmlnode_free(root);
+	g_string_free(data.names, TRUE);
+}
+END_TEST
+
+START_TEST(test_xmlnode_stream_large)
+{
+	struct stream_data data = { 0, 0, NULL };
+	xmlnode_stream *stream;
+	xmlnode *root, *group;
+	GString *doc = g_string_new("<?xml version='1.0' encoding='UTF-8' ?>\n<blist>\n");
+	gsize offset, len;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 100 == 0)
+			g_string_append_printf(doc, "%s\t<group name='g%d'>\n",
+					i > 0 ? "\t</group>\n" : "", i / 100);
+		g_string_append_printf(doc,
+				"\t\t<buddy name='%d'><alias>buddy number %d</alias></buddy>\n", i % 10, i);
+	}
+	g_string_append(doc, "\t</group>\n</blist>\n");
+
+	data.names = g_string_new(NULL);
+	stream = xmlnode_stream_new(2, stream_open_cb, stream_element_cb, &data);
+
+	/* Chunks much smaller than the document, so that most of them end
+	 * deep inside a buddy that is about to be handed off and freed */
+	for (offset = 0; offset < doc->len; offset += len) {
+		len = MIN(4093, doc->len - offset);
+		fail_unless(xmlnode_stream_feed(stream, doc->str + offset, len), NULL);
+	}
+
+	root = xmlnode_stream_end(stream);
+	fail_unless(root != NULL, NULL);
+	assert_string_equal("blist", root->name);
+	fail_unless(root->parent == NULL, NULL);
+
+	fail_unless(data.opened == 11, NULL);
+	fail_unless(data.elements == 1000, NULL);
+
+	/* Every group is still there, and none of the buddies */
+	i = 0;
+	for (group = xmlnode_get_child(root, "group"); group != NULL;
+			group = xmlnode_get_next_twin(group)) {
+		fail_unless(xmlnode_get_child(group, "buddy") == NULL, NULL);
+		i++;
+	}
+	fail_unless(i == 10, NULL);
+
+	xmlnode_free(root);
+	g_string_free(data.names, TRUE);
+	g_string_free(doc, TRUE);
+}
+END_TEST
+
+START_TEST(test_xmlnode_stream_error)
+{
+	struct stream_data data = { 0, 0, NULL };
+	xmlnode_stream *stream;
+
+	data.names = g_string_new(NULL);
+	stream = xmlnode_stream_new(2, NULL, stream_element_cb, &data);
+
+	xmlnode_stream_feed(stream, "<blist><group><buddy name='1'/></grou></blist>", -1);
+	fail_unless(xmlnode_stream_end(stream) == NULL, NULL);
+
+	g_string_free(data.names, TRUE);
+}
+END_TEST
+
+START_TEST(test_xmlnode_arena_parse)
+{
+	const char *stanza =
+		"<message to='a@b/c' type='chat' xmlns='jabber:client'>"
+		"<body>hello &amp; goodbye</body>"
+		"<x xmlns='jabber:x:event'><composing/></x>"
+		"</message>";
+	xmlnode *heap, *arena, *other, *body;
+	char *a, *b;
+
+	heap = xmlnode_from_str(stanza, -1);
+	arena = xmlnode_from_str_arena(stanza, -1);
+	fail_unless(heap != NULL, NULL);
+	fail_unless(arena != NULL, NULL);
+	fail_unless(arena->arena != NULL, NULL);
+
+	a = xmlnode_to_str(heap, NULL);
+	b = xmlnode_to_str(arena, NULL);
+	assert_string_equal(a, b);
+	g_free(a);
+	g_free(b);
+
+	body = xmlnode_get_child(arena, "body");
+	assert_string_equal_free("hello & goodbye", xmlnode_get_data(body));
+
+	/* Names are shared between arenas */
+	other = xmlnode_from_str_arena(stanza, -1);
+	fail_unless(xmlnode_get_child(other, "body")->name == body->name, NULL);
+	fail_unless(other->xmlns == arena->xmlns, NULL);
+
+	xmlnode_free(heap);
+	xmlnode_free(arena);
+	xmlnode_free(other);
+}
+END_TEST
+
+START_TEST(test_xmlnode_arena_mixed)
+{
+	xmlnode *root, *child, *heap, *copy;
+	char *str;
+
+	root = xmlnode_new_arena("iq");
+	xmlnode_set_attrib(root, "type", "get");
+	xmlnode_set_attrib(root, "type", "set");
+	child = xmlnode_new_child(root, "query");
+	xmlnode_set_namespace(child, "jabber:iq:roster");
+	fail_unless(child->arena == root->arena, NULL);
+
+	/* Heap nodes inserted into an arena tree are freed along with it */
+	heap = xmlnode_new("item");
+	xmlnode_set_attrib(heap, "jid", "a@b");
+	xmlnode_insert_child(child, heap);
+	xmlnode_insert_data(xmlnode_new_child(heap, "group"), "Friends", -1);
+
+	/* Removing part of an arena tree only unlinks it */
+	xmlnode_free(xmlnode_new_child(root, "error"));
+
+	str = xmlnode_to_str(root, NULL);
+	assert_string_equal("<iq type='set'><query xmlns='jabber:iq:roster'>"
+			"<item jid='a@b'><group>Friends</group></item></query></iq>", str);
+	g_free(str);
+
+	/* Copies never share the arena */
+	copy = xmlnode_copy(root);
+	fail_unless(copy->arena == NULL, NULL);
+	xmlnode_free(root);
+
+	str = xmlnode_to_str(copy, NULL);
+	assert_string_equal("<iq type='set'><query xmlns='jabber:iq:roster'>"
+			"<item jid='a@b'><group>Friends</group></item></query></iq>", str);
+	g_free(str);
+	xmlnode_free(copy);
+}
+END_TEST
+
+static gboolean
+write_to_gstring(const char *data, gsize len, gpointer user_data)
+{
+	g_string_append_len(user_data, data, len);
+	return TRUE;
+}
+
+START_TEST(test_xmlnode_write)
+{
+	xmlnode *root, *child;
+	GString *out = g_string_new(NULL);
+	char *str;
+	int len;
+
+	root = xmlnode_new("a");
+	xmlnode_set_attrib(root, "q", "it's \"<&>\"");
+	child = xmlnode_new_child(root, "b");
+	xmlnode_set_namespace(child, "urn:x");
+	xmlnode_new_child(child, "c");
+	xmlnode_insert_data(xmlnode_new_child(root, "d"), "1 < 2 & 3 > 2", -1);
+
+	str = xmlnode_to_str(root, &len);
+	assert_string_equal("<a q='it&apos;s &quot;&lt;&amp;&gt;&quot;'>"
+			"<b xmlns='urn:x'><c/></b><d>1 &lt; 2 &amp; 3 &gt; 2</d></a>", str);
+	fail_unless(len == strlen(str), NULL);
+	fail_unless(xmlnode_write(root, FALSE, NULL, NULL) == len, NULL);
+
+	fail_unless(xmlnode_write(root, FALSE, write_to_gstring, out) == len, NULL);
+	assert_string_equal(str, out->str);
+	g_free(str);
+
+	str = xmlnode_to_formatted_str(root, &len);
+	assert_string_equal("<?xml version='1.0' encoding='UTF-8' ?>\n\n"
+			"<a q='it&apos;s &quot;&lt;&amp;&gt;&quot;'>\n"
+			"\t<b xmlns='urn:x'>\n"
+			"\t\t<c/>\n"
+			"\t</b>\n"
+			"\t<d>1 &lt; 2 &amp; 3 &gt; 2</d>\n"
+			"</a>\n", str);
+	fail_unless(xmlnode_write(root, TRUE, NULL, NULL) == len, NULL);
+	g_free(str);
+
+	g_string_free(out, TRUE);
+	xmlnode_free(root);
+}
+END_TEST
+
+Suite *
+xmlnode_suite(void)
+{
+	Suite *s = suite_create("XML Nodes");
+
+	TCase *tc = tcase_create("Streaming");
+	tcase_add_test(tc, test_xmlnode_stream_chunks);
+	tcase_add_test(tc, test_xmlnode_stream_large);
+	tcase_add_test(tc, test_xmlnode_stream_error);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Serialization");
+	tcase_add_test(tc, test_xmlnode_write);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Arenas");
+	tcase_add_test(tc, test_xmlnode_arena_parse);
+	tcase_add_test(tc, test_xmlnode_arena_mixed);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
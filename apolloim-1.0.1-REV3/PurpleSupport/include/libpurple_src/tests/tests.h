@@ -7,9 +7,27 @@
 /* define the test suites here */
 /* remember to add the suite to the runner in check_libpurple.c */
 Suite * master_suite(void);
+Suite * blist_suite(void);
 Suite * cipher_suite(void);
+Suite * dnsresolver_suite(void);
+Suite * ft_suite(void);
+Suite * httpclient_suite(void);
+Suite * jabber_caps_suite(void);
+Suite * jabber_compress_suite(void);
 Suite * jabber_jutil_suite(void);
+Suite * jabber_roster_suite(void);
+Suite * jabber_sm_suite(void);
+Suite * log_suite(void);
+Suite * msn_sync_suite(void);
+Suite * oscar_feedbag_suite(void);
+Suite * proxy_suite(void);
+Suite * signals_suite(void);
+Suite * status_suite(void);
 Suite * util_suite(void);
+Suite * xmlnode_suite(void);
+
+/* the protocol registered for the tests' accounts */
+#define PURPLE_CHECK_PRPL_ID "prpl-null"
 
 /* helper macros */
 #define assert_string_equal(expected, actual) { \
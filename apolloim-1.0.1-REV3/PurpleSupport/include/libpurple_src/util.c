@@ -26,6 +26,7 @@
 #include "conversation.h"
 #include "core.h"
 #include "debug.h"
+#include "httpclient.h"
 #include "notify.h"
 #include "prpl.h"
 #include "prefs.h"
@@ -52,18 +53,9 @@ struct _PurpleUtilFetchUrlData
 	char *user_agent;
 	gboolean http11;
 	char *request;
-	gsize request_written;
 	gboolean include_headers;
 
-	PurpleProxyConnectData *connect_data;
-	int fd;
-	guint inpa;
-
-	gboolean got_headers;
-	gboolean has_explicit_data_len;
-	char *webdata;
-	unsigned long len;
-	unsigned long data_len;
+	PurpleHttpClientRequest *http_request;
 };
 
 static char *custom_user_dir = NULL;
@@ -2538,8 +2530,10 @@ int purple_build_dir (const char *path, int mode)
  * it includes lots of error checking so as we don't overwrite
  * people's settings if there is a problem writing the new values.
  */
-gboolean
-purple_util_write_data_to_file(const char *filename, const char *data, size_t size)
+static gboolean
+write_file_contents(const char *filename,
+					size_t (*writer)(FILE *file, gpointer data, size_t *real_size),
+					gpointer data)
 {
 	const char *user_dir = purple_user_dir();
 	gchar *filename_temp, *filename_full;
@@ -2588,8 +2582,7 @@ purple_util_write_data_to_file(const char *filename, const char *data, size_t si
 	}
 
 	/* Write to file */
-	real_size = (size == -1) ? strlen(data) : size;
-	byteswritten = fwrite(data, 1, real_size, file);
+	byteswritten = writer(file, data, &real_size);
 
 	/* Close file */
 	if (fclose(file) != 0)
@@ -2644,6 +2637,73 @@ purple_util_write_data_to_file(const char *filename, const char *data, size_t si
 	return TRUE;
 }
 
+struct write_data {
+	const char *data;
+	size_t size;
+};
+
+static size_t
+write_data_writer(FILE *file, gpointer data, size_t *real_size)
+{
+	struct write_data *wd = data;
+
+	*real_size = (wd->size == -1) ? strlen(wd->data) : wd->size;
+	return fwrite(wd->data, 1, *real_size, file);
+}
+
+gboolean
+purple_util_write_data_to_file(const char *filename, const char *data, size_t size)
+{
+	struct write_data wd;
+
+	wd.data = data;
+	wd.size = size;
+
+	return write_file_contents(filename, write_data_writer, &wd);
+}
+
+static gboolean
+write_xml_cb(const char *data, gsize len, gpointer user_data)
+{
+	return fwrite(data, 1, len, user_data) == len;
+}
+
+static size_t
+write_xml_writer(FILE *file, gpointer data, size_t *real_size)
+{
+	gssize written;
+
+	/* The size is worked out up front, so a short write can be caught
+	 * the same way as for purple_util_write_data_to_file() */
+	*real_size = xmlnode_write(data, TRUE, NULL, NULL);
+	written = xmlnode_write(data, TRUE, write_xml_cb, file);
+
+	return (written < 0) ? 0 : written;
+}
+
+gboolean
+purple_util_write_xml_to_file(const char *filename, xmlnode *node)
+{
+	g_return_val_if_fail(node != NULL, FALSE);
+
+	return write_file_contents(filename, write_xml_writer, node);
+}
+
+static void
+read_xml_error(const char *filename, const char *filename_full,
+			   const char *description)
+{
+	gchar *title, *msg;
+
+	title = g_strdup_printf(_("Error Reading %s"), filename);
+	msg = g_strdup_printf(_("An error was encountered reading your "
+				"%s.  They have not been loaded, and the old file "
+				"has been renamed to %s~."), description, filename_full);
+	purple_notify_error(NULL, NULL, title, msg);
+	g_free(title);
+	g_free(msg);
+}
+
 xmlnode *
 purple_util_read_xml_from_file(const char *filename, const char *description)
 {
@@ -2678,7 +2738,7 @@ purple_util_read_xml_from_file(const char *filename, const char *description)
 
 	if ((contents != NULL) && (length > 0))
 	{
-		node = xmlnode_from_str(contents, length);
+		node = xmlnode_from_str_arena(contents, length);
 
 		/* If we were unable to parse the file then save its contents to a backup file */
 		if (node == NULL)
@@ -2697,15 +2757,97 @@ purple_util_read_xml_from_file(const char *filename, const char *description)
 
 	/* If we could not parse the file then show the user an error message */
 	if (node == NULL)
+		read_xml_error(filename, filename_full, description);
+
+	g_free(filename_full);
+
+	return node;
+}
+
+xmlnode *
+purple_util_read_xml_from_file_streamed(const char *filename,
+		const char *description, int depth,
+		xmlnode_stream_open_cb open_cb, xmlnode_stream_element_cb element_cb,
+		gpointer user_data)
+{
+	const char *user_dir = purple_user_dir();
+	gchar *filename_full;
+	gchar buf[32768];
+	gsize length, total = 0;
+	xmlnode_stream *stream;
+	xmlnode *node = NULL;
+	FILE *file;
+
+	g_return_val_if_fail(user_dir != NULL, NULL);
+
+	purple_debug_info("util", "Streaming file %s from directory %s\n",
+					filename, user_dir);
+
+	filename_full = g_build_filename(user_dir, filename, NULL);
+
+	if (!g_file_test(filename_full, G_FILE_TEST_EXISTS))
+	{
+		purple_debug_info("util", "File %s does not exist (this is not "
+						"necessarily an error)\n", filename_full);
+		g_free(filename_full);
+		return NULL;
+	}
+
+	if ((file = g_fopen(filename_full, "rb")) == NULL)
+	{
+		purple_debug_error("util", "Error reading file %s: %s\n",
+						 filename_full, strerror(errno));
+		read_xml_error(filename, filename_full, description);
+		g_free(filename_full);
+		return NULL;
+	}
+
+	stream = xmlnode_stream_new(depth, open_cb, element_cb, user_data);
+	if (stream == NULL)
+	{
+		fclose(file);
+		g_free(filename_full);
+		return NULL;
+	}
+
+	while ((length = fread(buf, 1, sizeof(buf), file)) > 0)
+	{
+		total += length;
+		if (!xmlnode_stream_feed(stream, buf, length))
+			break;
+	}
+
+	if (ferror(file))
 	{
-		gchar *title, *msg;
-		title = g_strdup_printf(_("Error Reading %s"), filename);
-		msg = g_strdup_printf(_("An error was encountered reading your "
-					"%s.  They have not been loaded, and the old file "
-					"has been renamed to %s~."), description, filename_full);
-		purple_notify_error(NULL, NULL, title, msg);
-		g_free(title);
-		g_free(msg);
+		purple_debug_error("util", "Error reading file %s: %s\n",
+						 filename_full, strerror(errno));
+		xmlnode_stream_free(stream);
+	}
+	else if (total > 0)
+		node = xmlnode_stream_end(stream);
+	else
+		xmlnode_stream_free(stream);
+
+	fclose(file);
+
+	if (node == NULL)
+	{
+		gchar *contents;
+
+		/* Only the broken file is read whole, to keep a backup of it */
+		if (total > 0 && g_file_get_contents(filename_full, &contents, &length, NULL))
+		{
+			gchar *filename_temp;
+
+			filename_temp = g_strdup_printf("%s~", filename);
+			purple_debug_error("util", "Error parsing file %s.  Renaming old "
+							 "file to %s\n", filename_full, filename_temp);
+			purple_util_write_data_to_file(filename_temp, contents, length);
+			g_free(filename_temp);
+			g_free(contents);
+		}
+
+		read_xml_error(filename, filename_full, description);
 	}
 
 	g_free(filename_full);
@@ -3478,10 +3620,10 @@ purple_util_fetch_url_error(PurpleUtilFetchUrlData *gfud, const char *format, ..
 	purple_util_fetch_url_cancel(gfud);
 }
 
-static void url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message);
+static void url_fetch_send(PurpleUtilFetchUrlData *gfud);
 
 static gboolean
-parse_redirect(const char *data, size_t data_len, gint sock,
+parse_redirect(const char *data, size_t data_len,
 			   PurpleUtilFetchUrlData *gfud)
 {
 	gchar *s;
@@ -3528,6 +3670,7 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 	gfud->num_times_redirected++;
 	if (gfud->num_times_redirected >= 5)
 	{
+		g_free(new_url);
 		purple_util_fetch_url_error(gfud,
 				_("Could not open %s: Redirected too many times"),
 				gfud->url);
@@ -3545,14 +3688,6 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 	g_free(gfud->request);
 	gfud->request = NULL;
 
-	purple_input_remove(gfud->inpa);
-	gfud->inpa = 0;
-	close(gfud->fd);
-	gfud->fd = -1;
-	gfud->request_written = 0;
-	gfud->len = 0;
-	gfud->data_len = 0;
-
 	g_free(gfud->website.user);
 	g_free(gfud->website.passwd);
 	g_free(gfud->website.address);
@@ -3560,244 +3695,64 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 	purple_url_parse(new_url, &gfud->website.address, &gfud->website.port,
 				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
 
-	gfud->connect_data = purple_proxy_connect(NULL, NULL,
-			gfud->website.address, gfud->website.port,
-			url_fetch_connect_cb, gfud);
-
-	if (gfud->connect_data == NULL)
-	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
-				gfud->website.address);
-	}
+	url_fetch_send(gfud);
 
 	return TRUE;
 }
 
-static size_t
-parse_content_len(const char *data, size_t data_len)
-{
-	size_t content_len = 0;
-	const char *p = NULL;
-
-	/* This is still technically wrong, since headers are case-insensitive
-	 * [RFC 2616, section 4.2], though this ought to catch the normal case.
-	 * Note: data is _not_ nul-terminated.
-	 */
-	if(data_len > 16) {
-		p = (strncmp(data, "Content-Length: ", 16) == 0) ? data : NULL;
-		if(!p)
-			p = (strncmp(data, "CONTENT-LENGTH: ", 16) == 0)
-				? data : NULL;
-		if(!p) {
-			p = g_strstr_len(data, data_len, "\nContent-Length: ");
-			if (p)
-				p++;
-		}
-		if(!p) {
-			p = g_strstr_len(data, data_len, "\nCONTENT-LENGTH: ");
-			if (p)
-				p++;
-		}
-
-		if(p)
-			p += 16;
-	}
-
-	/* If we can find a Content-Length header at all, try to sscanf it.
-	 * Response headers should end with at least \r\n, so sscanf is safe,
-	 * if we make sure that there is indeed a \n in our header.
-	 */
-	if (p && g_strstr_len(p, data_len - (p - data), "\n")) {
-		sscanf(p, "%" G_GSIZE_FORMAT, &content_len);
-		purple_debug_misc("util", "parsed %u\n", content_len);
-	}
-
-	return content_len;
-}
-
-
 static void
-url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
+url_fetch_response_cb(const PurpleHttpClientResponse *response,
+		const char *error_message, gpointer data)
 {
-	PurpleUtilFetchUrlData *gfud = url_data;
-	int len;
-	char buf[4096];
-	char *data_cursor;
-	gboolean got_eof = FALSE;
+	PurpleUtilFetchUrlData *gfud = data;
 
-	while((len = read(source, buf, sizeof(buf))) > 0) {
-		/* If we've filled up our buffer, make it bigger */
-		if((gfud->len + len) >= gfud->data_len) {
-			while((gfud->len + len) >= gfud->data_len)
-				gfud->data_len += sizeof(buf);
+	gfud->http_request = NULL;
 
-			gfud->webdata = g_realloc(gfud->webdata, gfud->data_len);
-		}
-
-		data_cursor = gfud->webdata + gfud->len;
-
-		gfud->len += len;
-
-		memcpy(data_cursor, buf, len);
-
-		gfud->webdata[gfud->len] = '\0';
-
-		if(!gfud->got_headers) {
-			char *tmp;
-
-			/* See if we've reached the end of the headers yet */
-			if((tmp = strstr(gfud->webdata, "\r\n\r\n"))) {
-				char * new_data;
-				guint header_len = (tmp + 4 - gfud->webdata);
-				size_t content_len;
-
-				purple_debug_misc("util", "Response headers: '%.*s'\n",
-					header_len, gfud->webdata);
-
-				/* See if we can find a redirect. */
-				if(parse_redirect(gfud->webdata, header_len, source, gfud))
-					return;
-
-				gfud->got_headers = TRUE;
-
-				/* No redirect. See if we can find a content length. */
-				content_len = parse_content_len(gfud->webdata, header_len);
-
-				if(content_len == 0) {
-					/* We'll stick with an initial 8192 */
-					content_len = 8192;
-				} else {
-					gfud->has_explicit_data_len = TRUE;
-				}
-
-
-				/* If we're returning the headers too, we don't need to clean them out */
-				if(gfud->include_headers) {
-					gfud->data_len = content_len + header_len;
-					gfud->webdata = g_realloc(gfud->webdata, gfud->data_len);
-				} else {
-					size_t body_len = 0;
-
-					if(gfud->len > (header_len + 1))
-						body_len = (gfud->len - header_len);
-
-					content_len = MAX(content_len, body_len);
-
-					new_data = g_try_malloc(content_len);
-					if(new_data == NULL) {
-						purple_debug_error("util",
-								"Failed to allocate %u bytes: %s\n",
-								content_len, strerror(errno));
-						purple_util_fetch_url_error(gfud,
-								_("Unable to allocate enough memory to hold "
-								  "the contents from %s.  The web server may "
-								  "be trying something malicious."),
-								gfud->website.address);
-
-						return;
-					}
-
-					/* We may have read part of the body when reading the headers, don't lose it */
-					if(body_len > 0) {
-						tmp += 4;
-						memcpy(new_data, tmp, body_len);
-					}
-
-					/* Out with the old... */
-					g_free(gfud->webdata);
-
-					/* In with the new. */
-					gfud->len = body_len;
-					gfud->data_len = content_len;
-					gfud->webdata = new_data;
-				}
-			}
-		}
-
-		if(gfud->has_explicit_data_len && gfud->len >= gfud->data_len) {
-			got_eof = TRUE;
-			break;
-		}
-	}
-
-	if(len < 0) {
-		if(errno == EAGAIN) {
-			return;
-		} else {
-			purple_util_fetch_url_error(gfud, _("Error reading from %s: %s"),
-					gfud->website.address, strerror(errno));
-			return;
-		}
-	}
-
-	if((len == 0) || got_eof) {
-		gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
-		gfud->webdata[gfud->len] = '\0';
-
-		gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
-		purple_util_fetch_url_cancel(gfud);
-	}
-}
-
-static void
-url_fetch_send_cb(gpointer data, gint source, PurpleInputCondition cond)
-{
-	PurpleUtilFetchUrlData *gfud;
-	int len, total_len;
-
-	gfud = data;
-
-	total_len = strlen(gfud->request);
-
-	len = write(gfud->fd, gfud->request + gfud->request_written,
-			total_len - gfud->request_written);
-
-	if (len < 0 && errno == EAGAIN)
-		return;
-	else if (len < 0) {
-		purple_util_fetch_url_error(gfud, _("Error writing to %s: %s"),
-				gfud->website.address, strerror(errno));
+	if (response == NULL)
+	{
+		purple_util_fetch_url_error(gfud, "%s", error_message);
 		return;
 	}
-	gfud->request_written += len;
 
-	if (gfud->request_written < total_len)
+	/* See if we can find a redirect. */
+	if (parse_redirect(response->headers, response->headers_len, gfud))
 		return;
 
-	/* We're done writing our request, now start reading the response */
-	purple_input_remove(gfud->inpa);
-	gfud->inpa = purple_input_add(gfud->fd, PURPLE_INPUT_READ, url_fetch_recv_cb,
-		gfud);
-}
-
-static void
-url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message)
-{
-	PurpleUtilFetchUrlData *gfud;
+	if (gfud->include_headers)
+	{
+		gsize len = response->headers_len + response->body_len;
+		gchar *webdata = g_malloc(len + 1);
 
-	gfud = url_data;
-	gfud->connect_data = NULL;
+		memcpy(webdata, response->headers, response->headers_len);
+		memcpy(webdata + response->headers_len, response->body, response->body_len);
+		webdata[len] = '\0';
 
-	if (source == -1)
+		gfud->callback(gfud, gfud->user_data, webdata, len, NULL);
+		g_free(webdata);
+	}
+	else
 	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s: %s"),
-				(gfud->website.address ? gfud->website.address : ""), error_message);
-		return;
+		gfud->callback(gfud, gfud->user_data, response->body,
+				response->body_len, NULL);
 	}
 
-	gfud->fd = source;
+	purple_util_fetch_url_cancel(gfud);
+}
 
+static void
+url_fetch_send(PurpleUtilFetchUrlData *gfud)
+{
 	if (!gfud->request)
 	{
+		/*
+		 * The connection is kept open for whatever comes next from the
+		 * same server.  The HTTP client understands the "chunked"
+		 * transfer encoding which HTTP/1.1 servers may use.
+		 */
 		if (gfud->user_agent) {
-			/* Host header is not forbidden in HTTP/1.0 requests, and HTTP/1.1
-			 * clients must know how to handle the "chunked" transfer encoding.
-			 * Purple doesn't know how to handle "chunked", so should always send
-			 * the Host header regardless, to get around some observed problems
-			 */
 			gfud->request = g_strdup_printf(
 				"GET %s%s HTTP/%s\r\n"
-				"Connection: close\r\n"
+				"Connection: keep-alive\r\n"
 				"User-Agent: %s\r\n"
 				"Accept: */*\r\n"
 				"Host: %s\r\n\r\n",
@@ -3809,7 +3764,7 @@ url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message)
 		} else {
 			gfud->request = g_strdup_printf(
 				"GET %s%s HTTP/%s\r\n"
-				"Connection: close\r\n"
+				"Connection: keep-alive\r\n"
 				"Accept: */*\r\n"
 				"Host: %s\r\n\r\n",
 				(gfud->full ? "" : "/"),
@@ -3821,9 +3776,8 @@ url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message)
 
 	purple_debug_misc("util", "Request: '%s'\n", gfud->request);
 
-	gfud->inpa = purple_input_add(source, PURPLE_INPUT_WRITE,
-								url_fetch_send_cb, gfud);
-	url_fetch_send_cb(gfud, source, PURPLE_INPUT_WRITE);
+	gfud->http_request = purple_httpclient_request(gfud->website.address,
+			gfud->website.port, gfud->request, url_fetch_response_cb, gfud);
 }
 
 PurpleUtilFetchUrlData *
@@ -3855,16 +3809,7 @@ purple_util_fetch_url_request(const char *url, gboolean full,
 	purple_url_parse(url, &gfud->website.address, &gfud->website.port,
 				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
 
-	gfud->connect_data = purple_proxy_connect(NULL, NULL,
-			gfud->website.address, gfud->website.port,
-			url_fetch_connect_cb, gfud);
-
-	if (gfud->connect_data == NULL)
-	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
-				gfud->website.address);
-		return NULL;
-	}
+	url_fetch_send(gfud);
 
 	return gfud;
 }
@@ -3872,14 +3817,8 @@ purple_util_fetch_url_request(const char *url, gboolean full,
 void
 purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
 {
-	if (gfud->connect_data != NULL)
-		purple_proxy_connect_cancel(gfud->connect_data);
-
-	if (gfud->inpa > 0)
-		purple_input_remove(gfud->inpa);
-
-	if (gfud->fd >= 0)
-		close(gfud->fd);
+	if (gfud->http_request != NULL)
+		purple_httpclient_cancel(gfud->http_request);
 
 	g_free(gfud->website.user);
 	g_free(gfud->website.passwd);
@@ -3888,7 +3827,6 @@ purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
 	g_free(gfud->url);
 	g_free(gfud->user_agent);
 	g_free(gfud->request);
-	g_free(gfud->webdata);
 
 	g_free(gfud);
 }
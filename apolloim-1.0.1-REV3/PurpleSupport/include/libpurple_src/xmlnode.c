@@ -44,10 +44,143 @@
 # define NEWLINE_S "\n"
 #endif
 
+/*
+ * Arena allocation
+ *
+ * A tree created with xmlnode_new_arena() carves its nodes and strings out
+ * of a few large blocks instead of allocating each one separately, and
+ * hands the blocks back all at once when its root is freed.  Element and
+ * attribute names and namespaces come from a table shared by every arena,
+ * since the same few dozen of them make up nearly every document we read.
+ */
+#define XMLNODE_ARENA_BLOCK_SIZE 4096
+
+/* Only this many names are interned, so a peer inventing element names
+ * can't grow the table forever.  Past this, names are copied per arena. */
+#define XMLNODE_INTERN_MAX 2048
+
+struct _xmlnode_arena {
+	xmlnode *root;
+	GSList *blocks;
+	char *pos;
+	gsize left;
+	gboolean foreign;  /* Nodes from outside the arena were inserted */
+};
+
+static GHashTable *interned_names = NULL;
+
+static const char *
+xmlnode_intern(const char *str)
+{
+	char *interned;
+
+	if (interned_names == NULL)
+		interned_names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if ((interned = g_hash_table_lookup(interned_names, str)) != NULL)
+		return interned;
+
+	if (g_hash_table_size(interned_names) >= XMLNODE_INTERN_MAX)
+		return NULL;
+
+	interned = g_strdup(str);
+	g_hash_table_insert(interned_names, interned, interned);
+
+	return interned;
+}
+
+static gpointer
+arena_alloc(xmlnode_arena *arena, gsize size)
+{
+	gpointer ret;
+
+	size = (size + G_MEM_ALIGN - 1) & ~(gsize)(G_MEM_ALIGN - 1);
+
+	/* Big allocations get a block of their own, so they don't waste
+	 * whatever is left of the current one. */
+	if (size > XMLNODE_ARENA_BLOCK_SIZE / 4) {
+		ret = g_malloc(size);
+		arena->blocks = g_slist_prepend(arena->blocks, ret);
+		return ret;
+	}
+
+	if (size > arena->left) {
+		arena->pos = g_malloc(XMLNODE_ARENA_BLOCK_SIZE);
+		arena->left = XMLNODE_ARENA_BLOCK_SIZE;
+		arena->blocks = g_slist_prepend(arena->blocks, arena->pos);
+	}
+
+	ret = arena->pos;
+	arena->pos += size;
+	arena->left -= size;
+
+	return ret;
+}
+
+static char *
+arena_strndup(xmlnode_arena *arena, const char *str, gsize len)
+{
+	char *ret = arena_alloc(arena, len + 1);
+
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+static char *
+arena_name(xmlnode_arena *arena, const char *name)
+{
+	const char *interned;
+
+	if (name == NULL)
+		return NULL;
+
+	if ((interned = xmlnode_intern(name)) != NULL)
+		return (char *)interned;
+
+	return arena_strndup(arena, name, strlen(name));
+}
+
+static char *
+node_strdup(xmlnode_arena *arena, const char *str)
+{
+	if (arena == NULL)
+		return g_strdup(str);
+
+	if (str == NULL)
+		return NULL;
+
+	return arena_strndup(arena, str, strlen(str));
+}
+
+static void
+arena_destroy(xmlnode_arena *arena)
+{
+	GSList *l;
+
+	for (l = arena->blocks; l != NULL; l = l->next)
+		g_free(l->data);
+	g_slist_free(arena->blocks);
+	g_free(arena);
+}
+
 static xmlnode*
-new_node(const char *name, XMLNodeType type)
+new_node(const char *name, XMLNodeType type, xmlnode_arena *arena)
 {
-	xmlnode *node = g_new0(xmlnode, 1);
+	xmlnode *node;
+
+	if (arena != NULL) {
+		node = arena_alloc(arena, sizeof(xmlnode));
+		memset(node, 0, sizeof(xmlnode));
+		node->name = arena_name(arena, name);
+		node->type = type;
+		node->arena = arena;
+
+		return node;
+	}
+
+	node = g_new0(xmlnode, 1);
 
 	node->name = g_strdup(name);
 	node->type = type;
@@ -62,7 +195,20 @@ xmlnode_new(const char *name)
 {
 	g_return_val_if_fail(name != NULL, NULL);
 
-	return new_node(name, XMLNODE_TYPE_TAG);
+	return new_node(name, XMLNODE_TYPE_TAG, NULL);
+}
+
+xmlnode *
+xmlnode_new_arena(const char *name)
+{
+	xmlnode_arena *arena;
+
+	g_return_val_if_fail(name != NULL, NULL);
+
+	arena = g_new0(xmlnode_arena, 1);
+	arena->root = new_node(name, XMLNODE_TYPE_TAG, arena);
+
+	return arena->root;
 }
 
 xmlnode *
@@ -73,7 +219,7 @@ xmlnode_new_child(xmlnode *parent, const char *name)
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	node = new_node(name, XMLNODE_TYPE_TAG);
+	node = new_node(name, XMLNODE_TYPE_TAG, parent->arena);
 
 	xmlnode_insert_child(parent, node);
 
@@ -86,6 +232,9 @@ xmlnode_insert_child(xmlnode *parent, xmlnode *child)
 	g_return_if_fail(parent != NULL);
 	g_return_if_fail(child != NULL);
 
+	if (parent->arena != NULL && child->arena != parent->arena)
+		parent->arena->foreign = TRUE;
+
 	child->parent = parent;
 
 	if(parent->lastchild) {
@@ -109,9 +258,12 @@ xmlnode_insert_data(xmlnode *node, const char *data, gssize size)
 
 	real_size = size == -1 ? strlen(data) : size;
 
-	child = new_node(NULL, XMLNODE_TYPE_DATA);
+	child = new_node(NULL, XMLNODE_TYPE_DATA, node->arena);
 
-	child->data = g_memdup(data, real_size);
+	if (node->arena != NULL)
+		child->data = arena_strndup(node->arena, data, real_size);
+	else
+		child->data = g_memdup(data, real_size);
 	child->data_sz = real_size;
 
 	xmlnode_insert_child(node, child);
@@ -186,9 +338,9 @@ xmlnode_set_attrib(xmlnode *node, const char *attr, const char *value)
 
 	xmlnode_remove_attrib(node, attr);
 
-	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB, node->arena);
 
-	attrib_node->data = g_strdup(value);
+	attrib_node->data = node_strdup(node->arena, value);
 
 	xmlnode_insert_child(node, attrib_node);
 }
@@ -204,10 +356,13 @@ xmlnode_set_attrib_with_namespace(xmlnode *node, const char *attr, const char *x
 
 	xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
 
-	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB, node->arena);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
+	attrib_node->data = node_strdup(node->arena, value);
+	if (node->arena != NULL)
+		attrib_node->xmlns = arena_name(node->arena, xmlns);
+	else
+		attrib_node->xmlns = g_strdup(xmlns);
 
 	xmlnode_insert_child(node, attrib_node);
 }
@@ -250,6 +405,11 @@ void xmlnode_set_namespace(xmlnode *node, const char *xmlns)
 {
 	g_return_if_fail(node != NULL);
 
+	if (node->arena != NULL) {
+		node->xmlns = arena_name(node->arena, xmlns);
+		return;
+	}
+
 	g_free(node->xmlns);
 	node->xmlns = g_strdup(xmlns);
 }
@@ -261,11 +421,43 @@ const char *xmlnode_get_namespace(xmlnode *node)
 	return node->xmlns;
 }
 
-void
-xmlnode_free(xmlnode *node)
+/* Frees a node and its children without unlinking it from its parent */
+static void
+xmlnode_release(xmlnode *node)
 {
+	xmlnode_arena *arena = node->arena;
 	xmlnode *x, *y;
 
+	/* Children of an arena node live in the arena too, unless something
+	 * else was inserted, so they only need to be visited in that case. */
+	if (arena == NULL || arena->foreign) {
+		x = node->child;
+		while(x) {
+			y = x->next;
+			xmlnode_release(x);
+			x = y;
+		}
+	}
+
+	if (arena != NULL) {
+		/* Everything else goes when the whole arena does */
+		if (arena->root == node)
+			arena_destroy(arena);
+		return;
+	}
+
+	/* now dispose of ourselves */
+	g_free(node->name);
+	g_free(node->data);
+	g_free(node->xmlns);
+
+	PURPLE_DBUS_UNREGISTER_POINTER(node);
+	g_free(node);
+}
+
+void
+xmlnode_free(xmlnode *node)
+{
 	g_return_if_fail(node != NULL);
 
 	/* if we're part of a tree, remove ourselves from the tree first */
@@ -283,21 +475,7 @@ xmlnode_free(xmlnode *node)
 		}
 	}
 
-	/* now free our children */
-	x = node->child;
-	while(x) {
-		y = x->next;
-		xmlnode_free(x);
-		x = y;
-	}
-
-	/* now dispose of ourselves */
-	g_free(node->name);
-	g_free(node->data);
-	g_free(node->xmlns);
-
-	PURPLE_DBUS_UNREGISTER_POINTER(node);
-	g_free(node);
+	xmlnode_release(node);
 }
 
 xmlnode*
@@ -374,40 +552,103 @@ xmlnode_get_data_unescaped(xmlnode *node)
 	return unescaped;
 }
 
-static char *
-xmlnode_to_str_helper(xmlnode *node, int *len, gboolean formatting, int depth)
+/*
+ * Serialization
+ *
+ * Nodes are written straight to a sink a piece at a time: markup and
+ * runs of text that need no escaping are passed through untouched, and
+ * entities are written in their place, so no intermediate strings are
+ * built.  With no sink at all, the same walk measures the output.
+ */
+#define XMLNODE_DECLARATION "<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S
+
+struct _xmlnode_writer {
+	xmlnode_write_func func;
+	gpointer user_data;
+	gsize len;
+	gboolean error;
+};
+
+static void
+writer_put(struct _xmlnode_writer *w, const char *data, gsize len)
 {
-	GString *text = g_string_new("");
-	xmlnode *c;
-	char *node_name, *esc, *esc2, *tab = NULL;
-	gboolean need_end = FALSE, pretty = formatting;
+	if (len == 0 || w->error)
+		return;
 
-	g_return_val_if_fail(node != NULL, NULL);
+	w->len += len;
 
-	if(pretty && depth) {
-		tab = g_strnfill(depth, '\t');
-		text = g_string_append(text, tab);
+	if (w->func != NULL && !w->func(data, len, w->user_data))
+		w->error = TRUE;
+}
+
+#define writer_put_str(w, str) writer_put((w), (str), strlen(str))
+
+static void
+writer_put_escaped(struct _xmlnode_writer *w, const char *text, gsize len)
+{
+	const char *run = text, *end = text + len, *p;
+
+	for (p = text; p < end; p++) {
+		const char *entity;
+
+		switch (*p) {
+			case '&':  entity = "&amp;";  break;
+			case '<':  entity = "&lt;";   break;
+			case '>':  entity = "&gt;";   break;
+			case '\'': entity = "&apos;"; break;
+			case '"':  entity = "&quot;"; break;
+			default:   continue;
+		}
+
+		writer_put(w, run, p - run);
+		writer_put_str(w, entity);
+		run = p + 1;
+	}
+
+	writer_put(w, run, end - run);
+}
+
+static void
+writer_put_tabs(struct _xmlnode_writer *w, int depth)
+{
+	static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+	while (depth > 0) {
+		int n = MIN(depth, (int)sizeof(tabs) - 1);
+		writer_put(w, tabs, n);
+		depth -= n;
 	}
+}
+
+static void
+xmlnode_write_helper(struct _xmlnode_writer *w, xmlnode *node, gboolean formatting, int depth)
+{
+	xmlnode *c;
+	gboolean need_end = FALSE, pretty = formatting;
+	gboolean indent = pretty && depth;
+
+	if(indent)
+		writer_put_tabs(w, depth);
 
-	node_name = g_markup_escape_text(node->name, -1);
-	g_string_append_printf(text, "<%s", node_name);
+	writer_put(w, "<", 1);
+	writer_put_escaped(w, node->name, strlen(node->name));
 
 	if (node->xmlns) {
 		if(!node->parent || !node->parent->xmlns || strcmp(node->xmlns, node->parent->xmlns))
 		{
-			char *xmlns = g_markup_escape_text(node->xmlns, -1);
-			g_string_append_printf(text, " xmlns='%s'", xmlns);
-			g_free(xmlns);
+			writer_put_str(w, " xmlns='");
+			writer_put_escaped(w, node->xmlns, strlen(node->xmlns));
+			writer_put(w, "'", 1);
 		}
 	}
 	for(c = node->child; c; c = c->next)
 	{
 		if(c->type == XMLNODE_TYPE_ATTRIB) {
-			esc = g_markup_escape_text(c->name, -1);
-			esc2 = g_markup_escape_text(c->data, -1);
-			g_string_append_printf(text, " %s='%s'", esc, esc2);
-			g_free(esc);
-			g_free(esc2);
+			writer_put(w, " ", 1);
+			writer_put_escaped(w, c->name, strlen(c->name));
+			writer_put(w, "='", 2);
+			writer_put_escaped(w, c->data, strlen(c->data));
+			writer_put(w, "'", 1);
 		} else if(c->type == XMLNODE_TYPE_TAG || c->type == XMLNODE_TYPE_DATA) {
 			if(c->type == XMLNODE_TYPE_DATA)
 				pretty = FALSE;
@@ -416,65 +657,122 @@ xmlnode_to_str_helper(xmlnode *node, int *len, gboolean formatting, int depth)
 	}
 
 	if(need_end) {
-		g_string_append_printf(text, ">%s", pretty ? NEWLINE_S : "");
+		writer_put(w, ">", 1);
+		if(pretty)
+			writer_put_str(w, NEWLINE_S);
 
 		for(c = node->child; c; c = c->next)
 		{
 			if(c->type == XMLNODE_TYPE_TAG) {
-				int esc_len;
-				esc = xmlnode_to_str_helper(c, &esc_len, pretty, depth+1);
-				text = g_string_append_len(text, esc, esc_len);
-				g_free(esc);
+				xmlnode_write_helper(w, c, pretty, depth+1);
 			} else if(c->type == XMLNODE_TYPE_DATA && c->data_sz > 0) {
-				esc = g_markup_escape_text(c->data, c->data_sz);
-				text = g_string_append(text, esc);
-				g_free(esc);
+				writer_put_escaped(w, c->data, c->data_sz);
 			}
 		}
 
-		if(tab && pretty)
-			text = g_string_append(text, tab);
-		g_string_append_printf(text, "</%s>%s", node_name, formatting ? NEWLINE_S : "");
+		if(indent && pretty)
+			writer_put_tabs(w, depth);
+		writer_put(w, "</", 2);
+		writer_put_escaped(w, node->name, strlen(node->name));
+		writer_put(w, ">", 1);
 	} else {
-		g_string_append_printf(text, "/>%s", formatting ? NEWLINE_S : "");
+		writer_put(w, "/>", 2);
 	}
 
-	g_free(node_name);
+	if(formatting)
+		writer_put_str(w, NEWLINE_S);
+}
+
+gssize
+xmlnode_write(xmlnode *node, gboolean formatted, xmlnode_write_func func,
+			  gpointer user_data)
+{
+	struct _xmlnode_writer w;
+
+	g_return_val_if_fail(node != NULL, -1);
+
+	w.func = func;
+	w.user_data = user_data;
+	w.len = 0;
+	w.error = FALSE;
+
+	if (formatted)
+		writer_put_str(&w, XMLNODE_DECLARATION);
+
+	xmlnode_write_helper(&w, node, formatted, 0);
 
-	g_free(tab);
+	return w.error ? -1 : (gssize)w.len;
+}
+
+static gboolean
+xmlnode_write_to_buffer(const char *data, gsize len, gpointer user_data)
+{
+	char **pos = user_data;
+
+	memcpy(*pos, data, len);
+	*pos += len;
+
+	return TRUE;
+}
+
+static char *
+xmlnode_to_str_helper(xmlnode *node, int *len, gboolean formatted)
+{
+	char *ret, *pos;
+	gssize size;
+
+	g_return_val_if_fail(node != NULL, NULL);
+
+	/* Measure first, so the string is allocated exactly once */
+	size = xmlnode_write(node, formatted, NULL, NULL);
+
+	ret = pos = g_malloc(size + 1);
+	xmlnode_write(node, formatted, xmlnode_write_to_buffer, &pos);
+	ret[size] = '\0';
 
 	if(len)
-		*len = text->len;
+		*len = size;
 
-	return g_string_free(text, FALSE);
+	return ret;
 }
 
 char *
 xmlnode_to_str(xmlnode *node, int *len)
 {
-	return xmlnode_to_str_helper(node, len, FALSE, 0);
+	return xmlnode_to_str_helper(node, len, FALSE);
 }
 
 char *
 xmlnode_to_formatted_str(xmlnode *node, int *len)
 {
-	char *xml, *xml_with_declaration;
-
-	g_return_val_if_fail(node != NULL, NULL);
-
-	xml = xmlnode_to_str_helper(node, len, TRUE, 0);
-	xml_with_declaration =
-		g_strdup_printf("<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S "%s", xml);
-	g_free(xml);
-
-	return xml_with_declaration;
+	return xmlnode_to_str_helper(node, len, TRUE);
 }
 
 struct _xmlnode_parser_data {
 	xmlnode *current;
+	xmlnode *root;
 	gboolean error;
+	gboolean arena;
+
+	/* Streaming state, only used by xmlnode_stream */
+	int depth;
+	int stream_depth;
+	xmlnode_stream_open_cb open_cb;
+	xmlnode_stream_element_cb element_cb;
+	gpointer user_data;
 };
 
+struct _xmlnode_stream {
+	struct _xmlnode_parser_data xpd;
+	xmlParserCtxtPtr context;
+};
+
+static gboolean
+xmlnode_parser_is_streaming(struct _xmlnode_parser_data *xpd)
+{
+	return xpd->stream_depth > 0;
+}
+
 static void
 xmlnode_parser_element_start_libxml(void *user_data,
 				   const xmlChar *element_name, const xmlChar *prefix, const xmlChar *xmlns,
@@ -488,10 +786,25 @@ xmlnode_parser_element_start_libxml(void *user_data,
 	if(!element_name || xpd->error) {
 		return;
 	} else {
-		if(xpd->current)
-			node = xmlnode_new_child(xpd->current, (const char*) element_name);
-		else
-			node = xmlnode_new((const char *) element_name);
+		if(xpd->current) {
+			xpd->depth++;
+
+			/* Each streamed element is an arena of its own, so it can be
+			 * thrown away as soon as the caller is done with it. */
+			if(xmlnode_parser_is_streaming(xpd) && xpd->depth == xpd->stream_depth) {
+				node = xmlnode_new_arena((const char *) element_name);
+				xmlnode_insert_child(xpd->current, node);
+			} else {
+				node = xmlnode_new_child(xpd->current, (const char*) element_name);
+			}
+		} else {
+			if(xpd->arena)
+				node = xmlnode_new_arena((const char *) element_name);
+			else
+				node = xmlnode_new((const char *) element_name);
+			xpd->root = node;
+			xpd->depth = 0;
+		}
 
 		xmlnode_set_namespace(node, (const char *) xmlns);
 
@@ -509,6 +822,10 @@ xmlnode_parser_element_start_libxml(void *user_data,
 		}
 
 		xpd->current = node;
+
+		if(xmlnode_parser_is_streaming(xpd) && xpd->depth < xpd->stream_depth &&
+				xpd->open_cb)
+			xpd->open_cb(node, xpd->user_data);
 	}
 }
 
@@ -522,8 +839,37 @@ xmlnode_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 		return;
 
 	if(xpd->current->parent) {
-		if(!xmlStrcmp((xmlChar*) xpd->current->name, element_name))
-			xpd->current = xpd->current->parent;
+		if(!xmlStrcmp((xmlChar*) xpd->current->name, element_name)) {
+			xmlnode *node = xpd->current;
+
+			xpd->current = node->parent;
+
+			if(xmlnode_parser_is_streaming(xpd) && xpd->depth == xpd->stream_depth) {
+				/* Hand the finished subtree to the caller.  Everything
+				 * else below the parent was either an attribute or has
+				 * already been handed off, so this walk is short. */
+				xmlnode *parent = node->parent;
+
+				if(parent->child == node) {
+					parent->child = NULL;
+					parent->lastchild = NULL;
+				} else {
+					xmlnode *prev = parent->child;
+					while(prev->next != node)
+						prev = prev->next;
+					prev->next = NULL;
+					parent->lastchild = prev;
+				}
+				node->parent = NULL;
+
+				if(xpd->element_cb)
+					xpd->element_cb(node, parent, xpd->user_data);
+				else
+					xmlnode_free(node);
+			}
+
+			xpd->depth--;
+		}
 	}
 }
 
@@ -538,6 +884,11 @@ xmlnode_parser_element_text_libxml(void *user_data, const xmlChar *text, int tex
 	if(!text || !text_len)
 		return;
 
+	/* Text between streamed elements would otherwise pile up in the
+	 * elements we keep around for the whole parse. */
+	if(xmlnode_parser_is_streaming(xpd) && xpd->depth < xpd->stream_depth)
+		return;
+
 	xmlnode_insert_data(xpd->current, (const char*) text, text_len);
 }
 
@@ -583,8 +934,8 @@ static xmlSAXHandler xmlnode_parser_libxml = {
 	NULL, /* serror */
 };
 
-xmlnode *
-xmlnode_from_str(const char *str, gssize size)
+static xmlnode *
+xmlnode_from_str_internal(const char *str, gssize size, gboolean arena)
 {
 	struct _xmlnode_parser_data *xpd;
 	xmlnode *ret;
@@ -594,6 +945,7 @@ xmlnode_from_str(const char *str, gssize size)
 
 	real_size = size < 0 ? strlen(str) : size;
 	xpd = g_new0(struct _xmlnode_parser_data, 1);
+	xpd->arena = arena;
 
 	if (xmlSAXUserParseMemory(&xmlnode_parser_libxml, xpd, str, real_size) < 0) {
 		while(xpd->current && xpd->current->parent)
@@ -613,6 +965,99 @@ xmlnode_from_str(const char *str, gssize size)
 	return ret;
 }
 
+xmlnode *
+xmlnode_from_str(const char *str, gssize size)
+{
+	return xmlnode_from_str_internal(str, size, FALSE);
+}
+
+xmlnode *
+xmlnode_from_str_arena(const char *str, gssize size)
+{
+	return xmlnode_from_str_internal(str, size, TRUE);
+}
+
+xmlnode_stream *
+xmlnode_stream_new(int depth, xmlnode_stream_open_cb open_cb,
+				   xmlnode_stream_element_cb element_cb, gpointer user_data)
+{
+	xmlnode_stream *stream;
+
+	g_return_val_if_fail(depth > 0, NULL);
+
+	stream = g_new0(xmlnode_stream, 1);
+	stream->xpd.stream_depth = depth;
+	stream->xpd.open_cb = open_cb;
+	stream->xpd.element_cb = element_cb;
+	stream->xpd.user_data = user_data;
+
+	stream->context = xmlCreatePushParserCtxt(&xmlnode_parser_libxml,
+			&stream->xpd, NULL, 0, NULL);
+	if (stream->context == NULL) {
+		g_free(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+gboolean
+xmlnode_stream_feed(xmlnode_stream *stream, const char *data, gssize size)
+{
+	g_return_val_if_fail(stream != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	if (stream->xpd.error)
+		return FALSE;
+
+	if (size < 0)
+		size = strlen(data);
+
+	if (xmlParseChunk(stream->context, data, size, 0) != XML_ERR_OK)
+		stream->xpd.error = TRUE;
+
+	return !stream->xpd.error;
+}
+
+xmlnode *
+xmlnode_stream_end(xmlnode_stream *stream)
+{
+	xmlnode *ret;
+
+	g_return_val_if_fail(stream != NULL, NULL);
+
+	if (!stream->xpd.error &&
+			xmlParseChunk(stream->context, NULL, 0, 1) != XML_ERR_OK)
+		stream->xpd.error = TRUE;
+
+	/* Not current, which is left wherever a broken document stopped */
+	ret = stream->xpd.root;
+	stream->xpd.root = NULL;
+	stream->xpd.current = NULL;
+
+	if (stream->xpd.error && ret != NULL) {
+		xmlnode_free(ret);
+		ret = NULL;
+	}
+
+	xmlnode_stream_free(stream);
+
+	return ret;
+}
+
+void
+xmlnode_stream_free(xmlnode_stream *stream)
+{
+	if (stream == NULL)
+		return;
+
+	if (stream->xpd.root != NULL)
+		xmlnode_free(stream->xpd.root);
+
+	xmlFreeParserCtxt(stream->context);
+	g_free(stream);
+}
+
 xmlnode *
 xmlnode_copy(const xmlnode *src)
 {
@@ -622,7 +1067,8 @@ xmlnode_copy(const xmlnode *src)
 
 	g_return_val_if_fail(src != NULL, NULL);
 
-	ret = new_node(src->name, src->type);
+	ret = new_node(src->name, src->type, NULL);
+	ret->xmlns = g_strdup(src->xmlns);
 	if(src->data) {
 		if(src->data_sz) {
 			ret->data = g_memdup(src->data, src->data_sz);